@@ -0,0 +1,462 @@
+/*
+ *  pkmBasicMat.h
+ *
+
+ pkm::BasicMat<T>, the row-major matrix for element types other than float
+ (BasicMat<float> is pkm::Mat, see pkmMatrix.h), so that double data such
+ as a mixture model's means and covariances can be worked on in double
+ instead of going through float.
+
+ it keeps the core of Mat's interface: storage (reset, setUserData,
+ push_back), element access, element-wise and scalar arithmetic, the
+ reductions, transposes and products.  BLAS, LAPACK and vDSP are reached
+ through the overloads in pkm::blas below, which pick the s or d routine
+ for the element type, so the same code builds for either.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include "pkmMatrix.h"
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+
+namespace pkm
+{
+    // the float and double variant of every routine BasicMat and its users
+    // need, chosen by overloading.  row-major throughout, unit or given strides.
+    namespace blas
+    {
+        inline void copy(size_t n, const float *x, size_t incx, float *y, size_t incy)
+        {
+            cblas_scopy(n, x, incx, y, incy);
+        }
+        inline void copy(size_t n, const double *x, size_t incx, double *y, size_t incy)
+        {
+            cblas_dcopy(n, x, incx, y, incy);
+        }
+
+        // y += a x
+        inline void axpy(size_t n, float a, const float *x, float *y)      { cblas_saxpy(n, a, x, 1, y, 1); }
+        inline void axpy(size_t n, double a, const double *x, double *y)   { cblas_daxpy(n, a, x, 1, y, 1); }
+
+        inline void scal(size_t n, float a, float *x)                      { cblas_sscal(n, a, x, 1); }
+        inline void scal(size_t n, double a, double *x)                    { cblas_dscal(n, a, x, 1); }
+
+        inline float dot(size_t n, const float *x, size_t incx, const float *y, size_t incy)
+        {
+            return cblas_sdot(n, x, incx, y, incy);
+        }
+        inline double dot(size_t n, const double *x, size_t incx, const double *y, size_t incy)
+        {
+            return cblas_ddot(n, x, incx, y, incy);
+        }
+
+        // C = alpha op(A) op(B) + beta C, with C m x n
+        inline void gemm(bool transA, bool transB, size_t m, size_t n, size_t k,
+                         float alpha, const float *A, size_t lda, const float *B, size_t ldb,
+                         float beta, float *C, size_t ldc)
+        {
+            cblas_sgemm(CblasRowMajor, transA ? CblasTrans : CblasNoTrans, transB ? CblasTrans : CblasNoTrans,
+                        m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+        }
+        inline void gemm(bool transA, bool transB, size_t m, size_t n, size_t k,
+                         double alpha, const double *A, size_t lda, const double *B, size_t ldb,
+                         double beta, double *C, size_t ldc)
+        {
+            cblas_dgemm(CblasRowMajor, transA ? CblasTrans : CblasNoTrans, transB ? CblasTrans : CblasNoTrans,
+                        m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+        }
+
+        // solves L X = alpha B in place for a lower triangular n x n L, B n x m
+        inline void trsmLower(size_t n, size_t m, float alpha, const float *L, size_t ldl, float *B, size_t ldb)
+        {
+            cblas_strsm(CblasRowMajor, CblasLeft, CblasLower, CblasNoTrans, CblasNonUnit,
+                        n, m, alpha, L, ldl, B, ldb);
+        }
+        inline void trsmLower(size_t n, size_t m, double alpha, const double *L, size_t ldl, double *B, size_t ldb)
+        {
+            cblas_dtrsm(CblasRowMajor, CblasLeft, CblasLower, CblasNoTrans, CblasNonUnit,
+                        n, m, alpha, L, ldl, B, ldb);
+        }
+
+        // lapack's cholesky, column-major: 'U' on a row-major matrix leaves
+        // the row-major lower factor.  returns lapack's info.
+        inline long potrf(char uplo, size_t n, float *A)
+        {
+            __CLPK_integer d = n, info = 0;
+            spotrf_(&uplo, &d, A, &d, &info);
+            return info;
+        }
+        inline long potrf(char uplo, size_t n, double *A)
+        {
+            __CLPK_integer d = n, info = 0;
+            dpotrf_(&uplo, &d, A, &d, &info);
+            return info;
+        }
+
+        // vDSP: z = x + y, z = x * y, z = x + s, z = x * s, z = x * a + b,
+        // z = x^2, sum of x, fill
+        inline void vadd(const float *x, long ix, const float *y, long iy, float *z, long iz, size_t n)
+        {
+            vDSP_vadd(x, ix, y, iy, z, iz, n);
+        }
+        inline void vadd(const double *x, long ix, const double *y, long iy, double *z, long iz, size_t n)
+        {
+            vDSP_vaddD(x, ix, y, iy, z, iz, n);
+        }
+        inline void vmul(const float *x, long ix, const float *y, long iy, float *z, long iz, size_t n)
+        {
+            vDSP_vmul(x, ix, y, iy, z, iz, n);
+        }
+        inline void vmul(const double *x, long ix, const double *y, long iy, double *z, long iz, size_t n)
+        {
+            vDSP_vmulD(x, ix, y, iy, z, iz, n);
+        }
+        inline void vsadd(const float *x, long ix, float s, float *z, long iz, size_t n)
+        {
+            vDSP_vsadd(x, ix, &s, z, iz, n);
+        }
+        inline void vsadd(const double *x, long ix, double s, double *z, long iz, size_t n)
+        {
+            vDSP_vsaddD(x, ix, &s, z, iz, n);
+        }
+        inline void vsmul(const float *x, long ix, float s, float *z, long iz, size_t n)
+        {
+            vDSP_vsmul(x, ix, &s, z, iz, n);
+        }
+        inline void vsmul(const double *x, long ix, double s, double *z, long iz, size_t n)
+        {
+            vDSP_vsmulD(x, ix, &s, z, iz, n);
+        }
+        inline void vsmsa(const float *x, long ix, float a, const float *b, float *z, long iz, size_t n)
+        {
+            vDSP_vsmsa(x, ix, &a, b, z, iz, n);
+        }
+        inline void vsmsa(const double *x, long ix, double a, const double *b, double *z, long iz, size_t n)
+        {
+            vDSP_vsmsaD(x, ix, &a, b, z, iz, n);
+        }
+        inline void vsq(const float *x, long ix, float *z, long iz, size_t n)      { vDSP_vsq(x, ix, z, iz, n); }
+        inline void vsq(const double *x, long ix, double *z, long iz, size_t n)    { vDSP_vsqD(x, ix, z, iz, n); }
+        inline float sve(const float *x, long ix, size_t n)
+        {
+            float s = 0;
+            vDSP_sve(x, ix, &s, n);
+            return s;
+        }
+        inline double sve(const double *x, long ix, size_t n)
+        {
+            double s = 0;
+            vDSP_sveD(x, ix, &s, n);
+            return s;
+        }
+        inline void vfill(float s, float *z, long iz, size_t n)        { vDSP_vfill(&s, z, iz, n); }
+        inline void vfill(double s, double *z, long iz, size_t n)      { vDSP_vfillD(&s, z, iz, n); }
+    }
+
+    template<typename T>
+    class BasicMat
+    {
+    public:
+        BasicMat()
+        {
+            init();
+        }
+
+        // allocate data
+        BasicMat(size_t r, size_t c, bool clear = false)
+        {
+            init();
+            reset(r, c, clear);
+        }
+
+        // copies r * c values, row-major
+        BasicMat(size_t r, size_t c, const T *buffer)
+        {
+            init();
+            reset(r, c);
+            if (size()) {
+                blas::copy(size(), buffer, 1, data, 1);
+            }
+        }
+
+        // set every element to a value
+        BasicMat(size_t r, size_t c, T val)
+        {
+            init();
+            reset(r, c);
+            setTo(val);
+        }
+
+        BasicMat(const BasicMat &rhs)
+        {
+            init();
+            *this = rhs;
+        }
+
+        // from a matrix of another element type, e.g. Mat, converting
+        template<typename U>
+        explicit BasicMat(const BasicMat<U> &rhs)
+        {
+            init();
+            reset(rhs.rows, rhs.cols);
+            std::copy(rhs.data, rhs.data + size(), data);
+        }
+
+        ~BasicMat()
+        {
+            releaseMemory();
+        }
+
+        BasicMat & operator=(const BasicMat &rhs)
+        {
+            if (this == &rhs) {
+                return *this;
+            }
+            if (rows != rhs.rows || cols != rhs.cols || !bAllocated) {
+                reset(rhs.rows, rhs.cols);
+            }
+            if (size()) {
+                blas::copy(size(), rhs.data, 1, data, 1);
+            }
+            return *this;
+        }
+
+        // into a matrix of another element type, e.g. back to Mat;
+        // m is only reallocated when it is not already rows x cols
+        template<typename U>
+        void copyTo(BasicMat<U> &m) const
+        {
+            if (m.rows != rows || m.cols != cols) {
+                m.reset(rows, cols);
+            }
+            for (size_t i = 0; i < size(); i++) {
+                m.data[i] = (U)data[i];
+            }
+        }
+
+        void reset(size_t r, size_t c, bool clear = false)
+        {
+            releaseMemory();
+            rows = r;
+            cols = c;
+            if (rows * cols > 0) {
+                data = (T *)malloc(sizeof(T) * rows * cols);
+                bAllocated = true;
+            }
+            if (clear) {
+                this->clear();
+            }
+        }
+
+        // points at memory owned by someone else, which is never freed here
+        void setUserData(size_t r, size_t c, T *buffer)
+        {
+            releaseMemory();
+            rows = r;
+            cols = c;
+            data = buffer;
+        }
+
+        // appends the rows of m, which must be as wide (any width when empty)
+        void push_back(const BasicMat &m)
+        {
+            if (m.size() == 0) {
+                return;
+            }
+            if (size() == 0) {
+                *this = m;
+                return;
+            }
+#ifdef DEBUG
+            assert(m.cols == cols);
+#endif
+            BasicMat grown(rows + m.rows, cols);
+            blas::copy(size(), data, 1, grown.data, 1);
+            blas::copy(m.size(), m.data, 1, grown.data + size(), 1);
+            swap(grown);
+        }
+
+        void swap(BasicMat &rhs)
+        {
+            std::swap(rows, rhs.rows);
+            std::swap(cols, rhs.cols);
+            std::swap(data, rhs.data);
+            std::swap(bAllocated, rhs.bAllocated);
+        }
+
+        inline void setTo(T val)
+        {
+            if (size()) {
+                blas::vfill(val, data, 1, size());
+            }
+        }
+
+        inline void clear()
+        {
+            setTo(T(0));
+        }
+
+        inline T * row(size_t r)                        { return data + r * cols; }
+        inline const T * row(size_t r) const            { return data + r * cols; }
+        inline T & operator[](size_t i)                 { return data[i]; }
+        inline const T & operator[](size_t i) const     { return data[i]; }
+        inline size_t size() const                      { return rows * cols; }
+        inline bool isEmpty() const                     { return data == NULL || size() == 0; }
+
+        // element-wise, in place
+        void add(const BasicMat &rhs)
+        {
+#ifdef DEBUG
+            assert(rows == rhs.rows && cols == rhs.cols);
+#endif
+            blas::axpy(size(), T(1), rhs.data, data);
+        }
+
+        void subtract(const BasicMat &rhs)
+        {
+#ifdef DEBUG
+            assert(rows == rhs.rows && cols == rhs.cols);
+#endif
+            blas::axpy(size(), T(-1), rhs.data, data);
+        }
+
+        void multiply(const BasicMat &rhs)
+        {
+#ifdef DEBUG
+            assert(rows == rhs.rows && cols == rhs.cols);
+#endif
+            blas::vmul(data, 1, rhs.data, 1, data, 1, size());
+        }
+
+        void add(T scalar)                  { blas::vsadd(data, 1, scalar, data, 1, size()); }
+        void subtract(T scalar)             { blas::vsadd(data, 1, -scalar, data, 1, size()); }
+        void multiply(T scalar)             { blas::scal(size(), scalar, data); }
+        void divide(T scalar)               { blas::scal(size(), T(1) / scalar, data); }
+
+        // this * rhs, through ?gemm
+        BasicMat GEMM(const BasicMat &rhs) const
+        {
+            BasicMat result(rows, rhs.cols);
+            GEMM(rhs, result);
+            return result;
+        }
+
+        // result must already be rows x rhs.cols
+        void GEMM(const BasicMat &rhs, BasicMat &result) const
+        {
+#ifdef DEBUG
+            assert(cols == rhs.rows && result.rows == rows && result.cols == rhs.cols);
+#endif
+            blas::gemm(false, false, rows, rhs.cols, cols,
+                       T(1), data, cols, rhs.data, rhs.cols, T(0), result.data, result.cols);
+        }
+
+        BasicMat getTranspose() const
+        {
+            BasicMat t(cols, rows);
+            for (size_t r = 0; r < rows; r++) {
+                blas::copy(cols, data + r * cols, 1, t.data + r, rows);
+            }
+            return t;
+        }
+
+        T sumAll() const
+        {
+            return size() ? blas::sve(data, 1, size()) : T(0);
+        }
+
+        // as Mat: row_major gives 1 x cols (down each column), otherwise
+        // rows x 1 (along each row)
+        BasicMat sum(bool row_major = true) const
+        {
+            if (row_major) {
+                BasicMat result(1, cols);
+                for (size_t c = 0; c < cols; c++) {
+                    result.data[c] = blas::sve(data + c, cols, rows);
+                }
+                return result;
+            }
+            BasicMat result(rows, 1);
+            for (size_t r = 0; r < rows; r++) {
+                result.data[r] = blas::sve(data + r * cols, 1, cols);
+            }
+            return result;
+        }
+
+        BasicMat mean(bool row_major = true) const
+        {
+            BasicMat result = sum(row_major);
+            result.divide(T(row_major ? rows : cols));
+            return result;
+        }
+
+        // log sum exp(x), kept from overflowing by taking out the largest
+        // term.  as Mat: row_major gives rows x 1 (along each row), otherwise
+        // 1 x cols.
+        BasicMat logSumExp(bool row_major = true) const
+        {
+            size_t n = row_major ? rows : cols;
+            size_t length = row_major ? cols : rows;
+            size_t stride = row_major ? 1 : cols;
+            size_t step = row_major ? cols : 1;
+            BasicMat result = row_major ? BasicMat(rows, 1) : BasicMat(1, cols);
+            for (size_t i = 0; i < n; i++) {
+                const T *x = data + i * step;
+                T largest = -INFINITY;
+                for (size_t j = 0; j < length; j++) {
+                    largest = std::max(largest, x[j * stride]);
+                }
+                if (!(largest > -INFINITY && largest < INFINITY)) {
+                    result.data[i] = largest;
+                    continue;
+                }
+                T total = 0;
+                for (size_t j = 0; j < length; j++) {
+                    total += exp(x[j * stride] - largest);
+                }
+                result.data[i] = largest + log(total);
+            }
+            return result;
+        }
+
+        size_t  rows, cols;
+        T       *data;
+        bool    bAllocated;
+
+    private:
+        void init()
+        {
+            rows = cols = 0;
+            data = NULL;
+            bAllocated = false;
+        }
+
+        void releaseMemory()
+        {
+            if (bAllocated) {
+                free(data);
+            }
+            data = NULL;
+            bAllocated = false;
+            rows = cols = 0;
+        }
+    };
+}
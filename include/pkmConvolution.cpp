@@ -0,0 +1,358 @@
+/*
+ *  pkmConvolution.cpp
+ *
+
+ direct and overlap-add FFT 1-D filtering.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmConvolution.h"
+#include "pkmFFT.h"
+#include "pkmThreadPool.h"
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// multiply-adds per task
+#define PKM_FILTER_CHUNK 65536
+
+using namespace pkm;
+using namespace pkm::filter;
+
+namespace
+{
+#if defined(__AVX512F__)
+    struct Simd
+    {
+        typedef __m512 V;
+        enum { W = 16 };
+        static V load(const float *p)                   { return _mm512_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm512_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm512_set1_ps(f); }
+        static V fma(V a, V b, V c)                     { return _mm512_fmadd_ps(a, b, c); }
+    };
+#elif defined(__AVX2__) && defined(__FMA__)
+    struct Simd
+    {
+        typedef __m256 V;
+        enum { W = 8 };
+        static V load(const float *p)                   { return _mm256_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm256_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm256_set1_ps(f); }
+        static V fma(V a, V b, V c)                     { return _mm256_fmadd_ps(a, b, c); }
+    };
+#elif defined(__SSE2__)
+    struct Simd
+    {
+        typedef __m128 V;
+        enum { W = 4 };
+        static V load(const float *p)                   { return _mm_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm_set1_ps(f); }
+        static V fma(V a, V b, V c)                     { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    };
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    struct Simd
+    {
+        typedef float32x4_t V;
+        enum { W = 4 };
+        static V load(const float *p)                   { return vld1q_f32(p); }
+        static void store(float *p, V a)                { vst1q_f32(p, a); }
+        static V set(float f)                           { return vdupq_n_f32(f); }
+        static V fma(V a, V b, V c)                     { return vfmaq_f32(c, a, b); }
+    };
+#else
+    struct Simd
+    {
+        typedef float V;
+        enum { W = 1 };
+        static V load(const float *p)                   { return *p; }
+        static void store(float *p, V a)                { *p = a; }
+        static V set(float f)                           { return f; }
+        static V fma(V a, V b, V c)                     { return a * b + c; }
+    };
+#endif
+
+    typedef Simd::V V;
+    enum { W = Simd::W, VN = 4 };
+
+    // y[c] (+)= sum_k g[k] x[c + k step] for c < count.  VN vectors of
+    // outputs stay in registers while every tap is applied to them.
+    void dotTaps(const float *x, size_t step, const float *g, size_t taps,
+                 float *y, size_t count, bool accumulate = false)
+    {
+        size_t c = 0;
+        for (; c + VN*W <= count; c += VN*W) {
+            V acc[VN];
+#pragma GCC unroll 4
+            for (size_t v = 0; v < VN; v++) {
+                acc[v] = accumulate ? Simd::load(y + c + v*W) : Simd::set(0.0f);
+            }
+            const float *xc = x + c;
+            for (size_t k = 0; k < taps; k++, xc += step) {
+                V gk = Simd::set(g[k]);
+#pragma GCC unroll 4
+                for (size_t v = 0; v < VN; v++) {
+                    acc[v] = Simd::fma(gk, Simd::load(xc + v*W), acc[v]);
+                }
+            }
+#pragma GCC unroll 4
+            for (size_t v = 0; v < VN; v++) {
+                Simd::store(y + c + v*W, acc[v]);
+            }
+        }
+        for (; c + W <= count; c += W) {
+            V acc = accumulate ? Simd::load(y + c) : Simd::set(0.0f);
+            const float *xc = x + c;
+            for (size_t k = 0; k < taps; k++, xc += step) {
+                acc = Simd::fma(Simd::set(g[k]), Simd::load(xc), acc);
+            }
+            Simd::store(y + c, acc);
+        }
+        for (; c < count; c++) {
+            float acc = accumulate ? y[c] : 0.0f;
+            for (size_t k = 0; k < taps; k++) {
+                acc += g[k] * x[c + k*step];
+            }
+            y[c] = acc;
+        }
+    }
+
+    // where a shape starts in the full output, and how long it is
+    void extent(Shape shape, size_t n, size_t taps, size_t &start, size_t &length)
+    {
+        switch (shape) {
+            case FULL:
+                start = 0;
+                length = n + taps - 1;
+                break;
+            case SAME:
+                start = (taps - 1) / 2;
+                length = n;
+                break;
+            default:
+                start = taps - 1;
+                length = n + 1 - taps;
+                break;
+        }
+    }
+
+    size_t perTask(size_t multiplyAdds)
+    {
+        return std::max((size_t)1, PKM_FILTER_CHUNK / std::max(multiplyAdds, (size_t)1));
+    }
+
+    // every row convolved with h, directly: row r is padded with taps - 1
+    // zeros each side, so that every output is the same taps long dot product
+    void convolveRowsDirect(const Mat &X, const float *h, size_t taps,
+                            size_t start, size_t length, Mat &Y)
+    {
+        std::vector<float> g(h, h + taps);
+        std::reverse(g.begin(), g.end());
+        size_t n = X.cols;
+        pkm::parallelFor(X.rows, perTask(length * taps), [&](size_t begin, size_t end) {
+            std::vector<float> padded(n + 2 * (taps - 1), 0.0f);
+            for (size_t r = begin; r < end; r++) {
+                std::copy(X.data + r * n, X.data + (r + 1) * n, padded.begin() + taps - 1);
+                dotTaps(&padded[start], 1, &g[0], taps, Y.data + r * length, length);
+            }
+        });
+    }
+
+    // every column convolved with h, directly: an output row is a sum of
+    // up to taps input rows, leaving out those beyond the ends
+    void convolveColumnsDirect(const Mat &X, const float *h, size_t taps,
+                               size_t start, size_t length, Mat &Y)
+    {
+        std::vector<float> g(h, h + taps);
+        std::reverse(g.begin(), g.end());
+        size_t n = X.rows, cols = X.cols;
+        pkm::parallelFor(length, perTask(cols * taps), [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; r++) {
+                // full output j reads input rows j - taps + 1 + k for tap k
+                size_t j = start + r;
+                size_t first = j + 1 < taps ? taps - 1 - j : 0;
+                size_t last = std::min(taps, n + taps - 1 - j);
+                float *y = Y.data + r * cols;
+                if (first >= last) {
+                    std::fill(y, y + cols, 0.0f);
+                    continue;
+                }
+                dotTaps(X.data + (j + first + 1 - taps) * cols, cols, &g[first], last - first, y, cols);
+            }
+        });
+    }
+
+    // every row convolved with h by overlap-add: blocks of the row are
+    // zero padded to a power of two, multiplied by h's spectrum and the
+    // overlapping results summed
+    void convolveRowsFFT(const Mat &X, const float *h, size_t taps,
+                         size_t start, size_t length, Mat &Y)
+    {
+        size_t n = X.cols;
+        size_t full = n + taps - 1;
+
+        // about 4 K points keeps the FFT cost per output near its minimum
+        // without transforming more than the whole row
+        size_t N = 2;
+        while (N < std::min(4 * taps, full)) {
+            N *= 2;
+        }
+        size_t bins = N / 2 + 1;
+        size_t block = N + 1 - taps;
+        const FFT &fft = FFT::get(N);
+
+        // h's spectrum
+        std::vector<float> kernel(N, 0.0f), hRe(bins), hIm(bins);
+        std::copy(h, h + taps, kernel.begin());
+        fft.forwardReal(&kernel[0], &hRe[0], &hIm[0]);
+
+        // the inverse scales by N
+        float scale = 1.0f / N;
+
+        pkm::parallelFor(X.rows, perTask(full * 16), [&](size_t begin, size_t end) {
+            std::vector<float> buffer(N), re(bins), im(bins), sum(full);
+            for (size_t r = begin; r < end; r++) {
+                const float *x = X.data + r * n;
+                std::fill(sum.begin(), sum.end(), 0.0f);
+                for (size_t offset = 0; offset < n; offset += block) {
+                    size_t count = std::min(block, n - offset);
+                    std::copy(x + offset, x + offset + count, buffer.begin());
+                    std::fill(buffer.begin() + count, buffer.end(), 0.0f);
+
+                    fft.forwardReal(&buffer[0], &re[0], &im[0]);
+                    for (size_t k = 0; k < bins; k++) {
+                        float a = re[k] * hRe[k] - im[k] * hIm[k];
+                        float b = re[k] * hIm[k] + im[k] * hRe[k];
+                        re[k] = a;
+                        im[k] = b;
+                    }
+                    fft.inverseReal(&re[0], &im[0], &buffer[0]);
+
+                    size_t produced = std::min(N, full - offset);
+                    for (size_t i = 0; i < produced; i++) {
+                        sum[offset + i] += scale * buffer[i];
+                    }
+                }
+                std::copy(sum.begin() + start, sum.begin() + start + length, Y.data + r * length);
+            }
+        });
+    }
+
+    void apply(const Mat &X, const float *h, size_t taps, Mat &Y, Axis axis, Shape shape)
+    {
+        size_t n = axis == ALONG_ROWS ? X.cols : X.rows;
+        if (taps == 0 || n == 0 || (shape == VALID && taps > n)) {
+            printf("[ERROR: pkm::filter::convolve()] Cannot filter %lu samples with %lu taps.\n", n, taps);
+            return;
+        }
+        size_t start, length;
+        extent(shape, n, taps, start, length);
+
+        if (taps <= PKM_FILTER_FFT_TAPS) {
+            if (axis == ALONG_ROWS) {
+                Y.reset(X.rows, length);
+                convolveRowsDirect(X, h, taps, start, length, Y);
+            }
+            else {
+                Y.reset(length, X.cols);
+                convolveColumnsDirect(X, h, taps, start, length, Y);
+            }
+        }
+        else if (axis == ALONG_ROWS) {
+            Y.reset(X.rows, length);
+            convolveRowsFFT(X, h, taps, start, length, Y);
+        }
+        else {
+            // columns go through the FFT as the rows of X^T
+            Mat T(X.cols, X.rows), U(X.cols, length);
+            Mat::transpose(X.data, X.rows, X.cols, X.cols, T.data, T.cols);
+            convolveRowsFFT(T, h, taps, start, length, U);
+            Y.reset(length, X.cols);
+            Mat::transpose(U.data, U.rows, U.cols, U.cols, Y.data, Y.cols);
+        }
+    }
+}
+
+void pkm::filter::convolve(const Mat &X, const Mat &kernel, Mat &Y, Axis axis, Shape shape)
+{
+    if (&X == &Y || &kernel == &Y) {
+        Mat result;
+        convolve(X, kernel, result, axis, shape);
+        Y = result;
+        return;
+    }
+    apply(X, kernel.data, kernel.size(), Y, axis, shape);
+}
+
+void pkm::filter::correlate(const Mat &X, const Mat &kernel, Mat &Y, Axis axis, Shape shape)
+{
+    std::vector<float> h(kernel.data, kernel.data + kernel.size());
+    std::reverse(h.begin(), h.end());
+    if (&X == &Y) {
+        Mat result;
+        apply(X, h.empty() ? NULL : &h[0], h.size(), result, axis, shape);
+        Y = result;
+        return;
+    }
+    apply(X, h.empty() ? NULL : &h[0], h.size(), Y, axis, shape);
+}
+
+void pkm::filter::separable(const Mat &X, const Mat &rowKernel, const Mat &columnKernel, Mat &Y, Shape shape)
+{
+    Mat T;
+    convolve(X, rowKernel, T, ALONG_ROWS, shape);
+    convolve(T, columnKernel, Y, ALONG_COLUMNS, shape);
+}
+
+Stream::Stream(const Mat &kernel, size_t dimensions)
+: taps(1, kernel.size()), history(kernel.size(), dimensions), output(1, dimensions)
+{
+    std::reverse_copy(kernel.data, kernel.data + kernel.size(), taps.data);
+    reset();
+}
+
+const Mat & Stream::insert(const float *frame)
+{
+    if (history.rows == 0) {
+        printf("[ERROR: pkm::filter::Stream::insert()] The kernel is empty.\n");
+        return output;
+    }
+
+    // oldest to newest is current_row .. K - 1 then 0 .. current_row - 1
+    history.insertRowCircularly(frame);
+    size_t K = history.rows, oldest = history.current_row;
+    dotTaps(history.row(oldest), history.cols, taps.data, K - oldest, output.data, output.cols);
+    dotTaps(history.data, history.cols, taps.data + K - oldest, oldest, output.data, output.cols, true);
+    return output;
+}
+
+void Stream::reset()
+{
+    std::fill(history.data, history.data + history.size(), 0.0f);
+    std::fill(output.data, output.data + output.size(), 0.0f);
+    history.resetCircularRowCounter();
+}
@@ -0,0 +1,104 @@
+/*
+ *  pkmConvolution.h
+ *
+
+ 1-D convolution and correlation of every row, or every column, of a Mat
+ with an arbitrary kernel, for smoothing features and onset detection
+ functions.  a kernel is any 1 x K or K x 1 Mat.
+
+ kernels of up to PKM_FILTER_FFT_TAPS taps are applied directly: blocks of
+ outputs are kept in SIMD registers (AVX-512F, AVX2 + FMA, SSE2, aarch64
+ NEON or scalar, whichever the compiler targets) while the taps stream
+ past.  longer kernels go through overlap-add with pkm::FFT's real
+ transform, whose cost per output grows with log K rather than K.  rows,
+ or output rows when filtering columns, are split across the shared
+ pkm::ThreadPool.
+
+ correlate(X, h) is convolve(X, h reversed).  the output is FULL (n + K - 1
+ long, every overlap), SAME (n long, centred as numpy and scipy do, so
+ starting (K - 1) / 2 into FULL) or VALID (n - K + 1 long, no zero padding).
+
+ Stream filters frames as they arrive, one output frame per input frame,
+ keeping the last K frames in a Mat filled by insertRowCircularly().
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include "pkmMatrix.h"
+
+// kernels longer than this filter through overlap-add FFT
+#define PKM_FILTER_FFT_TAPS 160
+
+namespace pkm
+{
+    namespace filter
+    {
+        enum Axis
+        {
+            ALONG_ROWS,         // every row is a signal
+            ALONG_COLUMNS       // every column is a signal, e.g. frames over time
+        };
+
+        enum Shape
+        {
+            FULL,
+            SAME,
+            VALID
+        };
+
+        // Y = X * kernel along the given axis.  Y may be X.
+        void convolve(const Mat &X, const Mat &kernel, Mat &Y, Axis axis, Shape shape = SAME);
+
+        // Y = X (*) kernel, the kernel not flipped
+        void correlate(const Mat &X, const Mat &kernel, Mat &Y, Axis axis, Shape shape = SAME);
+
+        // 2-D convolution with the outer product columnKernel rowKernel^T,
+        // done as rowKernel along the rows and then columnKernel along the
+        // columns: K1 + K2 rather than K1 K2 multiply-adds per output
+        void separable(const Mat &X, const Mat &rowKernel, const Mat &columnKernel, Mat &Y, Shape shape = SAME);
+
+        // causal convolution of a stream of frames along time,
+        //     y[t] = sum_k kernel[k] x[t - k],
+        // with the frames before the first taken to be zeros.  each insert
+        // costs K multiply-adds per dimension whatever the kernel length.
+        class Stream
+        {
+        public:
+            Stream(const Mat &kernel, size_t dimensions);
+
+            // push one frame of 'dimensions' values and return y for it
+            const Mat & insert(const float *frame);
+            const Mat & insert(const Mat &frame)        { return insert(frame.data); }
+
+            // forget every frame so far
+            void reset();
+
+            // 1 x dimensions, the output for the last frame inserted
+            const Mat & getOutput() const               { return output; }
+
+            // the last K frames, oldest at history.current_row
+            const Mat & getHistory() const              { return history; }
+
+        private:
+            Mat taps;           // the kernel reversed, oldest frame first
+            Mat history;        // K x dimensions, circular
+            Mat output;         // 1 x dimensions
+        };
+    }
+}
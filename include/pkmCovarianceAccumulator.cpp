@@ -0,0 +1,228 @@
+/*
+ *  pkmCovarianceAccumulator.cpp
+ *
+
+ running mean and covariance of a stream of frames.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmCovarianceAccumulator.h"
+#include "pkmMath.h"
+#include <math.h>
+#include <stdio.h>
+
+// frames per ssyrk when a whole Mat is pushed
+#define PKM_COVARIANCE_BLOCK 4096
+
+pkmCovarianceAccumulator::pkmCovarianceAccumulator(size_t dimensions)
+{
+    reset(dimensions);
+}
+
+void pkmCovarianceAccumulator::reset(size_t dimensions)
+{
+    this->dimensions = dimensions;
+    count = 0;
+    pendingRows = 0;
+    mean.assign(dimensions, 0.0);
+    scatter.assign(dimensions * dimensions, 0.0);
+    if (dimensions) {
+        pending.reset(PKM_COVARIANCE_BATCH, dimensions);
+    }
+    else {
+        pending = Mat();
+    }
+}
+
+void pkmCovarianceAccumulator::push_back(const float *frame)
+{
+    if (dimensions == 0) {
+        printf("[ERROR: pkmCovarianceAccumulator::push_back()] Unknown frame width, use reset(dimensions) or push_back(Mat) first.\n");
+        return;
+    }
+    cblas_scopy(dimensions, frame, 1, pending.row(pendingRows), 1);
+    if (++pendingRows == PKM_COVARIANCE_BATCH) {
+        flush();
+    }
+}
+
+void pkmCovarianceAccumulator::push_back(const Mat &frames)
+{
+    if (frames.rows == 0) {
+        return;
+    }
+    if (getCount() == 0 && dimensions != frames.cols) {
+        reset(frames.cols);
+    }
+    else if (dimensions != frames.cols) {
+        printf("[ERROR: pkmCovarianceAccumulator::push_back()] Expected %lu dimensions, got %lu.\n", dimensions, frames.cols);
+        return;
+    }
+
+    flush();
+    for (size_t first = 0; first < frames.rows; first += PKM_COVARIANCE_BLOCK) {
+        update(frames.data + first * dimensions, MIN((size_t)PKM_COVARIANCE_BLOCK, frames.rows - first));
+    }
+}
+
+void pkmCovarianceAccumulator::flush()
+{
+    if (pendingRows) {
+        update(pending.data, pendingRows);
+        pendingRows = 0;
+    }
+}
+
+template<typename T>
+void pkmCovarianceAccumulator::combine(size_t n, const double *otherMean, const T *otherScatter)
+{
+    size_t d = dimensions;
+    double total = (double)count + n;
+    double weight = (double)count * n / total;
+
+    std::vector<double> delta(d);
+    for (size_t j = 0; j < d; j++) {
+        delta[j] = otherMean[j] - mean[j];
+    }
+    for (size_t i = 0; i < d; i++) {
+        double *s = &scatter[i * d];
+        const T *o = otherScatter + i * d;
+        double wi = weight * delta[i];
+        for (size_t j = i; j < d; j++) {
+            s[j] += o[j] + wi * delta[j];
+        }
+    }
+    for (size_t j = 0; j < d; j++) {
+        mean[j] += delta[j] * (n / total);
+    }
+    count += n;
+}
+
+void pkmCovarianceAccumulator::update(const float *frames, size_t n)
+{
+    size_t d = dimensions;
+
+    std::vector<double> batchMean(d, 0.0);
+    for (size_t i = 0; i < n; i++) {
+        const float *frame = frames + i * d;
+        for (size_t j = 0; j < d; j++) {
+            batchMean[j] += frame[j];
+        }
+    }
+    for (size_t j = 0; j < d; j++) {
+        batchMean[j] /= n;
+    }
+
+    // center on the batch mean, so the ssyrk only sees the spread within the batch
+    Mat batchMeanf(1, d);
+    for (size_t j = 0; j < d; j++) {
+        batchMeanf.data[j] = batchMean[j];
+    }
+    if (centered.rows < n || centered.cols != d) {
+        centered.reset(MAX(n, (size_t)PKM_COVARIANCE_BATCH), d);
+    }
+    for (size_t i = 0; i < n; i++) {
+        vDSP_vsub(batchMeanf.data, 1, frames + i * d, 1, centered.row(i), 1, d);
+    }
+
+    if (batchScatter.rows != d) {
+        batchScatter.reset(d, d);
+    }
+    cblas_ssyrk(CblasRowMajor, CblasUpper, CblasTrans, d, n, 1.0f,
+                centered.data, d, 0.0f, batchScatter.data, d);
+
+    combine(n, &batchMean[0], batchScatter.data);
+}
+
+void pkmCovarianceAccumulator::merge(const pkmCovarianceAccumulator &other)
+{
+    if (other.getCount() == 0) {
+        return;
+    }
+    if (getCount() == 0 && dimensions != other.dimensions) {
+        reset(other.dimensions);
+    }
+    else if (dimensions != other.dimensions) {
+        printf("[ERROR: pkmCovarianceAccumulator::merge()] Expected %lu dimensions, got %lu.\n", dimensions, other.dimensions);
+        return;
+    }
+
+    flush();
+    if (other.pendingRows) {
+        pkmCovarianceAccumulator flushed(other);
+        flushed.flush();
+        combine(flushed.count, &flushed.mean[0], &flushed.scatter[0]);
+    }
+    else {
+        combine(other.count, &other.mean[0], &other.scatter[0]);
+    }
+}
+
+void pkmCovarianceAccumulator::getMean(Mat &m) const
+{
+    if (pendingRows) {
+        pkmCovarianceAccumulator flushed(*this);
+        flushed.flush();
+        flushed.getMean(m);
+        return;
+    }
+    m.reset(1, dimensions);
+    for (size_t j = 0; j < dimensions; j++) {
+        m.data[j] = mean[j];
+    }
+}
+
+void pkmCovarianceAccumulator::getVariance(Mat &variance, bool bUnbiased) const
+{
+    if (pendingRows) {
+        pkmCovarianceAccumulator flushed(*this);
+        flushed.flush();
+        flushed.getVariance(variance, bUnbiased);
+        return;
+    }
+    double n = bUnbiased ? (double)count - 1 : (double)count;
+    variance.reset(1, dimensions);
+    for (size_t j = 0; j < dimensions; j++) {
+        variance.data[j] = n > 0 ? MAX(scatter[j * dimensions + j], 0.0) / n : 0;
+    }
+}
+
+void pkmCovarianceAccumulator::getStdDev(Mat &stddev, bool bUnbiased) const
+{
+    getVariance(stddev, bUnbiased);
+    pkm::math::sqrt(stddev.data, stddev.data, stddev.cols);
+}
+
+void pkmCovarianceAccumulator::getCovariance(Mat &covariance, bool bUnbiased) const
+{
+    if (pendingRows) {
+        pkmCovarianceAccumulator flushed(*this);
+        flushed.flush();
+        flushed.getCovariance(covariance, bUnbiased);
+        return;
+    }
+    size_t d = dimensions;
+    double n = bUnbiased ? (double)count - 1 : (double)count;
+    double scale = n > 0 ? 1.0 / n : 0;
+    covariance.reset(d, d);
+    for (size_t i = 0; i < d; i++) {
+        for (size_t j = i; j < d; j++) {
+            covariance.data[i * d + j] = covariance.data[j * d + i] = scatter[i * d + j] * scale;
+        }
+    }
+}
@@ -0,0 +1,91 @@
+/*
+ *  pkmCovarianceAccumulator.h
+ *
+
+ running mean and covariance of a stream of frames, so feature pipelines
+ can get mean(), stddev() and principal components (see pkmPCA::fit) without
+ keeping every frame in a Mat.
+
+ frames are buffered and folded in PKM_COVARIANCE_BATCH at a time as a
+ rank-b update: the batch is centered on its own mean, its scatter is one
+ cblas_ssyrk, and it is combined with the running totals using the
+ pairwise update of chan, golub and leveque.  the same combination merges
+ two accumulators, so each thread can own one and merge them at the end.
+
+ totals are kept in double, which costs d^2 adds per batch against the
+ d^2 * b multiply-adds of the ssyrk, and keeps long streams from drifting.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include "pkmMatrix.h"
+#include <vector>
+
+using namespace pkm;
+
+// frames buffered before each rank-b update
+#define PKM_COVARIANCE_BATCH 256
+
+class pkmCovarianceAccumulator
+{
+public:
+    pkmCovarianceAccumulator(size_t dimensions = 0);
+
+    // forgets everything, and sets the frame width (0 takes it from the first frame)
+    void reset(size_t dimensions = 0);
+
+    // one frame of getDimensions() floats, or every row of frames
+    void push_back(const float *frame);
+    void push_back(const Mat &frames);
+
+    // as if every frame pushed to other had been pushed here
+    void merge(const pkmCovarianceAccumulator &other);
+
+    size_t getCount() const                 { return count + pendingRows; }
+    size_t getDimensions() const            { return dimensions; }
+
+    // 1 x dimensions, and dimensions x dimensions.  like Mat::stddev() these
+    // divide by the number of frames, or by one less with bUnbiased.
+    void getMean(Mat &mean) const;
+    void getVariance(Mat &variance, bool bUnbiased = false) const;
+    void getStdDev(Mat &stddev, bool bUnbiased = false) const;
+    void getCovariance(Mat &covariance, bool bUnbiased = false) const;
+
+private:
+    // folds the buffered frames in
+    void flush();
+
+    // rank-n update from n contiguous frames
+    void update(const float *frames, size_t n);
+
+    // chan et al.: combines n frames with the given mean and scatter
+    // (upper triangle, row-major) into the running totals
+    template<typename T>
+    void combine(size_t n, const double *otherMean, const T *otherScatter);
+
+    size_t                  dimensions;
+    size_t                  count;
+    std::vector<double>     mean;
+    std::vector<double>     scatter;        // sum of centered outer products, upper triangle
+
+    Mat                     pending;        // PKM_COVARIANCE_BATCH x dimensions
+    size_t                  pendingRows;
+
+    Mat                     centered, batchScatter;
+};
@@ -26,7 +26,7 @@
 
 
 // -------------------------------------------------------------------------
-void pkmDTW::calculateBounds(Mat &input, Mat &upperBound, Mat &lowerBound)
+void pkmDTW::calculateBounds(Mat &input, Mat &upperBound, Mat &lowerBound) const
 {
     // compute how much we allow the time to stretch in terms of the query's subscripts
     // Sakoe-Chiba uses fixed range
@@ -26,6 +26,7 @@ Copyright (C) 2011 Parag K. Mital
 #pragma once
 
 #include "pkmMatrix.h"
+#include "pkmSparseMat.h"
 
 #define WITH_OF
 
@@ -42,16 +43,46 @@ public:
     // -------------------------------------------------------------------------
     pkmDTW()
     {
-        bSetQuery = false;
         bHaveCandidates = false;
         bUseZNormalize = false;
         bUseCosineDistance = true;
+        numCandidates = 0;
         
         range = 1.0;
-
-        bestSoFar = INFINITY;
     }
     // -------------------------------------------------------------------------
+    
+    // -------------------------------------------------------------------------
+    //  Everything a query needs besides the database: the normalized query
+    //  and the scratch matrices the search reuses from call to call.
+    //
+    //  Give each concurrent caller its own session; the database is only read
+    //  while searching, so one loaded pkmDTW can serve any number of sessions
+    //  from any number of threads, as long as nothing is added to it meanwhile.
+    // -------------------------------------------------------------------------
+    class Session
+    {
+    public:
+        Session()
+        {
+            bestSoFar = INFINITY;
+            bandRadius = 0;
+        }
+        
+    private:
+        friend class pkmDTW;
+        
+        float           bestSoFar;
+        Mat             query, queryTransposed, queryNormalization;
+        Mat             differenceMatrix, dtwDistance, traceBack;
+        Mat             candidateSquared, candidateNormalization, normalization;
+        Mat             distanceMatrix;
+        
+        SparseMat       band;               // candidate's rows x query's rows
+        size_t          bandRadius;
+        vector<unsigned char> bandTraceBack;
+    };
+    // -------------------------------------------------------------------------
 
     // -------------------------------------------------------------------------
     //  Change the possible range of the warping envelope
@@ -85,11 +116,16 @@ public:
     
     
     // -------------------------------------------------------------------------
-    void getNearestCandidate(const Mat &q,
+    //  Searches the database for the candidate closest to 'q' (frames x
+    //  dimensions) using only 'session' for scratch; 'q' is left untouched.
+    // -------------------------------------------------------------------------
+    void getNearestCandidate(Session &session,
+                             const Mat &q,
                              float &distance, 
                              int &subscript, 
                              vector<int> &bestPathI,  // candidate's frame   (source)
                              vector<int> &bestPathJ)  // query's frame       (target)
+                             const
     {
         if (!bHaveCandidates) {
             cout << "[ERROR::pkmDTW]: Add sequences to the database first using pkmDTW::addToDatabase(el)!" << endl;
@@ -97,31 +133,42 @@ public:
         }
         
         // establish the query
-        setQuery(q);
+        setQuery(session, q);
         
         subscript = 0;
         // search all candidates linearly
         for (int i = 0; i < numCandidates; i++)
         {
             vector<int> pathI, pathJ;
-            Mat differenceMatrix, dtwDistance;
-            Mat thisCandidate = candidates.rowRange(candidates_lut.row(i)[0], candidates_lut.row(i)[0] + candidates_lut.row(i)[1], false);
+            Mat thisCandidate = getCandidate(i);
             
-            differenceMatrix = computeDifferenceMatrix(thisCandidate);
-            float thisDistance = dtw(differenceMatrix, dtwDistance, pathI, pathJ);
+            computeDifferenceMatrix(session, thisCandidate);
+            float thisDistance = dtw(session, pathI, pathJ);
 
-            if (thisDistance < bestSoFar) 
+            if (thisDistance < session.bestSoFar) 
             {
-                bestSoFar = thisDistance;
+                session.bestSoFar = thisDistance;
                 bestPathI = pathI;
                 bestPathJ = pathJ;
                 subscript = i;
             }
         }
-        distance = bestSoFar;
-        bestSoFar = INFINITY;
-        
-        
+        distance = session.bestSoFar;
+        session.bestSoFar = INFINITY;
+    }
+    // -------------------------------------------------------------------------
+    
+    
+    // -------------------------------------------------------------------------
+    //  Single caller versions, using a session owned by the database
+    // -------------------------------------------------------------------------
+    void getNearestCandidate(const Mat &q,
+                             float &distance, 
+                             int &subscript, 
+                             vector<int> &bestPathI,  // candidate's frame   (source)
+                             vector<int> &bestPathJ)  // query's frame       (target)
+    {
+        getNearestCandidate(defaultSession, q, distance, subscript, bestPathI, bestPathJ);
     }
     // -------------------------------------------------------------------------
     
@@ -141,33 +188,109 @@ public:
     
     
     // -------------------------------------------------------------------------
-    void getNearestCandidateEuclidean(const Mat &q,
+    //  The same search as getNearestCandidate(), with the difference and dtw
+    //  matrices only stored within the warping envelope set by setRange():
+    //  memory and time grow with the band rather than with candidate frames
+    //  x query frames, so long sequences with a narrow range are far cheaper.
+    //
+    //  Unlike the dense version, the band follows the diagonal from corner
+    //  to corner when the candidate and query differ in length, and the
+    //  squared difference is used for all of it when not using the cosine
+    //  distance.
+    // -------------------------------------------------------------------------
+    void getNearestCandidateBanded(Session &session,
+                                   const Mat &q,
+                                   float &distance,
+                                   int &subscript,
+                                   vector<int> &bestPathI,  // candidate's frame   (source)
+                                   vector<int> &bestPathJ)  // query's frame       (target)
+                                   const
+    {
+        if (!bHaveCandidates) {
+            cout << "[ERROR::pkmDTW]: Add sequences to the database first using pkmDTW::addToDatabase(el)!" << endl;
+            return;
+        }
+        
+        // establish the query
+        setQuery(session, q);
+        
+        subscript = 0;
+        // search all candidates linearly
+        for (int i = 0; i < numCandidates; i++)
+        {
+            vector<int> pathI, pathJ;
+            Mat thisCandidate = getCandidate(i);
+            
+            computeBandedDifference(session, thisCandidate);
+            float thisDistance = dtwBanded(session, pathI, pathJ);
+            
+            if (thisDistance < session.bestSoFar)
+            {
+                session.bestSoFar = thisDistance;
+                bestPathI = pathI;
+                bestPathJ = pathJ;
+                subscript = i;
+            }
+        }
+        distance = session.bestSoFar;
+        session.bestSoFar = INFINITY;
+    }
+    // -------------------------------------------------------------------------
+    
+    
+    // -------------------------------------------------------------------------
+    void getNearestCandidateBanded(const Mat &q,
+                                   float &distance,
+                                   int &subscript,
+                                   vector<int> &bestPathI,  // candidate's frame   (source)
+                                   vector<int> &bestPathJ)  // query's frame       (target)
+    {
+        getNearestCandidateBanded(defaultSession, q, distance, subscript, bestPathI, bestPathJ);
+    }
+    // -------------------------------------------------------------------------
+    
+    
+    // -------------------------------------------------------------------------
+    void getNearestCandidateEuclidean(Session &session,
+                                      const Mat &q,
                                       float &distance, 
-                                      int &subscript) 
+                                      int &subscript) const
     {
         if (!bHaveCandidates) {
             cout << "[ERROR::pkmDTW]: Add sequences to the database first using pkmDTW::addToDatabase(el)!" << endl;
             return;
         }
         subscript = 0;
-        Mat query = q;
-        Mat distanceMatrix = Mat(q.rows, q.cols);
+        if (session.distanceMatrix.rows != q.rows || session.distanceMatrix.cols != q.cols) {
+            session.distanceMatrix.reset(q.rows, q.cols);
+        }
+        Mat &distanceMatrix = session.distanceMatrix;
         // search all candidates linearly
         for (int i = 0; i < numCandidates; i++)
         {
-            Mat thisCandidate = candidates.rowRange(candidates_lut.row(i)[0], candidates_lut.row(i)[0] + candidates_lut.row(i)[1], false);
-            query.subtract(thisCandidate, distanceMatrix);
+            Mat thisCandidate = getCandidate(i);
+            q.subtract(thisCandidate, distanceMatrix);
             distanceMatrix.abs();
             Mat distance2 = distanceMatrix.sum(false);
             float thisDistance = Mat::sum(distance2);
-            if (thisDistance < bestSoFar) 
+            if (thisDistance < session.bestSoFar) 
             {
-                bestSoFar = thisDistance;
+                session.bestSoFar = thisDistance;
                 subscript = i;
             }
         }
-        distance = bestSoFar;
-        bestSoFar = INFINITY;
+        distance = session.bestSoFar;
+        session.bestSoFar = INFINITY;
+    }
+    // -------------------------------------------------------------------------
+    
+    
+    // -------------------------------------------------------------------------
+    void getNearestCandidateEuclidean(const Mat &q,
+                                      float &distance, 
+                                      int &subscript) 
+    {
+        getNearestCandidateEuclidean(defaultSession, q, distance, subscript);
     }
     // -------------------------------------------------------------------------
   
@@ -218,6 +341,18 @@ public:
     
 protected:
     
+    // -------------------------------------------------------------------------
+    // A view of candidate 'i' straight into the database, no copy
+    // -------------------------------------------------------------------------
+    Mat getCandidate(int i) const
+    {
+        size_t start = candidates_lut.data[i*2];
+        size_t length = candidates_lut.data[i*2 + 1];
+        return Mat(length, candidates.cols, candidates.data + start*candidates.cols, false);
+    }
+    // -------------------------------------------------------------------------
+    
+    
     // -------------------------------------------------------------------------
     // Establish the query to compare against all candidates
     //
@@ -225,8 +360,9 @@ protected:
     //  T is the number of frames or time-steps
     //  D is the dimension of each data point
     // -------------------------------------------------------------------------
-    void setQuery(const Mat &q)
+    void setQuery(Session &session, const Mat &q) const
     {
+        Mat &query = session.query;
         query = q;
         if(bUseZNormalize)
         {
@@ -236,16 +372,14 @@ protected:
                 thisRow.divide(stdValues);
             }
         }
-        queryTransposed = query;
-        queryTransposed.setTranspose();
+        session.queryTransposed = query;
+        session.queryTransposed.setTranspose();
         
-        Mat temp = q;
+        Mat temp = query;
         temp.sqr();
-        queryNormalization = temp.sum(false);
-        queryNormalization.sqrt();
-        queryNormalization.setTranspose();
-        
-        bSetQuery = true;
+        session.queryNormalization = temp.sum(false);
+        session.queryNormalization.sqrt();
+        session.queryNormalization.setTranspose();
     }
     // -------------------------------------------------------------------------
     
@@ -257,63 +391,74 @@ protected:
     //  'differenceMatrix': size will be candidate's rows x query's rows,
     //      i.e. differenceMatrix(i,j) indexes [1 - cosine distance of (candidate(i,:), query(j,:))]
     // -------------------------------------------------------------------------
-    Mat computeDifferenceMatrix(Mat &candidate)
+    void computeDifferenceMatrix(Session &session, Mat &candidate) const
     {
-        Mat differenceMatrix;
-        if (bSetQuery) {
-            if(bUseCosineDistance)
-            {
-                Mat temp(candidate.rows, candidate.cols);
-                temp.copy(candidate);
-                temp.sqr();
-                Mat candidateNormalization = temp.sum(false);
-                candidateNormalization.sqrt();
-                Mat normalization = candidateNormalization.GEMM(queryNormalization);
-                differenceMatrix = candidate.GEMM(queryTransposed);
-                differenceMatrix.divide(normalization);
-                
-                // remove these next 3 lines for a similarity matrix instead
-                float factor = -1;
-                float term = 1;
-                vDSP_vsmsa(differenceMatrix.data, 1, &factor, &term, differenceMatrix.data, 1, differenceMatrix.size());
+        const Mat &query = session.query;
+        Mat &differenceMatrix = session.differenceMatrix;
+        if (differenceMatrix.rows != candidate.rows || differenceMatrix.cols != query.rows) {
+            differenceMatrix.reset(candidate.rows, query.rows);
+        }
+        
+        if(bUseCosineDistance)
+        {
+            Mat &temp = session.candidateSquared;
+            if (temp.rows != candidate.rows || temp.cols != candidate.cols) {
+                temp.reset(candidate.rows, candidate.cols);
             }
-            else
+            temp.copy(candidate);
+            temp.sqr();
+            session.candidateNormalization = temp.sum(false);
+            session.candidateNormalization.sqrt();
+            if (session.normalization.rows != candidate.rows || session.normalization.cols != query.rows) {
+                session.normalization.reset(candidate.rows, query.rows);
+            }
+            session.candidateNormalization.GEMM(session.queryNormalization, session.normalization);
+            candidate.GEMM(session.queryTransposed, differenceMatrix);
+            differenceMatrix.divide(session.normalization);
+            
+            // remove these next 3 lines for a similarity matrix instead
+            float factor = -1;
+            float term = 1;
+            vDSP_vsmsa(differenceMatrix.data, 1, &factor, &term, differenceMatrix.data, 1, differenceMatrix.size());
+        }
+        else
+        {
+            int padding = query.rows * range;
+            float one = 1.0f;
+            vDSP_vfill(&one, differenceMatrix.data, 1, differenceMatrix.size());
+            
+            Mat ssd(1, candidate.cols);
+            float size = ssd.size();
+            for (int i = 0; i < candidate.rows; i++)
             {
-                int padding = query.rows * range;
-                differenceMatrix = Mat(candidate.rows, query.rows, 1.0f);
-                
-                Mat ssd(1, candidate.cols);
-                float size = ssd.size();
-                for (int i = 0; i < candidate.rows; i++)
+                Mat p1(1, candidate.cols, candidate.row(i), false);
+                for (int j = max(0, i - padding); j < std::min<int>(query.rows, i + padding - 1); j++)
                 {
-                    Mat p1(1, candidate.cols, candidate.row(i), false);
-                    for (int j = max(0, i - padding); j < std::min<int>(query.rows, i + padding - 1); j++)
-                    {
-                        Mat p2(1, query.cols, query.row(j), false);
-                        p1.subtract(p2, ssd);
-                        ssd.sqr();
+                    Mat p2(1, query.cols, query.data + j*query.cols, false);
+                    p1.subtract(p2, ssd);
+                    ssd.sqr();
 
-                        differenceMatrix.data[query.rows*i + j] = ssd.sumAll() / size;
+                    differenceMatrix.data[query.rows*i + j] = ssd.sumAll() / size;
 
 //                        differenceMatrix.data[query.rows*i + j] = L1Norm(candidate.row(i), query.row(j), query.cols);
 
-                    }
                 }
             }
         }
-        return differenceMatrix;
     }
     // -------------------------------------------------------------------------
-    
-    // -------------------------------------------------------------------------
-    float dtw(Mat &differenceMatrix,
-             Mat &dtwDistance,
+    float dtw(Session &session,
              vector<int> &pathI,
-             vector<int> &pathJ)
+             vector<int> &pathJ) const
     {
         // calculate the dtw distance matrix
+        Mat &differenceMatrix = session.differenceMatrix;
+        Mat &dtwDistance = session.dtwDistance;
+        Mat &traceBack = session.traceBack;
         int subscriptRange = differenceMatrix.cols * range;
-        Mat traceBack(differenceMatrix.rows, differenceMatrix.cols);
+        if (traceBack.rows != differenceMatrix.rows || traceBack.cols != differenceMatrix.cols) {
+            traceBack.reset(differenceMatrix.rows, differenceMatrix.cols);
+        }
         dtwDistance = differenceMatrix;
         float x, y, z;
         int i, j;
@@ -376,7 +521,7 @@ protected:
             }
             
             // abandon early
-            if (minCost > bestSoFar) {
+            if (minCost > session.bestSoFar) {
                 return INFINITY;
             }
         }
@@ -403,6 +548,168 @@ protected:
         return *(dtwDistance.last());
     }
     // -------------------------------------------------------------------------
+    //  computeDifferenceMatrix() within the band only
+    //
+    //  'session.band': candidate's rows x query's rows, holding the difference
+    //      of every pair of frames at most range * query's rows apart (more
+    //      when the lengths differ by so much that the band would break up)
+    // -------------------------------------------------------------------------
+    void computeBandedDifference(Session &session, const Mat &candidate) const
+    {
+        const Mat &query = session.query;
+        SparseMat &band = session.band;
+        
+        // consecutive rows' runs must touch for a path to get through.  a
+        // 1 frame candidate's band is its whole row whatever the radius.
+        size_t connected = candidate.rows > 1 ? (query.rows - 1 + candidate.rows - 2) / (candidate.rows - 1) : 1;
+        size_t radius = std::max<size_t>(ceilf(query.rows * range), (connected + 1) / 2);
+        if (band.rows != candidate.rows || band.cols != query.rows || session.bandRadius != radius) {
+            band = SparseMat::bandPattern(candidate.rows, query.rows, radius);
+            session.bandRadius = radius;
+        }
+        band.setDots(candidate, query);
+        
+        Mat &candidateNormalization = session.candidateNormalization;
+        if (candidateNormalization.rows != candidate.rows || candidateNormalization.cols != 1) {
+            candidateNormalization.reset(candidate.rows, 1);
+        }
+        for (int i = 0; i < candidate.rows; i++) {
+            const float *c = candidate.data + i*candidate.cols;
+            candidateNormalization.data[i] = cblas_sdot(candidate.cols, c, 1, c, 1);
+        }
+        
+        const vector<size_t> &pointers = band.getPointers();
+        const vector<uint32_t> &indices = band.getIndices();
+        float *difference = band.getValues().data;
+        const float *queryNormalization = session.queryNormalization.data;
+        for (int i = 0; i < candidate.rows; i++)
+        {
+            float candidateSquared = candidateNormalization.data[i];
+            for (size_t p = pointers[i]; p < pointers[i+1]; p++)
+            {
+                float querySquared = queryNormalization[indices[p]] * queryNormalization[indices[p]];
+                if (bUseCosineDistance) {
+                    difference[p] = 1.0f - difference[p] / sqrtf(candidateSquared * querySquared);
+                }
+                else {
+                    difference[p] = (candidateSquared - 2.0f * difference[p] + querySquared) / candidate.cols;
+                }
+            }
+        }
+    }
+    // -------------------------------------------------------------------------
+    
+    
+    // -------------------------------------------------------------------------
+    //  dtw() over session.band, accumulating the distance in place.  cells
+    //  outside the band are never reached.
+    // -------------------------------------------------------------------------
+    float dtwBanded(Session &session,
+                    vector<int> &pathI,
+                    vector<int> &pathJ) const
+    {
+        SparseMat &band = session.band;
+        if (band.nnz() == 0) {
+            return INFINITY;
+        }
+        const vector<size_t> &pointers = band.getPointers();
+        const vector<uint32_t> &indices = band.getIndices();
+        float *dist = band.getValues().data;
+        
+        // the path runs corner to corner, so the band must hold both
+        if (indices[0] != 0 || indices[band.nnz() - 1] != band.cols - 1) {
+            printf("[ERROR: pkmDTW::dtwBanded()] The band must hold (0, 0) and (%lu, %lu).\n", band.rows - 1, band.cols - 1);
+            return INFINITY;
+        }
+        session.bandTraceBack.resize(band.nnz());
+        unsigned char *tb = &session.bandTraceBack[0];
+        
+        // the previous row's run of columns [previousFirst, previousLast]
+        size_t previousBegin = 0, previousFirst = 0, previousLast = 0;
+        for (size_t i = 0; i < band.rows; i++)
+        {
+            size_t begin = pointers[i], end = pointers[i+1];
+            float minCost = INFINITY;
+            for (size_t p = begin; p < end; p++)
+            {
+                size_t j = indices[p];
+                if (i == 0 && j == 0) {
+                    minCost = dist[p];
+                    continue;
+                }
+                
+                // get distance for all branches
+                float x, y, z;
+                if (p == begin)                                         x = INFINITY;                       // horizontal
+                else                                                    x = dist[p-1];
+                if (i == 0 || j < previousFirst || j > previousLast)    y = INFINITY;                       // vertical
+                else                                                    y = dist[previousBegin + j - previousFirst];
+                if (i == 0 || j <= previousFirst || j > previousLast+1) z = INFINITY;                       // diagonal
+                else                                                    z = dist[previousBegin + j - 1 - previousFirst];
+                
+                // find minimum branch and store path
+                float val;
+                if (x < y) {        // horizontal
+                    val = x;
+                    tb[p] = 0;
+                }
+                else {              // vertical
+                    val = y;
+                    tb[p] = 1;
+                }
+                if (z < val) {      // diagonal
+                    val = z;
+                    tb[p] = 2;
+                }
+                
+                // aggregate distance
+                dist[p] += val;
+                
+                if (dist[p] < minCost) {
+                    minCost = dist[p];
+                }
+            }
+            
+            // abandon early
+            if (minCost > session.bestSoFar) {
+                return INFINITY;
+            }
+            previousBegin = begin;
+            previousFirst = indices[begin];
+            previousLast = indices[end-1];
+        }
+        
+        // no path reached the corner (the distances were not finite), so
+        // there is nothing to trace back
+        float distance = dist[band.nnz() - 1];
+        if (!(distance < INFINITY)) {
+            return INFINITY;
+        }
+        
+        // calculate path
+        size_t i = band.rows - 1, j = band.cols - 1;
+        while (true)
+        {
+            pathI.push_back(i);
+            pathJ.push_back(j);
+            if (i == 0 && j == 0) {
+                break;
+            }
+            unsigned char t = tb[pointers[i] + j - indices[pointers[i]]];
+            if (t == 0) {                   // horizontal
+                j--;
+            }
+            else if (t == 1) {              // vertical
+                i--;
+            }
+            else {                          // diagonal
+                i--;
+                j--;
+            }
+        }
+        return distance;
+    }
+    // -------------------------------------------------------------------------
 
     // -------------------------------------------------------------------------
     // Calculates the Sakoe-Chiba Band for a multidimensional input T x D
@@ -425,9 +732,9 @@ protected:
     // -------------------------------------------------------------------------
     void calculateBounds(Mat &input, 
                          Mat &upperBound, 
-                         Mat &lowerBound);
+                         Mat &lowerBound) const;
     
-    float cosineDistance(float *x, float *y, unsigned int count) {
+    float cosineDistance(float *x, float *y, unsigned int count) const {
         float dotProd, magX, magY;
         float *tmp = (float*)malloc(count * sizeof(float));
         
@@ -446,7 +753,7 @@ protected:
         return 1.0 - (dotProd / (magX * magY));
     }
     
-    float L1Norm(float *buf1, float *buf2, int size)
+    float L1Norm(float *buf1, float *buf2, int size) const
     {
         int a = size;
         float diff = 0;
@@ -463,20 +770,17 @@ protected:
     
 private:
     // -------------------------------------------------------------------------
-    float           bestSoFar;
     float           range;
-    Mat             query, queryTransposed, queryNormalization;
     
     Mat             candidates;
     Mat             candidates_lut; // idx = segment; 0 = row in candidates, 1 = num rows for segment
     Mat             meanValues, stdValues;
     int             numCandidates;
     
-    Mat             queryLB;
-    Mat             queryUB;
+    Session         defaultSession; // for the single caller api
     // -------------------------------------------------------------------------
     
     // -------------------------------------------------------------------------
-    bool            bUseZNormalize, bSetQuery, bHaveCandidates, bUseCosineDistance;
+    bool            bUseZNormalize, bHaveCandidates, bUseCosineDistance;
     // -------------------------------------------------------------------------
 };
\ No newline at end of file
@@ -0,0 +1,755 @@
+/*
+ *  pkmFFT.cpp
+ *
+
+ Stockham FFT passes, real-input packing, and the STFT.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmFFT.h"
+#include "pkmThreadPool.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// butterflies per task when frames are split across threads
+#define PKM_FFT_CHUNK 65536
+
+using namespace pkm;
+
+namespace
+{
+#if defined(__AVX512F__)
+    struct Simd
+    {
+        typedef __m512 V;
+        enum { W = 16 };
+        static V load(const float *p)                   { return _mm512_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm512_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm512_set1_ps(f); }
+        static V add(V a, V b)                          { return _mm512_add_ps(a, b); }
+        static V sub(V a, V b)                          { return _mm512_sub_ps(a, b); }
+        static V mul(V a, V b)                          { return _mm512_mul_ps(a, b); }
+        static V fma(V a, V b, V c)                     { return _mm512_fmadd_ps(a, b, c); }
+        static V fms(V a, V b, V c)                     { return _mm512_fmsub_ps(a, b, c); }
+    };
+#elif defined(__AVX2__) && defined(__FMA__)
+    struct Simd
+    {
+        typedef __m256 V;
+        enum { W = 8 };
+        static V load(const float *p)                   { return _mm256_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm256_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm256_set1_ps(f); }
+        static V add(V a, V b)                          { return _mm256_add_ps(a, b); }
+        static V sub(V a, V b)                          { return _mm256_sub_ps(a, b); }
+        static V mul(V a, V b)                          { return _mm256_mul_ps(a, b); }
+        static V fma(V a, V b, V c)                     { return _mm256_fmadd_ps(a, b, c); }
+        static V fms(V a, V b, V c)                     { return _mm256_fmsub_ps(a, b, c); }
+    };
+#elif defined(__SSE2__)
+    struct Simd
+    {
+        typedef __m128 V;
+        enum { W = 4 };
+        static V load(const float *p)                   { return _mm_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm_set1_ps(f); }
+        static V add(V a, V b)                          { return _mm_add_ps(a, b); }
+        static V sub(V a, V b)                          { return _mm_sub_ps(a, b); }
+        static V mul(V a, V b)                          { return _mm_mul_ps(a, b); }
+        static V fma(V a, V b, V c)                     { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+        static V fms(V a, V b, V c)                     { return _mm_sub_ps(_mm_mul_ps(a, b), c); }
+    };
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    struct Simd
+    {
+        typedef float32x4_t V;
+        enum { W = 4 };
+        static V load(const float *p)                   { return vld1q_f32(p); }
+        static void store(float *p, V a)                { vst1q_f32(p, a); }
+        static V set(float f)                           { return vdupq_n_f32(f); }
+        static V add(V a, V b)                          { return vaddq_f32(a, b); }
+        static V sub(V a, V b)                          { return vsubq_f32(a, b); }
+        static V mul(V a, V b)                          { return vmulq_f32(a, b); }
+        static V fma(V a, V b, V c)                     { return vfmaq_f32(c, a, b); }
+        static V fms(V a, V b, V c)                     { return vnegq_f32(vfmsq_f32(c, a, b)); }
+    };
+#else
+    struct Simd
+    {
+        typedef float V;
+        enum { W = 1 };
+        static V load(const float *p)                   { return *p; }
+        static void store(float *p, V a)                { *p = a; }
+        static V set(float f)                           { return f; }
+        static V add(V a, V b)                          { return a + b; }
+        static V sub(V a, V b)                          { return a - b; }
+        static V mul(V a, V b)                          { return a * b; }
+        static V fma(V a, V b, V c)                     { return a * b + c; }
+        static V fms(V a, V b, V c)                     { return a * b - c; }
+    };
+#endif
+
+    // for passes whose stride is narrower than a vector
+    struct Scalar
+    {
+        typedef float V;
+        enum { W = 1 };
+        static V load(const float *p)                   { return *p; }
+        static void store(float *p, V a)                { *p = a; }
+        static V set(float f)                           { return f; }
+        static V add(V a, V b)                          { return a + b; }
+        static V sub(V a, V b)                          { return a - b; }
+        static V mul(V a, V b)                          { return a * b; }
+        static V fma(V a, V b, V c)                     { return a * b + c; }
+        static V fms(V a, V b, V c)                     { return a * b - c; }
+    };
+
+    // forward DFT of 4 points in place: b -> -i b where needed, no multiplies
+    template<class S>
+    inline void dft4(typename S::V *re, typename S::V *im, size_t a, size_t b, size_t c, size_t d)
+    {
+        typedef typename S::V V;
+        V apcRe = S::add(re[a], re[c]), apcIm = S::add(im[a], im[c]);
+        V amcRe = S::sub(re[a], re[c]), amcIm = S::sub(im[a], im[c]);
+        V bpdRe = S::add(re[b], re[d]), bpdIm = S::add(im[b], im[d]);
+        V bmdRe = S::sub(re[b], re[d]), bmdIm = S::sub(im[b], im[d]);
+        re[a] = S::add(apcRe, bpdRe);   im[a] = S::add(apcIm, bpdIm);
+        re[c] = S::sub(apcRe, bpdRe);   im[c] = S::sub(apcIm, bpdIm);
+        // amc -/+ i bmd
+        re[b] = S::add(amcRe, bmdIm);   im[b] = S::sub(amcIm, bmdRe);
+        re[d] = S::sub(amcRe, bmdIm);   im[d] = S::add(amcIm, bmdRe);
+    }
+
+    // forward DFT of R points in place, outputs in natural order
+    template<class S, size_t R>
+    struct Butterfly;
+
+    template<class S>
+    struct Butterfly<S, 2>
+    {
+        static void apply(typename S::V *re, typename S::V *im)
+        {
+            typename S::V r = re[0], i = im[0];
+            re[0] = S::add(r, re[1]);   im[0] = S::add(i, im[1]);
+            re[1] = S::sub(r, re[1]);   im[1] = S::sub(i, im[1]);
+        }
+    };
+
+    template<class S>
+    struct Butterfly<S, 4>
+    {
+        static void apply(typename S::V *re, typename S::V *im)
+        {
+            dft4<S>(re, im, 0, 1, 2, 3);
+        }
+    };
+
+    // two 4-point DFTs of the even and odd points, the odd ones turned by
+    // w8^r, then one radix-2 step
+    template<class S>
+    struct Butterfly<S, 8>
+    {
+        static void apply(typename S::V *re, typename S::V *im)
+        {
+            typedef typename S::V V;
+            dft4<S>(re, im, 0, 2, 4, 6);
+            dft4<S>(re, im, 1, 3, 5, 7);
+
+            V h = S::set(0.70710678118654752f);
+            // w8 (x + iy) = h (x + y) + i h (y - x)
+            V r3 = re[3], i3 = im[3];
+            re[3] = S::mul(h, S::add(r3, i3));
+            im[3] = S::mul(h, S::sub(i3, r3));
+            // w8^2 (x + iy) = y - ix
+            V r5 = re[5];
+            re[5] = im[5];
+            im[5] = S::sub(S::set(0.0f), r5);
+            // w8^3 (x + iy) = h (y - x) - i h (x + y)
+            V r7 = re[7], i7 = im[7];
+            re[7] = S::mul(h, S::sub(i7, r7));
+            im[7] = S::sub(S::set(0.0f), S::mul(h, S::add(r7, i7)));
+
+            // E_r is at 2r and O_r at 2r + 1
+            V outRe[8], outIm[8];
+            for (size_t r = 0; r < 4; r++) {
+                outRe[r] = S::add(re[2*r], re[2*r + 1]);
+                outIm[r] = S::add(im[2*r], im[2*r + 1]);
+                outRe[r + 4] = S::sub(re[2*r], re[2*r + 1]);
+                outIm[r + 4] = S::sub(im[2*r], im[2*r + 1]);
+            }
+            for (size_t r = 0; r < 8; r++) {
+                re[r] = outRe[r];
+                im[r] = outIm[r];
+            }
+        }
+    };
+
+    // one Stockham pass: for every p < m and q < stride,
+    //     y[q + stride (R p + r)] = w^(r p) DFT_R(x[q + stride (p + t m)], t < R)[r]
+    template<class S, size_t R>
+    void pass(size_t stride, size_t m, const float *twRe, const float *twIm,
+              const float *xr, const float *xi, float *yr, float *yi)
+    {
+        typedef typename S::V V;
+        for (size_t p = 0; p < m; p++) {
+            V wRe[R], wIm[R];
+            for (size_t r = 1; r < R; r++) {
+                wRe[r] = S::set(twRe[(r - 1)*m + p]);
+                wIm[r] = S::set(twIm[(r - 1)*m + p]);
+            }
+            const float *inRe = xr + stride*p, *inIm = xi + stride*p;
+            float *outRe = yr + stride*R*p, *outIm = yi + stride*R*p;
+            for (size_t q = 0; q < stride; q += S::W) {
+                V re[R], im[R];
+                for (size_t t = 0; t < R; t++) {
+                    re[t] = S::load(inRe + q + stride*t*m);
+                    im[t] = S::load(inIm + q + stride*t*m);
+                }
+                Butterfly<S, R>::apply(re, im);
+                S::store(outRe + q, re[0]);
+                S::store(outIm + q, im[0]);
+                for (size_t r = 1; r < R; r++) {
+                    S::store(outRe + q + stride*r, S::fms(re[r], wRe[r], S::mul(im[r], wIm[r])));
+                    S::store(outIm + q + stride*r, S::fma(re[r], wIm[r], S::mul(im[r], wRe[r])));
+                }
+            }
+        }
+    }
+
+    // a pass whose stride is narrower than a vector: each vector holds
+    // W / stride consecutive p of stride q each, so the loads are still
+    // contiguous, the twiddles come repeated stride times, and the outputs
+    // are scattered stride floats at a time
+    template<size_t R, size_t stride>
+    void narrowPass(size_t m, const float *twRe, const float *twIm,
+                    const float *xr, const float *xi, float *yr, float *yi)
+    {
+        typedef Simd::V V;
+        size_t span = stride * m;
+        float outRe[R][Simd::W], outIm[R][Simd::W];
+        for (size_t i = 0; i < span; i += Simd::W) {
+            V re[R], im[R];
+            for (size_t t = 0; t < R; t++) {
+                re[t] = Simd::load(xr + i + t*span);
+                im[t] = Simd::load(xi + i + t*span);
+            }
+            Butterfly<Simd, R>::apply(re, im);
+            Simd::store(outRe[0], re[0]);
+            Simd::store(outIm[0], im[0]);
+            for (size_t r = 1; r < R; r++) {
+                V wRe = Simd::load(twRe + (r - 1)*span + i), wIm = Simd::load(twIm + (r - 1)*span + i);
+                Simd::store(outRe[r], Simd::fms(re[r], wRe, Simd::mul(im[r], wIm)));
+                Simd::store(outIm[r], Simd::fma(re[r], wIm, Simd::mul(im[r], wRe)));
+            }
+
+            // lane j is p = (i + j) / stride, q = (i + j) % stride
+#pragma GCC unroll 16
+            for (size_t j = 0; j < (size_t)Simd::W; j += stride) {
+                size_t p = (i + j) / stride;
+                float *toRe = yr + stride*R*p, *toIm = yi + stride*R*p;
+#pragma GCC unroll 8
+                for (size_t r = 0; r < R; r++) {
+#pragma GCC unroll 8
+                    for (size_t q = 0; q < stride; q++) {
+                        toRe[stride*r + q] = outRe[r][j + q];
+                        toIm[stride*r + q] = outIm[r][j + q];
+                    }
+                }
+            }
+        }
+    }
+
+    // whether a pass runs as narrowPass(), which wants whole vectors of p
+    bool isNarrow(size_t stride, size_t m)
+    {
+        return stride < (size_t)Simd::W && (stride * m) % Simd::W == 0;
+    }
+
+    // narrowPass<R, stride> for a power of 2 stride below the vector width,
+    // found by recursion so that strides a vector can't hold (8 on SSE2 or
+    // NEON, any on scalar builds) are never instantiated
+    template<size_t R, size_t S, bool bNarrower = (S < (size_t)Simd::W)>
+    struct NarrowPass
+    {
+        static void run(size_t stride, size_t m, const float *twRe, const float *twIm,
+                        const float *xr, const float *xi, float *yr, float *yi)
+        {
+            if (stride == S) {
+                narrowPass<R, S>(m, twRe, twIm, xr, xi, yr, yi);
+            }
+            else {
+                NarrowPass<R, 2 * S>::run(stride, m, twRe, twIm, xr, xi, yr, yi);
+            }
+        }
+    };
+
+    template<size_t R, size_t S>
+    struct NarrowPass<R, S, false>
+    {
+        static void run(size_t, size_t, const float *, const float *,
+                        const float *, const float *, float *, float *)
+        {
+        }
+    };
+
+    template<size_t R>
+    void pass(size_t stride, size_t m, const float *twRe, const float *twIm,
+              const float *xr, const float *xi, float *yr, float *yi)
+    {
+        if (stride % Simd::W == 0) {
+            pass<Simd, R>(stride, m, twRe, twIm, xr, xi, yr, yi);
+        }
+        else if (isNarrow(stride, m)) {
+            NarrowPass<R, 1>::run(stride, m, twRe, twIm, xr, xi, yr, yi);
+        }
+        else {
+            pass<Scalar, R>(stride, m, twRe, twIm, xr, xi, yr, yi);
+        }
+    }
+
+    // per thread, for the passes that do not work in place
+    float * scratch(size_t n)
+    {
+        static thread_local std::vector<float> buffer;
+        if (buffer.size() < n) {
+            buffer.resize(n);
+        }
+        return &buffer[0];
+    }
+
+    size_t perTask(size_t work)
+    {
+        return std::max((size_t)1, PKM_FFT_CHUNK / std::max(work, (size_t)1));
+    }
+}
+
+FFT::FFT(size_t n)
+: n(n), half(NULL)
+{
+    if (n == 0 || (n & (n - 1)) != 0) {
+        printf("[ERROR: pkm::FFT::FFT()] %lu is not a power of 2.\n", n);
+        this->n = 0;
+        return;
+    }
+
+    size_t log2n = 0;
+    while (((size_t)1 << log2n) < n) {
+        log2n++;
+    }
+
+    // the odd radix-2 or radix-4 pass first, where the stride is 1
+    std::vector<size_t> radices;
+    if (log2n % 3 == 1) {
+        radices.push_back(2);
+    }
+    else if (log2n % 3 == 2) {
+        radices.push_back(4);
+    }
+    for (size_t i = 0; i < log2n / 3; i++) {
+        radices.push_back(8);
+    }
+
+    size_t stride = 1;
+    for (size_t i = 0; i < radices.size(); i++) {
+        Pass pass;
+        pass.radix = radices[i];
+        pass.stride = stride;
+        size_t length = n / stride;
+        pass.m = length / pass.radix;
+        size_t repeat = isNarrow(stride, pass.m) ? stride : 1;
+        pass.re.resize((pass.radix - 1) * pass.m * repeat);
+        pass.im.resize((pass.radix - 1) * pass.m * repeat);
+        for (size_t r = 1; r < pass.radix; r++) {
+            for (size_t p = 0; p < pass.m; p++) {
+                double angle = -2.0 * M_PI * (double)(r * p) / (double)length;
+                for (size_t q = 0; q < repeat; q++) {
+                    pass.re[((r - 1)*pass.m + p)*repeat + q] = (float)cos(angle);
+                    pass.im[((r - 1)*pass.m + p)*repeat + q] = (float)sin(angle);
+                }
+            }
+        }
+        passes.push_back(pass);
+        stride *= pass.radix;
+    }
+
+    if (n >= 2) {
+        half = &get(n / 2);
+        realRe.resize(n / 2);
+        realIm.resize(n / 2);
+        for (size_t k = 0; k < n / 2; k++) {
+            double angle = -2.0 * M_PI * (double)k / (double)n;
+            realRe[k] = (float)cos(angle);
+            realIm[k] = (float)sin(angle);
+        }
+    }
+}
+
+const FFT & FFT::get(size_t n)
+{
+    // plans are never freed, so references to them stay valid
+    static std::mutex mutex;
+    static std::map<size_t, std::unique_ptr<FFT> > plans;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<size_t, std::unique_ptr<FFT> >::iterator it = plans.find(n);
+        if (it != plans.end()) {
+            return *it->second;
+        }
+    }
+
+    // built outside the lock, since a plan gets its half size plan
+    std::unique_ptr<FFT> plan(new FFT(n));
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<FFT> &cached = plans[n];
+    if (!cached) {
+        cached = std::move(plan);
+    }
+    return *cached;
+}
+
+void FFT::transform(float *re, float *im) const
+{
+    if (passes.empty()) {
+        return;
+    }
+
+    // ping-pong between the arrays and scratch, copying back at the end.
+    // inverseReal() keeps its own data past the first 2 n floats.
+    float *work = scratch(2 * n);
+    float *xr = re, *xi = im, *yr = work, *yi = work + n;
+    for (size_t i = 0; i < passes.size(); i++) {
+        const Pass &p = passes[i];
+        switch (p.radix) {
+            case 2:
+                pass<2>(p.stride, p.m, &p.re[0], &p.im[0], xr, xi, yr, yi);
+                break;
+            case 4:
+                pass<4>(p.stride, p.m, &p.re[0], &p.im[0], xr, xi, yr, yi);
+                break;
+            default:
+                pass<8>(p.stride, p.m, &p.re[0], &p.im[0], xr, xi, yr, yi);
+                break;
+        }
+        std::swap(xr, yr);
+        std::swap(xi, yi);
+    }
+    if (xr != re) {
+        memcpy(re, xr, n * sizeof(float));
+        memcpy(im, xi, n * sizeof(float));
+    }
+}
+
+void FFT::forward(float *re, float *im) const
+{
+    transform(re, im);
+}
+
+void FFT::inverse(float *re, float *im) const
+{
+    // the inverse DFT is the forward one with real and imaginary swapped
+    transform(im, re);
+}
+
+void FFT::forwardReal(const float *x, float *re, float *im) const
+{
+    if (n == 0) {
+        return;
+    }
+    if (n == 1) {
+        re[0] = x[0];
+        im[0] = 0.0f;
+        return;
+    }
+
+    // z[j] = x[2j] + i x[2j + 1], transformed in the first n / 2 bins
+    size_t h = n / 2;
+    for (size_t j = 0; j < h; j++) {
+        re[j] = x[2*j];
+        im[j] = x[2*j + 1];
+    }
+    half->forward(re, im);
+
+    // X[k] = E[k] + w^k O[k], where E = (Z[k] + Z*[h - k]) / 2 is the DFT
+    // of the even samples and O = (Z[k] - Z*[h - k]) / 2i of the odd ones;
+    // bins k and h - k come from the same pair of Z
+    float z0Re = re[0], z0Im = im[0];
+    re[0] = z0Re + z0Im;
+    im[0] = 0.0f;
+    re[h] = z0Re - z0Im;
+    im[h] = 0.0f;
+    for (size_t k = 1; k <= h / 2; k++) {
+        size_t l = h - k;
+        float aRe = re[k], aIm = im[k], bRe = re[l], bIm = im[l];
+
+        float eRe = 0.5f * (aRe + bRe), eIm = 0.5f * (aIm - bIm);
+        float oRe = 0.5f * (aIm + bIm), oIm = 0.5f * (bRe - aRe);
+        re[k] = eRe + realRe[k] * oRe - realIm[k] * oIm;
+        im[k] = eIm + realRe[k] * oIm + realIm[k] * oRe;
+
+        // bin l has E and O the conjugates of k's, and w^l = -conj(w^k),
+        // so X[l] = conj(E - w^k O)
+        re[l] = eRe - realRe[k] * oRe + realIm[k] * oIm;
+        im[l] = -eIm + realRe[k] * oIm + realIm[k] * oRe;
+    }
+}
+
+void FFT::inverseReal(const float *re, const float *im, float *x) const
+{
+    if (n == 0) {
+        return;
+    }
+    if (n == 1) {
+        x[0] = re[0];
+        return;
+    }
+
+    // rebuild Z[k] = E[k] + i O[k] at twice its size, so that the n / 2
+    // point inverse gives n x
+    size_t h = n / 2;
+    float *zRe = scratch(4 * n) + 2 * n, *zIm = zRe + h;
+    zRe[0] = re[0] + re[h];
+    zIm[0] = re[0] - re[h];
+    for (size_t k = 1; k <= h / 2; k++) {
+        size_t l = h - k;
+        float aRe = re[k], aIm = im[k], bRe = re[l], bIm = im[l];
+
+        // E = X[k] + X*[l], O = (X[k] - X*[l]) conj(w^k)
+        float eRe = aRe + bRe, eIm = aIm - bIm;
+        float dRe = aRe - bRe, dIm = aIm + bIm;
+        float oRe = dRe * realRe[k] + dIm * realIm[k];
+        float oIm = dIm * realRe[k] - dRe * realIm[k];
+        zRe[k] = eRe - oIm;
+        zIm[k] = eIm + oRe;
+
+        // for l, E and O are the conjugates of k's
+        zRe[l] = eRe + oIm;
+        zIm[l] = -eIm + oRe;
+    }
+    half->inverse(zRe, zIm);
+    for (size_t j = 0; j < h; j++) {
+        x[2*j] = zRe[j];
+        x[2*j + 1] = zIm[j];
+    }
+}
+
+STFT::STFT(size_t fftSize, size_t hopSize, Window windowType)
+: plan(FFT::get(fftSize)), fftSize(fftSize), hopSize(std::max(hopSize, (size_t)1)), window(1, fftSize)
+{
+    for (size_t i = 0; i < fftSize; i++) {
+        double phase = 2.0 * M_PI * (double)i / (double)fftSize;
+        switch (windowType) {
+            case RECTANGULAR:
+                window.data[i] = 1.0f;
+                break;
+            case HANN:
+                window.data[i] = (float)(0.5 - 0.5 * cos(phase));
+                break;
+            case HAMMING:
+                window.data[i] = (float)(0.54 - 0.46 * cos(phase));
+                break;
+            case BLACKMAN:
+                window.data[i] = (float)(0.42 - 0.5 * cos(phase) + 0.08 * cos(2.0 * phase));
+                break;
+        }
+    }
+
+    // sample i of a hop, once frames overlap fully, is covered by the
+    // window at i, i + hop, i + 2 hop, ...
+    overlap.assign(this->hopSize, 0.0f);
+    for (size_t i = 0; i < fftSize; i++) {
+        overlap[i % this->hopSize] += window.data[i] * window.data[i];
+    }
+
+    input.resize(fftSize);
+    output.resize(fftSize);
+    frame.resize(fftSize);
+    re.resize(getNumBins());
+    im.resize(getNumBins());
+    resetStream();
+}
+
+size_t STFT::getNumFrames(size_t samples) const
+{
+    return samples < fftSize ? 0 : 1 + (samples - fftSize) / hopSize;
+}
+
+size_t STFT::getNumSamples(size_t frames) const
+{
+    return frames == 0 ? 0 : (frames - 1) * hopSize + fftSize;
+}
+
+void STFT::forward(const float *x, size_t samples, Mat &real, Mat &imag) const
+{
+    size_t frames = getNumFrames(samples), bins = getNumBins();
+    if (real.rows != frames || real.cols != bins) {
+        real.reset(frames, bins);
+    }
+    if (imag.rows != frames || imag.cols != bins) {
+        imag.reset(frames, bins);
+    }
+
+    pkm::parallelFor(frames, perTask(fftSize * 4), [&](size_t begin, size_t end) {
+        std::vector<float> windowed(fftSize);
+        for (size_t t = begin; t < end; t++) {
+            const float *f = x + t * hopSize;
+            for (size_t i = 0; i < fftSize; i++) {
+                windowed[i] = f[i] * window.data[i];
+            }
+            plan.forwardReal(&windowed[0], real.row(t), imag.row(t));
+        }
+    });
+}
+
+void STFT::magnitudes(const float *x, size_t samples, Mat &magnitudes, bool bPower) const
+{
+    size_t frames = getNumFrames(samples), bins = getNumBins();
+    if (magnitudes.rows != frames || magnitudes.cols != bins) {
+        magnitudes.reset(frames, bins);
+    }
+
+    pkm::parallelFor(frames, perTask(fftSize * 4), [&](size_t begin, size_t end) {
+        std::vector<float> windowed(fftSize), re(bins), im(bins);
+        for (size_t t = begin; t < end; t++) {
+            const float *f = x + t * hopSize;
+            for (size_t i = 0; i < fftSize; i++) {
+                windowed[i] = f[i] * window.data[i];
+            }
+            plan.forwardReal(&windowed[0], &re[0], &im[0]);
+            float *m = magnitudes.row(t);
+            for (size_t k = 0; k < bins; k++) {
+                float power = re[k] * re[k] + im[k] * im[k];
+                m[k] = bPower ? power : sqrtf(power);
+            }
+        }
+    });
+}
+
+void STFT::inverse(const Mat &real, const Mat &imag, float *y) const
+{
+    size_t frames = real.rows, bins = getNumBins();
+    if (real.cols != bins || imag.cols != bins || imag.rows != frames) {
+        printf("[ERROR: pkm::STFT::inverse()] Expected two %lu x %lu Mats, got %lu x %lu and %lu x %lu.\n",
+               frames, bins, real.rows, real.cols, imag.rows, imag.cols);
+        return;
+    }
+    size_t samples = getNumSamples(frames);
+    std::vector<float> norm(samples, 0.0f);
+    std::fill(y, y + samples, 0.0f);
+
+    // frames that many hops apart do not overlap, so each of these rounds
+    // can add its frames from every thread at once
+    size_t rounds = (fftSize + hopSize - 1) / hopSize;
+    float scale = 1.0f / fftSize;
+    for (size_t round = 0; round < rounds; round++) {
+        size_t count = frames > round ? (frames - round + rounds - 1) / rounds : 0;
+        pkm::parallelFor(count, perTask(fftSize * 4), [&](size_t begin, size_t end) {
+            std::vector<float> f(fftSize);
+            for (size_t i = begin; i < end; i++) {
+                size_t t = round + i * rounds;
+                plan.inverseReal(real.data + t * bins, imag.data + t * bins, &f[0]);
+                float *out = y + t * hopSize;
+                float *weight = &norm[t * hopSize];
+                for (size_t j = 0; j < fftSize; j++) {
+                    out[j] += scale * f[j] * window.data[j];
+                    weight[j] += window.data[j] * window.data[j];
+                }
+            }
+        });
+    }
+
+    for (size_t i = 0; i < samples; i++) {
+        if (norm[i] > 1e-8f) {
+            y[i] /= norm[i];
+        }
+    }
+}
+
+bool STFT::analyze(const float *hop, float *real, float *imag)
+{
+    memmove(&input[0], &input[hopSize], (fftSize - std::min(hopSize, fftSize)) * sizeof(float));
+    if (hopSize >= fftSize) {
+        memcpy(&input[0], hop + hopSize - fftSize, fftSize * sizeof(float));
+    }
+    else {
+        memcpy(&input[fftSize - hopSize], hop, hopSize * sizeof(float));
+    }
+    numInput = std::min(numInput + hopSize, fftSize);
+    if (numInput < fftSize) {
+        return false;
+    }
+
+    for (size_t i = 0; i < fftSize; i++) {
+        frame[i] = input[i] * window.data[i];
+    }
+    plan.forwardReal(&frame[0], real, imag);
+    return true;
+}
+
+bool STFT::analyze(const float *hop, Mat &spectrogram)
+{
+    if (spectrogram.cols != getNumBins()) {
+        printf("[ERROR: pkm::STFT::analyze()] Expected %lu columns, got %lu.\n", getNumBins(), spectrogram.cols);
+        return false;
+    }
+    if (!analyze(hop, &re[0], &im[0])) {
+        return false;
+    }
+    for (size_t k = 0; k < re.size(); k++) {
+        re[k] = sqrtf(re[k] * re[k] + im[k] * im[k]);
+    }
+    spectrogram.insertRowCircularly(re);
+    return true;
+}
+
+void STFT::synthesize(const float *real, const float *imag, float *hop)
+{
+    plan.inverseReal(real, imag, &frame[0]);
+    float scale = 1.0f / fftSize;
+    for (size_t i = 0; i < fftSize; i++) {
+        output[i] += scale * frame[i] * window.data[i];
+    }
+
+    size_t done = std::min(hopSize, fftSize);
+    for (size_t i = 0; i < done; i++) {
+        hop[i] = overlap[i] > 1e-8f ? output[i] / overlap[i] : output[i];
+    }
+    std::fill(hop + done, hop + hopSize, 0.0f);
+    memmove(&output[0], &output[done], (fftSize - done) * sizeof(float));
+    std::fill(output.begin() + (fftSize - done), output.end(), 0.0f);
+}
+
+void STFT::resetStream()
+{
+    std::fill(input.begin(), input.end(), 0.0f);
+    std::fill(output.begin(), output.end(), 0.0f);
+    numInput = 0;
+}
@@ -0,0 +1,153 @@
+/*
+ *  pkmFFT.h
+ *
+
+ power of two FFTs of our own, and a short-time Fourier transform that
+ writes spectrogram frames straight into the rows of a Mat for DTW, GMMs
+ and the rest of the library.
+
+ FFT is a self-sorting (Stockham) transform on split real and imaginary
+ arrays: radix-8 passes, plus one radix-2 or radix-4 pass when log2 n is
+ not a multiple of 3, with the twiddles of every pass precomputed in
+ double precision.  passes run on AVX-512F, AVX2 + FMA, SSE2 or aarch64
+ NEON vectors, whichever the compiler targets: across the stride once it
+ is a vector wide, and across consecutive butterflies before that.  get()
+ caches one plan per size, shared by every thread.  real transforms of n
+ points are an n / 2 point complex transform plus a split into n / 2 + 1
+ bins.  transforms are unscaled: inverse(forward(x)) is n x.
+
+ STFT frames a signal every hopSize samples (no padding: the first frame
+ starts at sample 0 and the last ends at or before the end), windows each
+ frame and transforms it, with frames split across the shared
+ pkm::ThreadPool.  inverse() undoes it by weighted overlap-add, dividing
+ by the summed squared windows.  analyze() and synthesize() do the same a
+ hop at a time for live input.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include "pkmMatrix.h"
+#include <vector>
+
+namespace pkm
+{
+    class FFT
+    {
+    public:
+        // n must be a power of 2
+        explicit FFT(size_t n);
+
+        // the shared plan for n points, built on first use
+        static const FFT & get(size_t n);
+
+        size_t size() const                     { return n; }
+
+        // n complex points in place
+        void forward(float *re, float *im) const;
+        void inverse(float *re, float *im) const;
+
+        // n real samples to bins 0 .. n / 2, so re and im hold n / 2 + 1
+        // (the imaginary parts of bins 0 and n / 2 are 0).  x must not be
+        // re or im.
+        void forwardReal(const float *x, float *re, float *im) const;
+
+        // bins 0 .. n / 2 back to n real samples, ignoring the imaginary
+        // parts of bins 0 and n / 2
+        void inverseReal(const float *re, const float *im, float *x) const;
+
+    private:
+        // a radix pass over transforms of n / stride points, with
+        // twiddles w^(r p) for r = 1 .. radix - 1 (rows) and p < m, each
+        // repeated stride times when the stride is narrower than a vector
+        struct Pass
+        {
+            size_t              radix, stride, m;
+            std::vector<float>  re, im;
+        };
+
+        void transform(float *re, float *im) const;
+
+        size_t              n;
+        std::vector<Pass>   passes;
+        const FFT           *half;              // n / 2 points, for real transforms
+        std::vector<float>  realRe, realIm;     // e^(-2 pi i k / n), k < n / 2
+    };
+
+    class STFT
+    {
+    public:
+        enum Window
+        {
+            RECTANGULAR,
+            HANN,
+            HAMMING,
+            BLACKMAN
+        };
+
+        // fftSize a power of 2, and the frame length.  windows are periodic.
+        STFT(size_t fftSize, size_t hopSize, Window window = HANN);
+
+        size_t getFFTSize() const               { return fftSize; }
+        size_t getHopSize() const               { return hopSize; }
+        size_t getNumBins() const               { return fftSize / 2 + 1; }
+        const Mat & getWindow() const           { return window; }
+
+        // frames in, and samples back out of, a signal
+        size_t getNumFrames(size_t samples) const;
+        size_t getNumSamples(size_t frames) const;
+
+        // frames x bins real and imaginary parts.  Mats that already have
+        // that shape (including ones over user data) are written in place.
+        void forward(const float *x, size_t samples, Mat &real, Mat &imag) const;
+
+        // frames x bins |X|, or |X|^2
+        void magnitudes(const float *x, size_t samples, Mat &magnitudes, bool bPower = false) const;
+
+        // getNumSamples(real.rows) samples into y.  samples where the
+        // summed squared windows vanish (the first of a Hann window) are
+        // left as the overlap-add gives them.
+        void inverse(const Mat &real, const Mat &imag, float *y) const;
+
+        // streaming analysis: push hopSize samples, and once fftSize samples
+        // have arrived write the newest frame's bins and return true
+        bool analyze(const float *hop, float *real, float *imag);
+
+        // the same, inserting |X| of the frame into a spectrogram with
+        // getNumBins() columns by insertRowCircularly()
+        bool analyze(const float *hop, Mat &spectrogram);
+
+        // streaming synthesis: overlap-add one frame's bins and write the
+        // hopSize samples that are complete, fftSize - hopSize behind
+        void synthesize(const float *real, const float *imag, float *hop);
+
+        // forget what analyze() and synthesize() have seen
+        void resetStream();
+
+    private:
+        const FFT           &plan;
+        size_t              fftSize, hopSize;
+        Mat                 window;             // 1 x fftSize
+
+        std::vector<float>  input;              // the last fftSize samples
+        size_t              numInput;
+        std::vector<float>  output;             // fftSize samples being summed
+        std::vector<float>  overlap;            // summed squared windows, per phase of a hop
+        std::vector<float>  frame, re, im;      // fftSize and bins work buffers
+    };
+}
@@ -0,0 +1,514 @@
+/*
+ *  pkmFixedMat.h
+ *
+
+ small matrices with dimensions fixed at compile time and storage on the
+ stack, for the 2x2 .. 8x8 algebra that doesn't deserve a heap allocation
+ and a LAPACK call: per-pixel gaussians, 2-D/3-D geometry, small
+ covariances.  row-major like pkm::Mat, and converts to and from it.
+
+ every loop runs to a compile time constant, so the compiler unrolls them
+ completely; determinant and inverse have closed forms up to 3x3.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include "pkmMatrix.h"
+#include <cmath>
+
+namespace pkm
+{
+    template<size_t R, size_t C, typename T = float>
+    class FixedMat
+    {
+    public:
+        enum { rows = R, cols = C };
+
+        // uninitialized, like Mat(r, c)
+        FixedMat()
+        {
+        }
+
+        explicit FixedMat(T val)
+        {
+            setTo(val);
+        }
+
+        // R * C values, row-major
+        explicit FixedMat(const T *buf)
+        {
+            for (size_t i = 0; i < R * C; i++) {
+                data[i] = buf[i];
+            }
+        }
+
+        // from a pkm::Mat of the same size (converting to T)
+        explicit FixedMat(const Mat &m)
+        {
+#ifdef DEBUG
+            assert(m.rows == R && m.cols == C);
+#endif
+            for (size_t i = 0; i < R * C; i++) {
+                data[i] = (T)m.data[i];
+            }
+        }
+
+        Mat toMat() const
+        {
+            Mat m(R, C);
+            copyTo(m);
+            return m;
+        }
+
+        void copyTo(Mat &m) const
+        {
+            if (m.rows != R || m.cols != C) {
+                m.reset(R, C);
+            }
+            for (size_t i = 0; i < R * C; i++) {
+                m.data[i] = (float)data[i];
+            }
+        }
+
+        static FixedMat zeros()
+        {
+            return FixedMat(T(0));
+        }
+
+        static FixedMat identity()
+        {
+            FixedMat m(T(0));
+            for (size_t i = 0; i < (R < C ? R : C); i++) {
+                m(i, i) = T(1);
+            }
+            return m;
+        }
+
+        void setTo(T val)
+        {
+            for (size_t i = 0; i < R * C; i++) {
+                data[i] = val;
+            }
+        }
+
+        inline T & operator()(size_t r, size_t c)               { return data[r * C + c]; }
+        inline const T & operator()(size_t r, size_t c) const   { return data[r * C + c]; }
+        inline T & operator[](size_t i)                         { return data[i]; }
+        inline const T & operator[](size_t i) const             { return data[i]; }
+        inline T * row(size_t r)                                { return data + r * C; }
+        inline const T * row(size_t r) const                    { return data + r * C; }
+
+        FixedMat<C, R, T> getTranspose() const
+        {
+            FixedMat<C, R, T> t;
+            for (size_t i = 0; i < R; i++) {
+                for (size_t j = 0; j < C; j++) {
+                    t(j, i) = (*this)(i, j);
+                }
+            }
+            return t;
+        }
+
+        FixedMat & operator+=(const FixedMat &rhs)
+        {
+            for (size_t i = 0; i < R * C; i++) {
+                data[i] += rhs.data[i];
+            }
+            return *this;
+        }
+
+        FixedMat & operator-=(const FixedMat &rhs)
+        {
+            for (size_t i = 0; i < R * C; i++) {
+                data[i] -= rhs.data[i];
+            }
+            return *this;
+        }
+
+        FixedMat & operator*=(T s)
+        {
+            for (size_t i = 0; i < R * C; i++) {
+                data[i] *= s;
+            }
+            return *this;
+        }
+
+        FixedMat operator+(const FixedMat &rhs) const   { FixedMat m(*this); return m += rhs; }
+        FixedMat operator-(const FixedMat &rhs) const   { FixedMat m(*this); return m -= rhs; }
+        FixedMat operator*(T s) const                   { FixedMat m(*this); return m *= s; }
+
+        // matrix product
+        template<size_t K>
+        FixedMat<R, K, T> operator*(const FixedMat<C, K, T> &rhs) const
+        {
+            FixedMat<R, K, T> m(T(0));
+            for (size_t i = 0; i < R; i++) {
+                for (size_t k = 0; k < C; k++) {
+                    T a = (*this)(i, k);
+                    for (size_t j = 0; j < K; j++) {
+                        m(i, j) += a * rhs(k, j);
+                    }
+                }
+            }
+            return m;
+        }
+
+        T trace() const
+        {
+            T t = 0;
+            for (size_t i = 0; i < (R < C ? R : C); i++) {
+                t += (*this)(i, i);
+            }
+            return t;
+        }
+
+        void print() const
+        {
+            printf("r: %lu c: %lu\n", (unsigned long)R, (unsigned long)C);
+            for (size_t i = 0; i < R; i++) {
+                for (size_t j = 0; j < C; j++) {
+                    printf("%8.8f,", (double)(*this)(i, j));
+                }
+                printf("\n");
+            }
+            printf("\n");
+        }
+
+        T data[R * C];
+    };
+
+
+    // -------------------------------------------------------------------------
+    //  square matrix algorithms; closed forms for the smallest sizes, and
+    //  partial pivoting elimination otherwise
+    // -------------------------------------------------------------------------
+    namespace fixed
+    {
+        template<size_t N, typename T>
+        struct Square
+        {
+            static T determinant(const FixedMat<N, N, T> &m)
+            {
+                FixedMat<N, N, T> a(m);
+                T det = 1;
+                for (size_t k = 0; k < N; k++) {
+                    size_t p = k;
+                    for (size_t i = k + 1; i < N; i++) {
+                        if (std::abs(a(i, k)) > std::abs(a(p, k))) {
+                            p = i;
+                        }
+                    }
+                    if (a(p, k) == T(0)) {
+                        return T(0);
+                    }
+                    if (p != k) {
+                        for (size_t j = 0; j < N; j++) {
+                            std::swap(a(k, j), a(p, j));
+                        }
+                        det = -det;
+                    }
+                    det *= a(k, k);
+                    T inv = T(1) / a(k, k);
+                    for (size_t i = k + 1; i < N; i++) {
+                        T f = a(i, k) * inv;
+                        for (size_t j = k + 1; j < N; j++) {
+                            a(i, j) -= f * a(k, j);
+                        }
+                    }
+                }
+                return det;
+            }
+
+            // gauss-jordan on [m | I]
+            static bool inverse(const FixedMat<N, N, T> &m, FixedMat<N, N, T> &out)
+            {
+                FixedMat<N, N, T> a(m);
+                out = FixedMat<N, N, T>::identity();
+                for (size_t k = 0; k < N; k++) {
+                    size_t p = k;
+                    for (size_t i = k + 1; i < N; i++) {
+                        if (std::abs(a(i, k)) > std::abs(a(p, k))) {
+                            p = i;
+                        }
+                    }
+                    if (a(p, k) == T(0)) {
+                        return false;
+                    }
+                    if (p != k) {
+                        for (size_t j = 0; j < N; j++) {
+                            std::swap(a(k, j), a(p, j));
+                            std::swap(out(k, j), out(p, j));
+                        }
+                    }
+                    T inv = T(1) / a(k, k);
+                    for (size_t j = 0; j < N; j++) {
+                        a(k, j) *= inv;
+                        out(k, j) *= inv;
+                    }
+                    for (size_t i = 0; i < N; i++) {
+                        if (i == k) {
+                            continue;
+                        }
+                        T f = a(i, k);
+                        for (size_t j = 0; j < N; j++) {
+                            a(i, j) -= f * a(k, j);
+                            out(i, j) -= f * out(k, j);
+                        }
+                    }
+                }
+                return true;
+            }
+        };
+
+        template<typename T>
+        struct Square<1, T>
+        {
+            static T determinant(const FixedMat<1, 1, T> &m)
+            {
+                return m.data[0];
+            }
+
+            static bool inverse(const FixedMat<1, 1, T> &m, FixedMat<1, 1, T> &out)
+            {
+                if (m.data[0] == T(0)) {
+                    return false;
+                }
+                out.data[0] = T(1) / m.data[0];
+                return true;
+            }
+        };
+
+        template<typename T>
+        struct Square<2, T>
+        {
+            static T determinant(const FixedMat<2, 2, T> &m)
+            {
+                return m.data[0] * m.data[3] - m.data[1] * m.data[2];
+            }
+
+            static bool inverse(const FixedMat<2, 2, T> &m, FixedMat<2, 2, T> &out)
+            {
+                T det = determinant(m);
+                if (det == T(0)) {
+                    return false;
+                }
+                T inv = T(1) / det;
+                T a = m.data[0], b = m.data[1], c = m.data[2], d = m.data[3];
+                out.data[0] = d * inv;
+                out.data[1] = -b * inv;
+                out.data[2] = -c * inv;
+                out.data[3] = a * inv;
+                return true;
+            }
+        };
+
+        template<typename T>
+        struct Square<3, T>
+        {
+            static T determinant(const FixedMat<3, 3, T> &m)
+            {
+                return m(0, 0) * (m(1, 1) * m(2, 2) - m(1, 2) * m(2, 1))
+                     - m(0, 1) * (m(1, 0) * m(2, 2) - m(1, 2) * m(2, 0))
+                     + m(0, 2) * (m(1, 0) * m(2, 1) - m(1, 1) * m(2, 0));
+            }
+
+            // adjugate over determinant
+            static bool inverse(const FixedMat<3, 3, T> &m, FixedMat<3, 3, T> &out)
+            {
+                T c00 = m(1, 1) * m(2, 2) - m(1, 2) * m(2, 1);
+                T c01 = m(1, 2) * m(2, 0) - m(1, 0) * m(2, 2);
+                T c02 = m(1, 0) * m(2, 1) - m(1, 1) * m(2, 0);
+                T det = m(0, 0) * c00 + m(0, 1) * c01 + m(0, 2) * c02;
+                if (det == T(0)) {
+                    return false;
+                }
+                T inv = T(1) / det;
+                FixedMat<3, 3, T> r;
+                r(0, 0) = c00 * inv;
+                r(1, 0) = c01 * inv;
+                r(2, 0) = c02 * inv;
+                r(0, 1) = (m(0, 2) * m(2, 1) - m(0, 1) * m(2, 2)) * inv;
+                r(1, 1) = (m(0, 0) * m(2, 2) - m(0, 2) * m(2, 0)) * inv;
+                r(2, 1) = (m(0, 1) * m(2, 0) - m(0, 0) * m(2, 1)) * inv;
+                r(0, 2) = (m(0, 1) * m(1, 2) - m(0, 2) * m(1, 1)) * inv;
+                r(1, 2) = (m(0, 2) * m(1, 0) - m(0, 0) * m(1, 2)) * inv;
+                r(2, 2) = (m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0)) * inv;
+                out = r;
+                return true;
+            }
+        };
+    }
+
+    template<size_t N, typename T>
+    inline T determinant(const FixedMat<N, N, T> &m)
+    {
+        return fixed::Square<N, T>::determinant(m);
+    }
+
+    // false (and out untouched or partial) when m is singular
+    template<size_t N, typename T>
+    inline bool inverse(const FixedMat<N, N, T> &m, FixedMat<N, N, T> &out)
+    {
+        return fixed::Square<N, T>::inverse(m, out);
+    }
+
+    // m = L L^T with L lower triangular; false if m is not positive definite
+    template<size_t N, typename T>
+    inline bool cholesky(const FixedMat<N, N, T> &m, FixedMat<N, N, T> &L)
+    {
+        L.setTo(T(0));
+        for (size_t j = 0; j < N; j++) {
+            T d = m(j, j);
+            for (size_t k = 0; k < j; k++) {
+                d -= L(j, k) * L(j, k);
+            }
+            if (!(d > T(0))) {
+                return false;
+            }
+            L(j, j) = std::sqrt(d);
+            T inv = T(1) / L(j, j);
+            for (size_t i = j + 1; i < N; i++) {
+                T s = m(i, j);
+                for (size_t k = 0; k < j; k++) {
+                    s -= L(i, k) * L(j, k);
+                }
+                L(i, j) = s * inv;
+            }
+        }
+        return true;
+    }
+
+    // eigenvalues (ascending, like ssyev) and eigenvectors (as columns) of a
+    // symmetric matrix, by cyclic jacobi rotations
+    template<size_t N, typename T>
+    inline void eigenSymmetric(const FixedMat<N, N, T> &m,
+                               FixedMat<1, N, T> &values,
+                               FixedMat<N, N, T> &vectors)
+    {
+        static_assert(N <= 8, "jacobi sweeps are meant for small matrices");
+        FixedMat<N, N, T> a(m);
+        vectors = FixedMat<N, N, T>::identity();
+
+        for (int sweep = 0; sweep < 50; sweep++) {
+            T off = 0;
+            for (size_t p = 0; p < N; p++) {
+                for (size_t q = p + 1; q < N; q++) {
+                    off += a(p, q) * a(p, q);
+                }
+            }
+            if (off == T(0)) {
+                break;
+            }
+            for (size_t p = 0; p < N; p++) {
+                for (size_t q = p + 1; q < N; q++) {
+                    if (a(p, q) == T(0)) {
+                        continue;
+                    }
+                    // rotation that zeroes a(p, q), the smaller of the two angles
+                    T theta = (a(q, q) - a(p, p)) / (2 * a(p, q));
+                    T t = (theta >= 0 ? T(1) : T(-1)) / (std::abs(theta) + std::sqrt(theta * theta + 1));
+                    T c = T(1) / std::sqrt(t * t + 1), s = t * c;
+                    for (size_t k = 0; k < N; k++) {
+                        T akp = a(k, p), akq = a(k, q);
+                        a(k, p) = c * akp - s * akq;
+                        a(k, q) = s * akp + c * akq;
+                    }
+                    for (size_t k = 0; k < N; k++) {
+                        T apk = a(p, k), aqk = a(q, k);
+                        a(p, k) = c * apk - s * aqk;
+                        a(q, k) = s * apk + c * aqk;
+                    }
+                    for (size_t k = 0; k < N; k++) {
+                        T vkp = vectors(k, p), vkq = vectors(k, q);
+                        vectors(k, p) = c * vkp - s * vkq;
+                        vectors(k, q) = s * vkp + c * vkq;
+                    }
+                }
+            }
+        }
+
+        // selection sort, ascending, carrying the vectors along
+        for (size_t i = 0; i < N; i++) {
+            values[i] = a(i, i);
+        }
+        for (size_t i = 0; i < N; i++) {
+            size_t smallest = i;
+            for (size_t j = i + 1; j < N; j++) {
+                if (values[j] < values[smallest]) {
+                    smallest = j;
+                }
+            }
+            if (smallest != i) {
+                std::swap(values[i], values[smallest]);
+                for (size_t k = 0; k < N; k++) {
+                    std::swap(vectors(k, i), vectors(k, smallest));
+                }
+            }
+        }
+    }
+
+
+    // -------------------------------------------------------------------------
+    //  a gaussian factored once, then evaluated without touching the heap
+    // -------------------------------------------------------------------------
+    template<size_t N, typename T = float>
+    class FixedGaussian
+    {
+    public:
+        // false if the covariance is not positive definite
+        bool setup(const FixedMat<1, N, T> &mean, const FixedMat<N, N, T> &covariance)
+        {
+            this->mean = mean;
+            if (!cholesky(covariance, L)) {
+                return false;
+            }
+            // -0.5 (N log 2 pi + log |covariance|)
+            logNormalizer = T(-0.5) * N * std::log(T(2.0 * M_PI));
+            for (size_t i = 0; i < N; i++) {
+                logNormalizer -= std::log(L(i, i));
+            }
+            return true;
+        }
+
+        // x is N values
+        T logPdf(const T *x) const
+        {
+            // z = L^-1 (x - mean), by forward substitution
+            T z[N], mahalanobis = 0;
+            for (size_t i = 0; i < N; i++) {
+                T s = x[i] - mean[i];
+                for (size_t k = 0; k < i; k++) {
+                    s -= L(i, k) * z[k];
+                }
+                z[i] = s / L(i, i);
+                mahalanobis += z[i] * z[i];
+            }
+            return logNormalizer - T(0.5) * mahalanobis;
+        }
+
+        T logPdf(const FixedMat<1, N, T> &x) const     { return logPdf(x.data); }
+        T pdf(const T *x) const                         { return std::exp(logPdf(x)); }
+        T pdf(const FixedMat<1, N, T> &x) const        { return std::exp(logPdf(x.data)); }
+
+    private:
+        FixedMat<1, N, T> mean;
+        FixedMat<N, N, T> L;
+        T logNormalizer;
+    };
+};
@@ -0,0 +1,859 @@
+/*
+ *  pkmGEMM.cpp
+ *
+
+ batched single precision matrix products.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmGEMM.h"
+#include "pkmThreadPool.h"
+#include <Accelerate/Accelerate.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+using namespace pkm;
+using namespace pkm::gemm;
+
+namespace
+{
+    // C = alpha op(A) op(B) + beta C for n == N and k == K.  op(B) is read
+    // once into registers, then each row of C is K * N multiply-adds.
+    template<size_t N, size_t K>
+    void tinyKernel(Transpose transA, Transpose transB, size_t m,
+                    float alpha, const float *A, size_t lda,
+                    const float *B, size_t ldb,
+                    float beta, float *C, size_t ldc)
+    {
+        float b[K][N];
+        for (size_t p = 0; p < K; p++) {
+            for (size_t j = 0; j < N; j++) {
+                b[p][j] = alpha * (transB == TRANS ? B[j*ldb + p] : B[p*ldb + j]);
+            }
+        }
+
+        // steps between rows of op(A), and along a row
+        size_t rowStep = transA == TRANS ? 1 : lda;
+        size_t colStep = transA == TRANS ? lda : 1;
+        for (size_t i = 0; i < m; i++) {
+            const float *a = A + i*rowStep;
+            float c[N];
+            for (size_t j = 0; j < N; j++) {
+                c[j] = a[0] * b[0][j];
+            }
+            for (size_t p = 1; p < K; p++) {
+                float ap = a[p*colStep];
+                for (size_t j = 0; j < N; j++) {
+                    c[j] += ap * b[p][j];
+                }
+            }
+
+            float *ci = C + i*ldc;
+            if (beta == 0.0f) {
+                for (size_t j = 0; j < N; j++) {
+                    ci[j] = c[j];
+                }
+            }
+            else {
+                for (size_t j = 0; j < N; j++) {
+                    ci[j] = c[j] + beta * ci[j];
+                }
+            }
+        }
+    }
+
+    typedef void (*TinyKernel)(Transpose, Transpose, size_t, float, const float *, size_t,
+                               const float *, size_t, float, float *, size_t);
+
+    // by [n - 1][k - 1]
+    const TinyKernel tinyKernels[4][4] = {
+        { tinyKernel<1, 1>, tinyKernel<1, 2>, tinyKernel<1, 3>, tinyKernel<1, 4> },
+        { tinyKernel<2, 1>, tinyKernel<2, 2>, tinyKernel<2, 3>, tinyKernel<2, 4> },
+        { tinyKernel<3, 1>, tinyKernel<3, 2>, tinyKernel<3, 3>, tinyKernel<3, 4> },
+        { tinyKernel<4, 1>, tinyKernel<4, 2>, tinyKernel<4, 3>, tinyKernel<4, 4> }
+    };
+
+    // any small shape, a row of C at a time so that the inner loop runs
+    // along contiguous rows of B and C when B is not transposed
+    void smallKernel(Transpose transA, Transpose transB,
+                     size_t m, size_t n, size_t k,
+                     float alpha, const float *A, size_t lda,
+                     const float *B, size_t ldb,
+                     float beta, float *C, size_t ldc)
+    {
+        for (size_t i = 0; i < m; i++) {
+            float *ci = C + i*ldc;
+            if (beta == 0.0f) {
+                std::fill(ci, ci + n, 0.0f);
+            }
+            else if (beta != 1.0f) {
+                for (size_t j = 0; j < n; j++) {
+                    ci[j] *= beta;
+                }
+            }
+
+            for (size_t p = 0; p < k; p++) {
+                float ap = alpha * (transA == TRANS ? A[p*lda + i] : A[i*lda + p]);
+                if (transB == TRANS) {
+                    for (size_t j = 0; j < n; j++) {
+                        ci[j] += ap * B[j*ldb + p];
+                    }
+                }
+                else {
+                    const float *bp = B + p*ldb;
+                    for (size_t j = 0; j < n; j++) {
+                        ci[j] += ap * bp[j];
+                    }
+                }
+            }
+        }
+    }
+
+    // ---------------------------------------------------------------------
+    // the native product (sgemm), after goto and van de geijn, "anatomy of
+    // high-performance matrix multiplication": C is updated a kc deep slice
+    // of op(A) op(B) at a time.  each slice of op(B), kc x nc, is packed
+    // into NR wide column panels that stay in L3; each mc x kc block of
+    // op(A) is packed into MR high row panels that stay in L2; and the
+    // micro-kernel multiplies one of each into an MR x NR tile of C held in
+    // registers, streaming an NR x kc panel through L1.
+
+    // the vector operations the micro-kernel is written against, and its
+    // tile: MR rows by VN vectors of W floats.  CHAINS is how many
+    // independent multiply-adds measurePeakFlops() keeps in flight, enough
+    // to hide their latency: the tile's, except where a separate multiply
+    // and add make each step twice as long
+#if defined(__AVX512F__)
+    struct Simd
+    {
+        typedef __m512 V;
+        enum { W = 16, MR = 12, VN = 2, CHAINS = MR * VN };
+        static const char * name()                      { return "avx512"; }
+
+        static V load(const float *p)                   { return _mm512_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm512_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm512_set1_ps(f); }
+        static V mul(V a, V b)                          { return _mm512_mul_ps(a, b); }
+        static V fma(V a, V b, V c)                     { return _mm512_fmadd_ps(a, b, c); }
+    };
+#elif defined(__AVX2__) && defined(__FMA__)
+    struct Simd
+    {
+        typedef __m256 V;
+        enum { W = 8, MR = 6, VN = 2, CHAINS = MR * VN };
+        static const char * name()                      { return "avx2"; }
+
+        static V load(const float *p)                   { return _mm256_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm256_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm256_set1_ps(f); }
+        static V mul(V a, V b)                          { return _mm256_mul_ps(a, b); }
+        static V fma(V a, V b, V c)                     { return _mm256_fmadd_ps(a, b, c); }
+    };
+#elif defined(__SSE2__)
+    struct Simd
+    {
+        typedef __m128 V;
+        enum { W = 4, MR = 4, VN = 2, CHAINS = 14 };
+        static const char * name()                      { return "sse2"; }
+
+        static V load(const float *p)                   { return _mm_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm_set1_ps(f); }
+        static V mul(V a, V b)                          { return _mm_mul_ps(a, b); }
+        static V fma(V a, V b, V c)                     { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    };
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    struct Simd
+    {
+        typedef float32x4_t V;
+        enum { W = 4, MR = 8, VN = 3, CHAINS = MR * VN };
+        static const char * name()                      { return "neon"; }
+
+        static V load(const float *p)                   { return vld1q_f32(p); }
+        static void store(float *p, V a)                { vst1q_f32(p, a); }
+        static V set(float f)                           { return vdupq_n_f32(f); }
+        static V mul(V a, V b)                          { return vmulq_f32(a, b); }
+        static V fma(V a, V b, V c)                     { return vfmaq_f32(c, a, b); }
+    };
+#else
+    struct Simd
+    {
+        typedef float V;
+        enum { W = 1, MR = 4, VN = 4, CHAINS = MR * VN };
+        static const char * name()                      { return "scalar"; }
+
+        static V load(const float *p)                   { return *p; }
+        static void store(float *p, V a)                { *p = a; }
+        static V set(float f)                           { return f; }
+        static V mul(V a, V b)                          { return a * b; }
+        static V fma(V a, V b, V c)                     { return a * b + c; }
+    };
+#endif
+
+    typedef Simd::V V;
+    enum { W = Simd::W, MR = Simd::MR, VN = Simd::VN, NR = VN * W };
+
+    // how many steps of kc ahead the micro-kernel fetches its panels of op(A)
+    // and op(B).  the panels are packed back to back, so near the end of one
+    // this runs on into the next, which the following call then finds in L1
+    enum { PREFETCH_A = 16, PREFETCH_B = 8, LINE = 64 / sizeof(float) };
+
+    // C = alpha a b + beta C for the MR x kc panel a and kc x NR panel b,
+    // writing only the top left mr x nr of the tile
+    void microKernel(size_t kc, const float *a, const float *b,
+                     float alpha, float beta, float *C, size_t ldc,
+                     size_t mr, size_t nr)
+    {
+        V acc[MR][VN];
+#pragma GCC unroll 16
+        for (size_t i = 0; i < MR; i++) {
+#pragma GCC unroll 4
+            for (size_t v = 0; v < VN; v++) {
+                acc[i][v] = Simd::set(0.0f);
+            }
+        }
+
+        // the tile of C is only touched at the end; start fetching it now
+        for (size_t i = 0; i < mr; i++) {
+            __builtin_prefetch(C + i*ldc, 1);
+            __builtin_prefetch(C + i*ldc + nr - 1, 1);
+        }
+
+        for (size_t p = 0; p < kc; p++) {
+            __builtin_prefetch(a + PREFETCH_A*MR);
+#pragma GCC unroll 4
+            for (size_t j = 0; j < NR; j += LINE) {
+                __builtin_prefetch(b + PREFETCH_B*NR + j);
+            }
+            V bv[VN];
+#pragma GCC unroll 4
+            for (size_t v = 0; v < VN; v++) {
+                bv[v] = Simd::load(b + v*W);
+            }
+#pragma GCC unroll 16
+            for (size_t i = 0; i < MR; i++) {
+                V ai = Simd::set(a[i]);
+#pragma GCC unroll 4
+                for (size_t v = 0; v < VN; v++) {
+                    acc[i][v] = Simd::fma(ai, bv[v], acc[i][v]);
+                }
+            }
+            a += MR;
+            b += NR;
+        }
+
+        V alphaV = Simd::set(alpha);
+        if (mr == MR && nr == NR) {
+            V betaV = Simd::set(beta);
+            for (size_t i = 0; i < MR; i++) {
+                float *c = C + i*ldc;
+                for (size_t v = 0; v < VN; v++) {
+                    V r = Simd::mul(acc[i][v], alphaV);
+                    if (beta != 0.0f) {
+                        r = Simd::fma(Simd::load(c + v*W), betaV, r);
+                    }
+                    Simd::store(c + v*W, r);
+                }
+            }
+            return;
+        }
+
+        // a partial tile at the bottom or right edge of C
+        float tile[MR * NR];
+        for (size_t i = 0; i < MR; i++) {
+            for (size_t v = 0; v < VN; v++) {
+                Simd::store(tile + i*NR + v*W, Simd::mul(acc[i][v], alphaV));
+            }
+        }
+        for (size_t i = 0; i < mr; i++) {
+            float *c = C + i*ldc;
+            for (size_t j = 0; j < nr; j++) {
+                c[j] = beta == 0.0f ? tile[i*NR + j] : tile[i*NR + j] + beta * c[j];
+            }
+        }
+    }
+
+    // rows [i0, i0 + mc) and columns [p0, p0 + kc) of op(A) as MR high
+    // panels, each kc columns of MR values, zero padded past row mc
+    void packA(Transpose transA, const float *A, size_t lda,
+               size_t i0, size_t p0, size_t mc, size_t kc, float *dst)
+    {
+        for (size_t ir = 0; ir < mc; ir += MR) {
+            size_t mr = std::min<size_t>(MR, mc - ir);
+            if (transA == TRANS) {
+                for (size_t p = 0; p < kc; p++) {
+                    const float *a = A + (p0 + p)*lda + i0 + ir;
+                    float *d = dst + p*MR;
+                    for (size_t i = 0; i < mr; i++) {
+                        d[i] = a[i];
+                    }
+                    for (size_t i = mr; i < MR; i++) {
+                        d[i] = 0.0f;
+                    }
+                }
+            }
+            else if (mr == MR) {
+                // all MR rows a column at a time, so dst is written in order
+                const float *a = A + (i0 + ir)*lda + p0;
+                for (size_t p = 0; p < kc; p++) {
+#pragma GCC unroll 16
+                    for (size_t i = 0; i < MR; i++) {
+                        dst[p*MR + i] = a[i*lda + p];
+                    }
+                }
+            }
+            else {
+                for (size_t i = 0; i < mr; i++) {
+                    const float *a = A + (i0 + ir + i)*lda + p0;
+                    for (size_t p = 0; p < kc; p++) {
+                        dst[p*MR + i] = a[p];
+                    }
+                }
+                for (size_t i = mr; i < MR; i++) {
+                    for (size_t p = 0; p < kc; p++) {
+                        dst[p*MR + i] = 0.0f;
+                    }
+                }
+            }
+            dst += MR*kc;
+        }
+    }
+
+    // panels [first, last) of rows [p0, p0 + kc) and columns [j0, j0 + nc)
+    // of op(B), each NR wide panel kc rows of NR values, zero padded past
+    // column nc
+    void packB(Transpose transB, const float *B, size_t ldb,
+               size_t p0, size_t j0, size_t kc, size_t nc,
+               size_t first, size_t last, float *dst)
+    {
+        for (size_t panel = first; panel < last; panel++) {
+            size_t jr = panel*NR;
+            size_t nr = std::min<size_t>(NR, nc - jr);
+            float *d = dst + panel*NR*kc;
+            if (transB == TRANS) {
+                for (size_t j = 0; j < nr; j++) {
+                    const float *b = B + (j0 + jr + j)*ldb + p0;
+                    for (size_t p = 0; p < kc; p++) {
+                        d[p*NR + j] = b[p];
+                    }
+                }
+                for (size_t j = nr; j < NR; j++) {
+                    for (size_t p = 0; p < kc; p++) {
+                        d[p*NR + j] = 0.0f;
+                    }
+                }
+            }
+            else {
+                for (size_t p = 0; p < kc; p++) {
+                    const float *b = B + (p0 + p)*ldb + j0 + jr;
+                    for (size_t j = 0; j < nr; j++) {
+                        d[p*NR + j] = b[j];
+                    }
+                    for (size_t j = nr; j < NR; j++) {
+                        d[p*NR + j] = 0.0f;
+                    }
+                }
+            }
+        }
+    }
+
+    // a cache line aligned scratch buffer that only ever grows
+    struct PackBuffer
+    {
+        PackBuffer() : data(NULL), size(0) {}
+        ~PackBuffer() { free(data); }
+
+        float * reserve(size_t n)
+        {
+            if (n > size) {
+                free(data);
+                if (posix_memalign((void **)&data, 64, n * sizeof(float)) != 0) {
+                    data = NULL;
+                }
+                size = data ? n : 0;
+            }
+            return data;
+        }
+
+        float  *data;
+        size_t  size;
+    };
+
+    size_t cacheSize(int level, size_t fallback)
+    {
+        long bytes = 0;
+#if defined(__APPLE__)
+        const char *names[] = { "hw.l1dcachesize", "hw.l2cachesize", "hw.l3cachesize" };
+        int64_t value = 0;
+        size_t length = sizeof(value);
+        if (sysctlbyname(names[level - 1], &value, &length, NULL, 0) == 0) {
+            bytes = (long)value;
+        }
+#elif defined(_SC_LEVEL1_DCACHE_SIZE)
+        const int names[] = { _SC_LEVEL1_DCACHE_SIZE, _SC_LEVEL2_CACHE_SIZE, _SC_LEVEL3_CACHE_SIZE };
+        bytes = sysconf(names[level - 1]);
+#endif
+        return bytes > 0 ? (size_t)bytes : fallback;
+    }
+
+    BlockSizes detectBlockSizes()
+    {
+        size_t l1 = cacheSize(1, 32 << 10);
+        size_t l2 = cacheSize(2, 256 << 10);
+        size_t l3 = cacheSize(3, 8 << 20);
+
+        BlockSizes sizes;
+        // the kc x NR panel of op(B) that every panel of op(A) meets in L1
+        // (the MR x kc panels of op(A) stream from L2)
+        sizes.kc = std::min<size_t>(512, std::max<size_t>(128, l1 / (NR * sizeof(float))));
+        sizes.kc &= ~(size_t)7;
+        // an mc x kc block of op(A) in half of L2.  avx512's kc x 32 panel
+        // of op(B) fills L1 by itself, so it is read from L2 too, and the
+        // block does best in a sixteenth (measured 75% of peak against 67%
+        // for half, at 1024 and 2048 with a 2MB L2)
+#if defined(__AVX512F__)
+        size_t blockA = l2 / 16;
+#else
+        size_t blockA = l2 / 2;
+#endif
+        sizes.mc = std::max<size_t>(MR, blockA / (sizes.kc * sizeof(float)) / MR * MR);
+        // a kc x nc slice of op(B) in half of L3, or at most 4096 columns
+        sizes.nc = std::min<size_t>(4096, std::max<size_t>(NR, (l3 / 2) / (sizes.kc * sizeof(float)))) / NR * NR;
+        return sizes;
+    }
+
+    // ---------------------------------------------------------------------
+    // strassen-winograd: 7 half-size products and 15 additions per level in
+    // place of 8 products, with the low-memory schedule of douglas et al.,
+    // "GEMMW: a portable level 3 BLAS winograd variant of strassen's
+    // matrix-matrix multiply algorithm" (1994), which needs only three
+    // half-size temporaries per level besides the quadrants of C.  odd rows,
+    // columns and depth are peeled off and done as thin products.
+
+    std::atomic<size_t> strassenCrossover(0);
+
+    // the product below the crossover, or when strassen is off
+    void largeProduct(Transpose transA, Transpose transB,
+                      size_t m, size_t n, size_t k,
+                      float alpha, const float *A, size_t lda,
+                      const float *B, size_t ldb,
+                      float beta, float *C, size_t ldc)
+    {
+#ifdef PKM_NATIVE_GEMM
+        sgemm(transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+#else
+        cblas_sgemm(CblasRowMajor,
+                    transA == TRANS ? CblasTrans : CblasNoTrans,
+                    transB == TRANS ? CblasTrans : CblasNoTrans,
+                    (int)m, (int)n, (int)k, alpha, A, (int)lda, B, (int)ldb, beta, C, (int)ldc);
+#endif
+    }
+
+    // near-square, with every side at least the crossover
+    bool useStrassen(size_t m, size_t n, size_t k, size_t crossover)
+    {
+        size_t smallest = std::min(m, std::min(n, k));
+        size_t largest = std::max(m, std::max(n, k));
+        return crossover > 0 && smallest >= std::max<size_t>(crossover, 2) && largest <= 2 * smallest;
+    }
+
+    // op(X) starting at row i, column j
+    const float * offset(const float *X, Transpose t, size_t ldx, size_t i, size_t j)
+    {
+        return t == TRANS ? X + j*ldx + i : X + i*ldx + j;
+    }
+
+    // D = op(X) + sign op(Y), rows x cols, with D not transposed
+    void combine(const float *X, Transpose tx, size_t ldx,
+                 const float *Y, Transpose ty, size_t ldy, float sign,
+                 float *D, size_t ldd, size_t rows, size_t cols)
+    {
+        pkm::parallelFor(rows, std::max<size_t>(1, 16384 / std::max<size_t>(cols, 1)), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                float *d = D + i*ldd;
+                if (tx == NO_TRANS && ty == NO_TRANS) {
+                    const float *x = X + i*ldx, *y = Y + i*ldy;
+                    for (size_t j = 0; j < cols; j++) {
+                        d[j] = x[j] + sign * y[j];
+                    }
+                }
+                else {
+                    for (size_t j = 0; j < cols; j++) {
+                        float x = tx == TRANS ? X[j*ldx + i] : X[i*ldx + j];
+                        float y = ty == TRANS ? Y[j*ldy + i] : Y[i*ldy + j];
+                        d[j] = x + sign * y;
+                    }
+                }
+            }
+        });
+    }
+
+    // floats of workspace winograd() takes for an m x k by k x n product
+    size_t winogradWorkspace(size_t m, size_t n, size_t k, size_t crossover)
+    {
+        if (!useStrassen(m, n, k, crossover)) {
+            return 0;
+        }
+        size_t m2 = m / 2, n2 = n / 2, k2 = k / 2;
+        return m2*k2 + k2*n2 + m2*n2 + winogradWorkspace(m2, n2, k2, crossover);
+    }
+
+    // C = op(A) op(B), taking temporaries from the front of work
+    void winograd(Transpose transA, Transpose transB,
+                  size_t m, size_t n, size_t k,
+                  const float *A, size_t lda, const float *B, size_t ldb,
+                  float *C, size_t ldc, float *work, size_t crossover)
+    {
+        if (!useStrassen(m, n, k, crossover)) {
+            largeProduct(transA, transB, m, n, k, 1.0f, A, lda, B, ldb, 0.0f, C, ldc);
+            return;
+        }
+
+        size_t m2 = m / 2, n2 = n / 2, k2 = k / 2;
+        const float *A11 = A, *A12 = offset(A, transA, lda, 0, k2);
+        const float *A21 = offset(A, transA, lda, m2, 0), *A22 = offset(A, transA, lda, m2, k2);
+        const float *B11 = B, *B12 = offset(B, transB, ldb, 0, n2);
+        const float *B21 = offset(B, transB, ldb, k2, 0), *B22 = offset(B, transB, ldb, k2, n2);
+        float *C11 = C, *C12 = C + n2, *C21 = C + m2*ldc, *C22 = C + m2*ldc + n2;
+
+        float *X = work;                // m2 x k2
+        float *Y = X + m2*k2;           // k2 x n2
+        float *Z = Y + k2*n2;           // m2 x n2
+        float *next = Z + m2*n2;
+
+        // S3 = A11 - A21, T3 = B22 - B12, P7 = S3 T3 into C21
+        combine(A11, transA, lda, A21, transA, lda, -1.0f, X, k2, m2, k2);
+        combine(B22, transB, ldb, B12, transB, ldb, -1.0f, Y, n2, k2, n2);
+        winograd(NO_TRANS, NO_TRANS, m2, n2, k2, X, k2, Y, n2, C21, ldc, next, crossover);
+
+        // S1 = A21 + A22, T1 = B12 - B11, P5 = S1 T1 into C22
+        combine(A21, transA, lda, A22, transA, lda, 1.0f, X, k2, m2, k2);
+        combine(B12, transB, ldb, B11, transB, ldb, -1.0f, Y, n2, k2, n2);
+        winograd(NO_TRANS, NO_TRANS, m2, n2, k2, X, k2, Y, n2, C22, ldc, next, crossover);
+
+        // S2 = S1 - A11, T2 = B22 - T1, P6 = S2 T2 into C12
+        combine(X, NO_TRANS, k2, A11, transA, lda, -1.0f, X, k2, m2, k2);
+        combine(B22, transB, ldb, Y, NO_TRANS, n2, -1.0f, Y, n2, k2, n2);
+        winograd(NO_TRANS, NO_TRANS, m2, n2, k2, X, k2, Y, n2, C12, ldc, next, crossover);
+
+        // S4 = A12 - S2, P3 = S4 B22 into C11
+        combine(A12, transA, lda, X, NO_TRANS, k2, -1.0f, X, k2, m2, k2);
+        winograd(NO_TRANS, transB, m2, n2, k2, X, k2, B22, ldb, C11, ldc, next, crossover);
+
+        // P1 = A11 B11 into Z
+        winograd(transA, transB, m2, n2, k2, A11, lda, B11, ldb, Z, n2, next, crossover);
+
+        // U2 = P1 + P6, U3 = U2 + P7, U4 = U2 + P5, U7 = U3 + P5, U5 = U4 + P3
+        combine(Z, NO_TRANS, n2, C12, NO_TRANS, ldc, 1.0f, C12, ldc, m2, n2);
+        combine(C12, NO_TRANS, ldc, C21, NO_TRANS, ldc, 1.0f, C21, ldc, m2, n2);
+        combine(C12, NO_TRANS, ldc, C22, NO_TRANS, ldc, 1.0f, C12, ldc, m2, n2);
+        combine(C21, NO_TRANS, ldc, C22, NO_TRANS, ldc, 1.0f, C22, ldc, m2, n2);
+        combine(C12, NO_TRANS, ldc, C11, NO_TRANS, ldc, 1.0f, C12, ldc, m2, n2);
+
+        // T4 = T2 - B21, P4 = A22 T4 into C11, U6 = U3 - P4
+        combine(Y, NO_TRANS, n2, B21, transB, ldb, -1.0f, Y, n2, k2, n2);
+        winograd(transA, NO_TRANS, m2, n2, k2, A22, lda, Y, n2, C11, ldc, next, crossover);
+        combine(C21, NO_TRANS, ldc, C11, NO_TRANS, ldc, -1.0f, C21, ldc, m2, n2);
+
+        // P2 = A12 B21 into C11, U1 = P1 + P2
+        winograd(transA, transB, m2, n2, k2, A12, lda, B21, ldb, C11, ldc, next, crossover);
+        combine(Z, NO_TRANS, n2, C11, NO_TRANS, ldc, 1.0f, C11, ldc, m2, n2);
+
+        // the odd depth, column and row left over
+        size_t me = 2*m2, ne = 2*n2, ke = 2*k2;
+        if (k > ke) {
+            multiply(transA, transB, me, ne, 1, 1.0f, offset(A, transA, lda, 0, ke), lda,
+                     offset(B, transB, ldb, ke, 0), ldb, 1.0f, C, ldc);
+        }
+        if (n > ne) {
+            multiply(transA, transB, m, 1, k, 1.0f, A, lda,
+                     offset(B, transB, ldb, 0, ne), ldb, 0.0f, C + ne, ldc);
+        }
+        if (m > me) {
+            multiply(transA, transB, 1, ne, k, 1.0f, offset(A, transA, lda, me, 0), lda,
+                     B, ldb, 0.0f, C + me*ldc, ldc);
+        }
+    }
+
+    // problems per task for problems of m * n * k multiply-adds
+    size_t problemsPerTask(size_t m, size_t n, size_t k)
+    {
+        return std::max((size_t)1, PKM_GEMM_BATCH_CHUNK / std::max(m * n * k, (size_t)1));
+    }
+}
+
+void pkm::gemm::multiply(Transpose transA, Transpose transB,
+                         size_t m, size_t n, size_t k,
+                         float alpha, const float *A, size_t lda,
+                         const float *B, size_t ldb,
+                         float beta, float *C, size_t ldc)
+{
+    if (m == 0 || n == 0) {
+        return;
+    }
+    if (k == 0 || alpha == 0.0f) {
+        for (size_t i = 0; i < m; i++) {
+            float *ci = C + i*ldc;
+            for (size_t j = 0; j < n; j++) {
+                ci[j] = beta == 0.0f ? 0.0f : beta * ci[j];
+            }
+        }
+        return;
+    }
+
+    if (n <= 4 && k <= 4) {
+        tinyKernels[n - 1][k - 1](transA, transB, m, alpha, A, lda, B, ldb, beta, C, ldc);
+    }
+    else if (m * n * k <= PKM_GEMM_SMALL) {
+        smallKernel(transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+    }
+    else if (useStrassen(m, n, k, strassenCrossover.load())) {
+        strassen(transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+    }
+    else {
+        largeProduct(transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+    }
+}
+
+void pkm::gemm::strassen(Transpose transA, Transpose transB,
+                         size_t m, size_t n, size_t k,
+                         float alpha, const float *A, size_t lda,
+                         const float *B, size_t ldb,
+                         float beta, float *C, size_t ldc,
+                         size_t crossover)
+{
+    if (crossover == 0) {
+        crossover = std::max<size_t>(1, strassenCrossover.load());
+    }
+    if (m == 0 || n == 0 || k == 0 || alpha == 0.0f || !useStrassen(m, n, k, crossover)) {
+        multiply(transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+        return;
+    }
+
+    // the recursion overwrites what it writes to, so unless C = op(A) op(B)
+    // it writes to a temporary that is then scaled into C
+    bool direct = alpha == 1.0f && beta == 0.0f;
+    size_t work = winogradWorkspace(m, n, k, crossover);
+    static thread_local PackBuffer arena;
+    float *buffer = arena.reserve(work + (direct ? 0 : m*n));
+    if (buffer == NULL) {
+        printf("[ERROR: pkm::gemm::strassen()] Out of memory.\n");
+        return;
+    }
+
+    if (direct) {
+        winograd(transA, transB, m, n, k, A, lda, B, ldb, C, ldc, buffer, crossover);
+        return;
+    }
+    float *product = buffer + work;
+    winograd(transA, transB, m, n, k, A, lda, B, ldb, product, n, buffer, crossover);
+    pkm::parallelFor(m, std::max<size_t>(1, 16384 / n), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            float *c = C + i*ldc;
+            const float *p = product + i*n;
+            for (size_t j = 0; j < n; j++) {
+                c[j] = beta == 0.0f ? alpha * p[j] : alpha * p[j] + beta * c[j];
+            }
+        }
+    });
+}
+
+void pkm::gemm::setStrassenCrossover(size_t n)
+{
+    strassenCrossover.store(n);
+}
+
+size_t pkm::gemm::getStrassenCrossover()
+{
+    return strassenCrossover.load();
+}
+
+const BlockSizes & pkm::gemm::getBlockSizes()
+{
+    static BlockSizes sizes = detectBlockSizes();
+    return sizes;
+}
+
+const char * pkm::gemm::getInstructionSet()
+{
+    return Simd::name();
+}
+
+double pkm::gemm::measurePeakFlops()
+{
+    // acc = acc x + y tends to y / (1 - x), so it neither overflows nor
+    // goes denormal, and every update depends on the last one as in the
+    // micro-kernel
+    V acc[Simd::CHAINS];
+    for (size_t i = 0; i < Simd::CHAINS; i++) {
+        acc[i] = Simd::set((float)i);
+    }
+    V x = Simd::set(0.999f), y = Simd::set(0.001f);
+
+    // the best of a few runs long enough for the clock to settle
+    double best = 0;
+    size_t iterations = 1 << 16;
+    for (int run = 0; run < 5; run++) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < iterations; t++) {
+#pragma GCC unroll 32
+            for (size_t i = 0; i < Simd::CHAINS; i++) {
+                acc[i] = Simd::fma(acc[i], x, y);
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::max(best, 2.0 * Simd::CHAINS * W * iterations / seconds);
+        if (seconds < 0.02) {
+            iterations *= 2;
+            run--;
+        }
+    }
+
+    // keep the accumulators live
+    float lanes[W], sum = 0;
+    for (size_t i = 0; i < Simd::CHAINS; i++) {
+        Simd::store(lanes, acc[i]);
+        sum += lanes[0];
+    }
+    volatile float sink = sum;
+    (void)sink;
+    return best;
+}
+
+void pkm::gemm::sgemm(Transpose transA, Transpose transB,
+                      size_t m, size_t n, size_t k,
+                      float alpha, const float *A, size_t lda,
+                      const float *B, size_t ldb,
+                      float beta, float *C, size_t ldc)
+{
+    if (m == 0 || n == 0) {
+        return;
+    }
+    if (k == 0 || alpha == 0.0f) {
+        multiply(transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+        return;
+    }
+
+    const BlockSizes &sizes = getBlockSizes();
+    size_t threads = ThreadPool::shared().getNumThreads();
+
+    // blocks of op(A) no taller than needed to give every thread one, and
+    // when there are still too few, each block's panels of op(B) split
+    // between several threads too
+    size_t mc = std::min(sizes.mc, ((m + threads - 1) / threads + MR - 1) / MR * MR);
+    size_t blocksA = (m + mc - 1) / mc;
+
+    static thread_local PackBuffer packedB;
+    float *bufferB = packedB.reserve(sizes.kc * std::min(sizes.nc, (n + NR - 1) / NR * NR));
+    if (bufferB == NULL) {
+        printf("[ERROR: pkm::gemm::sgemm()] Out of memory.\n");
+        return;
+    }
+
+    for (size_t jc = 0; jc < n; jc += sizes.nc) {
+        size_t nc = std::min(sizes.nc, n - jc);
+        size_t panelsB = (nc + NR - 1) / NR;
+        size_t splitsB = std::min(panelsB, std::max<size_t>(1, threads / blocksA));
+
+        for (size_t pc = 0; pc < k; pc += sizes.kc) {
+            size_t kc = std::min(sizes.kc, k - pc);
+            // the first slice scales C by beta; the rest add to it
+            float betaSlice = pc == 0 ? beta : 1.0f;
+
+            pkm::parallelFor(panelsB, 1, [&](size_t first, size_t last) {
+                packB(transB, B, ldb, pc, jc, kc, nc, first, last, bufferB);
+            });
+
+            pkm::parallelFor(blocksA * splitsB, 1, [&](size_t begin, size_t end) {
+                static thread_local PackBuffer packedA;
+                float *bufferA = packedA.reserve(((mc + MR - 1) / MR) * MR * kc);
+                size_t packed = blocksA;
+                for (size_t task = begin; task < end; task++) {
+                    size_t block = task / splitsB;
+                    size_t split = task % splitsB;
+                    size_t ic = block * mc;
+                    size_t mcBlock = std::min(mc, m - ic);
+                    if (block != packed) {
+                        packA(transA, A, lda, ic, pc, mcBlock, kc, bufferA);
+                        packed = block;
+                    }
+
+                    size_t firstPanel = panelsB * split / splitsB;
+                    size_t lastPanel = panelsB * (split + 1) / splitsB;
+                    for (size_t panel = firstPanel; panel < lastPanel; panel++) {
+                        size_t jr = panel * NR;
+                        size_t nr = std::min<size_t>(NR, nc - jr);
+                        for (size_t ir = 0; ir < mcBlock; ir += MR) {
+                            size_t mr = std::min<size_t>(MR, mcBlock - ir);
+                            microKernel(kc, bufferA + ir*kc, bufferB + panel*NR*kc,
+                                        alpha, betaSlice, C + (ic + ir)*ldc + jc + jr, ldc, mr, nr);
+                        }
+                    }
+                }
+            });
+        }
+    }
+}
+
+void pkm::gemm::stridedBatched(Transpose transA, Transpose transB,
+                               size_t m, size_t n, size_t k,
+                               float alpha, const float *A, size_t lda, size_t strideA,
+                               const float *B, size_t ldb, size_t strideB,
+                               float beta, float *C, size_t ldc, size_t strideC,
+                               size_t batch)
+{
+    pkm::parallelFor(batch, problemsPerTask(m, n, k), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            multiply(transA, transB, m, n, k,
+                     alpha, A + i*strideA, lda, B + i*strideB, ldb,
+                     beta, C + i*strideC, ldc);
+        }
+    });
+}
+
+void pkm::gemm::batched(Transpose transA, Transpose transB,
+                        size_t m, size_t n, size_t k,
+                        float alpha, const float * const *A, size_t lda,
+                        const float * const *B, size_t ldb,
+                        float beta, float * const *C, size_t ldc,
+                        size_t batch)
+{
+    pkm::parallelFor(batch, problemsPerTask(m, n, k), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            multiply(transA, transB, m, n, k,
+                     alpha, A[i], lda, B[i], ldb,
+                     beta, C[i], ldc);
+        }
+    });
+}
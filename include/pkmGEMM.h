@@ -0,0 +1,154 @@
+/*
+ *  pkmGEMM.h
+ *
+
+ single precision matrix products for when one cblas_sgemm call per
+ product costs more than the product: many small independent problems
+ (per-gaussian whitening, 2 x 2 covariance updates) done as one batch.
+
+ all matrices are row-major, as in Mat, and every function computes
+ C = alpha op(A) op(B) + beta C with op(A) m x k, op(B) k x n and C m x n.
+ as with BLAS, C is not read when beta is 0.
+
+ a batch is split across the shared pkm::ThreadPool, each problem done
+ start to finish by one thread.  problems with n and k both at most 4
+ (any m) use fully unrolled kernels that keep op(B) in registers, other
+ small ones a plain loop, and only the rest call cblas_sgemm.
+
+ sgemm() is a cache-blocked product of our own, for platforms whose BLAS
+ is the unoptimized reference one: operands are packed into panels sized
+ from the cache sizes the os reports, and multiplied by a register-blocked
+ micro-kernel built for the widest of AVX-512F, AVX2 + FMA, SSE2, aarch64
+ NEON or scalar code that the compiler targets (so build with e.g.
+ -mavx2 -mfma).  blocks of C are spread across the shared pkm::ThreadPool.
+ define PKM_NATIVE_GEMM to send the large products of multiply(), and so
+ of Mat::GEMM() and operator*, through sgemm() instead of cblas_sgemm.
+
+ strassen() trades one of every eight half-size products for 15 additions
+ at each level of the strassen-winograd recursion, down to the crossover,
+ below which it calls the classic product.  multiply() takes this path for
+ products whose sides are all at least getStrassenCrossover() and within a
+ factor of 2 of each other, which is never until setStrassenCrossover() is
+ given a nonzero size (PKM_GEMM_STRASSEN_CROSSOVER is what benchmarked well
+ with the native kernels; below it the additions cost more than they save).
+
+ it is less accurate.  the classic product is componentwise accurate,
+     |C - fl(C)| <= k u |A| |B|,
+ where u = 2^-24, while winograd's variant is only normwise accurate,
+     max|C - fl(C)| <= [(k/k0)^log2(18) (k0^2 + 5 k0) - 5 k] u max|A| max|B|
+ for products of side k recursed down to side k0 (higham, "accuracy and
+ stability of numerical algorithms", 2nd ed., theorem 23.3): each level
+ grows the constant by up to 18 rather than 2, and small entries of C
+ computed from large entries of A and B lose relative accuracy.  in
+ practice, with random data, one or two levels cost about a bit each.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+// m * n * k at or below which a product skips cblas_sgemm
+#define PKM_GEMM_SMALL 4096
+
+// multiply-adds per thread when a batch is split
+#define PKM_GEMM_BATCH_CHUNK 65536
+
+// the strassen crossover that benchmarked well, for setStrassenCrossover()
+#define PKM_GEMM_STRASSEN_CROSSOVER 4096
+
+namespace pkm
+{
+    namespace gemm
+    {
+        enum Transpose
+        {
+            NO_TRANS,
+            TRANS
+        };
+
+        // the blocking sgemm() uses: kc deep slices, mc x kc blocks of op(A)
+        // and kc x nc slices of op(B)
+        struct BlockSizes
+        {
+            size_t mc, kc, nc;
+        };
+
+        // one product
+        void multiply(Transpose transA, Transpose transB,
+                      size_t m, size_t n, size_t k,
+                      float alpha, const float *A, size_t lda,
+                      const float *B, size_t ldb,
+                      float beta, float *C, size_t ldc);
+
+        // batch products of the same shape, the i-th reading A + i * strideA
+        // and B + i * strideB and writing C + i * strideC.  a stride of 0
+        // uses the same A or B for every product.
+        void stridedBatched(Transpose transA, Transpose transB,
+                            size_t m, size_t n, size_t k,
+                            float alpha, const float *A, size_t lda, size_t strideA,
+                            const float *B, size_t ldb, size_t strideB,
+                            float beta, float *C, size_t ldc, size_t strideC,
+                            size_t batch);
+
+        // batch products of the same shape at arbitrary addresses
+        void batched(Transpose transA, Transpose transB,
+                     size_t m, size_t n, size_t k,
+                     float alpha, const float * const *A, size_t lda,
+                     const float * const *B, size_t ldb,
+                     float beta, float * const *C, size_t ldc,
+                     size_t batch);
+
+        // one product through the native kernels, whatever PKM_NATIVE_GEMM says
+        void sgemm(Transpose transA, Transpose transB,
+                   size_t m, size_t n, size_t k,
+                   float alpha, const float *A, size_t lda,
+                   const float *B, size_t ldb,
+                   float beta, float *C, size_t ldc);
+
+        // one product by strassen-winograd recursion down to sides below the
+        // crossover (0 for getStrassenCrossover(), or at least 1 if that is
+        // off).  workspace comes from a per-thread arena that is kept, about
+        // (m k + k n + m n) / 3 floats, plus m n unless alpha is 1 and beta 0.
+        void strassen(Transpose transA, Transpose transB,
+                      size_t m, size_t n, size_t k,
+                      float alpha, const float *A, size_t lda,
+                      const float *B, size_t ldb,
+                      float beta, float *C, size_t ldc,
+                      size_t crossover = 0);
+
+        // the smallest side at which multiply() switches to strassen(), or
+        // 0, the default, to never switch
+        void setStrassenCrossover(size_t n);
+        size_t getStrassenCrossover();
+
+        // chosen from the cache sizes on first use
+        const BlockSizes & getBlockSizes();
+
+        // which micro-kernel sgemm() was built with, e.g. "avx2"
+        const char * getInstructionSet();
+
+        // FLOP/s of one core doing only the micro-kernel's multiply-adds, on
+        // enough accumulators held in registers to hide their latency, with
+        // nothing loaded: the per-core peak sgemm() is measured against, at
+        // the current clock.  takes about a tenth of a second.  (SSE2's
+        // separate multiply and add need 14 accumulators, more than its
+        // kernel's 8.)
+        double measurePeakFlops();
+    }
+}
@@ -26,8 +26,8 @@ Copyright (C) 2011 Parag K. Mital
 #pragma once
 
 #include "pkmMatrix.h"
-#include "GestureVariationFollower.h"
-#include <Eigen/Core>
+#include "pkmParticleFilter.h"
+#include "pkmTemplateStore.h"
 
 #define WITH_OF
 
@@ -43,20 +43,49 @@ class pkmGVF
 public:
     // -------------------------------------------------------------------------
     pkmGVF()
+    : defaultSession(1000000)
     {
         numCandidates = 0;
         bHaveCandidates = false;
-        
-        Eigen::VectorXf sigs(3);
-        sigs(0) = 0.00001;
-        sigs(1) = 0.001;
-        sigs(2) = 0.00001;
-        int numParticles = 1e6;
-        float tolerance = 1.0;
-        gvf = new GestureVariationFollower(numParticles, sigs, 1.0 / (tolerance*tolerance), numParticles / 100);
-
     }
     // -------------------------------------------------------------------------
+    
+    // -------------------------------------------------------------------------
+    //  One performer being followed: the particle filter and a scratch copy
+    //  of the query.  The templates themselves stay in the database and are
+    //  shared by every session, so a loaded database can follow any number
+    //  of performers at once, each session from its own thread.
+    //
+    //  Adding templates is exclusive, as with pkmDTW: addToDatabase() must
+    //  not run while any thread is inside startSession(), updateSession() or
+    //  getNearestCandidate().  Start a session with startSession() once the
+    //  database is loaded, and pass it to updateSession() after templates
+    //  are added.  With a bundle, a session that hasn't been updated yet
+    //  carries on with the templates it had, whose frames stay mapped until
+    //  the database is closed or reloaded.  Without one, it must be updated
+    //  before its next frame, since addToDatabase() moves the frames its
+    //  filter points into.  The default session is updated for you.
+    // -------------------------------------------------------------------------
+    class Session
+    {
+    public:
+        // phase, speed and scale noise, observation tolerance, and resampling
+        // once the effective sample size drops below numParticles / 100.
+        // each particle takes 40 bytes, so the default is 400 KB a
+        // performer; the single performer api's own session has 1e6.
+        Session(size_t numParticles = 10000, float tolerance = 1.0)
+        : filter(numParticles, 0.00001, 0.001, 0.00001, tolerance, numParticles / 100)
+        {
+        }
+        
+        // e.g. for setAdaptive(), getNumParticles(), getEffectiveSampleSize()
+        pkmParticleFilter filter;
+        
+    private:
+        friend class pkmGVF;
+        Mat query;              // normalized copy of the last frame
+    };
+    // -------------------------------------------------------------------------
 
     
     // -------------------------------------------------------------------------
@@ -66,14 +95,26 @@ public:
     // -------------------------------------------------------------------------
     void addToDatabase(Mat &el)
     {
-        vector<float> lut_el;
-        lut_el.push_back(allFeatures.rows);
-        allFeatures.push_back(el);
-        lut_el.push_back(allFeatures.rows - lut_el[0]);
-        lut.push_back(lut_el);
+        // a mapped bundle takes the new template without touching the rest,
+        // and other sessions keep reading the frames they were pointed at
+        if (store.isOpen()) {
+            store.append(el);
+            useStore();
+        }
+        else {
+            vector<float> lut_el;
+            lut_el.push_back(allFeatures.rows);
+            allFeatures.push_back(el);
+            lut_el.push_back(allFeatures.rows - lut_el[0]);
+            lut.push_back(lut_el);
+            
+            numCandidates++;
+            bHaveCandidates = true;
+        }
         
-        numCandidates++;
-        bHaveCandidates = true;
+        // push_back reallocates the frames the default session's filter
+        // points into, so it is re-pointed either way
+        updateSession(defaultSession);
     }
     // -------------------------------------------------------------------------
     
@@ -85,13 +126,11 @@ public:
         stdFeature = allFeatures.stddev();
         
         allFeatures.zNormalizeEachCol();
-        
-        allFeatures.save(ofToDataPath("all-features-normalized.txt"));
     }
     // -------------------------------------------------------------------------
     
     
-    void normalizeQuery(Mat &query)
+    void normalizeQuery(Mat &query) const
     {
         query.subtract(meanFeature);
         query.divide(stdFeature);
@@ -100,43 +139,78 @@ public:
     // -------------------------------------------------------------------------
     void buildDatabase()
     {
-        
-        for(int i = 0; i < numCandidates; i++)
-        {
-            gvf->addTemplate();
-            
-            int idxOfGesture = lut.row(i)[0];
-            int numFramesInGesture = lut.row(i)[1];
-            
-            vector<float> query;
-            query.resize(allFeatures.cols);
-            
-            for(int f = 0; f < numFramesInGesture; f++)
-            {
-                std::memcpy(&query[0], allFeatures.row(idxOfGesture + f), sizeof(float)*allFeatures.cols);
-//
-//                cout << "gesture: " << i;
-//                for(int m = 0; m < allFeatures.cols; m++)
-//                    cout << " " << query[m];
-//                cout << endl;
-                
-                gvf->fillTemplate(i, query);
-            }
+        startSession(defaultSession);
+    }
+    // -------------------------------------------------------------------------
+    
+    
+    // -------------------------------------------------------------------------
+    //  Points a session at the templates and spreads its particles
+    // -------------------------------------------------------------------------
+    void startSession(Session &session) const
+    {
+        if (!bHaveCandidates) {
+            return;
         }
         
-        Eigen::VectorXf meanPVRS(3);
-        Eigen::VectorXf rangePVRS(3);
+        // the filter reads each gesture straight out of allFeatures using the lut
+        session.filter.setTemplates(allFeatures, lut);
         
-        meanPVRS << 0.0 , 1.0 , 1.0; // phase, speed, scale
-        rangePVRS << 0.1 , 0.1 , 0.1; // how much to spread uniformly
+        // phase, speed, scale, and how much to spread each uniformly
+        session.filter.spreadParticles(0.0, 1.0, 1.0,
+                                       0.1, 0.1, 0.1);
+    }
+    // -------------------------------------------------------------------------
+    
+    
+    // -------------------------------------------------------------------------
+    //  Picks up templates added since the session was started
+    // -------------------------------------------------------------------------
+    void updateSession(Session &session) const
+    {
+        if (!bHaveCandidates) {
+            return;
+        }
         
-        gvf->spreadParticles(meanPVRS, rangePVRS);
+        if (session.filter.getNumTemplates() == 0) {
+            startSession(session);
+        }
+        else {
+            session.filter.addTemplates(allFeatures, lut);
+        }
+    }
+    // -------------------------------------------------------------------------
+    
+    
+    // -------------------------------------------------------------------------
+    //  Follows one frame 'q' of numFeatures raw (unnormalized) values, which
+    //  is left untouched.  'subscript' is the most likely gesture and
+    //  'phase' how far through it we are, in [0, 1).
+    // -------------------------------------------------------------------------
+    void getNearestCandidate(Session &session,
+                             const float *q, int numFeatures,
+                             int &subscript,
+                             float &phase) const
+    {
+        if (!bHaveCandidates) {
+            cout << "[ERROR::pkmGVF]: Add sequences to the database first using pkmDTW::addToDatabase(el)!" << endl;
+            return;
+        }
+        
+        if (session.query.rows != 1 || session.query.cols != numFeatures) {
+            session.query.reset(1, numFeatures);
+        }
+        cblas_scopy(numFeatures, q, 1, session.query.data, 1);
+        normalizeQuery(session.query);
         
-        gvf->saveTemplates(ofToDataPath("gvf-database.txt"));
+        session.filter.infer(session.query.data);
+        session.filter.getEstimatedStatus(subscript, phase);
     }
     // -------------------------------------------------------------------------
     
     
+    // -------------------------------------------------------------------------
+    //  Single performer versions, using a session owned by the database
     // -------------------------------------------------------------------------
     void getNearestCandidate(Mat &q, 
                              float &distance, 
@@ -149,27 +223,10 @@ public:
             return;
         }
         
-        normalizeQuery(q);
-        
-        vector<float> query;
-        query.resize(q.cols);
-        std::memcpy(&query[0], q.data, sizeof(float)*q.cols);
-        
-        
-//        Eigen::VectorXf meanPVRS(3);
-//        Eigen::VectorXf rangePVRS(3);
-//        
-//        meanPVRS << 0.0 , 1.0 , 1.0; // phase, speed, scale
-//        rangePVRS << 0.1 , 0.1 , 0.1; // how much to spread uniformly
-//        
-//        gvf->spreadParticles(meanPVRS, rangePVRS);
-
-        gvf->infer(query);
-        int c;
         float i;
-        gvf->getEstimatedStatus(c, i);
-        subscript = c;
-        cout << "gvf | " << c << " " << i << endl;
+        getNearestCandidate(defaultSession, q.data, q.cols, subscript, i);
+        cout << "gvf | " << subscript << " " << i
+             << " | particles " << getNumParticles() << " ess " << getEffectiveSampleSize() << endl;
         bestPathI.push_back(i);
     }
     // -------------------------------------------------------------------------
@@ -187,30 +244,36 @@ public:
             return;
         }
         
-        Mat qmat(1,numFeatures,q,false);
-        normalizeQuery(qmat);
-        
-        vector<float> query;
-        query.resize(numFeatures);
-        std::memcpy(&query[0], q, sizeof(float)*numFeatures);
-        
-        
-        //        Eigen::VectorXf meanPVRS(3);
-        //        Eigen::VectorXf rangePVRS(3);
-        //
-        //        meanPVRS << 0.0 , 1.0 , 1.0; // phase, speed, scale
-        //        rangePVRS << 0.1 , 0.1 , 0.1; // how much to spread uniformly
-        //
-        //        gvf->spreadParticles(meanPVRS, rangePVRS);
-        
-        gvf->infer(query);
         float i;
-        gvf->getEstimatedStatus(subscript, i);
-        cout << "gvf | " << subscript << " " << roundf(i*lut.row(subscript)[1]) << "/" << lut.row(subscript)[1] << endl;
+        getNearestCandidate(defaultSession, q, numFeatures, subscript, i);
+        cout << "gvf | " << subscript << " " << roundf(i*lut.row(subscript)[1]) << "/" << lut.row(subscript)[1]
+             << " | particles " << getNumParticles() << " ess " << getEffectiveSampleSize() << endl;
         bestPathI.push_back(roundf(i*lut.row(subscript)[1]));
     }
     //
     
+    // -------------------------------------------------------------------------
+    //  Let the number of particles follow the spread of the posterior
+    //  (kld-sampling), between minParticles and the 1e6 we start with
+    // -------------------------------------------------------------------------
+    void setAdaptive(bool bAdaptive, size_t minParticles = 1000)
+    {
+        defaultSession.filter.setAdaptive(bAdaptive, minParticles);
+    }
+    
+    // particles and effective sample size of the last frame
+    size_t getNumParticles() const
+    {
+        return defaultSession.filter.getNumParticles();
+    }
+    
+    float getEffectiveSampleSize() const
+    {
+        return defaultSession.filter.getEffectiveSampleSize();
+    }
+    // -------------------------------------------------------------------------
+    
+    
     // -------------------------------------------------------------------------
     void save()
     {
@@ -220,9 +283,18 @@ public:
     // -------------------------------------------------------------------------
     
     
+    // -------------------------------------------------------------------------
+    //  Loads the binary bundle if there is one, otherwise parses and
+    //  normalizes the text files once and, if there was no bundle at all,
+    //  writes one for next time
     // -------------------------------------------------------------------------
     void load()
     {
+        string bundle = ofToDataPath("gvf-database.bin");
+        if (loadDatabase(bundle)) {
+            return;
+        }
+        
         allFeatures.load(ofToDataPath("all-features.txt"));
         lut.load(ofToDataPath("all-features-lut.txt"));
         
@@ -230,12 +302,44 @@ public:
         
         normalizeDatabase();
         
-        buildDatabase();
+        // a bundle that is there but would not open may hold templates the
+        // text files don't, so it is left alone rather than written over
+        if (!pkmTemplateStore::exists(bundle) &&
+            saveDatabase(bundle) && loadDatabase(bundle)) {
+            return;
+        }
         
-        if (numCandidates > 0) {
-            bHaveCandidates = true;
+        // startSession() does nothing until there are candidates
+        bHaveCandidates = numCandidates > 0;
+        buildDatabase();
+    }
+    // -------------------------------------------------------------------------
+    
+    
+    // -------------------------------------------------------------------------
+    //  Maps a bundle written by saveDatabase() and follows its templates
+    //  in place, without copying or renormalizing them
+    // -------------------------------------------------------------------------
+    bool loadDatabase(string filename)
+    {
+        if (!store.open(filename)) {
+            return false;
         }
         
+        // useStore() sets bHaveCandidates, which buildDatabase() needs
+        useStore();
+        buildDatabase();
+        return true;
+    }
+    // -------------------------------------------------------------------------
+    
+    
+    // -------------------------------------------------------------------------
+    //  Writes the normalized database and its statistics as a binary bundle
+    // -------------------------------------------------------------------------
+    bool saveDatabase(string filename)
+    {
+        return pkmTemplateStore::save(filename, allFeatures, lut, meanFeature, stdFeature);
     }
     // -------------------------------------------------------------------------
     
@@ -244,13 +348,26 @@ protected:
 
 private:
     
+    // point the database at the mapped bundle (empty if it is closed)
+    void useStore()
+    {
+        allFeatures.setUserData(store.getNumFrames(), store.getDimensions(), store.getFrames().data);
+        lut.setUserData(store.getNumTemplates(), 2, store.getLut().data);
+        meanFeature.setUserData(1, store.getDimensions(), store.getMean().data);
+        stdFeature.setUserData(1, store.getDimensions(), store.getStdDev().data);
+        numCandidates = lut.rows;
+        bHaveCandidates = numCandidates > 0;
+    }
+    
+    pkmTemplateStore store;
+    
     Mat lut;                // 0, what index in allFeatures is the gesture
                             // 1, how many rows in allFeatures the gesture has
     Mat allFeatures;
     
     Mat meanFeature, stdFeature;
         
-    GestureVariationFollower *gvf;
+    Session defaultSession;     // for the single performer api
     int numCandidates;
     // -------------------------------------------------------------------------
     
@@ -19,6 +19,7 @@
  */
 
 #include "pkmGaussianMixtureModel.h"
+#include "pkmFixedMat.h"
 #include <opencv2/opencv.hpp>
 #include "ofConstants.h"
 #include <vector>
@@ -34,6 +35,7 @@ pkmGaussianMixtureModel::pkmGaussianMixtureModel(double *inputData, int observat
 	// Setup the CvMats for the inputdata, covariance, means, and labels
 	m_pCvData = cvCreateMat(observations, variables, CV_32FC1);
 	m_pCvLabels = cvCreateMat( observations, 1, CV_32SC1 );
+	m_data.reset(observations, variables);
 	
 	// Set the number of parameters for the free covariance matrix
 	m_nPars = (variables + variables * (variables + 1) / 2); 
@@ -45,6 +47,7 @@ pkmGaussianMixtureModel::pkmGaussianMixtureModel(double *inputData, int observat
 	{
 		for( int d = 0; d < variables; d++ )
 		{
+			m_data.row(n)[d] = inputData[n*variables+d]/(double)map_scalar;
 			((float*)(m_pCvData->data.ptr + m_pCvData->step*n))[d] = inputData[n*variables+d]/(float)map_scalar; 
 			//printf("(%d,%d): %f\n", n,d,((float*)(m_pCvData->data.ptr + m_pCvData->step*n))[d]);
 		}
@@ -290,30 +293,29 @@ void pkmGaussianMixtureModel::modelData(int minComponents, int maxComponents,
 			// anything higher?
 		{
 			double _log_likelihood = 0;//-CV_LOG2PI * (double)m_nObservations * (double)m_nVariables / 2.;
-			CvMat *pts = cvCreateMat(m_nVariables, 1, CV_64FC1);
-			CvMat *mean = cvCreateMat(m_nVariables, 1, CV_64FC1);
 			
+			// score every observation against every kernel in one batch, in double
+			// a covariance that is not positive definite leaves no kernels: skip this k
+			pkmMultivariateNormalD gaussians;
+			if (!setupMultivariateNormal(emModel[k-minComponents], gaussians))
+				continue;
+			
+			pkm::BasicMat<double> logProbs = gaussians.logPdf(m_data);
+			
+			// log sum_d w_d p_d(x), as a log-sum-exp so tiny densities do not underflow
+			pkm::BasicMat<double> logWeights(1, k);
+			for( int d = 0; d < k; d++ )
+			{
+				logWeights.data[d] = log(cvmGet(weights, 0, d));
+			}
 			for( int n = 0; n < m_nObservations; n++ )
 			{
-				double sum = 0;
-				cvmSet(pts, 0, 0, cvmGet(m_pCvData, n, 0));
-				cvmSet(pts, 1, 0, cvmGet(m_pCvData, n, 1));
-				double* pp = (double*)(probs->data.ptr + probs->step*n);
-				
-				for( int d = 0; d < k; d++ )
-				{
-					const CvMat * covar = modelCovs[d];
-					
-					cvmSet(mean, 0, 0, cvmGet(modelMus, d, 0));
-					cvmSet(mean, 1, 0, cvmGet(modelMus, d, 1));
-					
-					double p_x = multinormalDistribution(pts, mean, covar);
-					double w_k = cvmGet(weights, 0, d);
-					sum += p_x * w_k;// * pp[d];
-					//printf("%f + %f += %f\n", p_x, w_k, sum);
-				}
-				
-				_log_likelihood -= log(sum);
+				pkm::blas::vadd(logProbs.row(n), 1, logWeights.data, 1, logProbs.row(n), 1, k);
+			}
+			pkm::BasicMat<double> logLikelihoods = logProbs.logSumExp();
+			for( int n = 0; n < m_nObservations; n++ )
+			{
+				_log_likelihood -= logLikelihoods.data[n];
 			}
 			thisLikelihood = -_log_likelihood;//emModel[k-minComponents].get_log_likelihood();
 		}
@@ -346,27 +348,62 @@ void pkmGaussianMixtureModel::modelData(int minComponents, int maxComponents,
 	
 	
 }
+// the same density for a few dimensions, with everything on the stack
+template<size_t D>
+static double fixedMultinormalDistribution(const CvMat *pts, const CvMat *mean, const CvMat *covar)
+{
+	//  add a tiny bit because of small samples
+	pkm::FixedMat<D, D, double> covarShifted, covarInverted;
+	pkm::FixedMat<D, 1, double> centered;
+	for (size_t i = 0; i < D; i++)
+	{
+		centered[i] = cvmGet(pts, i, 0) - cvmGet(mean, i, 0);
+		for (size_t j = 0; j < D; j++)
+		{
+			covarShifted(i, j) = cvmGet(covar, i, j) + 0.001;
+		}
+	}
+	
+	double det = pkm::determinant(covarShifted);
+	if (!pkm::inverse(covarShifted, covarInverted))
+		return 0;
+	
+	double ff = pow(2.0*(double)PI, -0.5*(double)D)*(pow(det,-0.5));
+	double sum = (centered.getTranspose() * covarInverted * centered)[0];
+	
+	return ff * exp(-0.5*sum);
+}
+
 double pkmGaussianMixtureModel::multinormalDistribution(const CvMat *pts, const CvMat *mean, const CvMat *covar)
 {
 	
-	int dimensions = 2;
+	int dimensions = covar->rows;
+	switch (dimensions)
+	{
+		case 1: return fixedMultinormalDistribution<1>(pts, mean, covar);
+		case 2: return fixedMultinormalDistribution<2>(pts, mean, covar);
+		case 3: return fixedMultinormalDistribution<3>(pts, mean, covar);
+		case 4: return fixedMultinormalDistribution<4>(pts, mean, covar);
+		default: break;
+	}
+	
 	//  add a tiny bit because of small samples
-	CvMat *covarShifted = cvCreateMat(2, 2, CV_64FC1);
+	CvMat *covarShifted = cvCreateMat(dimensions, dimensions, CV_64FC1);
 	cvAddS( covar, cvScalarAll(0.001), covarShifted);
 	
 	// calculate the determinant
 	double det = cvDet(covarShifted);
 	
 	// invert covariance
-	CvMat *covarInverted = cvCreateMat(2, 2, CV_64FC1);
+	CvMat *covarInverted = cvCreateMat(dimensions, dimensions, CV_64FC1);
 	cvInvert(covarShifted, covarInverted);
 	
-	double ff = (1.0/(2.0*(double)PI))*(pow(det,-0.5));
+	double ff = pow(2.0*(double)PI, -0.5*(double)dimensions)*(pow(det,-0.5));
 	
-	CvMat *centered = cvCreateMat(2, 1, CV_64FC1);
+	CvMat *centered = cvCreateMat(dimensions, 1, CV_64FC1);
 	cvSub(pts, mean, centered);
 	
-	CvMat *invxmean = cvCreateMat(2, 1, CV_64FC1);
+	CvMat *invxmean = cvCreateMat(dimensions, 1, CV_64FC1);
 	//cvGEMM(covarInverted, centered, 1., NULL, 1., invxmean);
 	cvMatMul(covarInverted, centered, invxmean);
 	
@@ -393,6 +430,31 @@ double pkmGaussianMixtureModel::multinormalDistribution(const CvMat *pts, const
 	
 }
 
+bool pkmGaussianMixtureModel::setupMultivariateNormal(CvEM &model, pkmMultivariateNormalD &gaussians)
+{
+	int numClusters = model.get_nclusters();
+	const CvMat **modelCovs = model.get_covs();
+	const CvMat *modelMus = model.get_means();
+	
+	pkm::BasicMat<double> means(numClusters, m_nVariables);
+	std::vector<pkm::BasicMat<double> > covs(numClusters);
+	for (int k = 0; k < numClusters; k++)
+	{
+		covs[k].reset(m_nVariables, m_nVariables);
+		for (int i = 0; i < m_nVariables; i++)
+		{
+			means.row(k)[i] = cvmGet(modelMus, k, i);
+			
+			//  add a tiny bit because of small samples (same as multinormalDistribution)
+			for (int j = 0; j < m_nVariables; j++)
+			{
+				covs[k].row(i)[j] = cvmGet(modelCovs[k], i, j) + 0.001;
+			}
+		}
+	}
+	return gaussians.setGaussians(means, covs);
+}
+
 /*void pkmGaussianMixtureModel::getLikelihood(int x, int y)
  {
  
@@ -406,18 +468,16 @@ void pkmGaussianMixtureModel::getLikelihoodMap(int rows, int cols, unsigned char
     if(!bModeled)
         return;
     
-	CvEM myModel = emModel[bestModel];
+	CvEM &myModel = emModel[bestModel];
 	const CvMat **modelCovs = myModel.get_covs();
 	const CvMat *modelMus = myModel.get_means();
 	const CvMat *modelWeights = myModel.get_weights();
 	int numClusters = myModel.get_nclusters();
-	CvMat *pts = cvCreateMat(m_nVariables, 1, CV_64FC1);
-	CvMat *mean = cvCreateMat(m_nVariables, 1, CV_64FC1);
 	
-	double p = 0;
-	double weight;
-	double max = 0;
-	double prob;
+	pkmMultivariateNormalD gaussians;
+	if (!setupMultivariateNormal(myModel, gaussians))
+		return;
+	
 	filePtr << "clusters: " << numClusters << "\n";
 	filePtr << "likelihood: " << m_Likelihood << "\n";
 	filePtr << "BIC: " << m_BIC << "\n";
@@ -426,24 +486,14 @@ void pkmGaussianMixtureModel::getLikelihoodMap(int rows, int cols, unsigned char
     float best_weight = 0;
     bestCluster = 0;
     
+	std::vector<double> weights(numClusters);
 	for (int k = 0; k < numClusters; k++)
 	{
 		const CvMat * covar = modelCovs[k];
-		//printf("covar: (%f, %f, %f, %f)\n", covar->data.ptr[0], \
-		covar->data.ptr[1], \
-		covar->data.ptr[2], \
-		covar->data.ptr[3]);
-		//const double *meanVals = (const double *)(modelMus->data.ptr + k*modelWeights->step);
-		
-		cvmSet(mean, 0, 0, cvmGet(modelMus, k, 0));
-		cvmSet(mean, 1, 0, cvmGet(modelMus, k, 1));
-		
-		//const double *weightPtr = (const double *)(modelWeights->data.ptr + k*modelWeights->step);
-		//weight = weightPtr[k];
-		weight = cvmGet(modelWeights, 0, k);
+		weights[k] = cvmGet(modelWeights, 0, k);
         
-        if (best_weight < weight) {
-            best_weight = weight;
+        if (best_weight < weights[k]) {
+            best_weight = weights[k];
             bestCluster = k;
         }
 		
@@ -451,22 +501,32 @@ void pkmGaussianMixtureModel::getLikelihoodMap(int rows, int cols, unsigned char
 		
 		filePtr << "covar: " << cvmGet(covar, 0, 0) << "\n";
 		
-		filePtr << "weight: " << weight << "\n";
+		filePtr << "weight: " << weights[k] << "\n";
+	}
+	
+	// score a whole row of pixels against every cluster at once
+	pkm::BasicMat<double> pts(cols, m_nVariables, true);
+	pkm::BasicMat<double> logProbs(cols, numClusters);
+	for (int j = 0; j < cols; j++)
+	{
+		pts.row(j)[0] = (double)j;
+	}
+	
+	double scale = (double)(rows*cols);
+	for (int i = 0; i < rows; i++)
+	{
+		pkm::blas::vfill((double)i, pts.data + 1, m_nVariables, cols);
+		gaussians.logPdf(pts, logProbs);
 		
-		for (int i = 0; i < rows; i++)
+		for (int k = 0; k < numClusters; k++)
 		{
 			for (int j = 0; j < cols; j++)
 			{
-				cvmSet(pts, 0, 0, (double)j);
-				cvmSet(pts, 1, 0, (double)i);	
-				prob = multinormalDistribution(pts, mean, covar);
-				map[j+i*widthstep] += (int)((weight * prob)*(double)(rows*cols));				
-				
+				double prob = exp(logProbs.row(j)[k]);
+				map[j+i*widthstep] += (int)((weights[k] * prob)*scale);
 			}
 		}
 	}
-	cvReleaseMat(&mean);
-	cvReleaseMat(&pts);
 }
 
 int pkmGaussianMixtureModel::getNumberOfClusters()
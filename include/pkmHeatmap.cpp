@@ -0,0 +1,335 @@
+/*
+ *  pkmHeatmap.cpp
+ *
+
+ colormapped 8-bit rendering and pooled previews of float matrices.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmHeatmap.h"
+#include "pkmImage.h"
+#include "pkmThreadPool.h"
+#include <algorithm>
+#include <vector>
+#include <math.h>
+
+// 10 evenly spaced samples of each of the matplotlib colormaps, linearly
+// interpolated out to the 256 entry table
+static const uint32_t viridisSamples[10] = {
+    0x440154, 0x482878, 0x3e4989, 0x31688e, 0x26828e,
+    0x1f9e89, 0x35b779, 0x6ece58, 0xb5de2b, 0xfde725
+};
+static const uint32_t magmaSamples[10] = {
+    0x000004, 0x180f3d, 0x440f76, 0x721f81, 0x9e2f7f,
+    0xcd4071, 0xf1605d, 0xfd9668, 0xfeca8d, 0xfcfdbf
+};
+static const uint32_t infernoSamples[10] = {
+    0x000004, 0x1b0c41, 0x4a0c6b, 0x781c6d, 0xa52c60,
+    0xcf4446, 0xed6925, 0xfb9b06, 0xf7d13d, 0xfcffa4
+};
+static const uint32_t plasmaSamples[10] = {
+    0x0d0887, 0x47039f, 0x7301a8, 0x9c179e, 0xbd3786,
+    0xd8576b, 0xed7953, 0xfb9f3a, 0xfdca26, 0xf0f921
+};
+static const uint32_t graySamples[2] = {
+    0x000000, 0xffffff
+};
+
+// rows handed to each thread at a time when rendering
+#define PKM_HEATMAP_BAND 16
+
+// samples used to estimate percentiles
+#define PKM_HEATMAP_SAMPLES 65536
+
+pkmHeatmap::pkmHeatmap(Colormap colormap)
+{
+    bLogScale = false;
+    bFixedRange = false;
+    lowPercentile = 0.0f;
+    highPercentile = 1.0f;
+    low = 0.0f;
+    high = 1.0f;
+    setColormap(colormap);
+}
+
+void pkmHeatmap::setColormap(Colormap colormap)
+{
+    const uint32_t *samples;
+    size_t numSamples;
+    switch (colormap)
+    {
+        case COLORMAP_VIRIDIS:  samples = viridisSamples;   numSamples = 10;   break;
+        case COLORMAP_MAGMA:    samples = magmaSamples;     numSamples = 10;   break;
+        case COLORMAP_INFERNO:  samples = infernoSamples;   numSamples = 10;   break;
+        case COLORMAP_PLASMA:   samples = plasmaSamples;    numSamples = 10;   break;
+        default:                samples = graySamples;      numSamples = 2;    break;
+    }
+
+    for (size_t i = 0; i < 256; i++)
+    {
+        float t = i * (numSamples - 1) / 255.0f;
+        size_t s = std::min<size_t>((size_t)t, numSamples - 2);
+        float frac = t - s;
+        for (size_t ch = 0; ch < 3; ch++) {
+            int shift = 16 - 8 * ch;
+            float a = (samples[s] >> shift) & 0xff;
+            float b = (samples[s + 1] >> shift) & 0xff;
+            lut[i*4 + ch] = (uint8_t)lrintf(a + (b - a) * frac);
+        }
+        lut[i*4 + 3] = 255;
+    }
+}
+
+void pkmHeatmap::setPercentileClip(float lowPercentile, float highPercentile)
+{
+#ifdef DEBUG
+    assert(lowPercentile >= 0 && highPercentile <= 1 && lowPercentile <= highPercentile);
+#endif
+    this->lowPercentile = lowPercentile;
+    this->highPercentile = highPercentile;
+    bFixedRange = false;
+}
+
+void pkmHeatmap::setRange(float low, float high)
+{
+    this->low = low;
+    this->high = high;
+    bFixedRange = true;
+}
+
+void pkmHeatmap::findRange(const float *src, size_t rows, size_t cols, size_t srcStride)
+{
+    if (bFixedRange || rows == 0 || cols == 0) {
+        return;
+    }
+
+    if (lowPercentile <= 0.0f && highPercentile >= 1.0f)
+    {
+        // exact min/max, one reduction per band.  comparisons with NaN are
+        // false, so NaNs are skipped without a separate test.
+        size_t numBands = (rows + PKM_HEATMAP_BAND - 1) / PKM_HEATMAP_BAND;
+        std::vector<float> bandMin(numBands, INFINITY), bandMax(numBands, -INFINITY);
+        pkm::parallelFor(numBands, 1, [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; b++) {
+                float lo = INFINITY, hi = -INFINITY;
+                size_t rEnd = std::min(rows, (b + 1) * PKM_HEATMAP_BAND);
+                for (size_t r = b * PKM_HEATMAP_BAND; r < rEnd; r++) {
+                    const float *p = src + r * srcStride;
+                    for (size_t c = 0; c < cols; c++) {
+                        lo = p[c] < lo ? p[c] : lo;
+                        hi = p[c] > hi ? p[c] : hi;
+                    }
+                }
+                bandMin[b] = lo;
+                bandMax[b] = hi;
+            }
+        });
+        low = *std::min_element(bandMin.begin(), bandMin.end());
+        high = *std::max_element(bandMax.begin(), bandMax.end());
+    }
+    else
+    {
+        // percentiles of an evenly strided sample of the finite values
+        size_t total = rows * cols;
+        size_t step = std::max<size_t>(1, total / PKM_HEATMAP_SAMPLES);
+        std::vector<float> sample;
+        sample.reserve(total / step + 1);
+        for (size_t i = 0; i < total; i += step) {
+            float v = src[(i / cols) * srcStride + i % cols];
+            if (isfinite(v)) {
+                sample.push_back(v);
+            }
+        }
+        if (sample.empty()) {
+            low = high = 0.0f;
+            return;
+        }
+        size_t n = sample.size();
+        size_t lowRank = std::min<size_t>((size_t)(lowPercentile * (n - 1) + 0.5f), n - 1);
+        size_t highRank = std::min<size_t>((size_t)(highPercentile * (n - 1) + 0.5f), n - 1);
+        std::nth_element(sample.begin(), sample.begin() + lowRank, sample.end());
+        low = sample[lowRank];
+        std::nth_element(sample.begin(), sample.begin() + highRank, sample.end());
+        high = sample[highRank];
+    }
+
+    if (!isfinite(low) || !isfinite(high)) {
+        low = high = 0.0f;
+    }
+}
+
+void pkmHeatmap::render(const float *src, size_t rows, size_t cols, size_t srcStride,
+                        uint8_t *dst, size_t dstStride, size_t channels)
+{
+#ifdef DEBUG
+    assert(channels == 3 || channels == 4);
+#endif
+    findRange(src, rows, cols, srcStride);
+
+    // mode 0 linear, 1 log(v / lo), 2 log(1 + v - lo)
+    int mode = 0;
+    float range = high - low;
+    if (bLogScale) {
+        if (low > 0.0f) {
+            mode = 1;
+            range = logf(high / low);
+        }
+        else {
+            mode = 2;
+            range = log1pf(high - low);
+        }
+    }
+    float scale = range > 0.0f ? 255.0f / range : 0.0f;
+    float offset = mode == 0 ? 0.5f - low * scale : 0.5f;
+    float invLow = mode == 1 ? 1.0f / low : 0.0f;
+    float negLow = -low;
+    float threshold = mode == 1 ? 1.0f : 0.0f;
+    float lo = 0.0f, hi = 255.0f;
+    const uint8_t *table = lut;
+    static const uint8_t nanColor[4] = { 0, 0, 0, 0 };
+
+    pkm::parallelFor(rows, PKM_HEATMAP_BAND, [&](size_t begin, size_t end) {
+        std::vector<float> buf(cols);
+        std::vector<int> index(cols);
+        for (size_t r = begin; r < end; r++)
+        {
+            const float *p = src + r * srcStride;
+            uint8_t *out = dst + r * dstStride;
+
+            // value -> table position, clipped to the table
+            if (mode == 1) {
+                vDSP_vsmul(p, 1, &invLow, &buf[0], 1, cols);
+                vDSP_vthr(&buf[0], 1, &threshold, &buf[0], 1, cols);
+                pkm::math::log(&buf[0], &buf[0], cols);
+            }
+            else if (mode == 2) {
+                vDSP_vsadd(p, 1, &negLow, &buf[0], 1, cols);
+                vDSP_vthr(&buf[0], 1, &threshold, &buf[0], 1, cols);
+                pkm::math::log1p(&buf[0], &buf[0], cols);
+            }
+            vDSP_vsmsa(mode == 0 ? p : &buf[0], 1, &scale, &offset, &buf[0], 1, cols);
+            vDSP_vclip(&buf[0], 1, &lo, &hi, &buf[0], 1, cols);
+            vDSP_vfix32(&buf[0], 1, &index[0], 1, cols);
+
+            // gather from the table, NaNs read as transparent
+            if (channels == 4) {
+                for (size_t c = 0; c < cols; c++) {
+                    const uint8_t *color = p[c] == p[c] ? table + index[c] * 4 : nanColor;
+                    out[c*4 + 0] = color[0];
+                    out[c*4 + 1] = color[1];
+                    out[c*4 + 2] = color[2];
+                    out[c*4 + 3] = color[3];
+                }
+            }
+            else {
+                for (size_t c = 0; c < cols; c++) {
+                    const uint8_t *color = p[c] == p[c] ? table + index[c] * 4 : nanColor;
+                    out[c*3 + 0] = color[0];
+                    out[c*3 + 1] = color[1];
+                    out[c*3 + 2] = color[2];
+                }
+            }
+        }
+    });
+}
+
+bool pkmHeatmap::savePPM(const std::string &filename, const Mat &m)
+{
+    std::vector<uint8_t> rgb(m.rows * m.cols * 3);
+    render(m, rgb.empty() ? NULL : &rgb[0], m.cols * 3, 3);
+    return pkmImageSink::savePPM(filename, rgb.empty() ? NULL : &rgb[0], m.rows, m.cols, m.cols * 3);
+}
+
+void pkmHeatmap::poolRow(const float *row, size_t cols, size_t outCols, Pooling pooling,
+                         float *out, bool bFirst)
+{
+    for (size_t j = 0; j < outCols; j++)
+    {
+        size_t c0 = j * cols / outCols;
+        size_t c1 = std::max(c0 + 1, (j + 1) * cols / outCols);
+        float v;
+        switch (pooling)
+        {
+            case POOL_MIN:
+                vDSP_minv(row + c0, 1, &v, c1 - c0);
+                out[j] = bFirst ? v : std::min(out[j], v);
+                break;
+            case POOL_MAX:
+                vDSP_maxv(row + c0, 1, &v, c1 - c0);
+                out[j] = bFirst ? v : std::max(out[j], v);
+                break;
+            default:
+                // summed here, divided once the block's rows are all in
+                vDSP_sve(row + c0, 1, &v, c1 - c0);
+                out[j] = bFirst ? v : out[j] + v;
+                break;
+        }
+    }
+}
+
+void pkmHeatmap::pool(const RowSource &rowAt, size_t rows, size_t cols,
+                      Mat &preview, size_t outRows, size_t outCols, Pooling pooling)
+{
+#ifdef DEBUG
+    assert(outRows <= rows && outCols <= cols);
+#endif
+    if (preview.rows != outRows || preview.cols != outCols) {
+        preview.reset(outRows, outCols);
+    }
+    if (outRows == 0 || outCols == 0) {
+        return;
+    }
+
+    pkm::parallelFor(outRows, 1, [&](size_t begin, size_t end) {
+        std::vector<float> scratch(cols);
+        for (size_t i = begin; i < end; i++)
+        {
+            size_t r0 = i * rows / outRows;
+            size_t r1 = std::max(r0 + 1, (i + 1) * rows / outRows);
+            float *out = preview.data + i * outCols;
+
+            for (size_t r = r0; r < r1; r++) {
+                poolRow(rowAt(r, &scratch[0]), cols, outCols, pooling, out, r == r0);
+            }
+
+            if (pooling == POOL_MEAN) {
+                for (size_t j = 0; j < outCols; j++) {
+                    size_t c0 = j * cols / outCols;
+                    size_t c1 = std::max(c0 + 1, (j + 1) * cols / outCols);
+                    out[j] /= (float)((r1 - r0) * (c1 - c0));
+                }
+            }
+        }
+    });
+}
+
+void pkmHeatmap::downsample(const RowProvider &rowAt, size_t rows, size_t cols,
+                            Mat &preview, size_t outRows, size_t outCols, Pooling pooling)
+{
+    pool([&](size_t r, float *scratch) -> const float * {
+            rowAt(r, scratch);
+            return scratch;
+        }, rows, cols, preview, outRows, outCols, pooling);
+}
+
+void pkmHeatmap::downsample(const Mat &m, Mat &preview, size_t outRows, size_t outCols, Pooling pooling)
+{
+    pool([&](size_t r, float *) -> const float * {
+            return m.data + r * m.cols;
+        }, m.rows, m.cols, preview, outRows, outCols, pooling);
+}
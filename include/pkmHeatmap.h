@@ -0,0 +1,127 @@
+/*
+ *  pkmHeatmap.h
+ *
+
+ renders a pkm::Mat (dtw cost matrices, gmm likelihood maps, ...) as an
+ 8-bit RGB or RGBA image through a 256 entry colormap lookup table, with
+ optional log scaling and percentile clipping of the value range.  rows are
+ mapped in bands across the shared thread pool.
+
+ matrices too large to hold in memory can be previewed by pooling them down
+ (min, max or mean) from a row callback, one source row at a time.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include "pkmMatrix.h"
+#include <stdint.h>
+#include <string>
+#include <functional>
+
+using namespace pkm;
+
+class pkmHeatmap
+{
+public:
+    enum Colormap
+    {
+        COLORMAP_GRAY,
+        COLORMAP_VIRIDIS,
+        COLORMAP_MAGMA,
+        COLORMAP_INFERNO,
+        COLORMAP_PLASMA
+    };
+
+    enum Pooling
+    {
+        POOL_MEAN,
+        POOL_MIN,
+        POOL_MAX
+    };
+
+    // fills a source row (cols floats) into out; called concurrently from
+    // the pool's threads, so it must be safe to call for different rows at once
+    typedef std::function<void(size_t row, float *out)> RowProvider;
+
+    pkmHeatmap(Colormap colormap = COLORMAP_VIRIDIS);
+
+    void setColormap(Colormap colormap);
+
+    // log scaling maps log(v / lo) when the range is positive, otherwise
+    // log(1 + v - lo), so costs starting at zero still get a log axis
+    void setLogScale(bool bLogScale)    { this->bLogScale = bLogScale; }
+
+    // the value range comes from the data's lowPercentile and highPercentile
+    // (in [0, 1]), estimated from at most 64k samples.  0 and 1 use the
+    // exact min and max.
+    void setPercentileClip(float lowPercentile, float highPercentile);
+
+    // fixed value range instead of one taken from every rendered image
+    void setRange(float low, float high);
+    void setAutoRange()                 { bFixedRange = false; }
+
+    // range used by the last render
+    float getLow() const                { return low; }
+    float getHigh() const               { return high; }
+
+    // maps a rows x cols float image into channels (3 = RGB, 4 = RGBA)
+    // bytes per pixel of dst.  srcStride is in floats, dstStride in bytes.
+    // NaNs are drawn as transparent black.
+    void render(const float *src, size_t rows, size_t cols, size_t srcStride,
+                uint8_t *dst, size_t dstStride, size_t channels = 3);
+
+    void render(const Mat &m, uint8_t *dst, size_t dstStride, size_t channels = 3)
+    {
+        render(m.data, m.rows, m.cols, m.cols, dst, dstStride, channels);
+    }
+
+    // render and write a binary PPM
+    bool savePPM(const std::string &filename, const Mat &m);
+
+    // pools a rows x cols source down to preview (outRows x outCols), each
+    // output cell covering a near-equal block of the source.  only one row
+    // per thread is ever held, so the source never has to exist in full.
+    static void downsample(const RowProvider &rowAt, size_t rows, size_t cols,
+                           Mat &preview, size_t outRows, size_t outCols,
+                           Pooling pooling = POOL_MEAN);
+
+    static void downsample(const Mat &m, Mat &preview, size_t outRows, size_t outCols,
+                           Pooling pooling = POOL_MEAN);
+
+    // the 256 x 4 (RGBA) lookup table
+    const uint8_t * getLUT() const      { return lut; }
+
+private:
+    void findRange(const float *src, size_t rows, size_t cols, size_t srcStride);
+
+    // rowAt returns a pointer to the source row, either its own or the scratch row it is given
+    typedef std::function<const float *(size_t row, float *scratch)> RowSource;
+
+    static void pool(const RowSource &rowAt, size_t rows, size_t cols,
+                     Mat &preview, size_t outRows, size_t outCols, Pooling pooling);
+    static void poolRow(const float *row, size_t cols, size_t outCols, Pooling pooling,
+                        float *out, bool bFirst);
+
+    uint8_t     lut[256 * 4];
+
+    bool        bLogScale;
+    bool        bFixedRange;
+    float       lowPercentile, highPercentile;
+    float       low, high;
+};
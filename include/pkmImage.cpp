@@ -21,3 +21,152 @@
 
 #include "pkmImage.h"
 
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+void pkmImageSink::minMax(const float *src, size_t rows, size_t cols, size_t srcStride, float &min, float &max)
+{
+	float lo = HUGE_VALF, hi = -HUGE_VALF;
+	for (size_t r = 0; r < rows; r++)
+	{
+		const float *p = src + r * srcStride;
+		size_t i = 0;
+#if defined(__SSE2__)
+		if (cols >= 4) {
+			__m128 vlo = _mm_set1_ps(lo), vhi = _mm_set1_ps(hi);
+			for (; i + 4 <= cols; i += 4) {
+				__m128 x = _mm_loadu_ps(p + i);
+				vlo = _mm_min_ps(x, vlo);  // NaNs in x are skipped
+				vhi = _mm_max_ps(x, vhi);
+			}
+			float l[4], h[4];
+			_mm_storeu_ps(l, vlo);
+			_mm_storeu_ps(h, vhi);
+			for (int k = 0; k < 4; k++) {
+				lo = l[k] < lo ? l[k] : lo;
+				hi = h[k] > hi ? h[k] : hi;
+			}
+		}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+		if (cols >= 4) {
+			float32x4_t vlo = vdupq_n_f32(lo), vhi = vdupq_n_f32(hi);
+			for (; i + 4 <= cols; i += 4) {
+				float32x4_t x = vld1q_f32(p + i);
+				vlo = vminnmq_f32(vlo, x);
+				vhi = vmaxnmq_f32(vhi, x);
+			}
+			lo = vminnmvq_f32(vlo);
+			hi = vmaxnmvq_f32(vhi);
+		}
+#endif
+		for (; i < cols; i++) {
+			lo = p[i] < lo ? p[i] : lo;
+			hi = p[i] > hi ? p[i] : hi;
+		}
+	}
+	min = lo;
+	max = hi;
+}
+
+void pkmImageSink::convertFloatToUInt8(const float *src, size_t rows, size_t cols, size_t srcStride,
+									   uint8_t *dst, size_t dstStride, bool normalize)
+{
+	// pixel = x * scale + offset, then round and saturate
+	float scale = 255.0f, offset = 0.0f;
+	if (normalize) {
+		float min, max;
+		minMax(src, rows, cols, srcStride, min, max);
+		scale = (max > min) ? 255.0f / (max - min) : 0.0f;
+		offset = -min * scale;
+	}
+	
+	for (size_t r = 0; r < rows; r++)
+	{
+		const float *p = src + r * srcStride;
+		uint8_t *out = dst + r * dstStride;
+		size_t i = 0;
+#if defined(__SSE2__)
+		// clamp to [0, 255] first: cvtps gives 0x80000000 for anything past
+		// int32 (or NaN), which the packs would saturate to 0 rather than 255.
+		// max takes its second operand for NaN, so NaN still comes out 0.
+		// cvtps then rounds to nearest, and the two packs narrow to bytes.
+		__m128 vscale = _mm_set1_ps(scale), voffset = _mm_set1_ps(offset);
+		__m128 vlo = _mm_setzero_ps(), vhi = _mm_set1_ps(255.0f);
+		for (; i + 16 <= cols; i += 16) {
+			__m128i q[4];
+			for (int k = 0; k < 4; k++) {
+				__m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p + i + 4 * k), vscale), voffset);
+				q[k] = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, vlo), vhi));
+			}
+			__m128i ab = _mm_packs_epi32(q[0], q[1]);
+			__m128i cd = _mm_packs_epi32(q[2], q[3]);
+			_mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(ab, cd));
+		}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+		// the same clamp as SSE2: maxnm takes the number over NaN, so NaN
+		// comes out 0 here too rather than relying on what cvtn makes of it
+		float32x4_t vscale = vdupq_n_f32(scale), voffset = vdupq_n_f32(offset);
+		float32x4_t vlo = vdupq_n_f32(0.0f), vhi = vdupq_n_f32(255.0f);
+		for (; i + 8 <= cols; i += 8) {
+			float32x4_t x = vmlaq_f32(voffset, vld1q_f32(p + i), vscale);
+			float32x4_t y = vmlaq_f32(voffset, vld1q_f32(p + i + 4), vscale);
+			int32x4_t a = vcvtnq_s32_f32(vminq_f32(vmaxnmq_f32(x, vlo), vhi));
+			int32x4_t b = vcvtnq_s32_f32(vminq_f32(vmaxnmq_f32(y, vlo), vhi));
+			int16x8_t ab = vcombine_s16(vqmovn_s32(a), vqmovn_s32(b));
+			vst1_u8(out + i, vqmovun_s16(ab));
+		}
+#endif
+		for (; i < cols; i++) {
+			float v = p[i] * scale + offset;
+			// written so that NaN fails the test and comes out 0, as above
+			v = v >= 0.0f ? std::min(v, 255.0f) : 0.0f;
+			out[i] = (uint8_t)lrintf(v);
+		}
+	}
+}
+
+bool pkmImageSink::savePGM(const std::string &filename, const uint8_t *pixels, size_t rows, size_t cols, size_t stride)
+{
+	FILE *fp = fopen(filename.c_str(), "wb");
+	if (!fp) {
+		return false;
+	}
+	fprintf(fp, "P5\n%lu %lu\n255\n", cols, rows);
+	bool ok = true;
+	for (size_t r = 0; r < rows && ok; r++) {
+		ok = fwrite(pixels + r * stride, 1, cols, fp) == cols;
+	}
+	fclose(fp);
+	return ok;
+}
+
+bool pkmImageSink::savePPM(const std::string &filename, const uint8_t *rgb, size_t rows, size_t cols, size_t stride)
+{
+	FILE *fp = fopen(filename.c_str(), "wb");
+	if (!fp) {
+		return false;
+	}
+	fprintf(fp, "P6\n%lu %lu\n255\n", cols, rows);
+	bool ok = true;
+	for (size_t r = 0; r < rows && ok; r++) {
+		ok = fwrite(rgb + r * stride, 1, 3 * cols, fp) == 3 * cols;
+	}
+	fclose(fp);
+	return ok;
+}
+
+bool pkmImageSink::savePGM(const std::string &filename, const pkm::Mat &m, bool normalize)
+{
+	uint8_t *pixels = (uint8_t *)malloc(m.rows * m.cols);
+	convertFloatToUInt8(m, pixels, m.cols, normalize);
+	bool ok = savePGM(filename, pixels, m.rows, m.cols, m.cols);
+	free(pixels);
+	return ok;
+}
@@ -21,26 +21,64 @@
 #pragma once
 
 #include <Accelerate/Accelerate.h>
-#include "ofImage.h"
+#include <stdint.h>
+#include <string>
 #include "pkmMatrix.h"
+
+// define PKM_HEADLESS to build without openFrameworks (e.g. batch servers);
+// pkmImageSink works either way, pkmImage needs ofImage
+#ifndef PKM_HEADLESS
+#define WITH_OF
+#endif
+
+#ifdef WITH_OF
+#include "ofImage.h"
+#endif
+
+// float -> 8-bit conversion straight into caller memory, plus PGM/PPM dumps
+class pkmImageSink
+{
+public:
+	// converts a rows x cols float image into 8-bit pixels in one fused pass
+	// per row: scale, round, and saturate to [0, 255].  with normalize the
+	// data's [min, max] maps to [0, 255] (min/max found in a single
+	// reduction pass first), otherwise [0, 1] maps to [0, 255].
+	//
+	// srcStride is in floats, dstStride in bytes, so either side can be a
+	// view into a larger buffer.
+	static void convertFloatToUInt8(const float *src, size_t rows, size_t cols, size_t srcStride,
+									uint8_t *dst, size_t dstStride, bool normalize = true);
+	
+	static void convertFloatToUInt8(const pkm::Mat &m, uint8_t *dst, size_t dstStride, bool normalize = true)
+	{
+		convertFloatToUInt8(m.data, m.rows, m.cols, m.cols, dst, dstStride, normalize);
+	}
+	
+	// min and max of a strided float image in a single pass
+	static void minMax(const float *src, size_t rows, size_t cols, size_t srcStride, float &min, float &max);
+	
+	// binary (P5) grayscale and (P6) rgb writers, stride in bytes
+	static bool savePGM(const std::string &filename, const uint8_t *pixels, size_t rows, size_t cols, size_t stride);
+	static bool savePPM(const std::string &filename, const uint8_t *rgb, size_t rows, size_t cols, size_t stride);
+	
+	// convert and write a matrix as a grayscale heatmap
+	static bool savePGM(const std::string &filename, const pkm::Mat &m, bool normalize = true);
+};
+
+#ifdef WITH_OF
 class pkmImage
 {
 public:
 	pkmImage()
 	{
-		data_scaled = NULL;
+		bAllocated = false;
 	}
 	~pkmImage()
 	{
-		if (bAllocated) {
-			free(data_scaled);
-		}
 	}
 	
 	void allocate(int rows, int cols)
 	{
-		data_scaled = (float *)malloc(sizeof(float) * rows * cols);
-		pixels = (char *)malloc(sizeof(char) * rows * cols);
 		image.allocate(cols, rows, OF_IMAGE_GRAYSCALE);
 		bAllocated = true;
 		r = rows;
@@ -48,37 +86,16 @@ public:
 		len = r*c;
 	}
 	
+	// converts straight into the ofImage's pixels, no intermediate buffers
 	void convertFloatToOFImage(float *data, bool normalize = true)
 	{
-		if (normalize) {
-			float max, min;
-			vDSP_maxv(data, 1, &max, len);
-			vDSP_minv(data, 1, &min, len);
-			
-			min = -min;
-			vDSP_vsadd(data, 1, &min, data_scaled, 1, len);
-			min = -min;
-			float scale = 255.0 / (max - min);
-			vDSP_vsmul(data_scaled, 1, &scale, data_scaled, 1, len);
-			vDSP_vfix8(data_scaled, 1, pixels, 1, len);
-			//image.setFromPixels((unsigned char *)pixels, c, r, OF_IMAGE_GRAYSCALE);
-			memcpy(image.getPixels(), pixels, len*sizeof(unsigned char));
-			image.update();
-		}
-		else {
-			float scale = 255.0;
-			vDSP_vsmul(data, 1, &scale, data_scaled, 1, len);
-			vDSP_vfix8(data_scaled, 1, pixels, 1, len);
-			memcpy(image.getPixels(), pixels, len*sizeof(unsigned char));
-			//image.setFromPixels((unsigned char *)pixels, c, r, OF_IMAGE_GRAYSCALE);
-			image.update();
-		}
+		pkmImageSink::convertFloatToUInt8(data, r, c, c, image.getPixels(), c, normalize);
+		image.update();
 	}
 	
 	int len;
 	int r,c;
-	char *pixels;
-	float *data_scaled;
 	ofImage image;
 	bool bAllocated;
-};
\ No newline at end of file
+};
+#endif
@@ -0,0 +1,1257 @@
+/*
+ *  pkmMath.cpp
+ *
+
+ vectorized float transcendentals.
+
+ the polynomials and range reductions for PRECISE are cephes' (exp, log,
+ sin and cos); the FAST exp and log polynomials are minimax fits of the
+ same forms with fewer terms.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmMath.h"
+#include "pkmThreadPool.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// elements per thread when split
+#define PKM_MATH_CHUNK 8192
+
+// most blocks of rows a column reduction is split into
+#define PKM_MATH_MAX_BLOCKS 64
+
+// |x| beyond which the sin/cos reduction loses bits, and PRECISE falls back to libm
+#define PKM_MATH_TRIG_MAX 8192.0f
+
+namespace
+{
+    // the vector operations the kernels are written against.  V is a vector
+    // of floats, I of int32 and M a lane mask.
+#if defined(__AVX512F__)
+    struct Simd
+    {
+        typedef __m512 V;
+        typedef __m512i I;
+        typedef __mmask16 M;
+        enum { W = 16 };
+        static const char * name()                      { return "avx512"; }
+
+        static V load(const float *p)                   { return _mm512_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm512_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm512_set1_ps(f); }
+        static V add(V a, V b)                          { return _mm512_add_ps(a, b); }
+        static V sub(V a, V b)                          { return _mm512_sub_ps(a, b); }
+        static V mul(V a, V b)                          { return _mm512_mul_ps(a, b); }
+        static V div(V a, V b)                          { return _mm512_div_ps(a, b); }
+        static V fma(V a, V b, V c)                     { return _mm512_fmadd_ps(a, b, c); }
+        static V min(V a, V b)                          { return _mm512_min_ps(a, b); }
+        static V max(V a, V b)                          { return _mm512_max_ps(a, b); }
+        static V sqrt(V a)                              { return _mm512_sqrt_ps(a); }
+        static V floor(V a)                             { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+        static V ceil(V a)                              { return _mm512_roundscale_ps(a, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC); }
+
+        static V bitAnd(V a, V b)                       { return asFloat(_mm512_and_si512(asInt(a), asInt(b))); }
+        static V bitOr(V a, V b)                        { return asFloat(_mm512_or_si512(asInt(a), asInt(b))); }
+        static V bitXor(V a, V b)                       { return asFloat(_mm512_xor_si512(asInt(a), asInt(b))); }
+
+        static M lt(V a, V b)                           { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+        static M le(V a, V b)                           { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+        static M eq(V a, V b)                           { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+        static M isNaN(V a)                             { return _mm512_cmp_ps_mask(a, a, _CMP_UNORD_Q); }
+        static M maskOr(M a, M b)                       { return a | b; }
+        static M maskNot(M a)                           { return (M)~a; }
+        static bool any(M a)                            { return a != 0; }
+        static V select(M m, V a, V b)                  { return _mm512_mask_blend_ps(m, b, a); }
+
+        static I iset(int32_t i)                        { return _mm512_set1_epi32(i); }
+        static I iadd(I a, I b)                         { return _mm512_add_epi32(a, b); }
+        static I isub(I a, I b)                         { return _mm512_sub_epi32(a, b); }
+        static I iand(I a, I b)                         { return _mm512_and_si512(a, b); }
+        static I iandnot(I a, I b)                      { return _mm512_andnot_si512(a, b); }
+        static I ior(I a, I b)                          { return _mm512_or_si512(a, b); }
+        template<int s> static I shl(I a)               { return _mm512_slli_epi32(a, s); }
+        template<int s> static I shr(I a)               { return _mm512_srli_epi32(a, s); }
+        template<int s> static I sra(I a)               { return _mm512_srai_epi32(a, s); }
+        static M ieq(I a, I b)                          { return _mm512_cmpeq_epi32_mask(a, b); }
+        static I round(V a)                             { return _mm512_cvtps_epi32(a); }
+        static I truncate(V a)                          { return _mm512_cvttps_epi32(a); }
+        static V toFloat(I a)                           { return _mm512_cvtepi32_ps(a); }
+        static I asInt(V a)                             { return _mm512_castps_si512(a); }
+        static V asFloat(I a)                           { return _mm512_castsi512_ps(a); }
+    };
+#elif defined(__AVX2__) && defined(__FMA__)
+    struct Simd
+    {
+        typedef __m256 V;
+        typedef __m256i I;
+        typedef __m256 M;
+        enum { W = 8 };
+        static const char * name()                      { return "avx2"; }
+
+        static V load(const float *p)                   { return _mm256_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm256_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm256_set1_ps(f); }
+        static V add(V a, V b)                          { return _mm256_add_ps(a, b); }
+        static V sub(V a, V b)                          { return _mm256_sub_ps(a, b); }
+        static V mul(V a, V b)                          { return _mm256_mul_ps(a, b); }
+        static V div(V a, V b)                          { return _mm256_div_ps(a, b); }
+        static V fma(V a, V b, V c)                     { return _mm256_fmadd_ps(a, b, c); }
+        static V min(V a, V b)                          { return _mm256_min_ps(a, b); }
+        static V max(V a, V b)                          { return _mm256_max_ps(a, b); }
+        static V sqrt(V a)                              { return _mm256_sqrt_ps(a); }
+        static V floor(V a)                             { return _mm256_floor_ps(a); }
+        static V ceil(V a)                              { return _mm256_ceil_ps(a); }
+
+        static V bitAnd(V a, V b)                       { return _mm256_and_ps(a, b); }
+        static V bitOr(V a, V b)                        { return _mm256_or_ps(a, b); }
+        static V bitXor(V a, V b)                       { return _mm256_xor_ps(a, b); }
+
+        static M lt(V a, V b)                           { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        static M le(V a, V b)                           { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+        static M eq(V a, V b)                           { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+        static M isNaN(V a)                             { return _mm256_cmp_ps(a, a, _CMP_UNORD_Q); }
+        static M maskOr(M a, M b)                       { return _mm256_or_ps(a, b); }
+        static M maskNot(M a)                           { return _mm256_xor_ps(a, _mm256_castsi256_ps(_mm256_set1_epi32(-1))); }
+        static bool any(M a)                            { return _mm256_movemask_ps(a) != 0; }
+        static V select(M m, V a, V b)                  { return _mm256_blendv_ps(b, a, m); }
+
+        static I iset(int32_t i)                        { return _mm256_set1_epi32(i); }
+        static I iadd(I a, I b)                         { return _mm256_add_epi32(a, b); }
+        static I isub(I a, I b)                         { return _mm256_sub_epi32(a, b); }
+        static I iand(I a, I b)                         { return _mm256_and_si256(a, b); }
+        static I iandnot(I a, I b)                      { return _mm256_andnot_si256(a, b); }
+        static I ior(I a, I b)                          { return _mm256_or_si256(a, b); }
+        template<int s> static I shl(I a)               { return _mm256_slli_epi32(a, s); }
+        template<int s> static I shr(I a)               { return _mm256_srli_epi32(a, s); }
+        template<int s> static I sra(I a)               { return _mm256_srai_epi32(a, s); }
+        static M ieq(I a, I b)                          { return _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b)); }
+        static I round(V a)                             { return _mm256_cvtps_epi32(a); }
+        static I truncate(V a)                          { return _mm256_cvttps_epi32(a); }
+        static V toFloat(I a)                           { return _mm256_cvtepi32_ps(a); }
+        static I asInt(V a)                             { return _mm256_castps_si256(a); }
+        static V asFloat(I a)                           { return _mm256_castsi256_ps(a); }
+    };
+#elif defined(__SSE2__)
+    struct Simd
+    {
+        typedef __m128 V;
+        typedef __m128i I;
+        typedef __m128 M;
+        enum { W = 4 };
+        static const char * name()                      { return "sse2"; }
+
+        static V load(const float *p)                   { return _mm_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm_set1_ps(f); }
+        static V add(V a, V b)                          { return _mm_add_ps(a, b); }
+        static V sub(V a, V b)                          { return _mm_sub_ps(a, b); }
+        static V mul(V a, V b)                          { return _mm_mul_ps(a, b); }
+        static V div(V a, V b)                          { return _mm_div_ps(a, b); }
+        static V fma(V a, V b, V c)                     { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+        static V min(V a, V b)                          { return _mm_min_ps(a, b); }
+        static V max(V a, V b)                          { return _mm_max_ps(a, b); }
+        static V sqrt(V a)                              { return _mm_sqrt_ps(a); }
+#if defined(__SSE4_1__)
+        static V floor(V a)                             { return _mm_floor_ps(a); }
+        static V ceil(V a)                              { return _mm_ceil_ps(a); }
+#else
+        // through int32, for |a| < 2^23 (anything larger is already whole).
+        // or-ing in a's sign keeps -0 and gives ceil(-0.5) = -0.
+        static V floor(V a)
+        {
+            V t = toFloat(truncate(a));
+            t = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), set(1.0f)));
+            t = _mm_or_ps(t, _mm_and_ps(a, set(-0.0f)));
+            return select(lt(_mm_andnot_ps(set(-0.0f), a), set(8388608.0f)), t, a);
+        }
+        static V ceil(V a)
+        {
+            V t = toFloat(truncate(a));
+            t = _mm_add_ps(t, _mm_and_ps(_mm_cmplt_ps(t, a), set(1.0f)));
+            t = _mm_or_ps(t, _mm_and_ps(a, set(-0.0f)));
+            return select(lt(_mm_andnot_ps(set(-0.0f), a), set(8388608.0f)), t, a);
+        }
+#endif
+
+        static V bitAnd(V a, V b)                       { return _mm_and_ps(a, b); }
+        static V bitOr(V a, V b)                        { return _mm_or_ps(a, b); }
+        static V bitXor(V a, V b)                       { return _mm_xor_ps(a, b); }
+
+        static M lt(V a, V b)                           { return _mm_cmplt_ps(a, b); }
+        static M le(V a, V b)                           { return _mm_cmple_ps(a, b); }
+        static M eq(V a, V b)                           { return _mm_cmpeq_ps(a, b); }
+        static M isNaN(V a)                             { return _mm_cmpunord_ps(a, a); }
+        static M maskOr(M a, M b)                       { return _mm_or_ps(a, b); }
+        static M maskNot(M a)                           { return _mm_xor_ps(a, _mm_castsi128_ps(_mm_set1_epi32(-1))); }
+        static bool any(M a)                            { return _mm_movemask_ps(a) != 0; }
+        static V select(M m, V a, V b)                  { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+
+        static I iset(int32_t i)                        { return _mm_set1_epi32(i); }
+        static I iadd(I a, I b)                         { return _mm_add_epi32(a, b); }
+        static I isub(I a, I b)                         { return _mm_sub_epi32(a, b); }
+        static I iand(I a, I b)                         { return _mm_and_si128(a, b); }
+        static I iandnot(I a, I b)                      { return _mm_andnot_si128(a, b); }
+        static I ior(I a, I b)                          { return _mm_or_si128(a, b); }
+        template<int s> static I shl(I a)               { return _mm_slli_epi32(a, s); }
+        template<int s> static I shr(I a)               { return _mm_srli_epi32(a, s); }
+        template<int s> static I sra(I a)               { return _mm_srai_epi32(a, s); }
+        static M ieq(I a, I b)                          { return _mm_castsi128_ps(_mm_cmpeq_epi32(a, b)); }
+        static I round(V a)                             { return _mm_cvtps_epi32(a); }
+        static I truncate(V a)                          { return _mm_cvttps_epi32(a); }
+        static V toFloat(I a)                           { return _mm_cvtepi32_ps(a); }
+        static I asInt(V a)                             { return _mm_castps_si128(a); }
+        static V asFloat(I a)                           { return _mm_castsi128_ps(a); }
+    };
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    struct Simd
+    {
+        typedef float32x4_t V;
+        typedef int32x4_t I;
+        typedef uint32x4_t M;
+        enum { W = 4 };
+        static const char * name()                      { return "neon"; }
+
+        static V load(const float *p)                   { return vld1q_f32(p); }
+        static void store(float *p, V a)                { vst1q_f32(p, a); }
+        static V set(float f)                           { return vdupq_n_f32(f); }
+        static V add(V a, V b)                          { return vaddq_f32(a, b); }
+        static V sub(V a, V b)                          { return vsubq_f32(a, b); }
+        static V mul(V a, V b)                          { return vmulq_f32(a, b); }
+        static V div(V a, V b)                          { return vdivq_f32(a, b); }
+        static V fma(V a, V b, V c)                     { return vfmaq_f32(c, a, b); }
+        static V min(V a, V b)                          { return vminq_f32(a, b); }
+        static V max(V a, V b)                          { return vmaxq_f32(a, b); }
+        static V sqrt(V a)                              { return vsqrtq_f32(a); }
+        static V floor(V a)                             { return vrndmq_f32(a); }
+        static V ceil(V a)                              { return vrndpq_f32(a); }
+
+        static V bitAnd(V a, V b)                       { return asFloat(vandq_s32(asInt(a), asInt(b))); }
+        static V bitOr(V a, V b)                        { return asFloat(vorrq_s32(asInt(a), asInt(b))); }
+        static V bitXor(V a, V b)                       { return asFloat(veorq_s32(asInt(a), asInt(b))); }
+
+        static M lt(V a, V b)                           { return vcltq_f32(a, b); }
+        static M le(V a, V b)                           { return vcleq_f32(a, b); }
+        static M eq(V a, V b)                           { return vceqq_f32(a, b); }
+        static M isNaN(V a)                             { return vmvnq_u32(vceqq_f32(a, a)); }
+        static M maskOr(M a, M b)                       { return vorrq_u32(a, b); }
+        static M maskNot(M a)                           { return vmvnq_u32(a); }
+        static bool any(M a)                            { return vmaxvq_u32(a) != 0; }
+        static V select(M m, V a, V b)                  { return vbslq_f32(m, a, b); }
+
+        static I iset(int32_t i)                        { return vdupq_n_s32(i); }
+        static I iadd(I a, I b)                         { return vaddq_s32(a, b); }
+        static I isub(I a, I b)                         { return vsubq_s32(a, b); }
+        static I iand(I a, I b)                         { return vandq_s32(a, b); }
+        static I iandnot(I a, I b)                      { return vbicq_s32(b, a); }
+        static I ior(I a, I b)                          { return vorrq_s32(a, b); }
+        template<int s> static I shl(I a)               { return vshlq_n_s32(a, s); }
+        template<int s> static I shr(I a)               { return vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(a), s)); }
+        template<int s> static I sra(I a)               { return vshrq_n_s32(a, s); }
+        static M ieq(I a, I b)                          { return vceqq_s32(a, b); }
+        static I round(V a)                             { return vcvtnq_s32_f32(a); }
+        static I truncate(V a)                          { return vcvtq_s32_f32(a); }
+        static V toFloat(I a)                           { return vcvtq_f32_s32(a); }
+        static I asInt(V a)                             { return vreinterpretq_s32_f32(a); }
+        static V asFloat(I a)                           { return vreinterpretq_f32_s32(a); }
+    };
+#else
+    struct Simd
+    {
+        typedef float V;
+        typedef int32_t I;
+        typedef bool M;
+        enum { W = 1 };
+        static const char * name()                      { return "scalar"; }
+
+        static V load(const float *p)                   { return *p; }
+        static void store(float *p, V a)                { *p = a; }
+        static V set(float f)                           { return f; }
+        static V add(V a, V b)                          { return a + b; }
+        static V sub(V a, V b)                          { return a - b; }
+        static V mul(V a, V b)                          { return a * b; }
+        static V div(V a, V b)                          { return a / b; }
+        static V fma(V a, V b, V c)                     { return a * b + c; }
+        static V min(V a, V b)                          { return a < b ? a : b; }
+        static V max(V a, V b)                          { return a > b ? a : b; }
+        static V sqrt(V a)                              { return sqrtf(a); }
+        static V floor(V a)                             { return floorf(a); }
+        static V ceil(V a)                              { return ceilf(a); }
+
+        static V bitAnd(V a, V b)                       { return asFloat(asInt(a) & asInt(b)); }
+        static V bitOr(V a, V b)                        { return asFloat(asInt(a) | asInt(b)); }
+        static V bitXor(V a, V b)                       { return asFloat(asInt(a) ^ asInt(b)); }
+
+        static M lt(V a, V b)                           { return a < b; }
+        static M le(V a, V b)                           { return a <= b; }
+        static M eq(V a, V b)                           { return a == b; }
+        static M isNaN(V a)                             { return a != a; }
+        static M maskOr(M a, M b)                       { return a || b; }
+        static M maskNot(M a)                           { return !a; }
+        static bool any(M a)                            { return a; }
+        static V select(M m, V a, V b)                  { return m ? a : b; }
+
+        static I iset(int32_t i)                        { return i; }
+        static I iadd(I a, I b)                         { return (I)((uint32_t)a + (uint32_t)b); }
+        static I isub(I a, I b)                         { return (I)((uint32_t)a - (uint32_t)b); }
+        static I iand(I a, I b)                         { return a & b; }
+        static I iandnot(I a, I b)                      { return ~a & b; }
+        static I ior(I a, I b)                          { return a | b; }
+        template<int s> static I shl(I a)               { return (I)((uint32_t)a << s); }
+        template<int s> static I shr(I a)               { return (I)((uint32_t)a >> s); }
+        template<int s> static I sra(I a)               { return a >> s; }
+        static M ieq(I a, I b)                          { return a == b; }
+        static I round(V a)                             { return (I)lrintf(a); }
+        static I truncate(V a)                          { return (I)a; }
+        static V toFloat(I a)                           { return (V)a; }
+        static I asInt(V a)                             { I i; memcpy(&i, &a, sizeof(i)); return i; }
+        static V asFloat(I a)                           { V f; memcpy(&f, &a, sizeof(f)); return f; }
+    };
+#endif
+
+    typedef Simd S;
+    typedef S::V V;
+    typedef S::I I;
+    typedef S::M M;
+
+    // 2^n for n in [-126, 127]
+    inline V pow2(I n)
+    {
+        return S::asFloat(S::shl<23>(S::iadd(n, S::iset(127))));
+    }
+
+    inline V absolute(V x)
+    {
+        return S::asFloat(S::iandnot(S::iset(0x80000000), S::asInt(x)));
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // exp: x = n ln2 + r, |r| <= ln2 / 2, e^x = 2^n e^r
+
+    inline V expPrecise(V x)
+    {
+        // beyond these the result is inf or 0 anyway
+        V xc = S::min(S::max(x, S::set(-104.0f)), S::set(89.0f));
+        V n = S::toFloat(S::round(S::mul(xc, S::set(1.44269504088896341f))));
+        V r = S::fma(n, S::set(-0.693359375f), xc);
+        r = S::fma(n, S::set(2.12194440e-4f), r);
+
+        V p = S::set(1.9875691500E-4f);
+        p = S::fma(p, r, S::set(1.3981999507E-3f));
+        p = S::fma(p, r, S::set(8.3334519073E-3f));
+        p = S::fma(p, r, S::set(4.1665795894E-2f));
+        p = S::fma(p, r, S::set(1.6666665459E-1f));
+        p = S::fma(p, r, S::set(5.0000001201E-1f));
+        V y = S::add(S::fma(p, S::mul(r, r), r), S::set(1.0f));
+
+        // 2^n in two halves, so results that overflow or are denormal are
+        // rounded once, like libm
+        I ni = S::round(n);
+        I n1 = S::sra<1>(ni);
+        y = S::mul(S::mul(y, pow2(n1)), pow2(S::isub(ni, n1)));
+        return S::select(S::isNaN(x), x, y);
+    }
+
+    inline V expFast(V x)
+    {
+        V xc = S::min(S::max(x, S::set(-104.0f)), S::set(89.0f));
+        V n = S::toFloat(S::round(S::mul(xc, S::set(1.44269504088896341f))));
+        V r = S::fma(n, S::set(-0.693359375f), xc);
+        r = S::fma(n, S::set(2.12194440e-4f), r);
+
+        V p = S::set(8.3125249455e-3f);
+        p = S::fma(p, r, S::set(4.1890113275e-2f));
+        p = S::fma(p, r, S::set(1.6667114465e-1f));
+        p = S::fma(p, r, S::set(4.9999231790e-1f));
+        V y = S::add(S::fma(p, S::mul(r, r), r), S::set(1.0f));
+
+        I ni = S::round(n);
+        I n1 = S::sra<1>(ni);
+        return S::mul(S::mul(y, pow2(n1)), pow2(S::isub(ni, n1)));
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // log: x = 2^e m, sqrt(1/2) <= m < sqrt(2), log x = e ln2 + log(1 + z), z = m - 1
+
+    // splits positive normal x into e (as a float) and z
+    inline void logReduce(V x, V &e, V &z)
+    {
+        I bits = S::asInt(x);
+        I ei = S::isub(S::shr<23>(bits), S::iset(126));
+        V m = S::asFloat(S::ior(S::iand(bits, S::iset(0x007fffff)), S::iset(0x3f000000)));
+
+        // m in [0.5, 1): below sqrt(1/2) double it, otherwise it is m - 1 of
+        // the next exponent
+        M small = S::lt(m, S::set(0.707106781186547524f));
+        e = S::sub(S::toFloat(ei), S::select(small, S::set(1.0f), S::set(0.0f)));
+        z = S::sub(S::add(m, S::select(small, m, S::set(0.0f))), S::set(1.0f));
+    }
+
+    // log(1 + z) for z from logReduce, less the final z2 and z terms
+    inline V log1pTail(V z, V z2)
+    {
+        V p = S::set(7.0376836292E-2f);
+        p = S::fma(p, z, S::set(-1.1514610310E-1f));
+        p = S::fma(p, z, S::set(1.1676998740E-1f));
+        p = S::fma(p, z, S::set(-1.2420140846E-1f));
+        p = S::fma(p, z, S::set(1.4249322787E-1f));
+        p = S::fma(p, z, S::set(-1.6668057665E-1f));
+        p = S::fma(p, z, S::set(2.0000714765E-1f));
+        p = S::fma(p, z, S::set(-2.4999993993E-1f));
+        p = S::fma(p, z, S::set(3.3333331174E-1f));
+        return S::mul(S::mul(p, z), z2);
+    }
+
+    // logReduce, with denormals scaled up by 2^23 first
+    inline void logReduceAll(V x, V &e, V &z)
+    {
+        M denormal = S::lt(x, S::set(1.17549435e-38f));
+        logReduce(S::select(denormal, S::mul(x, S::set(8388608.0f)), x), e, z);
+        e = S::sub(e, S::select(denormal, S::set(23.0f), S::set(0.0f)));
+    }
+
+    inline V logPrecise(V x)
+    {
+        V e, z;
+        logReduceAll(x, e, z);
+
+        V z2 = S::mul(z, z);
+        V y = log1pTail(z, z2);
+        y = S::fma(e, S::set(-2.12194440e-4f), y);
+        y = S::fma(z2, S::set(-0.5f), y);
+        y = S::add(z, y);
+        y = S::fma(e, S::set(0.693359375f), y);
+
+        // log 0 = -inf, log of negatives and NaN is NaN, log inf = inf
+        y = S::select(S::eq(x, S::set(0.0f)), S::set(-INFINITY), y);
+        y = S::select(S::lt(x, S::set(0.0f)), S::set(NAN), y);
+        y = S::select(S::eq(x, S::set(INFINITY)), x, y);
+        return S::select(S::isNaN(x), x, y);
+    }
+
+    inline V logFast(V x)
+    {
+        V e, z;
+        logReduce(S::max(x, S::set(1.17549435e-38f)), e, z);
+
+        V z2 = S::mul(z, z);
+        V p = S::set(-1.0191729067e-01f);
+        p = S::fma(p, z, S::set(1.6024380610e-01f));
+        p = S::fma(p, z, S::set(-1.7137127232e-01f));
+        p = S::fma(p, z, S::set(1.9924503493e-01f));
+        p = S::fma(p, z, S::set(-2.4983266946e-01f));
+        p = S::fma(p, z, S::set(3.3334245712e-01f));
+        V y = S::mul(S::mul(p, z), z2);
+        y = S::fma(e, S::set(-2.12194440e-4f), y);
+        y = S::fma(z2, S::set(-0.5f), y);
+        y = S::add(z, y);
+        return S::fma(e, S::set(0.693359375f), y);
+    }
+
+    // log(u) - ((u - 1) - x) / u with u = 1 + x corrects for the rounding of u
+    inline V log1pPrecise(V x)
+    {
+        V u = S::add(x, S::set(1.0f));
+        V l = logPrecise(u);
+        V y = S::sub(l, S::div(S::sub(S::sub(u, S::set(1.0f)), x), u));
+        y = S::select(S::eq(u, S::set(1.0f)), x, y);
+        // u of 0 or less, inf and NaN are log's
+        y = S::select(S::lt(S::set(0.0f), u), y, l);
+        return S::select(S::eq(u, S::set(INFINITY)), u, y);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // pow: with |x| = 2^e (1 + z), |x|^p = 2^(p e) 2^(p log2(1 + z)).  p is
+    // split in two so that p e is exact, and only the small second part
+    // carries rounding, which keeps the error from growing with log x.
+
+    struct PowConstants
+    {
+        V pHigh, pLow, pLog2e;
+        V ofZero, ofInfinity;
+    };
+
+    PowConstants powConstants(float p)
+    {
+        // 16 bits of p times the 8 bits of e is exact, and so is the rest
+        uint32_t bits;
+        memcpy(&bits, &p, sizeof(bits));
+        bits &= 0xffffff00;
+        float pHigh;
+        memcpy(&pHigh, &bits, sizeof(pHigh));
+
+        PowConstants k;
+        k.pHigh = S::set(pHigh);
+        k.pLow = S::set(p - pHigh);
+        k.pLog2e = S::set((float)(p * 1.44269504088896341));
+        k.ofZero = S::set(p > 0 ? 0.0f : INFINITY);
+        k.ofInfinity = S::set(p > 0 ? INFINITY : 0.0f);
+        return k;
+    }
+
+    // |x|^p for x >= 0.  FAST uses the shorter log and exp polynomials and
+    // leaves 0, inf and NaN undefined.
+    template<bool bFast>
+    inline V powKernel(V ax, const PowConstants &k)
+    {
+        V e, z, l;
+        if (bFast) {
+            logReduce(S::max(ax, S::set(1.17549435e-38f)), e, z);
+            V z2 = S::mul(z, z);
+            V p = S::set(-1.0191729067e-01f);
+            p = S::fma(p, z, S::set(1.6024380610e-01f));
+            p = S::fma(p, z, S::set(-1.7137127232e-01f));
+            p = S::fma(p, z, S::set(1.9924503493e-01f));
+            p = S::fma(p, z, S::set(-2.4983266946e-01f));
+            p = S::fma(p, z, S::set(3.3334245712e-01f));
+            l = S::add(z, S::fma(z2, S::set(-0.5f), S::mul(S::mul(p, z), z2)));
+        }
+        else {
+            logReduceAll(ax, e, z);
+            V z2 = S::mul(z, z);
+            l = S::add(z, S::fma(z2, S::set(-0.5f), log1pTail(z, z2)));
+        }
+        V u = S::mul(k.pLog2e, l);
+        V wh = S::mul(k.pHigh, e);
+        V wl = S::mul(k.pLow, e);
+
+        // 2^n 2^f, |f| <= 1/2.  past the clamp the result is 0 or inf anyway.
+        V n = S::toFloat(S::round(S::min(S::max(S::add(wh, u), S::set(-160.0f)), S::set(130.0f))));
+        V f = S::add(S::add(S::sub(wh, n), wl), u);
+        f = S::min(S::max(f, S::set(-1.0f)), S::set(1.0f));
+        V r = S::mul(f, S::set(0.693147180559945309f));
+
+        V p;
+        if (bFast) {
+            p = S::set(8.3125249455e-3f);
+            p = S::fma(p, r, S::set(4.1890113275e-2f));
+            p = S::fma(p, r, S::set(1.6667114465e-1f));
+            p = S::fma(p, r, S::set(4.9999231790e-1f));
+        }
+        else {
+            p = S::set(1.9875691500E-4f);
+            p = S::fma(p, r, S::set(1.3981999507E-3f));
+            p = S::fma(p, r, S::set(8.3334519073E-3f));
+            p = S::fma(p, r, S::set(4.1665795894E-2f));
+            p = S::fma(p, r, S::set(1.6666665459E-1f));
+            p = S::fma(p, r, S::set(5.0000001201E-1f));
+        }
+        V y = S::add(S::fma(p, S::mul(r, r), r), S::set(1.0f));
+
+        I ni = S::round(n);
+        I n1 = S::sra<1>(ni);
+        y = S::mul(S::mul(y, pow2(n1)), pow2(S::isub(ni, n1)));
+        if (bFast) {
+            return y;
+        }
+
+        y = S::select(S::eq(ax, S::set(0.0f)), k.ofZero, y);
+        y = S::select(S::eq(ax, S::set(INFINITY)), k.ofInfinity, y);
+        return S::select(S::isNaN(ax), ax, y);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // sin and cos: x = j pi/4 + r, |r| <= pi/4, then the sin or cos
+    // polynomial of r depending on the octant, with the sign from j
+
+    inline void sinCos(V x, V &s, V &c)
+    {
+        V sign = S::bitAnd(x, S::set(-0.0f));
+        V ax = absolute(x);
+
+        I j = S::truncate(S::mul(ax, S::set(1.27323954473516f)));
+        j = S::iand(S::iadd(j, S::iset(1)), S::iset(~1));
+        V y = S::toFloat(j);
+
+        // pi/4 in pieces of at most 10 bits, so y * piece is exact for
+        // j < 2^14 even without fma and the reduction stays accurate next to
+        // multiples of pi
+        V r = S::fma(y, S::set(-0.78515625f), ax);
+        r = S::fma(y, S::set(-2.4175643920898438e-4f), r);
+        r = S::fma(y, S::set(-1.5692785382270813e-7f), r);
+        r = S::fma(y, S::set(-3.035438567167148e-11f), r);
+        r = S::fma(y, S::set(-3.108624468950438e-14f), r);
+        r = S::fma(y, S::set(-3.0616171314629196e-17f), r);
+
+        V sinSign = S::bitXor(sign, S::asFloat(S::shl<29>(S::iand(j, S::iset(4)))));
+        V cosSign = S::asFloat(S::shl<29>(S::iandnot(S::isub(j, S::iset(2)), S::iset(4))));
+        M sinPoly = S::ieq(S::iand(j, S::iset(2)), S::iset(0));
+
+        V z = S::mul(r, r);
+        V pc = S::set(2.443315711809948E-005f);
+        pc = S::fma(pc, z, S::set(-1.388731625493765E-003f));
+        pc = S::fma(pc, z, S::set(4.166664568298827E-002f));
+        pc = S::fma(S::mul(pc, z), z, S::fma(z, S::set(-0.5f), S::set(1.0f)));
+
+        V ps = S::set(-1.9515295891E-4f);
+        ps = S::fma(ps, z, S::set(8.3321608736E-3f));
+        ps = S::fma(ps, z, S::set(-1.6666654611E-1f));
+        ps = S::fma(S::mul(ps, z), r, r);
+
+        s = S::bitXor(S::select(sinPoly, ps, pc), sinSign);
+        c = S::bitXor(S::select(sinPoly, pc, ps), cosSign);
+    }
+
+    // lanes the reduction cannot handle (large, inf, NaN) go through libm
+    inline void trigFixup(V x, V &s, V &c, bool bSin, bool bCos)
+    {
+        M bad = S::maskNot(S::le(absolute(x), S::set(PKM_MATH_TRIG_MAX)));
+        if (!S::any(bad)) {
+            return;
+        }
+        float xs[S::W], ss[S::W], cs[S::W];
+        S::store(xs, x);
+        S::store(ss, s);
+        S::store(cs, c);
+        for (int i = 0; i < S::W; i++) {
+            if (!(fabsf(xs[i]) <= PKM_MATH_TRIG_MAX)) {
+                ss[i] = bSin ? sinf(xs[i]) : 0;
+                cs[i] = bCos ? cosf(xs[i]) : 0;
+            }
+        }
+        s = S::load(ss);
+        c = S::load(cs);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    // runs f over [0, n) a vector at a time, the tail through a padded
+    // vector so every element sees the same arithmetic, and across the
+    // thread pool for large n
+    template<typename F>
+    void apply(const float *src, float *dst, size_t n, F f)
+    {
+        auto run = [&](size_t begin, size_t end) {
+            size_t i = begin;
+            for (; i + S::W <= end; i += S::W) {
+                S::store(dst + i, f(S::load(src + i)));
+            }
+            if (i < end) {
+                float in[S::W] = { 0 }, out[S::W];
+                memcpy(in, src + i, (end - i) * sizeof(float));
+                S::store(out, f(S::load(in)));
+                memcpy(dst + i, out, (end - i) * sizeof(float));
+            }
+        };
+        if (n >= PKM_MATH_PARALLEL_MIN) {
+            pkm::parallelFor(n, PKM_MATH_CHUNK, run);
+        }
+        else {
+            run(0, n);
+        }
+    }
+
+    // f(x, a, b) writing two outputs
+    template<typename F>
+    void apply2(const float *src, float *dstA, float *dstB, size_t n, F f)
+    {
+        auto run = [&](size_t begin, size_t end) {
+            size_t i = begin;
+            V a, b;
+            for (; i + S::W <= end; i += S::W) {
+                f(S::load(src + i), a, b);
+                S::store(dstA + i, a);
+                S::store(dstB + i, b);
+            }
+            if (i < end) {
+                float in[S::W] = { 0 }, outA[S::W], outB[S::W];
+                memcpy(in, src + i, (end - i) * sizeof(float));
+                f(S::load(in), a, b);
+                S::store(outA, a);
+                S::store(outB, b);
+                memcpy(dstA + i, outA, (end - i) * sizeof(float));
+                memcpy(dstB + i, outB, (end - i) * sizeof(float));
+            }
+        };
+        if (n >= PKM_MATH_PARALLEL_MIN) {
+            pkm::parallelFor(n, PKM_MATH_CHUNK, run);
+        }
+        else {
+            run(0, n);
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // along the rows or columns of a row-major rows x cols block.  a row is
+    // worked on start to finish by one thread while it is in cache.  a
+    // column is strided, so columns are reduced a row at a time into a
+    // vector of per-column totals instead, in blocks of rows across threads.
+
+    // cols rounded up to whole vectors, the length of per-column buffers
+    inline size_t paddedColumns(size_t cols)
+    {
+        return (cols + S::W - 1) / S::W * S::W;
+    }
+
+    // the first k lanes
+    inline M firstLanes(size_t k)
+    {
+        float lanes[S::W];
+        for (int i = 0; i < S::W; i++) {
+            lanes[i] = (float)i;
+        }
+        return S::lt(S::load(lanes), S::set((float)k));
+    }
+
+    // the lanes of acc combined
+    template<typename C>
+    inline float fold(V acc, C combine)
+    {
+        float lanes[S::W];
+        S::store(lanes, acc);
+        float result = lanes[0];
+        for (int i = 1; i < S::W; i++) {
+            result = combine(result, lanes[i]);
+        }
+        return result;
+    }
+
+    inline float maxOf(float a, float b)        { return a > b ? a : b; }
+    inline float minOf(float a, float b)        { return a < b ? a : b; }
+    inline float sumOf(float a, float b)        { return a + b; }
+    inline float largestOf(float a, float b)    { return fabsf(b) > fabsf(a) ? b : a; }
+
+    // what to take off before exp, given the max: all -inf or any inf
+    // would make x - max NaN
+    inline float shiftFor(float max)
+    {
+        return isfinite(max) ? max : 0.0f;
+    }
+
+    template<bool bFast>
+    inline V expOf(V x)
+    {
+        return bFast ? expFast(x) : expPrecise(x);
+    }
+
+    // f(r) for every row, across the thread pool for large blocks
+    template<typename F>
+    void forEachRow(size_t rows, size_t cols, F f)
+    {
+        auto run = [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; r++) {
+                f(r);
+            }
+        };
+        if (rows * cols >= PKM_MATH_PARALLEL_MIN) {
+            pkm::parallelFor(rows, std::max((size_t)1, PKM_MATH_CHUNK / cols), run);
+        }
+        else {
+            run(0, rows);
+        }
+    }
+
+    // folds the n floats at x into a vector accumulator with
+    // y = f(x, p, acc), writing each y to dst unless it is NULL, and returns
+    // the lanes combined
+    template<typename F, typename C>
+    float reduceRow(const float *x, float *dst, size_t n, float p, float init, F f, C combine)
+    {
+        const V pv = S::set(p);
+        V acc = S::set(init);
+        size_t i = 0;
+        for (; i + S::W <= n; i += S::W) {
+            V y = f(S::load(x + i), pv, acc);
+            if (dst) {
+                S::store(dst + i, y);
+            }
+        }
+        if (i < n) {
+            float in[S::W] = { 0 }, out[S::W];
+            memcpy(in, x + i, (n - i) * sizeof(float));
+            V tail = acc;
+            S::store(out, f(S::load(in), pv, tail));
+            acc = S::select(firstLanes(n - i), tail, acc);
+            if (dst) {
+                memcpy(dst + i, out, (n - i) * sizeof(float));
+            }
+        }
+        return fold(acc, combine);
+    }
+
+    // the same down every column, with per-column p, into totals.  p and
+    // totals are paddedColumns(cols) long.
+    template<typename F, typename C>
+    void reduceColumns(const float *src, float *dst, size_t rows, size_t cols,
+                       const float *p, float init, F f, C combine, std::vector<float> &totals)
+    {
+        size_t stride = paddedColumns(cols);
+        size_t blockRows = rows;
+        if (rows * cols >= PKM_MATH_PARALLEL_MIN) {
+            blockRows = std::max(PKM_MATH_CHUNK / cols, (rows + PKM_MATH_MAX_BLOCKS - 1) / PKM_MATH_MAX_BLOCKS);
+        }
+        size_t numBlocks = (rows + blockRows - 1) / blockRows;
+        std::vector<float> partial(numBlocks * stride, init);
+
+        auto run = [&](size_t firstBlock, size_t lastBlock) {
+            for (size_t b = firstBlock; b < lastBlock; b++) {
+                float *acc = &partial[b * stride];
+                size_t end = std::min(rows, (b + 1) * blockRows);
+                for (size_t r = b * blockRows; r < end; r++) {
+                    const float *x = src + r * cols;
+                    float *y = dst ? dst + r * cols : NULL;
+                    size_t c = 0;
+                    for (; c + S::W <= cols; c += S::W) {
+                        V a = S::load(acc + c);
+                        V out = f(S::load(x + c), S::load(p + c), a);
+                        S::store(acc + c, a);
+                        if (y) {
+                            S::store(y + c, out);
+                        }
+                    }
+                    if (c < cols) {
+                        // lanes past cols are never read back
+                        float in[S::W] = { 0 }, out[S::W];
+                        memcpy(in, x + c, (cols - c) * sizeof(float));
+                        V a = S::load(acc + c);
+                        S::store(out, f(S::load(in), S::load(p + c), a));
+                        S::store(acc + c, a);
+                        if (y) {
+                            memcpy(y + c, out, (cols - c) * sizeof(float));
+                        }
+                    }
+                }
+            }
+        };
+        if (numBlocks > 1) {
+            pkm::parallelFor(numBlocks, 1, run);
+        }
+        else {
+            run(0, numBlocks);
+        }
+
+        totals.assign(partial.begin(), partial.begin() + stride);
+        for (size_t b = 1; b < numBlocks; b++) {
+            for (size_t c = 0; c < cols; c++) {
+                totals[c] = combine(totals[c], partial[b * stride + c]);
+            }
+        }
+    }
+
+    // dst = (x - offset) / scale
+    inline void shiftScaleRow(const float *x, float *dst, size_t n, float offset, float scale)
+    {
+        const V o = S::set(offset), s = S::set(scale);
+        size_t i = 0;
+        for (; i + S::W <= n; i += S::W) {
+            S::store(dst + i, S::div(S::sub(S::load(x + i), o), s));
+        }
+        for (; i < n; i++) {
+            dst[i] = (x[i] - offset) / scale;
+        }
+    }
+
+    // with offset and scale per column
+    void shiftScaleColumns(const float *src, float *dst, size_t rows, size_t cols,
+                           const std::vector<float> &offset, const std::vector<float> &scale)
+    {
+        forEachRow(rows, cols, [&](size_t r) {
+            const float *x = src + r * cols;
+            float *y = dst + r * cols;
+            size_t c = 0;
+            for (; c + S::W <= cols; c += S::W) {
+                S::store(y + c, S::div(S::sub(S::load(x + c), S::load(&offset[c])), S::load(&scale[c])));
+            }
+            for (; c < cols; c++) {
+                y[c] = (x[c] - offset[c]) / scale[c];
+            }
+        });
+    }
+
+    // sum of exp(x - shift) over a row, with the exps written to dst unless
+    // it is NULL
+    template<bool bFast>
+    float expSumRow(const float *x, float *dst, size_t n, float &shift)
+    {
+        auto maxStep = [](V v, V, V &acc) { acc = S::max(acc, v); return v; };
+        auto expStep = [](V v, V p, V &acc) { V e = expOf<bFast>(S::sub(v, p)); acc = S::add(acc, e); return e; };
+        shift = shiftFor(reduceRow(x, NULL, n, 0.0f, -INFINITY, maxStep, maxOf));
+        return reduceRow(x, dst, n, shift, 0.0f, expStep, sumOf);
+    }
+
+    template<bool bFast>
+    void expSumColumns(const float *src, float *dst, size_t rows, size_t cols,
+                       std::vector<float> &shift, std::vector<float> &sum)
+    {
+        auto maxStep = [](V v, V, V &acc) { acc = S::max(acc, v); return v; };
+        auto expStep = [](V v, V p, V &acc) { V e = expOf<bFast>(S::sub(v, p)); acc = S::add(acc, e); return e; };
+        std::vector<float> unused(paddedColumns(cols), 0.0f);
+        reduceColumns(src, NULL, rows, cols, &unused[0], -INFINITY, maxStep, maxOf, shift);
+        for (size_t c = 0; c < cols; c++) {
+            shift[c] = shiftFor(shift[c]);
+        }
+        reduceColumns(src, dst, rows, cols, &shift[0], 0.0f, expStep, sumOf, sum);
+    }
+
+    template<bool bFast>
+    void softmaxKernel(const float *src, float *dst, size_t rows, size_t cols, bool row_major)
+    {
+        if (row_major) {
+            forEachRow(rows, cols, [&](size_t r) {
+                float shift, sum = expSumRow<bFast>(src + r * cols, dst + r * cols, cols, shift);
+                shiftScaleRow(dst + r * cols, dst + r * cols, cols, 0.0f, sum);
+            });
+        }
+        else {
+            std::vector<float> shift, sum;
+            expSumColumns<bFast>(src, dst, rows, cols, shift, sum);
+            shiftScaleColumns(dst, dst, rows, cols, std::vector<float>(sum.size(), 0.0f), sum);
+        }
+    }
+
+    template<bool bFast>
+    void logSoftmaxKernel(const float *src, float *dst, size_t rows, size_t cols, bool row_major)
+    {
+        if (row_major) {
+            forEachRow(rows, cols, [&](size_t r) {
+                float shift, sum = expSumRow<bFast>(src + r * cols, NULL, cols, shift);
+                shiftScaleRow(src + r * cols, dst + r * cols, cols, shift + logf(sum), 1.0f);
+            });
+        }
+        else {
+            std::vector<float> shift, sum;
+            expSumColumns<bFast>(src, NULL, rows, cols, shift, sum);
+            for (size_t c = 0; c < cols; c++) {
+                shift[c] += logf(sum[c]);
+            }
+            shiftScaleColumns(src, dst, rows, cols, shift, std::vector<float>(shift.size(), 1.0f));
+        }
+    }
+
+    template<bool bFast>
+    void logSumExpKernel(const float *src, float *dst, size_t rows, size_t cols, bool row_major)
+    {
+        if (row_major) {
+            forEachRow(rows, cols, [&](size_t r) {
+                float shift, sum = expSumRow<bFast>(src + r * cols, NULL, cols, shift);
+                dst[r] = shift + logf(sum);
+            });
+        }
+        else {
+            std::vector<float> shift, sum;
+            expSumColumns<bFast>(src, NULL, rows, cols, shift, sum);
+            for (size_t c = 0; c < cols; c++) {
+                dst[c] = shift[c] + logf(sum[c]);
+            }
+        }
+    }
+
+    // divides each row or column by divisor(its fold under f), which
+    // returns 1 where it should be left alone
+    template<typename F, typename C, typename D>
+    void divideBy(const float *src, float *dst, size_t rows, size_t cols, bool row_major,
+                  float init, F f, C combine, D divisor)
+    {
+        if (row_major) {
+            forEachRow(rows, cols, [&](size_t r) {
+                float d = divisor(reduceRow(src + r * cols, NULL, cols, 0.0f, init, f, combine));
+                shiftScaleRow(src + r * cols, dst + r * cols, cols, 0.0f, d);
+            });
+        }
+        else {
+            std::vector<float> unused(paddedColumns(cols), 0.0f), d;
+            reduceColumns(src, NULL, rows, cols, &unused[0], init, f, combine, d);
+            for (size_t c = 0; c < cols; c++) {
+                d[c] = divisor(d[c]);
+            }
+            shiftScaleColumns(src, dst, rows, cols, unused, d);
+        }
+    }
+
+    inline float nonZero(float d)
+    {
+        return d != 0.0f ? d : 1.0f;
+    }
+}
+
+namespace pkm
+{
+    namespace math
+    {
+        void exp(const float *src, float *dst, size_t n, Precision precision)
+        {
+            if (precision == FAST) {
+                apply(src, dst, n, [](V x) { return expFast(x); });
+            }
+            else {
+                apply(src, dst, n, [](V x) { return expPrecise(x); });
+            }
+        }
+
+        void log(const float *src, float *dst, size_t n, Precision precision)
+        {
+            if (precision == FAST) {
+                apply(src, dst, n, [](V x) { return logFast(x); });
+            }
+            else {
+                apply(src, dst, n, [](V x) { return logPrecise(x); });
+            }
+        }
+
+        void log10(const float *src, float *dst, size_t n, Precision precision)
+        {
+            const V log10e = S::set(0.434294481903251828f);
+            if (precision == FAST) {
+                apply(src, dst, n, [&](V x) { return S::mul(logFast(x), log10e); });
+            }
+            else {
+                apply(src, dst, n, [&](V x) { return S::mul(logPrecise(x), log10e); });
+            }
+        }
+
+        void log1p(const float *src, float *dst, size_t n)
+        {
+            apply(src, dst, n, [](V x) { return log1pPrecise(x); });
+        }
+
+        void pow(const float *src, float p, float *dst, size_t n, Precision precision)
+        {
+            if (p == 0.0f) {
+                apply(src, dst, n, [](V) { return S::set(1.0f); });
+                return;
+            }
+            if (p == 1.0f) {
+                if (dst != src) {
+                    memmove(dst, src, n * sizeof(float));
+                }
+                return;
+            }
+            if (p == 2.0f) {
+                apply(src, dst, n, [](V x) { return S::mul(x, x); });
+                return;
+            }
+            if (p == -1.0f) {
+                apply(src, dst, n, [](V x) { return S::div(S::set(1.0f), x); });
+                return;
+            }
+            if (isinf(p) || isnan(p)) {
+                // |x| against 1 decides 0 or inf, and 1 stays 1 (even for NaN p)
+                const V below = S::set(isnan(p) ? NAN : (p > 0 ? 0.0f : INFINITY));
+                const V above = S::set(isnan(p) ? NAN : (p > 0 ? INFINITY : 0.0f));
+                const V one = S::set(isnan(p) ? NAN : 1.0f);
+                apply(src, dst, n, [&](V x) {
+                    V ax = absolute(x);
+                    V y = S::select(S::lt(ax, S::set(1.0f)), below, above);
+                    y = S::select(S::eq(ax, S::set(1.0f)), one, y);
+                    y = S::select(S::eq(x, S::set(1.0f)), S::set(1.0f), y);
+                    return S::select(S::isNaN(x), x, y);
+                });
+                return;
+            }
+            if (p == 0.5f) {
+                // pow(-0, 0.5) is +0 and pow(-inf, 0.5) is +inf, where sqrt gives -0 and NaN
+                apply(src, dst, n, [](V x) {
+                    V y = S::add(S::sqrt(x), S::set(0.0f));
+                    return S::select(S::eq(x, S::set(-INFINITY)), S::set(INFINITY), y);
+                });
+                return;
+            }
+
+            // |x|^p, then the sign for negative x: odd integer p keeps it,
+            // even integer p drops it, and anything else has no real result
+            bool bInteger = floorf(p) == p;
+            bool bOdd = bInteger && fabsf(p) < 16777216.0f && ((int64_t)p & 1);
+            const PowConstants k = powConstants(p);
+            const V negative = S::set(bInteger ? (bOdd ? -0.0f : 0.0f) : NAN);
+            // -inf has a real result for any p, signed only for odd p
+            const V negativeInfinity = S::set(bOdd ? -0.0f : 0.0f);
+            auto kernel = [&](V x, V y) {
+                M neg = S::lt(x, S::set(0.0f));
+                if (S::any(neg)) {
+                    // or-ing NaN's bits leaves a NaN
+                    V signedY = S::select(S::eq(x, S::set(-INFINITY)), S::bitOr(y, negativeInfinity), S::bitOr(y, negative));
+                    y = S::select(neg, signedY, y);
+                }
+                // the sign of zero carries through for odd p
+                return S::select(S::eq(x, S::set(0.0f)), S::bitOr(y, S::bitAnd(x, S::bitAnd(negative, S::set(-0.0f)))), y);
+            };
+            if (precision == FAST) {
+                apply(src, dst, n, [&](V x) { return kernel(x, powKernel<true>(absolute(x), k)); });
+            }
+            else {
+                apply(src, dst, n, [&](V x) { return kernel(x, powKernel<false>(absolute(x), k)); });
+            }
+        }
+
+        void sin(const float *src, float *dst, size_t n, Precision precision)
+        {
+            if (precision == FAST) {
+                apply(src, dst, n, [](V x) { V s, c; sinCos(x, s, c); return s; });
+            }
+            else {
+                apply(src, dst, n, [](V x) { V s, c; sinCos(x, s, c); trigFixup(x, s, c, true, false); return s; });
+            }
+        }
+
+        void cos(const float *src, float *dst, size_t n, Precision precision)
+        {
+            if (precision == FAST) {
+                apply(src, dst, n, [](V x) { V s, c; sinCos(x, s, c); return c; });
+            }
+            else {
+                apply(src, dst, n, [](V x) { V s, c; sinCos(x, s, c); trigFixup(x, s, c, false, true); return c; });
+            }
+        }
+
+        void sincos(const float *src, float *sinDst, float *cosDst, size_t n, Precision precision)
+        {
+            if (precision == FAST) {
+                apply2(src, sinDst, cosDst, n, [](V x, V &s, V &c) { sinCos(x, s, c); });
+            }
+            else {
+                apply2(src, sinDst, cosDst, n, [](V x, V &s, V &c) { sinCos(x, s, c); trigFixup(x, s, c, true, true); });
+            }
+        }
+
+        void sqrt(const float *src, float *dst, size_t n)
+        {
+            apply(src, dst, n, [](V x) { return S::sqrt(x); });
+        }
+
+        void floor(const float *src, float *dst, size_t n)
+        {
+            apply(src, dst, n, [](V x) { return S::floor(x); });
+        }
+
+        void ceil(const float *src, float *dst, size_t n)
+        {
+            apply(src, dst, n, [](V x) { return S::ceil(x); });
+        }
+
+        void softmax(const float *src, float *dst, size_t rows, size_t cols, bool row_major, Precision precision)
+        {
+            if (rows == 0 || cols == 0) {
+                return;
+            }
+            if (precision == FAST) {
+                softmaxKernel<true>(src, dst, rows, cols, row_major);
+            }
+            else {
+                softmaxKernel<false>(src, dst, rows, cols, row_major);
+            }
+        }
+
+        void logSoftmax(const float *src, float *dst, size_t rows, size_t cols, bool row_major, Precision precision)
+        {
+            if (rows == 0 || cols == 0) {
+                return;
+            }
+            if (precision == FAST) {
+                logSoftmaxKernel<true>(src, dst, rows, cols, row_major);
+            }
+            else {
+                logSoftmaxKernel<false>(src, dst, rows, cols, row_major);
+            }
+        }
+
+        void logSumExp(const float *src, float *dst, size_t rows, size_t cols, bool row_major, Precision precision)
+        {
+            if (cols == 0 || rows == 0) {
+                // the sum of nothing
+                std::fill(dst, dst + (row_major ? rows : cols), -INFINITY);
+                return;
+            }
+            if (precision == FAST) {
+                logSumExpKernel<true>(src, dst, rows, cols, row_major);
+            }
+            else {
+                logSumExpKernel<false>(src, dst, rows, cols, row_major);
+            }
+        }
+
+        void normalizeMinMax(const float *src, float *dst, size_t rows, size_t cols, bool row_major)
+        {
+            if (rows == 0 || cols == 0) {
+                return;
+            }
+            auto minStep = [](V x, V, V &acc) { acc = S::min(acc, x); return x; };
+            auto maxStep = [](V x, V, V &acc) { acc = S::max(acc, x); return x; };
+            if (row_major) {
+                forEachRow(rows, cols, [&](size_t r) {
+                    const float *x = src + r * cols;
+                    float lo = reduceRow(x, NULL, cols, 0.0f, INFINITY, minStep, minOf);
+                    float hi = reduceRow(x, NULL, cols, 0.0f, -INFINITY, maxStep, maxOf);
+                    shiftScaleRow(x, dst + r * cols, cols, lo, nonZero(hi - lo));
+                });
+            }
+            else {
+                std::vector<float> unused(paddedColumns(cols), 0.0f), lo, hi;
+                reduceColumns(src, NULL, rows, cols, &unused[0], INFINITY, minStep, minOf, lo);
+                reduceColumns(src, NULL, rows, cols, &unused[0], -INFINITY, maxStep, maxOf, hi);
+                for (size_t c = 0; c < cols; c++) {
+                    hi[c] = nonZero(hi[c] - lo[c]);
+                }
+                shiftScaleColumns(src, dst, rows, cols, lo, hi);
+            }
+        }
+
+        void normalizeSum(const float *src, float *dst, size_t rows, size_t cols, bool row_major)
+        {
+            if (rows == 0 || cols == 0) {
+                return;
+            }
+            divideBy(src, dst, rows, cols, row_major, 0.0f,
+                     [](V x, V, V &acc) { acc = S::add(acc, x); return x; }, sumOf, nonZero);
+        }
+
+        void normalizeMaxMagnitude(const float *src, float *dst, size_t rows, size_t cols, bool row_major)
+        {
+            if (rows == 0 || cols == 0) {
+                return;
+            }
+            divideBy(src, dst, rows, cols, row_major, 0.0f,
+                     [](V x, V, V &acc) { acc = S::select(S::lt(absolute(acc), absolute(x)), x, acc); return x; },
+                     largestOf, nonZero);
+        }
+
+        void normalizeL1(const float *src, float *dst, size_t rows, size_t cols, bool row_major)
+        {
+            if (rows == 0 || cols == 0) {
+                return;
+            }
+            divideBy(src, dst, rows, cols, row_major, 0.0f,
+                     [](V x, V, V &acc) { acc = S::add(acc, absolute(x)); return x; }, sumOf, nonZero);
+        }
+
+        void normalizeL2(const float *src, float *dst, size_t rows, size_t cols, bool row_major)
+        {
+            if (rows == 0 || cols == 0) {
+                return;
+            }
+            divideBy(src, dst, rows, cols, row_major, 0.0f,
+                     [](V x, V, V &acc) { acc = S::fma(x, x, acc); return x; }, sumOf,
+                     [](float sumOfSquares) { return nonZero(sqrtf(sumOfSquares)); });
+        }
+
+        const char * getInstructionSet()
+        {
+            return S::name();
+        }
+    }
+}
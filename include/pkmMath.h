@@ -0,0 +1,131 @@
+/*
+ *  pkmMath.h
+ *
+
+ vectorized float transcendentals for whole buffers, in place of the
+ vForce vv*f calls (which only exist on Apple) and of scalar libm loops,
+ and the softmax / log-sum-exp / normalize reductions built on them.
+
+ each function reads n floats from src and writes n to dst (which may be
+ src).  the kernels are written once against a small set of vector
+ operations and built for the widest of AVX-512F, AVX2 + FMA, SSE2,
+ aarch64 NEON or plain scalar code that the compiler targets, so build
+ with e.g. -mavx2 -mfma to get the 8 wide version.  buffers of
+ PKM_MATH_PARALLEL_MIN or more elements are split across the shared
+ pkm::ThreadPool.
+
+ PRECISE handles the full float domain (zeros, denormals, infinities,
+ NaN) like libm does.  FAST skips that and uses shorter polynomials, for
+ inner loops such as softmax and log-sum-exp where the inputs are known
+ to be finite and in range.
+
+ worst errors measured against double precision libm over every 16th
+ float (ulp of the correctly rounded result), and the same or better on
+ every instruction set except for pow (below):
+
+                PRECISE                     FAST
+    exp         1 ulp                       2.5 ulp, NaN not propagated
+    log         1 ulp                       5 ulp, positive normal x only
+    log10       2 ulp                       6 ulp, positive normal x only
+    log1p       1.5 ulp                     -
+    pow         below (*)                   below, positive normal x only
+    sin, cos    2.5 ulp                     2.5 ulp, |x| <= 8192 only
+    sqrt        correctly rounded           -
+    floor, ceil exact                       -
+
+ (*) p of 0.5, 1, 2 and -1 are exact or correctly rounded.  zeros,
+ infinities, NaN and negative x follow C's pow.  PRECISE sin and cos pass
+ |x| > 8192 to libm.
+
+ other p go through exp2(p log2(x)) with the log of x's mantissa held in
+ one float, so pow's error grows about linearly with |p|, and more so
+ where multiply and add are rounded separately (SSE2 and scalar builds)
+ than where they are fused (AVX2 + FMA, AVX-512F; NEON fuses too but was
+ not measured).  worst errors over every positive float:
+
+                PRECISE                     FAST
+    p           fused       SSE2, scalar    fused       SSE2, scalar
+    0.1         1.4 ulp     1.4 ulp         2.6 ulp     2.6 ulp
+    2.4         2.1         2.5             6.5         6.8
+    3           2.2         2.5             6.2         6.8
+    -2.5        1.7         2.1             5.9         6.4
+    7           3.6         4.7             12.9        13.9
+    10          4.7         7.0             19.2        21.3
+    100         50.7        68.8            203         220
+    -100        52.6        70.5            198         214
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+// buffers at least this long are split across threads
+#define PKM_MATH_PARALLEL_MIN (1 << 16)
+
+namespace pkm
+{
+    namespace math
+    {
+        enum Precision
+        {
+            PRECISE,
+            FAST
+        };
+
+        void exp(const float *src, float *dst, size_t n, Precision precision = PRECISE);
+        void log(const float *src, float *dst, size_t n, Precision precision = PRECISE);
+        void log10(const float *src, float *dst, size_t n, Precision precision = PRECISE);
+        void log1p(const float *src, float *dst, size_t n);
+        void pow(const float *src, float p, float *dst, size_t n, Precision precision = PRECISE);
+        void sin(const float *src, float *dst, size_t n, Precision precision = PRECISE);
+        void cos(const float *src, float *dst, size_t n, Precision precision = PRECISE);
+        void sincos(const float *src, float *sinDst, float *cosDst, size_t n, Precision precision = PRECISE);
+        void sqrt(const float *src, float *dst, size_t n);
+        void floor(const float *src, float *dst, size_t n);
+        void ceil(const float *src, float *dst, size_t n);
+
+        // the functions below work along each row (row_major) or each column
+        // of the row-major rows x cols block at src, like Mat::setNormalize().
+        // dst may be src.  rows are done start to finish by one thread while
+        // they are in cache; columns are reduced a contiguous row at a time.
+
+        // exp(x - max) / sum exp(x - max), and x - max - log sum exp(x - max).
+        // exp is taken at the given precision.
+        void softmax(const float *src, float *dst, size_t rows, size_t cols, bool row_major = true, Precision precision = PRECISE);
+        void logSoftmax(const float *src, float *dst, size_t rows, size_t cols, bool row_major = true, Precision precision = PRECISE);
+
+        // log sum exp(x) of each row or column into dst (rows or cols long),
+        // without overflowing
+        void logSumExp(const float *src, float *dst, size_t rows, size_t cols, bool row_major = true, Precision precision = PRECISE);
+
+        // (x - min) / (max - min), or x - min where max == min
+        void normalizeMinMax(const float *src, float *dst, size_t rows, size_t cols, bool row_major = true);
+
+        // x divided by the sum, the element of largest magnitude (keeping its
+        // sign), the sum of magnitudes, or the euclidean length.  all-zero
+        // rows or columns are left as they are.
+        void normalizeSum(const float *src, float *dst, size_t rows, size_t cols, bool row_major = true);
+        void normalizeMaxMagnitude(const float *src, float *dst, size_t rows, size_t cols, bool row_major = true);
+        void normalizeL1(const float *src, float *dst, size_t rows, size_t cols, bool row_major = true);
+        void normalizeL2(const float *src, float *dst, size_t rows, size_t cols, bool row_major = true);
+
+        // which kernels were built, e.g. "avx2"
+        const char * getInstructionSet();
+    }
+}
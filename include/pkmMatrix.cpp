@@ -23,12 +23,30 @@
  */
 
 #include "pkmMatrix.h"
+#include "pkmFixedMat.h"
+#include "pkmThreadPool.h"
 #include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// tile edge for the out-of-place transpose; 64 x 64 floats in and out
+// stay in L1 while the 8x8 kernels walk them
+#define PKM_TRANSPOSE_TILE 64
+
+// largest scratch (in floats) each thread keeps between in-place transposes
+#define PKM_TRANSPOSE_SCRATCH (1 << 20)
 
 using namespace pkm;
 
 
-Mat::Mat()
+Mat::BasicMat()
 {
 	bUserData = false;
 	rows = cols = 0;
@@ -39,7 +57,7 @@ Mat::Mat()
 }
 
 // destructor
-Mat::~Mat()
+Mat::~BasicMat()
 {
 	//printf("destruction\n");
 	releaseMemory();
@@ -51,7 +69,7 @@ Mat::~Mat()
     bUserData = false;
 }
 
-Mat::Mat(const std::vector<float> m)
+Mat::BasicMat(const std::vector<float> m)
 {
     rows = 1;
     cols = m.size();
@@ -66,7 +84,7 @@ Mat::Mat(const std::vector<float> m)
 	bAllocated = true;
 }
 
-Mat::Mat(const std::vector<std::vector<float> > m)
+Mat::BasicMat(const std::vector<std::vector<float> > m)
 {
     rows = m.size();
     cols = m[0].size();
@@ -85,7 +103,7 @@ Mat::Mat(const std::vector<std::vector<float> > m)
 }
 
 #ifdef HAVE_OPENCV
-Mat::Mat(const cv::Mat &m)
+Mat::BasicMat(const cv::Mat &m)
 {
     rows = m.rows;
     cols = m.cols;
@@ -101,7 +119,7 @@ Mat::Mat(const cv::Mat &m)
 }
 #endif
 // allocate data
-Mat::Mat(size_t r, size_t c, bool clear)
+Mat::BasicMat(size_t r, size_t c, bool clear)
 {
 #ifdef DEBUG
     assert(r > 0);
@@ -132,7 +150,7 @@ Mat::Mat(size_t r, size_t c, bool clear)
 // non-destructive by default
 // this WILL destroy the passed in data when object leaves scope if
 // with copy is not true
-Mat::Mat(size_t r, size_t c, const float *existing_buffer)
+Mat::BasicMat(size_t r, size_t c, const float *existing_buffer)
 {
     data = NULL;
     
@@ -154,7 +172,7 @@ Mat::Mat(size_t r, size_t c, const float *existing_buffer)
 // non-destructive by default
 // this WILL destroy the passed in data when object leaves scope if
 // with copy is not true
-Mat::Mat(size_t r, size_t c, float *existing_buffer, bool withCopy)
+Mat::BasicMat(size_t r, size_t c, float *existing_buffer, bool withCopy)
 {
 	data = NULL;
 	
@@ -182,7 +200,7 @@ Mat::Mat(size_t r, size_t c, float *existing_buffer, bool withCopy)
 }
 
 // set every element to a value
-Mat::Mat(size_t r, size_t c, float val)
+Mat::BasicMat(size_t r, size_t c, float val)
 {
 	data = NULL;
 	
@@ -204,7 +222,7 @@ Mat::Mat(size_t r, size_t c, float val)
 // copy-constructor, called during:
 //		pkm::Mat a = rhs;
 //		pkm::Mat a(rhs);
-Mat::Mat(const Mat &rhs)
+Mat::BasicMat(const Mat &rhs)
 {
 	if(rhs.bAllocated)
 	{
@@ -217,8 +235,16 @@ Mat::Mat(const Mat &rhs)
         {
             data = (float *)malloc(MULTIPLE_OF_4(rows * cols) * sizeof(float));
             memcpy(data, rhs.data, rows * cols * sizeof(float));
+            bAllocated = true;
+        }
+        else
+        {
+            // rhs only has reserved capacity (e.g. after reserve(), or
+            // removeRow() down to nothing): the copy keeps its shape but
+            // owns no memory, as shrink_to_fit() would leave it
+            data = NULL;
+            bAllocated = false;
         }
-		bAllocated = true;
 	}
     else if(rhs.bUserData)
     {
@@ -446,7 +472,7 @@ cv::Mat Mat::cvMat() const
 
 Mat Mat::getTranspose() const
 {
-#ifndef DEBUG			
+#ifdef DEBUG
 	assert(data != NULL);
 #endif	
 	Mat transposedMatrix(cols, rows);
@@ -456,12 +482,192 @@ Mat Mat::getTranspose() const
 		//memcpy(transposedMatrix.data, data, sizeof(float)*rows*cols);
 	}
 	else {
-		vDSP_mtrans(data, 1, transposedMatrix.data, 1, cols, rows);
+		transpose(data, rows, cols, cols, transposedMatrix.data, rows);
 	}
 	
 	return transposedMatrix;
 }
 
+// 8x8 block of src (rows apart by srcStride) to dst, transposed
+static inline void transpose8x8(const float *src, size_t srcStride, float *dst, size_t dstStride)
+{
+#if defined(__SSE2__)
+	// four 4x4 register transposes, the off-diagonal quarters swapping places
+	for (int bi = 0; bi < 8; bi += 4) {
+		for (int bj = 0; bj < 8; bj += 4) {
+			const float *s = src + bi * srcStride + bj;
+			__m128 r0 = _mm_loadu_ps(s);
+			__m128 r1 = _mm_loadu_ps(s + srcStride);
+			__m128 r2 = _mm_loadu_ps(s + 2 * srcStride);
+			__m128 r3 = _mm_loadu_ps(s + 3 * srcStride);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			float *d = dst + bj * dstStride + bi;
+			_mm_storeu_ps(d, r0);
+			_mm_storeu_ps(d + dstStride, r1);
+			_mm_storeu_ps(d + 2 * dstStride, r2);
+			_mm_storeu_ps(d + 3 * dstStride, r3);
+		}
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	for (int bi = 0; bi < 8; bi += 4) {
+		for (int bj = 0; bj < 8; bj += 4) {
+			const float *s = src + bi * srcStride + bj;
+			float32x4_t r0 = vld1q_f32(s);
+			float32x4_t r1 = vld1q_f32(s + srcStride);
+			float32x4_t r2 = vld1q_f32(s + 2 * srcStride);
+			float32x4_t r3 = vld1q_f32(s + 3 * srcStride);
+			// pairs of rows, then pairs of pairs
+			float64x2_t t0 = vreinterpretq_f64_f32(vtrn1q_f32(r0, r1));
+			float64x2_t t1 = vreinterpretq_f64_f32(vtrn2q_f32(r0, r1));
+			float64x2_t t2 = vreinterpretq_f64_f32(vtrn1q_f32(r2, r3));
+			float64x2_t t3 = vreinterpretq_f64_f32(vtrn2q_f32(r2, r3));
+			float *d = dst + bj * dstStride + bi;
+			vst1q_f32(d, vreinterpretq_f32_f64(vtrn1q_f64(t0, t2)));
+			vst1q_f32(d + dstStride, vreinterpretq_f32_f64(vtrn1q_f64(t1, t3)));
+			vst1q_f32(d + 2 * dstStride, vreinterpretq_f32_f64(vtrn2q_f64(t0, t2)));
+			vst1q_f32(d + 3 * dstStride, vreinterpretq_f32_f64(vtrn2q_f64(t1, t3)));
+		}
+	}
+#else
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+			dst[j * dstStride + i] = src[i * srcStride + j];
+		}
+	}
+#endif
+}
+
+// any block up to a tile, 8x8 kernels with scalar edges
+static void transposeBlock(const float *src, size_t rows, size_t cols, size_t srcStride,
+						   float *dst, size_t dstStride)
+{
+	size_t rows8 = rows & ~(size_t)7, cols8 = cols & ~(size_t)7;
+	for (size_t i = 0; i < rows8; i += 8) {
+		for (size_t j = 0; j < cols8; j += 8) {
+			transpose8x8(src + i * srcStride + j, srcStride, dst + j * dstStride + i, dstStride);
+		}
+		for (size_t j = cols8; j < cols; j++) {
+			for (size_t k = i; k < i + 8; k++) {
+				dst[j * dstStride + k] = src[k * srcStride + j];
+			}
+		}
+	}
+	for (size_t i = rows8; i < rows; i++) {
+		for (size_t j = 0; j < cols; j++) {
+			dst[j * dstStride + i] = src[i * srcStride + j];
+		}
+	}
+}
+
+void Mat::transpose(const float *src, size_t rows, size_t cols, size_t srcStride,
+					float *dst, size_t dstStride)
+{
+	for (size_t i = 0; i < rows; i += PKM_TRANSPOSE_TILE) {
+		size_t tileRows = MIN(PKM_TRANSPOSE_TILE, rows - i);
+		for (size_t j = 0; j < cols; j += PKM_TRANSPOSE_TILE) {
+			size_t tileCols = MIN(PKM_TRANSPOSE_TILE, cols - j);
+			transposeBlock(src + i * srcStride + j, tileRows, tileCols, srcStride,
+						   dst + j * dstStride + i, dstStride);
+		}
+	}
+}
+
+void Mat::transposeInPlace(float *data, size_t rows, size_t cols, bool bWithoutScratch)
+{
+	if (rows < 2 || cols < 2) {
+		return;
+	}
+	
+	if (rows == cols) {
+		// swap each 8x8 tile above the diagonal with its mirror below, going
+		// through a small buffer on the stack; diagonal tiles go through it alone
+		size_t n = rows, n8 = n & ~(size_t)7;
+		float tile[64];
+		for (size_t i = 0; i < n8; i += 8) {
+			transpose8x8(data + i * n + i, n, tile, 8);
+			for (size_t k = 0; k < 8; k++) {
+				memcpy(data + (i + k) * n + i, tile + k * 8, sizeof(float) * 8);
+			}
+			for (size_t j = i + 8; j < n8; j += 8) {
+				float *upper = data + i * n + j, *lower = data + j * n + i;
+				transpose8x8(upper, n, tile, 8);
+				transpose8x8(lower, n, upper, n);
+				for (size_t k = 0; k < 8; k++) {
+					memcpy(lower + k * n, tile + k * 8, sizeof(float) * 8);
+				}
+			}
+		}
+		// the ragged last rows and columns
+		for (size_t i = 0; i < n; i++) {
+			for (size_t j = MAX(i + 1, n8); j < n; j++) {
+				float t = data[i * n + j];
+				data[i * n + j] = data[j * n + i];
+				data[j * n + i] = t;
+			}
+		}
+		return;
+	}
+	
+	size_t size = rows * cols;
+	if (!bWithoutScratch) {
+		// tiled into scratch and copied back: two streaming passes, which beat
+		// following cycles around memory for all but the tiniest matrices
+		static thread_local std::vector<float> scratch;
+		if (size > PKM_TRANSPOSE_SCRATCH) {
+			float *large = (float *)malloc(sizeof(float) * size);
+			transpose(data, rows, cols, cols, large, rows);
+			memcpy(data, large, sizeof(float) * size);
+			free(large);
+			return;
+		}
+		if (scratch.size() < size) {
+			scratch.resize(size);
+		}
+		transpose(data, rows, cols, cols, &scratch[0], rows);
+		memcpy(data, &scratch[0], sizeof(float) * size);
+		return;
+	}
+	
+	// element (r, c) belongs at c * rows + r.  follow each cycle of that
+	// permutation once, marking where we've been; the first and last
+	// elements never move.  splitting an index back into (r, c) needs a
+	// division by cols, done as a multiply by its reciprocal when the
+	// indices fit in 32 bits.
+	size_t last = size - 1;
+	std::vector<uint64_t> moved((size + 63) / 64, 0);
+#if defined(__SIZEOF_INT128__)
+	bool bFastDivide = size <= 0xFFFFFFFFu;
+	uint64_t reciprocal = UINT64_C(0xFFFFFFFFFFFFFFFF) / cols + 1;
+#else
+	bool bFastDivide = false;
+#endif
+	for (size_t start = 1; start < last; start++) {
+		if (moved[start >> 6] & ((uint64_t)1 << (start & 63))) {
+			continue;
+		}
+		float value = data[start];
+		size_t k = start;
+		do {
+			size_t r;
+#if defined(__SIZEOF_INT128__)
+			if (bFastDivide) {
+				r = (size_t)(((unsigned __int128)reciprocal * k) >> 64);
+			}
+			else
+#endif
+			{
+				r = k / cols;
+			}
+			size_t next = (k - r * cols) * rows + r;
+			float t = data[next];
+			data[next] = value;
+			value = t;
+			moved[next >> 6] |= (uint64_t)1 << (next & 63);
+			k = next;
+		} while (k != start);
+	}
+}
+
 // get the diagonalized std::vector of a matrix (non-destructive)
 Mat Mat::getDiag() const
 {
@@ -564,39 +770,6 @@ void Mat::abs()
     vDSP_vabs(data, 1, data, 1, rows * cols);
 }
 
-/*
-
-Mat Mat::log(Mat &A)
-{
-#ifdef DEBUG			
-    assert(A.data != NULL);
-    assert(A.rows >0 &&
-           A.cols >0);
-#endif	
-	Mat newMat(A.rows, A.cols);
-	for(size_t i = 0; i < A.rows*A.cols; i++)
-	{
-		newMat.data[i] = logf(A.data[i]);
-	}
-	return newMat;
-}
-
-Mat Mat::exp(Mat &A)
-{
-#ifdef DEBUG			
-    assert(A.data != NULL);
-    assert(A.rows >0 &&
-           A.cols >0);
-#endif	
-	Mat newMat(A.rows, A.cols);
-	for(size_t i = 0; i < A.rows*A.cols; i++)
-	{
-		newMat.data[i] = expf(A.data[i]);
-	}
-	return newMat;
-}
-*/
-
 Mat Mat::eye(size_t dim)
 {
     
@@ -618,21 +791,28 @@ Mat Mat::identity(size_t dim)
 
 
 // set every element to a random value between low and high
-void Mat::setRand(float low, float high)
+void Mat::setRand(float low, float high, Random &random)
 {
-	float width = (high-low);
-	float *ptr = data;
-	for (size_t i = 0; i < rows*cols; i++) {
-		*ptr = low + (float(::random())/float(RAND_MAX))*width;
-		++ptr;
-	}
+	random.uniform(data, rows*cols, low, high);
 }
 
 // create a random matrix
-Mat Mat::rand(size_t r, size_t c, float low, float high)
+Mat Mat::rand(size_t r, size_t c, float low, float high, Random &random)
+{
+	Mat randomMatrix(r, c);
+	randomMatrix.setRand(low, high, random);
+	return randomMatrix;
+}
+
+void Mat::setRandn(float mean, float stddev, Random &random)
+{
+	random.normal(data, rows*cols, mean, stddev);
+}
+
+Mat Mat::randn(size_t r, size_t c, float mean, float stddev, Random &random)
 {
 	Mat randomMatrix(r, c);
-	randomMatrix.setRand(low, high);
+	randomMatrix.setRandn(mean, stddev, random);
 	return randomMatrix;
 }
 
@@ -662,77 +842,44 @@ Mat Mat::sum(bool across_rows)
 // normalize the values for each row-std::vector
 void Mat::setNormalize(bool row_major)
 {
-	if (row_major) {
-		for (size_t r = 0; r < rows; r++) {
-			float min, max;
-			vDSP_minv(&(data[r*cols]), 1, &min, cols);
-			vDSP_maxv(&(data[r*cols]), 1, &max, cols);
-			float height = max-min;
-			min = -min;
-			vDSP_vsadd(&(data[r*cols]), 1, &min, &(data[r*cols]), 1, cols);
-			if (height != 0) {
-				vDSP_vsdiv(&(data[r*cols]), 1, &height, &(data[r*cols]), 1, cols);	
-			}
-		}			
-	}
-	// or for each column
-	else {
-		for (size_t c = 0; c < cols; c++) {
-			float min, max;
-			vDSP_minv(&(data[c]), cols, &min, rows);
-			vDSP_maxv(&(data[c]), cols, &max, rows);
-			float height = max-min;
-			min = -min;
-			vDSP_vsadd(&(data[c]), cols, &min, &(data[c]), cols, rows);
-			if (height != 0) {
-				vDSP_vsdiv(&(data[c]), cols, &height, &(data[c]), cols, rows);	
-			}
-		}
-	}
+	math::normalizeMinMax(data, data, rows, cols, row_major);
+}
+
+void Mat::setNormalizeL1(bool row_major)
+{
+	math::normalizeL1(data, data, rows, cols, row_major);
+}
+
+void Mat::setNormalizeL2(bool row_major)
+{
+	math::normalizeL2(data, data, rows, cols, row_major);
 }
 
 void Mat::divideEachVecByMaxVecElement(bool row_major)
 {
-	if (row_major) {
-		for (size_t r = 0; r < rows; r++) {
-			size_t idx = cblas_isamax(cols, data+r*cols, 1);
-			float val = *(data+r*cols+idx);
-			if (val != 0.0f) {
-				vDSP_vsdiv(&(data[r*cols]), 1, &val, &(data[r*cols]), 1, cols);	
-			}
-		}
-	}
-	else {
-		for (size_t c = 0; c < cols; c++) {
-			size_t idx = cblas_isamax(rows, data+c, cols)*cols;
-			float val = *(data+c+idx);
-			if (val != 0.0f) {
-				vDSP_vsdiv(&(data[c]), cols, &val, &(data[c]), cols, rows);	
-			}
-		}
-	}
+	math::normalizeMaxMagnitude(data, data, rows, cols, row_major);
 }
 
 void Mat::divideEachVecBySum(bool row_major)
 {
-	if (row_major) {
-		for (size_t r = 0; r < rows; r++) {
-			float val;
-			vDSP_sve(data+r*cols, 1, &val, cols);
-			if (val != 0.0f) {
-				vDSP_vsdiv(data+r*cols, 1, &val, data+r*cols, 1, cols);	
-			}
-		}
-	}
-	else {
-		for (size_t c = 0; c < cols; c++) {
-			float val;
-			vDSP_sve(data+c, cols, &val, rows);
-			if (val != 0.0f) {
-				vDSP_vsdiv(data+c, cols, &val, data+c, cols, rows);	
-			}
-		}
-	}
+	math::normalizeSum(data, data, rows, cols, row_major);
+}
+
+void Mat::setSoftmax(bool row_major, math::Precision precision)
+{
+	math::softmax(data, data, rows, cols, row_major, precision);
+}
+
+void Mat::setLogSoftmax(bool row_major, math::Precision precision)
+{
+	math::logSoftmax(data, data, rows, cols, row_major, precision);
+}
+
+Mat Mat::logSumExp(bool row_major, math::Precision precision) const
+{
+	Mat result = row_major ? Mat(rows, 1) : Mat(1, cols);
+	math::logSumExp(data, result.data, rows, cols, row_major, precision);
+	return result;
 }
 
 void Mat::printAbbrev(bool row_major, char delimiter)
@@ -789,6 +936,248 @@ void Mat::print(bool row_major, char delimiter)
 	
 }
 
+// the resampler for the last shapes used on this thread, so resizing frame
+// after frame to the same size works out the weights once
+static const Resampler & lastResampler(size_t srcRows, size_t srcCols, size_t dstRows, size_t dstCols, Resampler::Method method)
+{
+	static thread_local Resampler resampler;
+	if (!resampler.matches(srcRows, srcCols, dstRows, dstCols, method)) {
+		resampler = Resampler(srcRows, srcCols, dstRows, dstCols, method);
+	}
+	return resampler;
+}
+
+void Mat::longerpolate(size_t r, size_t c, Resampler::Method method)
+{
+	float *new_data = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(r * c));
+	lastResampler(rows, cols, r, c, method).resample(data, cols, new_data, c);
+	
+	releaseMemory();
+	data = new_data;
+	bAllocated = true;
+	bUserData = false;
+	allocatedSize = 0;
+	
+	rows = r;
+	cols = c;
+}
+
+void Mat::longerpolate(size_t r, size_t c, Mat &new_mat, Resampler::Method method) const
+{
+	if (&new_mat == this) {
+		Mat resized;
+		longerpolate(r, c, resized, method);
+		new_mat = resized;
+		return;
+	}
+	lastResampler(rows, cols, r, c, method).resample(*this, new_mat);
+}
+
+void Mat::GEMMBatched(const std::vector<Mat> &lhs, const std::vector<Mat> &rhs, std::vector<Mat> &result)
+{
+	if (lhs.size() != rhs.size()) {
+		printf("[ERROR: pkmMatrix::GEMMBatched()] %lu left hand sides but %lu right hand sides.\n", lhs.size(), rhs.size());
+		return;
+	}
+	size_t batch = lhs.size();
+	result.resize(batch);
+	
+	size_t multiplyAdds = 0;
+	for (size_t i = 0; i < batch; i++) {
+		if (lhs[i].cols != rhs[i].rows) {
+			printf("[ERROR: pkmMatrix::GEMMBatched()] Product %lu is %lu x %lu times %lu x %lu.\n", i, lhs[i].rows, lhs[i].cols, rhs[i].rows, rhs[i].cols);
+			return;
+		}
+		if (result[i].rows != lhs[i].rows || result[i].cols != rhs[i].cols) {
+			result[i].reset(lhs[i].rows, rhs[i].cols);
+		}
+		multiplyAdds += lhs[i].rows * lhs[i].cols * rhs[i].cols;
+	}
+	
+	// split by the average product
+	size_t perTask = multiplyAdds ? MAX((size_t)1, PKM_GEMM_BATCH_CHUNK * batch / multiplyAdds) : batch;
+	pkm::parallelFor(batch, perTask, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			gemm::multiply(gemm::NO_TRANS, gemm::NO_TRANS, lhs[i].rows, rhs[i].cols, lhs[i].cols,
+						   1.0f, lhs[i].data, lhs[i].cols, rhs[i].data, rhs[i].cols,
+						   0.0f, result[i].data, result[i].cols);
+		}
+	});
+}
+
+// small dimensions factor on the stack rather than through lapack
+template<size_t D>
+static float fixedGaussianPosterior(const Mat &input, const Mat &mean, const Mat &sigma)
+{
+	FixedGaussian<D> gaussian;
+	if (!gaussian.setup(FixedMat<1, D>(mean.data), FixedMat<D, D>(sigma.data))) {
+		printf("[ERROR: pkmMatrix::gaussianPosterior()] sigma is not positive definite.\n");
+		return 0.0f;
+	}
+	return gaussian.pdf(input.data);
+}
 
+float Mat::gaussianPosterior(const Mat &input, const Mat &mean, const Mat &sigma)
+{
+#ifdef DEBUG
+	assert(input.cols == mean.cols);
+	assert(input.cols == sigma.rows);
+	assert(input.cols == sigma.cols);
+#endif
+	switch (input.cols) {
+		case 1: return fixedGaussianPosterior<1>(input, mean, sigma);
+		case 2: return fixedGaussianPosterior<2>(input, mean, sigma);
+		case 3: return fixedGaussianPosterior<3>(input, mean, sigma);
+		case 4: return fixedGaussianPosterior<4>(input, mean, sigma);
+		default: break;
+	}
+	
+	__CLPK_integer d = input.cols;
+	__CLPK_integer info = 0;
+	char uplo = 'U';
+	
+	// cholesky factor, sigma = L L^T, left in the row-major lower triangle
+	Mat L = sigma;
+	spotrf_(&uplo, &d, L.data, &d, &info);
+	if (info != 0) {
+		printf("[ERROR: pkmMatrix::gaussianPosterior()] sigma is not positive definite.\n");
+		return 0.0f;
+	}
+	
+	// z = L^{-1} (input - mean)
+	Mat z = input;
+	z.subtract(mean);
+	cblas_strsm(CblasRowMajor, CblasRight, CblasLower, CblasTrans, CblasNonUnit, 1, d, 1.0f, L.data, d, z.data, d);
+	
+	float halfLogDet = 0;
+	for (long i = 0; i < d; i++) {
+		halfLogDet += logf(L.data[i*d + i]);
+	}
+	float mahalanobis = cblas_sdot(d, z.data, 1, z.data, 1);
+	
+	return expf(-0.5f * (d * logf(2.0f * M_PI) + mahalanobis) - halfLogDet);
+}
 
+long Mat::svd(Mat &U, Mat &S, Mat &V_t, bool bThin) const
+{
+	// lapack is column-major, so it sees our rows x cols A as the cols x rows
+	// A^T = V S U^T: its left singular vectors come out as our V_t and its
+	// right ones as our U, with nothing to transpose
+	__CLPK_integer m = cols;
+	__CLPK_integer n = rows;
+	__CLPK_integer k = MIN(m, n);
+	__CLPK_integer lda = m;
+	__CLPK_integer ldu = m;
+	__CLPK_integer ldvt = bThin ? k : n;
+	
+	S.reset(1, k);
+	V_t.reset(bThin ? k : m, cols);
+	U.reset(rows, bThin ? k : n);
+	if (k == 0) {
+		return 0;
+	}
+	
+	// sgesdd destroys its input
+	Mat A(rows, cols, (const float *)data);
+	
+	//https://groups.google.com/forum/#!topic/julia-dev/mmgO65i6-fA sdd (divide/conquer, better if memory is available, for large matrices) versus svd (qr)
+	//http://docs.oracle.com/cd/E19422-01/819-3691/dgesvd.html
+	char job = bThin ? 'S' : 'A';
+	__CLPK_integer info = 0;
+	__CLPK_integer lwork = -1;
+	std::vector<__CLPK_integer> iwork(8 * k);
+	
+	// call svd to query optimal work size, then on the heap (not the stack)
+	float workSize;
+	sgesdd_(&job, &m, &n, A.data, &lda, S.data, V_t.data, &ldu, U.data, &ldvt, &workSize, &lwork, &iwork[0], &info);
+	lwork = (__CLPK_integer)workSize;
+	std::vector<float> work(lwork);
+	
+	sgesdd_(&job, &m, &n, A.data, &lda, S.data, V_t.data, &ldu, U.data, &ldvt, &work[0], &lwork, &iwork[0], &info);
+	
+	// Check for convergence
+	if( info > 0 ) {
+		printf( "[pkm::Mat]::svd(...) sgesdd_() failed to converge.\n" );
+	}
+	
+	return info;
+}
+
+// replaces the columns of the cols x rows column-major matrix held in Mt
+// (i.e. the rows of Mt) with an orthonormal basis for them, by householder qr
+static long orthonormalizeRows(Mat &Mt)
+{
+	__CLPK_integer m = Mt.cols;
+	__CLPK_integer n = Mt.rows;
+	__CLPK_integer lda = m;
+	__CLPK_integer info = 0;
+	__CLPK_integer lwork = -1;
+	std::vector<float> tau(n);
+	
+	float qrSize, qSize;
+	sgeqrf_(&m, &n, Mt.data, &lda, &tau[0], &qrSize, &lwork, &info);
+	sorgqr_(&m, &n, &n, Mt.data, &lda, &tau[0], &qSize, &lwork, &info);
+	lwork = (__CLPK_integer)MAX(qrSize, qSize);
+	std::vector<float> work(lwork);
+	
+	sgeqrf_(&m, &n, Mt.data, &lda, &tau[0], &work[0], &lwork, &info);
+	if (info == 0) {
+		sorgqr_(&m, &n, &n, Mt.data, &lda, &tau[0], &work[0], &lwork, &info);
+	}
+	return info;
+}
 
+long Mat::randomizedSVD(size_t k, Mat &U, Mat &S, Mat &V_t,
+						size_t oversamples, size_t powerIterations,
+						unsigned long seed) const
+{
+	size_t m = rows, n = cols;
+	size_t l = MIN(k + oversamples, MIN(m, n));
+	k = MIN(k, l);
+	if (k == 0) {
+		U.reset(m, 0);
+		S.reset(1, 0);
+		V_t.reset(0, n);
+		return 0;
+	}
+	
+	// every product is kept transposed, l x m or l x n row-major, which is
+	// exactly the m x l or n x l column-major matrix lapack wants to factor
+	Random random(seed);
+	Mat omegaT = Mat::randn(l, n, 0.0, 1.0, random);
+	
+	// Q = orth(A omega)
+	Mat Qt(l, m), Zt(l, n);
+	cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, l, m, n, 1.0f, omegaT.data, n, data, n, 0.0f, Qt.data, m);
+	long info = orthonormalizeRows(Qt);
+	
+	// Q = orth(A orth(A^T Q)), re-orthonormalizing each half step so the
+	// smaller singular directions don't round away
+	for (size_t i = 0; i < powerIterations && info == 0; i++) {
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, l, n, m, 1.0f, Qt.data, m, data, n, 0.0f, Zt.data, n);
+		info = orthonormalizeRows(Zt);
+		if (info == 0) {
+			cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, l, m, n, 1.0f, Zt.data, n, data, n, 0.0f, Qt.data, m);
+			info = orthonormalizeRows(Qt);
+		}
+	}
+	if (info != 0) {
+		printf("[ERROR: pkm::Mat::randomizedSVD()] QR failed (%ld).\n", info);
+		return info;
+	}
+	
+	// B = Q^T A is only l x n, so factor it exactly
+	Mat B(l, n), Ub, Sb, Vb_t;
+	cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, l, n, m, 1.0f, Qt.data, m, data, n, 0.0f, B.data, n);
+	info = B.svd(Ub, Sb, Vb_t, true);
+	
+	// U = Q Ub, keeping the first k of everything
+	U.reset(m, k);
+	cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, m, k, l, 1.0f, Qt.data, m, Ub.data, Ub.cols, 0.0f, U.data, k);
+	S.reset(1, k);
+	cblas_scopy(k, Sb.data, 1, S.data, 1);
+	V_t.reset(k, n);
+	cblas_scopy(k * n, Vb_t.data, 1, V_t.data, 1);
+	
+	return info;
+}
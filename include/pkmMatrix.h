@@ -26,8 +26,13 @@
 
 #include <iostream>
 #include <assert.h>
+#include <string.h>
 #include <Accelerate/Accelerate.h>
 #include <vector>
+#include "pkmGEMM.h"
+#include "pkmMath.h"
+#include "pkmRandom.h"
+#include "pkmResample.h"
 
 #ifdef OPENCV
 #define HAVE_OPENCV
@@ -63,38 +68,47 @@ template <typename T> long signum(T val) {
 
 namespace pkm
 {
+    // row-major matrix of T.  float, i.e. Mat, is the full class below,
+    // built on vDSP and the native kernels; other types get the smaller
+    // template in pkmBasicMat.h, which dispatches to the d BLAS routines
+    // (and so on) for its type.
+    template<typename T> class BasicMat;
+    template<> class BasicMat<float>;
+    typedef BasicMat<float> Mat;
+    
     // row-major floating point matrix
-    class Mat
+    template<>
+    class BasicMat<float>
     {
         /////////////////////////////////////////
     public:
         // default constructor
-        Mat();
+        BasicMat();
         
         // destructor
-        virtual ~Mat();
+        virtual ~BasicMat();
         
-        Mat(const std::vector<float> m);
+        BasicMat(const std::vector<float> m);
         
-        Mat(const std::vector<std::vector<float> > m);
+        BasicMat(const std::vector<std::vector<float> > m);
 #ifdef HAVE_OPENCV
-        Mat(const cv::Mat &m);
+        BasicMat(const cv::Mat &m);
 #endif
         // allocate data
-        Mat(size_t r, size_t c, bool clear = false);
+        BasicMat(size_t r, size_t c, bool clear = false);
         
         // pass in existing data
         // non-destructive by default
-        Mat(size_t r, size_t c, float *existing_buffer, bool withCopy);
+        BasicMat(size_t r, size_t c, float *existing_buffer, bool withCopy);
         
-        Mat(size_t r, size_t c, const float *existing_buffer);
+        BasicMat(size_t r, size_t c, const float *existing_buffer);
         
         // set every element to a value
-        Mat(size_t r, size_t c, float val);
+        BasicMat(size_t r, size_t c, float val);
         
         // copy-constructor, called during:
         //		pkm::Mat a(rhs);
-        Mat(const Mat &rhs);
+        BasicMat(const Mat &rhs);
         Mat & operator=(const Mat &rhs);
         Mat & operator=(const std::vector<float> &rhs);
         Mat & operator=(const std::vector<std::vector<float> > &rhs);
@@ -164,7 +178,7 @@ namespace pkm
             
             Mat gemmResult(rows, rhs.cols);
             //ldb must be >= MAX(N,1): ldb=30 N=3533Parameter 11 to routine cblas_sgemm was incorrect
-            cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, gemmResult.rows, gemmResult.cols, cols, 1.0f, data, cols, rhs.data, rhs.cols, 0.0f, gemmResult.data, gemmResult.cols);
+            gemm::multiply(gemm::NO_TRANS, gemm::NO_TRANS, gemmResult.rows, gemmResult.cols, cols, 1.0f, data, cols, rhs.data, rhs.cols, 0.0f, gemmResult.data, gemmResult.cols);
             //vDSP_mmul(data, 1, rhs.data, 1, gemmResult.data, 1, gemmResult.rows, gemmResult.cols, cols);
             return gemmResult;
         }
@@ -476,19 +490,8 @@ namespace pkm
                 
                 if (r >= rows && c >= cols) {
                     
-                    if (bUserData) {
-                        data = (float *)malloc(MULTIPLE_OF_4(r * c) * sizeof(float));
-                    }
-                    else
-                    {
-                        float *temp_data = (float *)malloc(sizeof(float)*MULTIPLE_OF_4(rows*cols));
-                        cblas_scopy(rows*cols, data, 1, temp_data, 1);
-                        
-                        data = (float *)realloc(data, MULTIPLE_OF_4(r * c) * sizeof(float));
-                        cblas_scopy(rows*cols, temp_data, 1, data, 1);
-                        
-                        free(temp_data);
-                        temp_data = NULL;
+                    if (!reserveElements(r * c, false)) {
+                        return;
                     }
                     
                     if(clear)
@@ -516,6 +519,7 @@ namespace pkm
             else
             {
                 data = (float *)malloc(MULTIPLE_OF_4(r * c) * sizeof(float));
+                allocatedSize = 0;
                 rows = r;
                 cols = c;
                 
@@ -554,42 +558,47 @@ namespace pkm
                 vDSP_vclr(data, 1, MULTIPLE_OF_4(rows*cols));
             }
         }
-        
+
+        // points an already declared matrix at memory owned by someone else
+        // (e.g. a memory mapped file) without a copy; it is never freed here
+        void setUserData(size_t r, size_t c, float *buffer)
+        {
+            releaseMemory();
+
+            rows = r;
+            cols = c;
+            current_row = 0;
+            bCircularInsertionFull = false;
+
+            data = buffer;
+            bAllocated = false;
+            bUserData = true;
+        }
+
         // longerpolates data (row-major) to new size
         void rescale(long r, long c)
         {
-            Mat longerp_mat(r, c);
-            size_t old_size = rows*cols;
-            size_t new_size = r*c;
-            float factor = (float)std::max<size_t>(0, old_size - 1) / (float)std::max<size_t>(0, new_size - 1);
-            for (long i = 0; i < new_size; i++) {
-                longerp_mat[i] = factor*i;
-            }
-            
-            float *new_data = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(new_size));
+            float *new_data = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(r * c));
+            pkm::interpolate(data, rows * cols, new_data, r * c);
             
-            vDSP_vlint(data, longerp_mat.data, 1, new_data, 1, new_size, old_size);
-            free(data);
+            releaseMemory();
             data = new_data;
+            bAllocated = true;
+            bUserData = false;
+            allocatedSize = 0;
             
             rows = r;
             cols = c;
         }
         
-        // longerpolates data (row-major) to new size
+        // longerpolates data (row-major) to new size; new_mat is only
+        // reallocated when it is not already r x c
         void rescale(long r, long c, Mat &new_mat) const
         {
-            Mat longerp_mat(r, c);
-            size_t old_size = rows*cols;
-            size_t new_size = r*c;
-            float factor = (float)std::max<size_t>(0, old_size - 1) / (float)std::max<size_t>(0, new_size - 1);
-            for (float i = 0; i < new_size; i++) {
-                longerp_mat[i] = factor * i;
+            if (new_mat.rows != (size_t)r || new_mat.cols != (size_t)c) {
+                new_mat.reset(r, c);
             }
-            
-            new_mat = Mat(r, c);
-            
-            vDSP_vlint(data, longerp_mat.data, 1, new_mat.data, 1, new_size, old_size);
+            pkm::interpolate(data, rows * cols, new_mat.data, r * c);
         }
         
         Mat max(bool row_major)
@@ -613,123 +622,13 @@ namespace pkm
         }
 
         
-        // like rescale, but 2D information preserved..
-        void longerpolate(size_t r, size_t c)
-        {
-            float *new_data = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(r * c));
-            
-            vImage_Buffer src = { (void *)data, (vImagePixelCount)rows, (vImagePixelCount)cols, (size_t)(sizeof(float) * cols) };
-            vImage_Buffer dest = { (void *)new_data, (vImagePixelCount)r, (vImagePixelCount)c, (size_t)(sizeof(float) * cols) };
-            vImage_Error err = vImageScale_PlanarF(&src, &dest, NULL, kvImageNoFlags);
-            
-            if(err == kvImageNoError)
-            {
-                
-            }
-            else if (err ==  kvImageRoiLargerThanInputBuffer)
-            {
-                std::cout << "image roi larger than input buffer" << std::endl;
-            }
-            else if (err == kvImageInvalidKernelSize)
-            {
-                std::cout << "image invalid kernel size" << std::endl;
-            }
-            else if (err == kvImageInvalidEdgeStyle)
-            {
-                std::cout << "invalid edge style" << std::endl;
-            }
-            else if (err == kvImageInvalidOffset_X)
-            {
-                std::cout << "invalid image offset x" << std::endl;
-            }
-            else if (err == kvImageInvalidOffset_Y)
-            {
-                std::cout << "invalid image offset y" << std::endl;
-            }
-            else if (err == kvImageMemoryAllocationError)
-            {
-                std::cout << "image memory allocation error" << std::endl;
-            }
-            else if (err == kvImageNullPointerArgument)
-            {
-                std::cout << "image null pointer argument error" << std::endl;
-            }
-            else if (err == kvImageInvalidParameter)
-            {
-                std::cout << "image invalid parameter" << std::endl;
-            }
-            else if (err == kvImageBufferSizeMismatch)
-            {
-                std::cout << "image buffer size mismatch" << std::endl;
-            }
-            else if (err == kvImageUnknownFlagsBit)
-            {
-                std::cout << "unknown flag bit error" << std::endl;
-            }
-            
-            free(data);
-            data = new_data;
-            
-            rows = r;
-            cols = c;
-        }
-        
+        // like rescale, but 2D information preserved (see pkm::Resampler).
+        // the weights for the last shapes resampled on a thread are kept.
+        void longerpolate(size_t r, size_t c, Resampler::Method method = Resampler::BICUBIC);
         
-        // like rescale, but 2D information preserved..
-        void longerpolate(size_t r, size_t c, Mat &new_mat) const
-        {
-            new_mat.reset(r, c);
-            
-            vImage_Buffer src = { (void *)data, (vImagePixelCount)rows, (vImagePixelCount)cols, (size_t)sizeof(float) * cols };
-            vImage_Buffer dest = { (void *)new_mat.data, (vImagePixelCount)r, (vImagePixelCount)c, (size_t)sizeof(float) * c };
-            vImage_Error err = vImageScale_PlanarF(&src, &dest, NULL, kvImageNoFlags);
-            
-            if(err == kvImageNoError)
-            {
-                
-            }
-            else if (err ==  kvImageRoiLargerThanInputBuffer)
-            {
-                std::cout << "image roi larger than input buffer" << std::endl;
-            }
-            else if (err == kvImageInvalidKernelSize)
-            {
-                std::cout << "image invalid kernel size" << std::endl;
-            }
-            else if (err == kvImageInvalidEdgeStyle)
-            {
-                std::cout << "invalid edge style" << std::endl;
-            }
-            else if (err == kvImageInvalidOffset_X)
-            {
-                std::cout << "invalid image offset x" << std::endl;
-            }
-            else if (err == kvImageInvalidOffset_Y)
-            {
-                std::cout << "invalid image offset y" << std::endl;
-            }
-            else if (err == kvImageMemoryAllocationError)
-            {
-                std::cout << "image memory allocation error" << std::endl;
-            }
-            else if (err == kvImageNullPointerArgument)
-            {
-                std::cout << "image null pointer argument error" << std::endl;
-            }
-            else if (err == kvImageInvalidParameter)
-            {
-                std::cout << "image invalid parameter" << std::endl;
-            }
-            else if (err == kvImageBufferSizeMismatch)
-            {
-                std::cout << "image buffer size mismatch" << std::endl;
-            }
-            else if (err == kvImageUnknownFlagsBit)
-            {
-                std::cout << "unknown flag bit error" << std::endl;
-            }
-            
-        }
+        // like rescale, but 2D information preserved; new_mat is only
+        // reallocated when it is not already r x c
+        void longerpolate(size_t r, size_t c, Mat &new_mat, Resampler::Method method = Resampler::BICUBIC) const;
         
         // can be used to create an already declared matrix without a copy constructor
         void reset(size_t r, size_t c, float val)
@@ -794,57 +693,51 @@ namespace pkm
             return !(bAllocated && (rows > 0) && (cols > 0));
         }
         
+        // push_backs grow the buffer geometrically, so appending row by row
+        // is amortized O(1); reserve() first when the final size is known
         void push_back(const Mat &m)
         {
 #ifdef DEBUG
             if(bUserData)
             {
-                std::cout << "[WARNING]: Pointer to user data will be resized.  Possible leak!" << std::endl;
+                std::cout << "[WARNING]: Pointer to user data will be copied before resizing." << std::endl;
             }
 #endif
-            // we're not empty
-            if (!isEmpty()) {
-                if(!m.isEmpty())
-                {
-                    if (m.cols == cols){
-                        // add more rows, since the columns are the same dimension
-                        float *temp_data = (float *)malloc((rows+m.rows)*cols*sizeof(float));
-                        
-                        cblas_scopy(rows*cols, data, 1, temp_data, 1);
-                        
-                        cblas_scopy(m.rows*m.cols, m.data, 1, temp_data + (rows*cols), 1);
-                        
-                        free(data);
-                        data = temp_data;
-                        
-                        rows+=m.rows;
-                    }
-                    else {
-                        // the columns don't match, and there are more than 1 rows, so no idea how to push back
-                        if (m.rows > 1 || rows > 1) {
-                            printf("[ERROR]: pkm::Mat push_back(Mat m) requires same number of columns or both matrices with <= 1 rows to concat along columns!\n");
-                            return;
-                        }
-                        // the columns don't match but the rows must be equal to 1 (because it is not empty)
-                        else
-                        {
-                            // extend along column dimension
-                            data = (float *)realloc(data, (cols + m.cols)*sizeof(float));
-                            cblas_scopy(m.cols, m.data, 1, data + cols, 1);
-                            cols += m.cols;
-                        }
-                    }
-                }
-                // so m is empty, nothing to do
-                else {
+            // so m is empty, nothing to do
+            if (!m.hasElements()) {
+                if (hasElements()) {
                     printf("[ERROR]: pkm::Mat push_back(Mat m), matrix m is empty!\n");
-                    return;
                 }
+                return;
+            }
+            
+            // we're empty, so take m's width (keeping any reserved memory)
+            if (!hasElements()) {
+                rows = 0;
+                cols = m.cols;
+                appendRows(m.data, m.rows);
+            }
+            else if (m.cols == cols) {
+                // add more rows, since the columns are the same dimension
+                appendRows(m.data, m.rows);
             }
             else {
-                *this = m;
+                // the columns don't match, and there are more than 1 rows, so no idea how to push back
+                if (m.rows > 1 || rows > 1) {
+                    printf("[ERROR]: pkm::Mat push_back(Mat m) requires same number of columns or both matrices with <= 1 rows to concat along columns!\n");
+                    return;
+                }
+                // the columns don't match but the rows must be equal to 1 (because it is not empty)
+                else
+                {
+                    // extend along column dimension
+                    if (!reserveElements(cols + m.cols)) {
+                        return;
+                    }
+                    cblas_scopy(m.cols, m.data, 1, data + cols, 1);
+                    cols += m.cols;
+                }
             }
-            
         }
         
         void push_back(float m)
@@ -857,76 +750,93 @@ namespace pkm
 #ifdef DEBUG
             if(bUserData)
             {
-                std::cout << "[WARNING]: Pointer to user data will be resized.  Possible leak!" << std::endl;
+                std::cout << "[WARNING]: Pointer to user data will be copied before resizing." << std::endl;
             }
 #endif
             if(size > 0)
             {
-                if (bAllocated && (rows > 0) && (cols > 0)) {
+                if (hasElements()) {
                     if (size != cols) {
                         printf("[ERROR]: pkm::Mat push_back(float *m) requires same number of columns in Mat as length of std::vector!\n");
                         return;
                     }
-                    data = (float *)realloc(data, MULTIPLE_OF_4((rows+1)*cols)*sizeof(float));
-                    cblas_scopy(cols, m, 1, data + (rows*cols), 1);
-                    rows++;
                 }
                 else {
+                    rows = 0;
                     cols = size;
-                    data = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(cols));
-                    cblas_scopy(cols, m, 1, data, 1);
-                    rows = 1;
-                    bAllocated = true;
                 }
+                appendRows(m, 1);
             }
         }
         
         inline void push_back(const std::vector<float> &m)
         {
-#ifdef DEBUG
-            if(bUserData)
-            {
-                std::cout << "[WARNING]: Pointer to user data will be resized.  Possible leak!" << std::endl;
+            if (m.size()) {
+                push_back(&(m[0]), m.size());
             }
-#endif
-            if (bAllocated && rows > 0 && cols > 0) {
-                if (m.size() != cols) {
-                    printf("[ERROR]: pkm::Mat push_back(std::vector<float> m) requires same number of columns in Mat as length of std::vector!\n");
-                    return;
+        }
+        
+        inline void push_back(const std::vector<std::vector<float> > &m)
+        {
+            if (m.empty() || m[0].empty()) {
+                return;
+            }
+            if (hasElements() && m[0].size() != cols) {
+                printf("[ERROR]: pkm::Mat push_back(std::vector<std::vector<float> > m) requires same number of cols in Mat as length of each std::vector!\n");
+                return;
+            }
+            if (!hasElements()) {
+                rows = 0;
+                cols = m[0].size();
+            }
+            if (!reserveElements((rows + m.size()) * cols)) {
+                return;
+            }
+            for (size_t i = 0; i < m.size(); i++) {
+                appendRows(&(m[i][0]), 1);
+            }
+        }
+        
+        // room for r rows of the current width (or of c columns, when
+        // empty) before push_back needs to reallocate
+        void reserve(size_t r, size_t c = 0)
+        {
+            if (!hasElements()) {
+                rows = 0;
+                if (c) {
+                    cols = c;
                 }
-                data = (float *)realloc(data, MULTIPLE_OF_4((rows+1)*cols)*sizeof(float));
-                cblas_scopy(cols, &(m[0]), 1, data + (rows*cols), 1);
-                rows++;
             }
-            else {
-                *this = m;
+            reserveElements(r * cols, false);
+        }
+        
+        // rows that fit in the current allocation
+        size_t capacity() const
+        {
+            if (cols == 0 || !bAllocated || bUserData) {
+                return rows;
             }
-            
+            return std::max(allocatedSize, rows * cols) / cols;
         }
         
-        inline void push_back(const std::vector<std::vector<float> > &m)
+        // gives back memory reserved beyond rows x cols
+        void shrink_to_fit()
         {
-#ifdef DEBUG
-            if(bUserData)
-            {
-                std::cout << "[WARNING]: Pointer to user data will be resized.  Possible leak!" << std::endl;
+            if (!bAllocated || bUserData || allocatedSize <= rows * cols) {
+                return;
             }
-#endif
-            if (rows > 0 && cols > 0) {
-                if (m[0].size() != cols) {
-                    printf("[ERROR]: pkm::Mat push_back(std::vector<std::vector<float> > m) requires same number of cols in Mat as length of each std::vector!\n");
-                    return;
-                }
-                data = (float *)realloc(data, MULTIPLE_OF_4((rows+m.size())*cols)*sizeof(float));
-                for (long i = 0; i < m.size(); i++) {
-                    cblas_scopy(cols, &(m[i][0]), 1, data + ((rows+i)*cols), 1);
-                }
-                rows+=m.size();
+            if (rows * cols == 0) {
+                size_t c = cols;
+                releaseMemory();
+                rows = 0;
+                cols = c;
+                return;
             }
-            else {
-                *this = m;
+            float *buffer = (float *)realloc(data, sizeof(float) * MULTIPLE_OF_4(rows * cols));
+            if (buffer) {
+                data = buffer;
+                allocatedSize = 0;
             }
-            
         }
         
         inline void insertRowCircularly(const float *buf)
@@ -1012,29 +922,22 @@ namespace pkm
             }
         }
         
+        // shifts the rows after i up by one; the memory is kept for later
+        // push_backs (see shrink_to_fit)
         void removeRow(size_t i)
         {
 #ifdef DEBUG
             assert(i < rows);
             assert(i >= 0);
 #endif
-            // are we removing the last row (or only row)?
-            if(i == (rows - 1))
-            {
-                rows--;
-                realloc(data, sizeof(float)*MULTIPLE_OF_4(rows*cols));
+            if (bAllocated && !bUserData) {
+                allocatedSize = std::max(allocatedSize, rows * cols);
             }
             // we have to preserve the memory after the deleted row
-            else {
-                size_t numRowsToCopy = rows - i - 1;
-                float *temp_data = (float *)malloc(sizeof(float)*numRowsToCopy * cols);
-                cblas_scopy(numRowsToCopy * cols, row(i+1), 1, temp_data, 1);
-                rows--;
-                realloc(data, sizeof(float)*MULTIPLE_OF_4(rows*cols));
-                cblas_scopy(cols * numRowsToCopy, temp_data, 1, row(i), 1);
-                free(temp_data);
-                temp_data = NULL;
+            if (i < (rows - 1)) {
+                memmove(row(i), row(i+1), sizeof(float) * (rows - i - 1) * cols);
             }
+            rows--;
         }
         
         // inclusive of start, exclusive of end
@@ -1311,7 +1214,7 @@ namespace pkm
                    cols == rhs.rows);
 #endif
             
-            cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, result.rows, result.cols, cols, 1.0f, data, cols, rhs.data, rhs.cols, 0.0f, result.data, result.cols);
+            gemm::multiply(gemm::NO_TRANS, gemm::NO_TRANS, result.rows, result.cols, cols, 1.0f, data, cols, rhs.data, rhs.cols, 0.0f, result.data, result.cols);
             //vDSP_mmul(data, 1, rhs.data, 1, result.data, 1, result.rows, result.cols, cols);
             
         }
@@ -1332,12 +1235,18 @@ namespace pkm
             Mat gemmResult(rows, rhs.cols);
             
             //printf("lda: %d\nldb: %d\nldc: %d\n", rows, rhs.rows, gemmResult.rows);
-            cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, gemmResult.rows, gemmResult.cols, cols, 1.0f, data, cols, rhs.data, rhs.cols, 0.0f, gemmResult.data, gemmResult.cols);
+            gemm::multiply(gemm::NO_TRANS, gemm::NO_TRANS, gemmResult.rows, gemmResult.cols, cols, 1.0f, data, cols, rhs.data, rhs.cols, 0.0f, gemmResult.data, gemmResult.cols);
             //vDSP_mmul(data, 1, rhs.data, 1, gemmResult.data, 1, gemmResult.rows, gemmResult.cols, cols);
             return gemmResult;
             
         }
         
+        // result[i] = lhs[i] rhs[i] for every i, as one batch split across
+        // threads (see pkmGEMM.h).  shapes may differ from product to product;
+        // result is resized to match lhs, and each result[i] only reallocated
+        // when its shape is wrong, so repeated batches allocate nothing.
+        static void GEMMBatched(const std::vector<Mat> &lhs, const std::vector<Mat> &rhs, std::vector<Mat> &result);
+        
         inline void setTranspose()
         {
 #ifdef DEBUG
@@ -1346,26 +1255,28 @@ namespace pkm
                 print("[Warning]: Transposing user data!");
             }
 #endif
-            if (rows == 1 || cols == 1) {
-                
-                size_t tempvar = cols;
-                cols = rows;
-                rows = tempvar;
-            }
-            else {
-                float *temp_data = (float *)malloc(sizeof(float)*rows*cols);
-                vDSP_mtrans(data, 1, temp_data, 1, cols, rows);
-                cblas_scopy(rows*cols, temp_data, 1, data, 1);
-                free(temp_data);
-                temp_data = NULL;
-                size_t tempvar = cols;
-                cols = rows;
-                rows = tempvar;
+            if (rows > 1 && cols > 1) {
+                transposeInPlace(data, rows, cols);
             }
+            size_t tempvar = cols;
+            cols = rows;
+            rows = tempvar;
         }
         
         Mat getTranspose() const;
         
+        // out-of-place transpose of a rows x cols block, in 8x8 tiles
+        // (src and dst must not overlap)
+        static void transpose(const float *src, size_t rows, size_t cols, size_t srcStride,
+                              float *dst, size_t dstStride);
+        
+        // transposes a contiguous rows x cols matrix in place.  square
+        // matrices swap tiles; others go through a per-thread scratch buffer,
+        // or with bWithoutScratch follow the cycles of the permutation with
+        // one bit per element to mark what has moved (slower, but the only
+        // extra memory is 1/32 of the matrix)
+        static void transposeInPlace(float *data, size_t rows, size_t cols, bool bWithoutScratch = false);
+        
         
         // diagonalize the std::vector longo a square matrix with
         // the current data std::vector along the diagonal
@@ -1397,6 +1308,7 @@ namespace pkm
                 // store in data
                 rows = cols = diagonal_elements;
                 std::swap(data, temp_data);
+                allocatedSize = 0;
                 
                 if(!bUserData)
                 {
@@ -1431,14 +1343,6 @@ namespace pkm
         // returns a new matrix with each el the abs(el)
         static Mat abs(const Mat &A);
         
-        /*
-         // returns a new matrix with each el the log(el)
-         static Mat log(Mat &A);
-         
-         // returns a new matrix with each el the exp(el)
-         static Mat exp(Mat &A);
-         */
-        
         // returns a new diagonalized matrix version of A
         //        static Mat diag(const Mat &A);
         static Mat diagMat(const Mat &A);
@@ -1454,11 +1358,17 @@ namespace pkm
             return Mat(rows, cols, true);
         }
         
-        // set every element to a random value between low and high
-        void setRand(float low = 0.0, float high = 1.0);
+        // set every element to a random value between low and high, from
+        // Random::shared() unless given a generator (seed one for
+        // reproducible matrices)
+        void setRand(float low = 0.0, float high = 1.0, Random &random = Random::shared());
         
         // create a random matrix
-        static Mat rand(size_t r, size_t c, float low = 0.0, float high = 1.0);
+        static Mat rand(size_t r, size_t c, float low = 0.0, float high = 1.0, Random &random = Random::shared());
+        
+        // the same with gaussian values
+        void setRandn(float mean = 0.0, float stddev = 1.0, Random &random = Random::shared());
+        static Mat randn(size_t r, size_t c, float mean = 0.0, float stddev = 1.0, Random &random = Random::shared());
         
         // sum across rows or columns creating a std::vector from a matrix, or a scalar from a std::vector
         Mat sum(bool across_rows = true);
@@ -1469,11 +1379,10 @@ namespace pkm
             // repeat a column std::vector across cols
             if(m.rows > 1 && m.cols == 1 && size > 1)
             {
-                Mat repeated_matrix(size, m.rows);
-                for (size_t i = 0; i < size; i++) {
-                    cblas_scopy(m.rows, m.data, 1, repeated_matrix.data + (i*m.rows), 1);
+                Mat repeated_matrix(m.rows, size);
+                for (size_t i = 0; i < m.rows; i++) {
+                    vDSP_vfill(m.data + i, repeated_matrix.data + (i*size), 1, size);
                 }
-                repeated_matrix.setTranspose();
                 return repeated_matrix;
             }
             else if( m.rows == 1 && m.cols > 1 && size > 1)
@@ -1499,11 +1408,10 @@ namespace pkm
             // repeat a column std::vector across cols
             if(m.rows > 1 && m.cols == 1 && size > 1)
             {
-                dst.reset(size, m.rows);
-                for (size_t i = 0; i < size; i++) {
-                    cblas_scopy(m.rows, m.data, 1, dst.data + (i*m.rows), 1);
+                dst.reset(m.rows, size);
+                for (size_t i = 0; i < m.rows; i++) {
+                    vDSP_vfill(m.data + i, dst.data + (i*size), 1, size);
                 }
-                dst.setTranspose();
             }
             else if( m.rows == 1 && m.cols > 1 && size > 1)
             {
@@ -1864,25 +1772,27 @@ namespace pkm
             stddev = sqrtf( sumsquareval / (float) size - mean * mean);
         }
         
-        // rescale the values in each row to their maximum
+        // rescale the values in each row (or column) to [0, 1]
         void setNormalize(bool row_major = true);
         
         void normalizeRow(size_t r)
         {
-            float min, max;
-            vDSP_minv(&(data[r*cols]), 1, &min, cols);
-            vDSP_maxv(&(data[r*cols]), 1, &max, cols);
-            float height = max-min;
-            min = -min;
-            vDSP_vsadd(&(data[r*cols]), 1, &min, &(data[r*cols]), 1, cols);
-            if (height != 0) {
-                vDSP_vsdiv(&(data[r*cols]), 1, &height, &(data[r*cols]), 1, cols);
-            }
+            math::normalizeMinMax(row(r), row(r), 1, cols);
         }
         
+        // divide each row (or column) by the sum of its magnitudes, or by its length
+        void setNormalizeL1(bool row_major = true);
+        void setNormalizeL2(bool row_major = true);
+        
         void divideEachVecByMaxVecElement(bool row_major);
         void divideEachVecBySum(bool row_major);
         
+        // softmax of each row (or column), its log, and log sum exp(x) as
+        // rows x 1 (or 1 x cols), without temporaries
+        void setSoftmax(bool row_major = true, math::Precision precision = math::PRECISE);
+        void setLogSoftmax(bool row_major = true, math::Precision precision = math::PRECISE);
+        Mat logSumExp(bool row_major = true, math::Precision precision = math::PRECISE) const;
+        
         void solve()
         {
             
@@ -1990,23 +1900,8 @@ namespace pkm
         // input is 1 x d dimensional std::vector
         // mean is 1 x d dimensional std::vector
         // sigma is d x d dimensional matrix
-        static float gaussianPosterior(const Mat &input, Mat mean, Mat sigma)
-        {
-#ifdef DEBUG
-            assert(input.cols == mean.cols);
-            assert(input.cols == sigma.rows);
-            assert(input.cols == sigma.cols);
-#endif
-            float A = 1.0 / (powf(M_PI * 2.0, input.cols / 2.0) * sqrtf(sigma[0]*sigma[3] - sigma[2]*sigma[1]));
-            Mat inputCopy = input;
-            inputCopy.subtract(mean);
-            sigma.inv2x2();
-            Mat a = inputCopy.GEMM(sigma);
-            Mat l = inputCopy;
-            l.setTranspose();
-            Mat b = a.GEMM(l);
-            return (A * expf(-0.5 * b[0]));
-        }
+        // (for many points/gaussians at once see pkmMultivariateNormal)
+        static float gaussianPosterior(const Mat &input, const Mat &mean, const Mat &sigma);
         
         void sqr()
         {
@@ -2022,128 +1917,112 @@ namespace pkm
         
         pkm::Mat& sqrt()
         {
-            int size = rows*cols;
-            vvsqrtf(data, data, &size);
+            math::sqrt(data, data, rows*cols);
             return *this;
         }
         
         static Mat sqrt(const Mat &b)
         {
             Mat newMat(b.rows, b.cols);
-            int size = b.rows*b.cols;
-            vvsqrtf(newMat.data, b.data, &size);
+            math::sqrt(b.data, newMat.data, b.rows*b.cols);
             return newMat;
         }
         
-        void sin()
+        // the transcendentals below take math::FAST where a few ulp more
+        // error is fine (see pkmMath.h)
+        void sin(math::Precision precision = math::PRECISE)
         {
-            int size = rows*cols;
-            vvsinf(data, data, &size);
+            math::sin(data, data, rows*cols, precision);
         }
         
-        static Mat sin(const Mat &b)
+        static Mat sin(const Mat &b, math::Precision precision = math::PRECISE)
         {
             Mat newMat(b.rows, b.cols);
-            int size = b.rows*b.cols;
-            vvsinf(newMat.data, b.data, &size);
+            math::sin(b.data, newMat.data, b.rows*b.cols, precision);
             return newMat;
         }
         
-        void cos()
+        void cos(math::Precision precision = math::PRECISE)
         {
-            int size = rows*cols;
-            vvcosf(data, data, &size);
+            math::cos(data, data, rows*cols, precision);
         }
         
-        static Mat cos(const Mat &b)
+        static Mat cos(const Mat &b, math::Precision precision = math::PRECISE)
         {
             Mat newMat(b.rows, b.cols);
-            int size = b.rows*b.cols;
-            vvcosf(newMat.data, b.data, &size);
+            math::cos(b.data, newMat.data, b.rows*b.cols, precision);
             return newMat;
         }
         
-        void pow(float p)
+        void pow(float p, math::Precision precision = math::PRECISE)
         {
-            int size = rows*cols;
-            vvpowf(data, &p, data, &size);
+            math::pow(data, p, data, rows*cols, precision);
         }
         
-        static Mat pow(const Mat &b, float p)
+        static Mat pow(const Mat &b, float p, math::Precision precision = math::PRECISE)
         {
             Mat newMat(b.rows, b.cols);
-            int size = b.rows*b.cols;
-            vvpowf(newMat.data, &p, b.data, &size);
+            math::pow(b.data, p, newMat.data, b.rows*b.cols, precision);
             return newMat;
         }
         
-        void log()
+        void log(math::Precision precision = math::PRECISE)
         {
-            int size = rows*cols;
-            vvlogf(data, data, &size);
+            math::log(data, data, rows*cols, precision);
         }
         
-        static Mat log(const Mat &b)
+        static Mat log(const Mat &b, math::Precision precision = math::PRECISE)
         {
             Mat newMat(b.rows, b.cols);
-            int size = b.rows*b.cols;
-            vvlogf(newMat.data, b.data, &size);
+            math::log(b.data, newMat.data, b.rows*b.cols, precision);
             return newMat;
         }
         
-        void log10()
+        void log10(math::Precision precision = math::PRECISE)
         {
-            int size = rows*cols;
-            vvlog10f(data, data, &size);
+            math::log10(data, data, rows*cols, precision);
         }
         
-        static Mat log10(const Mat &b)
+        static Mat log10(const Mat &b, math::Precision precision = math::PRECISE)
         {
             Mat newMat(b.rows, b.cols);
-            int size = b.rows*b.cols;
-            vvlog10f(newMat.data, b.data, &size);
+            math::log10(b.data, newMat.data, b.rows*b.cols, precision);
             return newMat;
         }
         
-        void exp()
+        void exp(math::Precision precision = math::PRECISE)
         {
-            int size = rows*cols;
-            vvexpf(data, data, &size);
+            math::exp(data, data, rows*cols, precision);
         }
         
-        static Mat exp(const Mat &b)
+        static Mat exp(const Mat &b, math::Precision precision = math::PRECISE)
         {
             Mat newMat(b.rows, b.cols);
-            int size = b.rows*b.cols;
-            vvexpf(newMat.data, b.data, &size);
+            math::exp(b.data, newMat.data, b.rows*b.cols, precision);
             return newMat;
         }
         
         void floor()
         {
-            int size = rows*cols;
-            vvfloorf(data, data, &size);
+            math::floor(data, data, rows*cols);
         }
         
         static Mat floor(const Mat &b)
         {
             Mat newMat(b.rows, b.cols);
-            int size = b.rows*b.cols;
-            vvfloorf(newMat.data, b.data, &size);
+            math::floor(b.data, newMat.data, b.rows*b.cols);
             return newMat;
         }
         
         void ceil()
         {
-            int size = rows*cols;
-            vvceilf(data, data, &size);
+            math::ceil(data, data, rows*cols);
         }
         
         static Mat ceil(const Mat &b)
         {
             Mat newMat(b.rows, b.cols);
-            int size = b.rows*b.cols;
-            vvceilf(newMat.data, b.data, &size);
+            math::ceil(b.data, newMat.data, b.rows*b.cols);
             return newMat;
         }
         
@@ -2160,14 +2039,8 @@ namespace pkm
         
         static Mat resize(const Mat &a, long newSize)
         {
-            long originalSize = a.size();
-            Mat b(1, newSize);
-            float factor = (float)((newSize - 1) / (float)(originalSize-1));
-            for (long i = 0; i < newSize; i++) {
-                b[i] = i / factor;
-            }
             Mat c(1, newSize);
-            vDSP_vlint(a.data, b.data, 1, c.data, 1, newSize, originalSize);
+            pkm::interpolate(a.data, a.size(), c.data, newSize);
             return c;
         }
         
@@ -2247,52 +2120,20 @@ namespace pkm
             average_sum /= (float)rows;
         }
         
-        inline long svd(Mat &U, Mat &S, Mat &V_t)
-        {
-            //            print();
-            
-            __CLPK_integer m = rows;
-            __CLPK_integer n = cols;
-            
-            __CLPK_integer lda = m;
-            __CLPK_integer ldu = m;
-            __CLPK_integer ldv = n;
-            
-            size_t nSVs = m > n ? n : m;
-            
-            U.reset(m, m);
-            V_t.reset(n, n);
-            S.reset(1, nSVs);
-            
-            float workSize;
-            
-            __CLPK_integer lwork = -1;
-            __CLPK_integer info = 0;
-            
-            // iwork dimension should be at least 8*min(m,n)
-            __CLPK_integer iwork[8*nSVs];
-            
-            //https://groups.google.com/forum/#!topic/julia-dev/mmgO65i6-fA sdd (divide/conquer, better if memory is available, for large matrices) versus svd (qr)
-            //http://docs.oracle.com/cd/E19422-01/819-3691/dgesvd.html
-            
-            // call svd to query optimal work size:
-            char job = 'A';
-            sgesdd_(&job, &m, &n, data, &lda, S.data, U.data, &ldu, V_t.data, &ldv, &workSize, &lwork, iwork, &info);
-            
-            lwork = (long)workSize;
-            float work[lwork];
-            
-            // actual svd
-            sgesdd_(&job, &m, &n, data, &lda, S.data, U.data, &ldu, V_t.data, &ldv, work, &lwork, iwork, &info);
-            
-            // Check for convergence
-            if( info > 0 ) {
-                printf( "[pkm::Mat]::svd(...) sgesvd_() failed to converge.\\n" );
-            }
-            
-            return info;
-            
-        }
+        // A = U diag(S) V_t, leaving this matrix untouched.  with bThin, U is
+        // rows x k and V_t is k x cols for k = min(rows, cols), instead of the
+        // full rows x rows and cols x cols (which for a tall 10000 x 500
+        // matrix is a 10000 x 10000 U).  S is 1 x k, descending.
+        long svd(Mat &U, Mat &S, Mat &V_t, bool bThin = false) const;
+        
+        // top k singular triplets by randomized range finding (halko,
+        // martinsson & tropp 2011): project onto k + oversamples gaussian
+        // directions, sharpen with powerIterations rounds of A A^T, then an
+        // exact svd of the small projected matrix.  U is rows x k, S 1 x k,
+        // V_t k x cols.  costs a few passes of GEMM over the data.
+        long randomizedSVD(size_t k, Mat &U, Mat &S, Mat &V_t,
+                           size_t oversamples = 10, size_t powerIterations = 2,
+                           unsigned long seed = 1) const;
         
         void copyToDouble(double *ptr) const
         {
@@ -2359,6 +2200,7 @@ namespace pkm
             if (bAllocated && !bUserData) {
                 free(data); data = NULL;
                 rows = cols = 0;
+                allocatedSize = 0;
             }
             FILE *fp;
             fp = fopen(filename.c_str(), "r");
@@ -2387,6 +2229,7 @@ namespace pkm
             if (bAllocated && !bUserData) {
                 free(data); data = NULL;
                 rows = cols = 0;
+                allocatedSize = 0;
             }
             FILE *fp;
             fp = fopen(filename.c_str(), "r");
@@ -2441,8 +2284,70 @@ namespace pkm
                     free(data);
                     data = NULL;
                     bAllocated = false;
+                    allocatedSize = 0;
                 }
             }
         }
+        
+        // makes room for at least n floats.  with bGeometric the buffer grows
+        // by half again, so a run of push_backs is amortized O(1).  user data
+        // is copied out rather than reallocated, as we don't own it.
+        bool reserveElements(size_t n, bool bGeometric = true)
+        {
+            size_t used = (data != NULL) ? rows * cols : 0;
+            bool bOwned = bAllocated && !bUserData;
+            size_t available = bOwned ? std::max(allocatedSize, used) : 0;
+            if (n <= available) {
+                return true;
+            }
+            
+            size_t grown = bGeometric ? std::max(n, available + available / 2) : n;
+            float *buffer;
+            if (bOwned) {
+                buffer = (float *)realloc(data, sizeof(float) * MULTIPLE_OF_4(grown));
+            }
+            else {
+                buffer = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(grown));
+                if (buffer && used) {
+                    cblas_scopy(used, data, 1, buffer, 1);
+                }
+            }
+            if (buffer == NULL) {
+                printf("[ERROR: pkm::Mat::reserve()] Could not allocate %lu floats.\n", grown);
+                return false;
+            }
+            
+            data = buffer;
+            allocatedSize = grown;
+            bAllocated = true;
+            bUserData = false;
+            return true;
+        }
+        
+        // appends n rows of the current width, which may come from this matrix
+        void appendRows(const float *buf, size_t n)
+        {
+            size_t used = rows * cols;
+            bool bAliased = data != NULL && buf >= data && buf < data + used;
+            size_t offset = bAliased ? buf - data : 0;
+            if (!reserveElements((rows + n) * cols)) {
+                return;
+            }
+            if (bAliased) {
+                buf = data + offset;
+            }
+            cblas_scopy(n * cols, buf, 1, data + used, 1);
+            rows += n;
+        }
+        
+        bool hasElements() const
+        {
+            return data != NULL && rows > 0 && cols > 0;
+        }
+        
+        // floats allocated for data when more than rows * cols, else 0
+        size_t allocatedSize = 0;
     };
-};
\ No newline at end of file
+};
+
+#include "pkmBasicMat.h"
@@ -21,3 +21,237 @@
 
 #include "pkmMedianFilter.h"
 
+
+pkmMedianFilter::pkmMedianFilter(int dataLength, int filterLength)
+: mDataLength(dataLength), mFilterLength(filterLength)
+{
+	frames = pkm::Mat(filterLength, dataLength, true);
+	medianFrame = (float *)malloc(sizeof(float) * dataLength);
+	
+	sortBuffer = NULL;
+	heapValues = NULL;
+	heapIndices = NULL;
+	heapPositions = NULL;
+	
+	bUseNetwork = filterLength <= PKM_MEDIAN_NETWORK_MAX;
+	
+	if (bUseNetwork)
+	{
+		buildNetwork();
+		
+		// one extra row is the scratch output of each compare-exchange
+		sortBuffer = (float *)malloc(sizeof(float) * (filterLength + 1) * dataLength);
+		sortRows.resize(filterLength + 1);
+	}
+	else
+	{
+		// the window starts as all zeros, so any arrangement is a valid heap
+		maxCount = filterLength / 2;
+		minCount = (filterLength - 1) / 2;
+		
+		heapValues = (float *)malloc(sizeof(float) * filterLength * dataLength);
+		heapIndices = (int *)malloc(sizeof(int) * filterLength * dataLength);
+		heapPositions = (int *)malloc(sizeof(int) * filterLength * dataLength);
+		vDSP_vclr(heapValues, 1, filterLength * dataLength);
+		
+		for (int c = 0; c < dataLength; c++) {
+			for (int s = 0; s < filterLength; s++) {
+				heapIndices[c * filterLength + s] = s;
+				heapPositions[c * filterLength + s] = s - maxCount;
+			}
+		}
+	}
+}
+
+pkmMedianFilter::~pkmMedianFilter()
+{
+	free(medianFrame);
+	free(sortBuffer);
+	free(heapValues);
+	free(heapIndices);
+	free(heapPositions);
+}
+
+void pkmMedianFilter::update(const float *nextFrame, float *median)
+{
+	size_t slot = frames.current_row;
+	frames.insertRowCircularly(nextFrame);
+	
+	if (bUseNetwork) {
+		updateNetwork(median);
+	}
+	else {
+		updateHeaps(slot, nextFrame, median);
+	}
+}
+
+// -------------------------------------------------------------------------
+// sorting network
+
+void pkmMedianFilter::buildNetwork()
+{
+	int n = mFilterLength;
+	
+	// batcher's odd-even merge sort for arbitrary n
+	std::vector<int> network;
+	for (int p = 1; p < n; p <<= 1) {
+		for (int k = p; k >= 1; k >>= 1) {
+			for (int j = k % p; j + k < n; j += 2 * k) {
+				for (int i = 0; i < k && i + j + k < n; i++) {
+					if ((i + j) / (2 * p) == (i + j + k) / (2 * p)) {
+						network.push_back(i + j);
+						network.push_back(i + j + k);
+					}
+				}
+			}
+		}
+	}
+	
+	// only the middle row(s) are read, so walk backwards and keep just the
+	// comparators that can still influence them
+	std::vector<bool> needed(n, false);
+	needed[(n - 1) / 2] = true;
+	needed[n / 2] = true;
+	
+	std::vector<int> pruned;
+	for (int c = (int)network.size() - 2; c >= 0; c -= 2) {
+		int lo = network[c], hi = network[c + 1];
+		if (needed[lo] || needed[hi]) {
+			needed[lo] = needed[hi] = true;
+			pruned.push_back(hi);
+			pruned.push_back(lo);
+		}
+	}
+	comparators.assign(pruned.rbegin(), pruned.rend());
+}
+
+void pkmMedianFilter::updateNetwork(float *median)
+{
+	size_t n = mFilterLength;
+	size_t len = mDataLength;
+	
+	for (size_t r = 0; r <= n; r++) {
+		sortRows[r] = sortBuffer + r * len;
+	}
+	cblas_scopy(n * len, frames.data, 1, sortBuffer, 1);
+	
+	// compare-exchange whole frames; the min lands in the scratch row which
+	// is then swapped in by pointer, so no row is ever copied back
+	for (size_t c = 0; c < comparators.size(); c += 2) {
+		float *&lo = sortRows[comparators[c]];
+		float *&hi = sortRows[comparators[c + 1]];
+		float *&scratch = sortRows[n];
+		vDSP_vmin(lo, 1, hi, 1, scratch, 1, len);
+		vDSP_vmax(lo, 1, hi, 1, hi, 1, len);
+		std::swap(lo, scratch);
+	}
+	
+	if (n % 2) {
+		cblas_scopy(len, sortRows[n / 2], 1, median, 1);
+	}
+	else {
+		float half = 0.5f;
+		vDSP_vadd(sortRows[n / 2 - 1], 1, sortRows[n / 2], 1, median, 1, len);
+		vDSP_vsmul(median, 1, &half, median, 1, len);
+	}
+}
+
+// -------------------------------------------------------------------------
+// double heap: heap[0] is the median, heap[-1 .. -maxCount] a max-heap of
+// the samples below it and heap[1 .. minCount] a min-heap of those above.
+// parent of i is i / 2 on either side, so both roots hang off the median.
+
+void pkmMedianFilter::updateHeaps(size_t slot, const float *nextFrame, float *median)
+{
+	for (int c = 0; c < mDataLength; c++)
+	{
+		values = heapValues + c * mFilterLength;
+		heap = heapIndices + c * mFilterLength + maxCount;
+		pos = heapPositions + c * mFilterLength;
+		
+		replace(slot, nextFrame[c]);
+		
+		if (mFilterLength % 2) {
+			median[c] = values[heap[0]];
+		}
+		else {
+			median[c] = 0.5f * (values[heap[0]] + values[heap[-1]]);
+		}
+	}
+}
+
+void pkmMedianFilter::replace(size_t slot, float val)
+{
+	int p = pos[slot];
+	float old = values[slot];
+	values[slot] = val;
+	
+	if (p > 0) {
+		if (old < val)          minSortDown(p * 2);
+		else if (minSortUp(p))  maxSortDown(-1);
+	}
+	else if (p < 0) {
+		if (val < old)          maxSortDown(p * 2);
+		else if (maxSortUp(p))  minSortDown(1);
+	}
+	else {
+		if (maxCount)           maxSortDown(-1);
+		if (minCount)           minSortDown(1);
+	}
+}
+
+// swap heap entries i and j if value at i < value at j
+bool pkmMedianFilter::compareExchange(int i, int j)
+{
+	if (!less(i, j)) {
+		return false;
+	}
+	int t = heap[i];
+	heap[i] = heap[j];
+	heap[j] = t;
+	pos[heap[i]] = i;
+	pos[heap[j]] = j;
+	return true;
+}
+
+// i is the first child to compare against its parent
+void pkmMedianFilter::minSortDown(int i)
+{
+	for (; i <= minCount; i *= 2) {
+		if (i > 1 && i < minCount && less(i + 1, i)) {
+			++i;
+		}
+		if (!compareExchange(i, i / 2)) {
+			break;
+		}
+	}
+}
+
+void pkmMedianFilter::maxSortDown(int i)
+{
+	for (; i >= -maxCount; i *= 2) {
+		if (i < -1 && i > -maxCount && less(i, i - 1)) {
+			--i;
+		}
+		if (!compareExchange(i / 2, i)) {
+			break;
+		}
+	}
+}
+
+// returns true if the item reached the median
+bool pkmMedianFilter::minSortUp(int i)
+{
+	while (i > 0 && compareExchange(i, i / 2)) {
+		i /= 2;
+	}
+	return i == 0;
+}
+
+bool pkmMedianFilter::maxSortUp(int i)
+{
+	while (i < 0 && compareExchange(i / 2, i)) {
+		i /= 2;
+	}
+	return i == 0;
+}
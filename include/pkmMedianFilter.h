@@ -22,50 +22,69 @@
 #pragma once
 #include "pkmMatrix.h"
 #include <Accelerate/Accelerate.h>
+#include <vector>
+
+// running median over the last filterLength frames, independently for each
+// of the dataLength channels.  the window starts out filled with zeros.
+//
+// short windows (<= PKM_MEDIAN_NETWORK_MAX) run a pruned sorting network on
+// whole frames at once, so every compare-exchange is a vDSP min/max across
+// all channels.  longer windows keep a double heap per channel (max-heap
+// below the median, min-heap above it) which is updated in O(log w) by
+// replacing the oldest sample.  neither path transposes or allocates per frame.
+#define PKM_MEDIAN_NETWORK_MAX 15
 
 class pkmMedianFilter
 {
 public:
-	pkmMedianFilter(int dataLength, int filterLength)
-	: mDataLength(dataLength), mFilterLength(filterLength)
-	{
-		frames = pkm::Mat(filterLength, dataLength, true);
-		medianFrame = (float *)malloc(sizeof(float) * dataLength);
-	}
-	
-	~pkmMedianFilter()
-	{
-		free(medianFrame);
-	}
-	
+	pkmMedianFilter(int dataLength, int filterLength);
+	~pkmMedianFilter();
+
 	float *getMedian(float *nextFrame)
 	{
-		frames.insertRowCircularly(nextFrame);
-		frames.setTranspose();
-		
-		for (int i = 0; i < mDataLength; i++) {
-			medianFrame[i] = pkm::Mat::mean(frames.row(i), mFilterLength);
-		}
-		
-		frames.setTranspose();
-		
+		update(nextFrame, medianFrame);
 		return medianFrame;
 	}
-	
+
 	void getMedianIP(float *&nextFrame)
 	{
-		frames.insertRowCircularly(nextFrame);
-		frames.setTranspose();
-		
-		for (int i = 0; i < mDataLength; i++) {
-			nextFrame[i] = pkm::Mat::mean(frames.row(i), mFilterLength);
-		}
-		
-		frames.setTranspose();
+		update(nextFrame, nextFrame);
 	}
-	
+
 	float *medianFrame;
 	pkm::Mat frames;
 	int mDataLength, mFilterLength;
 
-};
\ No newline at end of file
+private:
+	void update(const float *nextFrame, float *median);
+
+	// sorting network (short windows)
+	void buildNetwork();
+	void updateNetwork(float *median);
+
+	// double heap (long windows)
+	void updateHeaps(size_t slot, const float *nextFrame, float *median);
+	void replace(size_t slot, float val);
+	bool less(int i, int j) const       { return values[heap[i]] < values[heap[j]]; }
+	bool compareExchange(int i, int j);
+	void minSortDown(int i);
+	void maxSortDown(int i);
+	bool minSortUp(int i);
+	bool maxSortUp(int i);
+
+	bool                bUseNetwork;
+
+	std::vector<int>    comparators;    // pairs of rows (lo, hi)
+	float               *sortBuffer;    // filterLength + 1 rows of dataLength
+	std::vector<float *> sortRows;
+
+	float               *heapValues;    // dataLength windows of filterLength samples
+	int                 *heapIndices;   // per channel, heap position -> slot (centered)
+	int                 *heapPositions; // per channel, slot -> heap position
+	int                 minCount, maxCount;
+
+	// the channel currently being updated
+	float               *values;
+	int                 *heap;
+	int                 *pos;
+};
@@ -0,0 +1,208 @@
+/*
+ *  pkmMultivariateNormal.cpp
+ *
+
+ batched multivariate normal log-density for N points against K gaussians
+ of arbitrary dimension D.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmMultivariateNormal.h"
+#include "pkmGEMM.h"
+#include <math.h>
+#include <algorithm>
+
+// scratch values logPdf() keeps at once, 2 K D per point
+#define PKM_MVN_BLOCK (1 << 18)
+
+// Z_k = C_k W_k^T for each of the K gaussians, C_k and Z_k n x D
+static void whiten(size_t n, size_t D, size_t K, const float *centered, const float *whiteners, float *whitened)
+{
+    gemm::stridedBatched(gemm::NO_TRANS, gemm::TRANS, n, D, D,
+                         1.0f, centered, D, n*D, whiteners, D, D*D,
+                         0.0f, whitened, D, n*D, K);
+}
+
+static void whiten(size_t n, size_t D, size_t K, const double *centered, const double *whiteners, double *whitened)
+{
+    for (size_t k = 0; k < K; k++) {
+        blas::gemm(false, true, n, D, D,
+                   1.0, centered + k*n*D, D, whiteners + k*D*D, D,
+                   0.0, whitened + k*n*D, D);
+    }
+}
+
+template<typename T>
+pkmBasicMultivariateNormal<T>::pkmBasicMultivariateNormal()
+{
+    numGaussians = 0;
+    numDimensions = 0;
+}
+
+template<typename T>
+bool pkmBasicMultivariateNormal<T>::setGaussians(const BasicMat<T> &m,
+                                                 const std::vector<BasicMat<T> > &covariances,
+                                                 T regularization)
+{
+#ifdef DEBUG
+    assert(m.rows == covariances.size());
+#endif
+    numGaussians = m.rows;
+    numDimensions = m.cols;
+    means = m;
+    choleskyFactors.resize(numGaussians);
+    logNormalizers.reset(1, numGaussians);
+    whiteners.reset(numGaussians * numDimensions, numDimensions);
+
+    for (size_t k = 0; k < numGaussians; k++)
+    {
+#ifdef DEBUG
+        assert(covariances[k].rows == numDimensions &&
+               covariances[k].cols == numDimensions);
+#endif
+        BasicMat<T> &L = choleskyFactors[k];
+        L = covariances[k];
+        for (size_t i = 0; i < numDimensions; i++) {
+            L.data[i*numDimensions + i] += regularization;
+        }
+
+        // the row-major lower triangle is lapack's column-major upper triangle,
+        // so asking for 'U' leaves L (covariance = L L^T) in our lower triangle
+        if (blas::potrf('U', numDimensions, L.data) != 0) {
+            printf("[ERROR: pkmMultivariateNormal::setGaussians()] Covariance %lu is not positive definite.\n", k);
+            numGaussians = 0;
+            return false;
+        }
+
+        // clear what is left of the original covariance above the diagonal
+        T halfLogDet = 0;
+        for (size_t i = 0; i < numDimensions; i++) {
+            halfLogDet += log(L.data[i*numDimensions + i]);
+            for (size_t j = i + 1; j < numDimensions; j++) {
+                L.data[i*numDimensions + j] = 0;
+            }
+        }
+
+        logNormalizers.data[k] = T(-0.5) * numDimensions * log(T(2 * M_PI)) - halfLogDet;
+
+        // L^{-1}, by solving L W = I
+        T *W = whiteners.data + k*numDimensions*numDimensions;
+        std::fill(W, W + numDimensions*numDimensions, T(0));
+        for (size_t i = 0; i < numDimensions; i++) {
+            W[i*numDimensions + i] = 1;
+        }
+        blas::trsmLower(numDimensions, numDimensions, T(1), L.data, numDimensions, W, numDimensions);
+    }
+
+    return true;
+}
+
+template<typename T>
+void pkmBasicMultivariateNormal<T>::logPdf(const BasicMat<T> &points, BasicMat<T> &result) const
+{
+#ifdef DEBUG
+    assert(points.cols == numDimensions);
+#endif
+    size_t N = points.rows;
+    size_t D = numDimensions;
+    size_t K = numGaussians;
+
+    if (N == 0 || K == 0) {
+        return;
+    }
+
+    if (result.rows != N || result.cols != K) {
+        result.reset(N, K);
+    }
+
+    T minusHalf = -0.5;
+
+    // points at a time, so the K centered and whitened copies stay a bounded size
+    size_t block = std::max((size_t)1, PKM_MVN_BLOCK / (2*K*D));
+    BasicMat<T> centered(K * std::min(block, N), D), whitened(K * std::min(block, N), D);
+
+    for (size_t start = 0; start < N; start += block)
+    {
+        size_t n = std::min(block, N - start);
+        const T *x = points.data + start*D;
+        T *logp = result.data + start*K;
+
+        // center every point on every mean, one (strided) dimension at a time
+        for (size_t k = 0; k < K; k++)
+        {
+            const T *mu = means.data + k*D;
+            T *c = centered.data + k*n*D;
+            for (size_t d = 0; d < D; d++) {
+                blas::vsadd(x + d, D, -mu[d], c + d, D, n);
+            }
+        }
+
+        // whiten against every gaussian in one batch: Z_k = (X - mu_k) L_k^{-T},
+        // so each row of Z_k is L_k^{-1} (x - mu_k)
+        whiten(n, D, K, centered.data, whiteners.data, whitened.data);
+
+        for (size_t k = 0; k < K; k++)
+        {
+            // squared mahalanobis distance accumulated straight into column k
+            T *z = whitened.data + k*n*D;
+            blas::vsq(z, 1, z, 1, n*D);
+            blas::copy(n, z, D, logp + k, K);
+            for (size_t d = 1; d < D; d++) {
+                blas::vadd(logp + k, K, z + d, D, logp + k, K, n);
+            }
+
+            // log p = log normalizer - 0.5 * mahalanobis
+            blas::vsmsa(logp + k, K, minusHalf, logNormalizers.data + k, logp + k, K, n);
+        }
+    }
+}
+
+template<typename T>
+BasicMat<T> pkmBasicMultivariateNormal<T>::logPdf(const BasicMat<T> &points) const
+{
+    BasicMat<T> result(points.rows, numGaussians);
+    logPdf(points, result);
+    return result;
+}
+
+template<typename T>
+T pkmBasicMultivariateNormal<T>::logPdf(const T *point, size_t k) const
+{
+#ifdef DEBUG
+    assert(k < numGaussians);
+#endif
+    size_t D = numDimensions;
+    const T *L = choleskyFactors[k].data;
+    const T *mu = means.data + k*D;
+
+    // forward substitution of L z = x - mu, accumulating z^T z as we go
+    std::vector<T> z(D);
+    T mahalanobis = 0;
+    for (size_t i = 0; i < D; i++) {
+        T val = point[i] - mu[i];
+        for (size_t j = 0; j < i; j++) {
+            val -= L[i*D + j] * z[j];
+        }
+        z[i] = val / L[i*D + i];
+        mahalanobis += z[i] * z[i];
+    }
+    return logNormalizers.data[k] - T(0.5) * mahalanobis;
+}
+
+template class pkmBasicMultivariateNormal<float>;
+template class pkmBasicMultivariateNormal<double>;
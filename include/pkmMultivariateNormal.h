@@ -0,0 +1,80 @@
+/*
+ *  pkmMultivariateNormal.h
+ *
+
+ batched multivariate normal log-density for N points against K gaussians
+ of arbitrary dimension D.  each covariance is factored once with LAPACK's
+ spotrf_ and the inverse of the cholesky factor is cached, so scoring a
+ batch is one batched product (pkm::gemm::stridedBatched) whitening the
+ centered points for all K gaussians at once.
+
+ pkmBasicMultivariateNormal<T> works in float (pkmMultivariateNormal) or
+ double (pkmMultivariateNormalD), factoring with spotrf_/dpotrf_ to match.
+ the double form whitens one gaussian at a time through cblas_dgemm, as the
+ native batched kernels are float only.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include "pkmMatrix.h"
+#include <vector>
+
+using namespace pkm;
+
+template<typename T>
+class pkmBasicMultivariateNormal
+{
+public:
+    pkmBasicMultivariateNormal();
+
+    // means is K x D, one gaussian per row
+    // covariances holds K matrices of D x D
+    // regularization is added to the diagonal of each covariance before factoring
+    // returns false if any covariance is not positive definite
+    bool setGaussians(const BasicMat<T> &means,
+                      const std::vector<BasicMat<T> > &covariances,
+                      T regularization = 0);
+
+    // points is N x D
+    // result is resized to N x K and holds log p(points(n,:) | gaussian k)
+    void logPdf(const BasicMat<T> &points, BasicMat<T> &result) const;
+    BasicMat<T> logPdf(const BasicMat<T> &points) const;
+
+    // single point, single gaussian, in the log domain
+    T logPdf(const T *point, size_t k) const;
+
+    size_t getNumGaussians() const      { return numGaussians; }
+    size_t getDimensions() const        { return numDimensions; }
+
+    // lower triangular factor L of gaussian k (covariance = L L^T), row-major
+    const BasicMat<T> & getCholeskyFactor(size_t k) const   { return choleskyFactors[k]; }
+
+    // -0.5 * (D log(2 pi) + log |covariance|) for each gaussian
+    const BasicMat<T> & getLogNormalizers() const           { return logNormalizers; }
+
+private:
+    size_t                      numGaussians, numDimensions;
+    BasicMat<T>                 means;
+    std::vector<BasicMat<T> >   choleskyFactors;
+    BasicMat<T>                 logNormalizers;
+    BasicMat<T>                 whiteners;          // L^{-1} of each gaussian, K D x D
+};
+
+typedef pkmBasicMultivariateNormal<float> pkmMultivariateNormal;
+typedef pkmBasicMultivariateNormal<double> pkmMultivariateNormalD;
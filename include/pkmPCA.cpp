@@ -0,0 +1,239 @@
+/*
+ *  pkmPCA.cpp
+ *
+
+ principal component analysis.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmPCA.h"
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+// observations centered and accumulated at a time
+#define PKM_PCA_BLOCK 4096
+
+pkmPCA::pkmPCA()
+{
+    bWhiten = false;
+}
+
+bool pkmPCA::fit(const Mat &X, size_t numComponents, bool bWhiten, Method method)
+{
+    if (X.rows < 2 || X.cols == 0) {
+        printf("[ERROR: pkmPCA::fit()] Need at least 2 observations.\n");
+        return false;
+    }
+    numComponents = MIN(numComponents, MIN(X.rows, X.cols));
+    this->bWhiten = bWhiten;
+    components.reset(0, X.cols);
+
+    if (method == AUTO) {
+        method = X.cols <= PKM_PCA_COVARIANCE_MAX_DIMS ? COVARIANCE : RANDOMIZED;
+    }
+    bool ok;
+    if (method == COVARIANCE) {
+        pkmCovarianceAccumulator accumulator;
+        accumulator.push_back(X);
+        ok = fitCovariance(accumulator, numComponents);
+    }
+    else {
+        ok = fitRandomized(X, numComponents);
+    }
+    if (!ok) {
+        components.reset(0, X.cols);
+        return false;
+    }
+    orientComponents();
+    return true;
+}
+
+bool pkmPCA::fit(const pkmCovarianceAccumulator &accumulator, size_t numComponents, bool bWhiten)
+{
+    size_t d = accumulator.getDimensions();
+    if (accumulator.getCount() < 2 || d == 0) {
+        printf("[ERROR: pkmPCA::fit()] Need at least 2 observations.\n");
+        return false;
+    }
+    numComponents = MIN(numComponents, MIN(accumulator.getCount(), d));
+    this->bWhiten = bWhiten;
+    components.reset(0, d);
+
+    if (!fitCovariance(accumulator, numComponents)) {
+        components.reset(0, d);
+        return false;
+    }
+    orientComponents();
+    return true;
+}
+
+void pkmPCA::orientComponents()
+{
+    for (size_t i = 0; i < components.rows; i++) {
+        float *w = components.row(i);
+        size_t largest = cblas_isamax(components.cols, w, 1);
+        if (w[largest] < 0) {
+            float minusOne = -1.0f;
+            vDSP_vsmul(w, 1, &minusOne, w, 1, components.cols);
+        }
+    }
+}
+
+void pkmPCA::computeMean(const Mat &X)
+{
+    // float sums per block, double across blocks
+    size_t d = X.cols;
+    std::vector<double> total(d, 0.0);
+    Mat ones(PKM_PCA_BLOCK, 1, 1.0f), blockSum(1, d);
+    for (size_t first = 0; first < X.rows; first += PKM_PCA_BLOCK) {
+        size_t n = MIN((size_t)PKM_PCA_BLOCK, X.rows - first);
+        cblas_sgemv(CblasRowMajor, CblasTrans, n, d, 1.0f, X.data + first * d, d,
+                    ones.data, 1, 0.0f, blockSum.data, 1);
+        for (size_t j = 0; j < d; j++) {
+            total[j] += blockSum.data[j];
+        }
+    }
+    mean.reset(1, d);
+    for (size_t j = 0; j < d; j++) {
+        mean.data[j] = total[j] / X.rows;
+    }
+}
+
+bool pkmPCA::fitCovariance(const pkmCovarianceAccumulator &accumulator, size_t numComponents)
+{
+    size_t d = accumulator.getDimensions();
+
+    Mat covariance;
+    accumulator.getMean(mean);
+    accumulator.getCovariance(covariance, true);
+
+    char job = 'V', uplo = 'L';
+    __CLPK_integer n = d, lda = d, info = 0, lwork = -1, liwork = -1;
+    Mat eigenvalues(1, d);
+    float workSize;
+    __CLPK_integer iworkSize;
+    ssyevd_(&job, &uplo, &n, covariance.data, &lda, eigenvalues.data, &workSize, &lwork, &iworkSize, &liwork, &info);
+    lwork = (__CLPK_integer)workSize;
+    liwork = iworkSize;
+    std::vector<float> work(lwork);
+    std::vector<__CLPK_integer> iwork(liwork);
+    ssyevd_(&job, &uplo, &n, covariance.data, &lda, eigenvalues.data, &work[0], &lwork, &iwork[0], &liwork, &info);
+    if (info != 0) {
+        printf("[ERROR: pkmPCA::fitCovariance()] ssyevd_() failed (%d).\n", (int)info);
+        return false;
+    }
+
+    // ascending eigenvalues, eigenvectors as (column-major) columns, i.e. rows
+    float totalVariance = 0;
+    for (size_t j = 0; j < d; j++) {
+        totalVariance += MAX(eigenvalues.data[j], 0.0f);
+    }
+    components.reset(numComponents, d);
+    explainedVariance.reset(1, numComponents);
+    explainedVarianceRatio.reset(1, numComponents);
+    for (size_t i = 0; i < numComponents; i++) {
+        size_t j = d - 1 - i;
+        cblas_scopy(d, covariance.data + j * d, 1, components.row(i), 1);
+        explainedVariance.data[i] = MAX(eigenvalues.data[j], 0.0f);
+        explainedVarianceRatio.data[i] = totalVariance > 0 ? explainedVariance.data[i] / totalVariance : 0;
+    }
+    return true;
+}
+
+bool pkmPCA::fitRandomized(const Mat &X, size_t numComponents)
+{
+    size_t d = X.cols;
+
+    computeMean(X);
+    Mat centered(X.rows, d);
+    double sumOfSquares = 0;
+    for (size_t i = 0; i < X.rows; i++) {
+        float *row = centered.row(i);
+        vDSP_vsub(mean.data, 1, X.data + i * d, 1, row, 1, d);
+        sumOfSquares += cblas_sdot(d, row, 1, row, 1);
+    }
+    float totalVariance = sumOfSquares / (X.rows - 1);
+
+    Mat U, S;
+    if (centered.randomizedSVD(numComponents, U, S, components) != 0) {
+        printf("[ERROR: pkmPCA::fitRandomized()] randomizedSVD() failed.\n");
+        return false;
+    }
+
+    explainedVariance.reset(1, numComponents);
+    explainedVarianceRatio.reset(1, numComponents);
+    for (size_t i = 0; i < numComponents; i++) {
+        explainedVariance.data[i] = S.data[i] * S.data[i] / (X.rows - 1);
+        explainedVarianceRatio.data[i] = totalVariance > 0 ? explainedVariance.data[i] / totalVariance : 0;
+    }
+    return true;
+}
+
+void pkmPCA::scaledComponents(Mat &W, bool bInverse) const
+{
+    W = components;
+    if (!bWhiten) {
+        return;
+    }
+    for (size_t i = 0; i < W.rows; i++) {
+        float stddev = sqrtf(explainedVariance.data[i]);
+        float scale = bInverse ? stddev : (stddev > 0 ? 1.0f / stddev : 0.0f);
+        vDSP_vsmul(W.row(i), 1, &scale, W.row(i), 1, W.cols);
+    }
+}
+
+void pkmPCA::transform(const Mat &X, Mat &Y) const
+{
+    if (!isFit() || X.cols != components.cols) {
+        printf("[ERROR: pkmPCA::transform()] Expected %lu dimensions after fit().\n", components.cols);
+        return;
+    }
+    size_t k = components.rows, d = components.cols;
+
+    // (X - mean) W^T = X W^T - mean W^T
+    Mat W, offset(1, k);
+    scaledComponents(W, false);
+    cblas_sgemv(CblasRowMajor, CblasNoTrans, k, d, 1.0f, W.data, d, mean.data, 1, 0.0f, offset.data, 1);
+
+    Y.reset(X.rows, k);
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, X.rows, k, d,
+                1.0f, X.data, d, W.data, d, 0.0f, Y.data, k);
+    for (size_t i = 0; i < Y.rows; i++) {
+        vDSP_vsub(offset.data, 1, Y.row(i), 1, Y.row(i), 1, k);
+    }
+}
+
+void pkmPCA::inverseTransform(const Mat &Y, Mat &X) const
+{
+    if (!isFit() || Y.cols != components.rows) {
+        printf("[ERROR: pkmPCA::inverseTransform()] Expected %lu components after fit().\n", components.rows);
+        return;
+    }
+    size_t k = components.rows, d = components.cols;
+
+    // Y W + mean
+    Mat W;
+    scaledComponents(W, true);
+    X.reset(Y.rows, d);
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, Y.rows, d, k,
+                1.0f, Y.data, k, W.data, d, 0.0f, X.data, d);
+    for (size_t i = 0; i < X.rows; i++) {
+        vDSP_vadd(X.row(i), 1, mean.data, 1, X.row(i), 1, d);
+    }
+}
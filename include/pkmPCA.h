@@ -0,0 +1,97 @@
+/*
+ *  pkmPCA.h
+ *
+
+ principal component analysis of observations x dimensions data.
+
+ two ways to fit:
+
+    COVARIANCE  one pass of a pkmCovarianceAccumulator over blocks of rows
+                (ssyrk), then the eigenvectors of the covariance.  exact,
+                and memory is d^2 whatever the number of observations, so
+                this is the one for tall data such as a 1M x 128 feature
+                set.  an accumulator filled elsewhere, e.g. frame by frame
+                or merged across threads, can be fit directly.
+    RANDOMIZED  Mat::randomizedSVD of a centered copy, for wide data where
+                a d x d covariance would be too big.
+
+ AUTO picks covariance up to PKM_PCA_COVARIANCE_MAX_DIMS dimensions.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include "pkmMatrix.h"
+#include "pkmCovarianceAccumulator.h"
+
+using namespace pkm;
+
+#define PKM_PCA_COVARIANCE_MAX_DIMS 2048
+
+class pkmPCA
+{
+public:
+    enum Method
+    {
+        AUTO,
+        COVARIANCE,
+        RANDOMIZED
+    };
+
+    pkmPCA();
+
+    // keeps the numComponents directions of largest variance.  with
+    // bWhiten, transform() also scales each component to unit variance.
+    bool fit(const Mat &X, size_t numComponents, bool bWhiten = false, Method method = AUTO);
+    bool fit(const pkmCovarianceAccumulator &accumulator, size_t numComponents, bool bWhiten = false);
+
+    // observations x dimensions <-> observations x numComponents
+    void transform(const Mat &X, Mat &Y) const;
+    void inverseTransform(const Mat &Y, Mat &X) const;
+
+    Mat transform(const Mat &X) const               { Mat Y; transform(X, Y); return Y; }
+    Mat inverseTransform(const Mat &Y) const        { Mat X; inverseTransform(Y, X); return X; }
+
+    bool isFit() const                              { return components.rows > 0; }
+    bool isWhitened() const                         { return bWhiten; }
+    size_t getNumComponents() const                 { return components.rows; }
+
+    // 1 x dimensions
+    const Mat & getMean() const                     { return mean; }
+    // numComponents x dimensions, one unit direction per row, largest first
+    const Mat & getComponents() const               { return components; }
+    // 1 x numComponents, variance along each component, and its share of the total
+    const Mat & getExplainedVariance() const        { return explainedVariance; }
+    const Mat & getExplainedVarianceRatio() const   { return explainedVarianceRatio; }
+
+private:
+    bool fitCovariance(const pkmCovarianceAccumulator &accumulator, size_t numComponents);
+    bool fitRandomized(const Mat &X, size_t numComponents);
+    void computeMean(const Mat &X);
+
+    // a deterministic sign: each component's largest entry is positive
+    void orientComponents();
+
+    // components scaled by 1 / stddev (whiten) or stddev (unwhiten), or as they are
+    void scaledComponents(Mat &W, bool bInverse) const;
+
+    Mat mean;
+    Mat components;
+    Mat explainedVariance, explainedVarianceRatio;
+    bool bWhiten;
+};
@@ -0,0 +1,483 @@
+/*
+ *  pkmParticleFilter.cpp
+ *
+
+ gesture variation following as a structure-of-arrays particle filter.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmParticleFilter.h"
+#include "pkmThreadPool.h"
+#include <algorithm>
+#include <math.h>
+
+// bits in the hashed occupancy grid used to count kld bins
+#define PKM_PARTICLE_BIN_BITS 20
+
+// mixes the bits of a bin key
+static inline uint64_t splitmix64(uint64_t x)
+{
+    uint64_t z = x + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+pkmParticleFilter::pkmParticleFilter(size_t numParticles,
+                                     float phaseSigma,
+                                     float speedSigma,
+                                     float scaleSigma,
+                                     float tolerance,
+                                     float resamplingThreshold,
+                                     uint64_t seed)
+: numParticles(numParticles), maxParticles(numParticles)
+{
+    numBlocks = (numParticles + PKM_PARTICLE_BLOCK - 1) / PKM_PARTICLE_BLOCK;
+    maxBlocks = numBlocks;
+    numTemplates = 0;
+    numDimensions = 0;
+
+    sigmas[PHASE] = phaseSigma;
+    sigmas[SPEED] = speedSigma;
+    sigmas[SCALE] = scaleSigma;
+    invTwoVariance = 0.5f / (tolerance * tolerance);
+    resamplingRatio = resamplingThreshold > 0 ? resamplingThreshold / numParticles : 0.01f;
+
+    particles[0].reset(4, numParticles);
+    particles[1].reset(4, numParticles);
+    current = 0;
+    weights.reset(1, numParticles);
+    logLikelihoods.reset(1, numParticles);
+
+    blockMax.reset(1, numBlocks);
+    blockSum.reset(1, numBlocks);
+    blockSumSq.reset(1, numBlocks);
+
+    templateIndex = 0;
+    effectiveSampleSize = 0;
+    observationNorm = 0;
+
+    bAdaptive = false;
+    minParticles = numParticles;
+    targetParticles = numParticles;
+    kldEpsilon = 0.05f;
+    kldZ = 2.326f;
+    binSizes[PHASE] = 0.01f;
+    binSizes[SPEED] = 0.05f;
+    binSizes[SCALE] = 0.05f;
+    numOccupiedBins = 0;
+
+    // phase, speed, scale
+    spreadMean[0] = 0.0f;   spreadRange[0] = 0.1f;
+    spreadMean[1] = 1.0f;   spreadRange[1] = 0.1f;
+    spreadMean[2] = 1.0f;   spreadRange[2] = 0.1f;
+
+    random.resize(maxBlocks + 1);
+    for (size_t i = 0; i < random.size(); i++) {
+        random[i].seed(seed, i);
+    }
+}
+
+void pkmParticleFilter::setTemplates(const Mat &t, const Mat &lut)
+{
+    frameNorms.setUserData(0, 0, NULL);
+    numTemplates = 0;
+    addTemplates(t, lut);
+}
+
+void pkmParticleFilter::addTemplates(const Mat &t, const Mat &lut)
+{
+#ifdef DEBUG
+    assert(t.rows >= frameNorms.rows && lut.rows >= numTemplates);
+#endif
+    // no copy, the frames stay wherever the caller keeps them
+    templates.setUserData(t.rows, t.cols, t.data);
+    numDimensions = templates.cols;
+    numTemplates = lut.rows;
+
+    frameStart.reset(1, numTemplates);
+    frameLength.reset(1, numTemplates);
+    cblas_scopy(numTemplates, lut.data, lut.cols, frameStart.data, 1);
+    cblas_scopy(numTemplates, lut.data + 1, lut.cols, frameLength.data, 1);
+
+    // only frames we haven't seen need their norms
+    size_t numKnown = frameNorms.rows;
+    Mat norms(templates.rows, 1);
+    if (numKnown) {
+        cblas_scopy(numKnown, frameNorms.data, 1, norms.data, 1);
+    }
+    for (size_t f = numKnown; f < templates.rows; f++) {
+        const float *row = templates.data + f * numDimensions;
+        norms.data[f] = cblas_sdot(numDimensions, row, 1, row, 1);
+    }
+    frameNorms = norms;
+    frameDots.reset(templates.rows, 1);
+
+    blockEstimates.reset(maxBlocks, numTemplates * 4);
+    estimates.reset(1, numTemplates * 4);
+    templateProbabilities.reset(1, numTemplates);
+    estimates.clear();
+    templateProbabilities.clear();
+    templateIndex = 0;
+}
+
+void pkmParticleFilter::spreadParticles(float meanPhase, float meanSpeed, float meanScale,
+                                        float rangePhase, float rangeSpeed, float rangeScale)
+{
+    spreadMean[0] = meanPhase;  spreadRange[0] = rangePhase;
+    spreadMean[1] = meanSpeed;  spreadRange[1] = rangeSpeed;
+    spreadMean[2] = meanScale;  spreadRange[2] = rangeScale;
+    respawn();
+}
+
+void pkmParticleFilter::respawn()
+{
+    // a fresh spread needs the full set, the adaptive count shrinks it again
+    setNumParticles(maxParticles);
+    targetParticles = maxParticles;
+
+    Mat &state = particles[current];
+    pkm::parallelFor(numBlocks, 1, [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; b++)
+        {
+            size_t first = b * PKM_PARTICLE_BLOCK;
+            size_t count = std::min<size_t>(PKM_PARTICLE_BLOCK, numParticles - first);
+            for (size_t k = 0; k < 3; k++) {
+                random[b].uniform(state.data + k * maxParticles + first, count,
+                                  spreadMean[k] - 0.5f * spreadRange[k], spreadMean[k] + 0.5f * spreadRange[k]);
+            }
+            float *t = state.data + TEMPLATE * maxParticles + first;
+            random[b].uniform(t, count, 0.0f, numTemplates);
+            for (size_t i = 0; i < count; i++) {
+                t[i] = std::min<size_t>((size_t)t[i], numTemplates - 1);
+            }
+        }
+    });
+
+    float w = 1.0f / numParticles;
+    vDSP_vfill(&w, weights.data, 1, numParticles);
+}
+
+void pkmParticleFilter::propagateBlock(size_t b, float *scratch)
+{
+    size_t begin = b * PKM_PARTICLE_BLOCK;
+    size_t count = std::min<size_t>(PKM_PARTICLE_BLOCK, numParticles - begin);
+
+    float *noise = scratch;
+    random[b].normal(noise, 3 * count);
+
+    Mat &state = particles[current];
+    float *phase = state.data + PHASE * maxParticles + begin;
+    float *speed = state.data + SPEED * maxParticles + begin;
+    float *scale = state.data + SCALE * maxParticles + begin;
+    const float *tmpl = state.data + TEMPLATE * maxParticles + begin;
+    float *ll = logLikelihoods.data + begin;
+
+    const float *start = frameStart.data;
+    const float *length = frameLength.data;
+    const float *dots = frameDots.data;
+    const float *norms = frameNorms.data;
+    float oo = observationNorm;
+    float maxLL = -INFINITY;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t t = (size_t)tmpl[i];
+        speed[i] += sigmas[SPEED] * noise[count + i];
+        scale[i] += sigmas[SCALE] * noise[2 * count + i];
+        phase[i] += sigmas[PHASE] * noise[i] + speed[i] / length[t];
+
+        // particles that ran off either end of their template get no weight
+        if (phase[i] >= 0.0f && phase[i] < 1.0f) {
+            // a phase just under 1 can round up to the length in float
+            size_t offset = std::min((size_t)(phase[i] * length[t]), (size_t)length[t] - 1);
+            size_t f = (size_t)start[t] + offset;
+            float s = scale[i];
+            float distance = oo - 2.0f * s * dots[f] + s * s * norms[f];
+            ll[i] = -distance * invTwoVariance;
+            maxLL = std::max(maxLL, ll[i]);
+        }
+        else {
+            ll[i] = -INFINITY;
+        }
+    }
+    blockMax.data[b] = maxLL;
+}
+
+void pkmParticleFilter::weightBlock(size_t b, float maxLogLikelihood)
+{
+    size_t begin = b * PKM_PARTICLE_BLOCK;
+    size_t count = std::min<size_t>(PKM_PARTICLE_BLOCK, numParticles - begin);
+
+    // w *= exp(ll - max), relative to the best particle so nothing underflows to all zeros
+    float *w = weights.data + begin;
+    float *ll = logLikelihoods.data + begin;
+    float negMax = -maxLogLikelihood;
+    vDSP_vsadd(ll, 1, &negMax, ll, 1, count);
+    pkm::math::exp(ll, ll, count, pkm::math::FAST);
+    vDSP_vmul(w, 1, ll, 1, w, 1, count);
+    vDSP_sve(w, 1, blockSum.data + b, count);
+    vDSP_svesq(w, 1, blockSumSq.data + b, count);
+
+    const Mat &state = particles[current];
+    const float *phase = state.data + PHASE * maxParticles + begin;
+    const float *speed = state.data + SPEED * maxParticles + begin;
+    const float *scale = state.data + SCALE * maxParticles + begin;
+    const float *tmpl = state.data + TEMPLATE * maxParticles + begin;
+
+    float *est = blockEstimates.data + b * blockEstimates.cols;
+    vDSP_vclr(est, 1, blockEstimates.cols);
+    for (size_t i = 0; i < count; i++) {
+        float *e = est + (size_t)tmpl[i] * 4;
+        e[0] += w[i];
+        e[1] += w[i] * phase[i];
+        e[2] += w[i] * speed[i];
+        e[3] += w[i] * scale[i];
+    }
+}
+
+void pkmParticleFilter::infer(const float *observation)
+{
+    if (numParticles == 0 || numTemplates == 0) {
+        printf("[ERROR: pkmParticleFilter::infer()] Set templates first.\n");
+        return;
+    }
+
+    // <t, o> for every template frame at once
+    cblas_sgemv(CblasRowMajor, CblasNoTrans, templates.rows, numDimensions, 1.0f,
+                templates.data, numDimensions, observation, 1, 0.0f, frameDots.data, 1);
+    observationNorm = cblas_sdot(numDimensions, observation, 1, observation, 1);
+
+    pkm::parallelFor(numBlocks, 1, [&](size_t begin, size_t end) {
+        std::vector<float> scratch(3 * PKM_PARTICLE_BLOCK);
+        for (size_t b = begin; b < end; b++) {
+            propagateBlock(b, &scratch[0]);
+        }
+    });
+
+    float maxLogLikelihood;
+    vDSP_maxv(blockMax.data, 1, &maxLogLikelihood, numBlocks);
+    if (!isfinite(maxLogLikelihood)) {
+        // every particle has left its template, start over
+        respawn();
+        return;
+    }
+
+    pkm::parallelFor(numBlocks, 1, [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; b++) {
+            weightBlock(b, maxLogLikelihood);
+        }
+    });
+
+    float total, totalSq;
+    vDSP_sve(blockSum.data, 1, &total, numBlocks);
+    vDSP_sve(blockSumSq.data, 1, &totalSq, numBlocks);
+    if (!(total > 0.0f) || !isfinite(total)) {
+        respawn();
+        return;
+    }
+    effectiveSampleSize = total * total / totalSq;
+
+    // weighted means per template
+    estimates.clear();
+    for (size_t b = 0; b < numBlocks; b++) {
+        vDSP_vadd(estimates.data, 1, blockEstimates.data + b * blockEstimates.cols, 1,
+                  estimates.data, 1, estimates.cols);
+    }
+    templateIndex = 0;
+    for (size_t t = 0; t < numTemplates; t++) {
+        float *e = estimates.data + t * 4;
+        templateProbabilities.data[t] = e[0] / total;
+        if (e[0] > 0.0f) {
+            e[1] /= e[0];
+            e[2] /= e[0];
+            e[3] /= e[0];
+        }
+        if (templateProbabilities.data[t] > templateProbabilities.data[templateIndex]) {
+            templateIndex = t;
+        }
+    }
+
+    // kld-sampling picks the particle count while resampling, so the
+    // adaptive mode resamples every frame
+    if (bAdaptive || effectiveSampleSize < resamplingRatio * numParticles) {
+        resample(total);
+    }
+    else {
+        float invTotal = 1.0f / total;
+        pkm::parallelFor(numBlocks, 1, [&](size_t begin, size_t end) {
+            size_t first = begin * PKM_PARTICLE_BLOCK;
+            size_t last = std::min(numParticles, end * PKM_PARTICLE_BLOCK);
+            vDSP_vsmul(weights.data + first, 1, &invTotal, weights.data + first, 1, last - first);
+        });
+    }
+}
+
+void pkmParticleFilter::resample(float total)
+{
+    // where each block's weight starts in the normalized cumulative distribution
+    std::vector<double> cumulative(numBlocks + 1);
+    cumulative[0] = 0.0;
+    for (size_t b = 0; b < numBlocks; b++) {
+        cumulative[b + 1] = cumulative[b] + blockSum.data[b] / (double)total;
+    }
+
+    float offset;
+    random[maxBlocks].uniform(&offset, 1);
+    float invTotal = 1.0f / total;
+    size_t numResampled = bAdaptive ? targetParticles : maxParticles;
+
+    pkm::parallelFor(numBlocks, 1, [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; b++) {
+            resampleBlock(b, cumulative, offset, invTotal, numResampled);
+        }
+    });
+
+    current = 1 - current;
+    setNumParticles(numResampled);
+    float w = 1.0f / numParticles;
+    vDSP_vfill(&w, weights.data, 1, numParticles);
+
+    if (bAdaptive) {
+        updateTargetParticles();
+    }
+}
+
+void pkmParticleFilter::setAdaptive(bool bAdaptive, size_t minParticles, float epsilon, float z,
+                                    float phaseBin, float speedBin, float scaleBin)
+{
+    this->bAdaptive = bAdaptive;
+    this->minParticles = std::min(std::max<size_t>(minParticles, 1), maxParticles);
+    kldEpsilon = epsilon;
+    kldZ = z;
+    binSizes[PHASE] = phaseBin;
+    binSizes[SPEED] = speedBin;
+    binSizes[SCALE] = scaleBin;
+    targetParticles = numParticles;
+
+    if (bAdaptive && binOccupancy.empty()) {
+        binOccupancy = std::vector<std::atomic<uint64_t> >(((size_t)1 << PKM_PARTICLE_BIN_BITS) / 64);
+    }
+}
+
+// kld-sampling (fox, 2003): count the histogram bins k the particles occupy
+// and take enough particles that the kl divergence between the sampled and
+// true posterior stays under epsilon with probability 1 - delta (z is the
+// upper 1 - delta normal quantile):
+//
+//   n = (k - 1) / (2 epsilon) * (1 - 2 / (9 (k - 1)) + sqrt(2 / (9 (k - 1))) z)^3
+//
+// bins are hashed into a fixed bitmap, so k is a slight underestimate once
+// it nears the bitmap size.  the count is used at the next resampling.
+void pkmParticleFilter::updateTargetParticles()
+{
+    size_t numWords = binOccupancy.size();
+    for (size_t w = 0; w < numWords; w++) {
+        binOccupancy[w].store(0, std::memory_order_relaxed);
+    }
+
+    const Mat &state = particles[current];
+    pkm::parallelFor(numBlocks, 1, [&](size_t begin, size_t end) {
+        size_t last = std::min(numParticles, end * PKM_PARTICLE_BLOCK);
+        for (size_t i = begin * PKM_PARTICLE_BLOCK; i < last; i++)
+        {
+            uint64_t key = (uint64_t)state.data[TEMPLATE * maxParticles + i];
+            for (size_t k = 0; k < 3; k++) {
+                int64_t bin = (int64_t)floorf(state.data[k * maxParticles + i] / binSizes[k]);
+                key = key * 0x9e3779b97f4a7c15ULL + (uint64_t)bin;
+            }
+            uint64_t hash = splitmix64(key) >> (64 - PKM_PARTICLE_BIN_BITS);
+            std::atomic<uint64_t> &word = binOccupancy[hash >> 6];
+            uint64_t bit = (uint64_t)1 << (hash & 63);
+            // most particles share a bin with another, so test before writing
+            if (!(word.load(std::memory_order_relaxed) & bit)) {
+                word.fetch_or(bit, std::memory_order_relaxed);
+            }
+        }
+    });
+
+    size_t k = 0;
+    for (size_t w = 0; w < numWords; w++) {
+        k += __builtin_popcountll(binOccupancy[w].load(std::memory_order_relaxed));
+    }
+    numOccupiedBins = k;
+
+    double n = minParticles;
+    if (k > 1) {
+        double a = 2.0 / (9.0 * (k - 1));
+        double b = 1.0 - a + sqrt(a) * kldZ;
+        n = (k - 1) / (2.0 * kldEpsilon) * b * b * b;
+    }
+    targetParticles = std::min<size_t>(std::max<size_t>((size_t)ceil(n), minParticles), maxParticles);
+}
+
+void pkmParticleFilter::setNumParticles(size_t n)
+{
+    numParticles = n;
+    numBlocks = (numParticles + PKM_PARTICLE_BLOCK - 1) / PKM_PARTICLE_BLOCK;
+}
+
+// systematic resampling: output j takes the particle whose cumulative weight
+// interval contains (j + offset) / N, for N = numResampled outputs.  each block owns the outputs that fall
+// in its slice of the distribution, so blocks write disjoint ranges.
+void pkmParticleFilter::resampleBlock(size_t b, const std::vector<double> &cumulative,
+                                      double offset, float invTotal, size_t numResampled)
+{
+    double N = numResampled;
+    size_t jBegin = (size_t)std::max(0.0, ceil(cumulative[b] * N - offset));
+    size_t jEnd = b + 1 == numBlocks ? numResampled
+                : (size_t)std::max(0.0, ceil(cumulative[b + 1] * N - offset));
+    jEnd = std::min(jEnd, numResampled);
+    if (jBegin >= jEnd) {
+        return;
+    }
+
+    size_t begin = b * PKM_PARTICLE_BLOCK;
+    size_t count = std::min<size_t>(PKM_PARTICLE_BLOCK, numParticles - begin);
+    const float *src = particles[current].data;
+    float *dst = particles[1 - current].data;
+    const float *w = weights.data;
+
+    double c = cumulative[b] * N;
+    size_t j = jBegin, last = begin;
+    for (size_t i = begin; i < begin + count && j < jEnd; i++)
+    {
+        c += w[i] * invTotal * N;
+        if (w[i] > 0.0f) {
+            last = i;
+        }
+        for (; j < jEnd && j + offset < c; j++) {
+            for (size_t k = 0; k < 4; k++) {
+                dst[k * maxParticles + j] = src[k * maxParticles + i];
+            }
+        }
+    }
+
+    // rounding in the running sum can leave the last few outputs unclaimed
+    for (; j < jEnd; j++) {
+        for (size_t k = 0; k < 4; k++) {
+            dst[k * maxParticles + j] = src[k * maxParticles + last];
+        }
+    }
+}
+
+void pkmParticleFilter::getEstimatedStatus(int &templateIndex, float &phase) const
+{
+    templateIndex = this->templateIndex;
+    phase = numTemplates ? estimates.data[templateIndex * 4 + 1] : 0.0f;
+}
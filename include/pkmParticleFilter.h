@@ -0,0 +1,166 @@
+/*
+ *  pkmParticleFilter.h
+ *
+
+ gesture variation following (Caramiaux et al.) as a particle filter over
+ (phase, speed, scale, template) states stored as a structure of arrays in
+ pkm::Mat rows.
+
+ every frame each particle takes a random walk in speed and scale, advances
+ its phase by speed / template length, and is weighted by a gaussian on the
+ distance between the observation and its scaled template frame.  that
+ distance is expanded as |o|^2 - 2 s <t, o> + s^2 |t|^2, so the only
+ D-dimensional work is one matrix-vector product of the observation against
+ every template frame; each particle then costs O(1) regardless of D.
+
+ particles are processed in fixed blocks across the shared thread pool,
+ each block with its own random stream, so results do not depend on the
+ number of threads.  resampling is systematic and parallel over blocks.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include "pkmMatrix.h"
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+
+using namespace pkm;
+
+// particles per block of work (and per random stream)
+#define PKM_PARTICLE_BLOCK 4096
+
+class pkmParticleFilter
+{
+public:
+    // sigmas are the standard deviations of the per-frame random walk of
+    // phase, speed and scale.  tolerance is the standard deviation of the
+    // observation likelihood.  resampling happens when the effective sample
+    // size drops below resamplingThreshold (0 = numParticles / 100).
+    pkmParticleFilter(size_t numParticles = 1000000,
+                      float phaseSigma = 0.00001,
+                      float speedSigma = 0.001,
+                      float scaleSigma = 0.00001,
+                      float tolerance = 1.0,
+                      float resamplingThreshold = 0,
+                      uint64_t seed = 1);
+
+    // frames x dimensions of all templates stacked, and a lut with one row
+    // per template: (first row in templates, number of rows), as in pkmGVF.
+    // the frames are not copied and must stay valid while the filter runs.
+    void setTemplates(const Mat &templates, const Mat &lut);
+
+    // the same templates and lut with more rows appended (e.g. after
+    // pkmTemplateStore::append); only the new frames are preprocessed.
+    // new templates get particles at the next spreadParticles().
+    void addTemplates(const Mat &templates, const Mat &lut);
+
+    // uniform in [mean - range/2, mean + range/2] for phase, speed and
+    // scale, with templates drawn uniformly
+    void spreadParticles(float meanPhase, float meanSpeed, float meanScale,
+                         float rangePhase, float rangeSpeed, float rangeScale);
+
+    // kld-sampling: resample every frame, choosing the particle count from
+    // the number of (template, phase, speed, scale) bins the particles
+    // occupy, between minParticles and the constructor's numParticles.
+    // epsilon bounds the kl divergence of the sampled posterior, z is the
+    // normal quantile for the confidence (2.326 = 99%).
+    void setAdaptive(bool bAdaptive, size_t minParticles = 1000,
+                     float epsilon = 0.05, float z = 2.326,
+                     float phaseBin = 0.01, float speedBin = 0.05, float scaleBin = 0.05);
+    bool isAdaptive() const                     { return bAdaptive; }
+
+    // one observation of 'dimensions' values
+    void infer(const float *observation);
+
+    // most probable template and its weighted mean phase in [0, 1)
+    void getEstimatedStatus(int &templateIndex, float &phase) const;
+    float getEstimatedSpeed() const     { return estimates.data[templateIndex*4 + 2]; }
+    float getEstimatedScale() const     { return estimates.data[templateIndex*4 + 3]; }
+
+    // 1 x numTemplates posterior probability of each template
+    const Mat & getTemplateProbabilities() const        { return templateProbabilities; }
+
+    // effective sample size, 1 / sum(w^2), before any resampling this frame
+    float getEffectiveSampleSize() const        { return effectiveSampleSize; }
+
+    // particles used by the last frame, and how many the next resampling will draw
+    size_t getNumParticles() const              { return numParticles; }
+    size_t getTargetParticles() const           { return bAdaptive ? targetParticles : maxParticles; }
+    size_t getMaxParticles() const              { return maxParticles; }
+    size_t getNumOccupiedBins() const           { return numOccupiedBins; }
+    size_t getNumTemplates() const              { return numTemplates; }
+
+    // rows phase, speed, scale, template index, one column per particle
+    // (only the first getNumParticles() columns are live)
+    const Mat & getParticles() const            { return particles[current]; }
+    const Mat & getWeights() const              { return weights; }
+
+private:
+    enum { PHASE, SPEED, SCALE, TEMPLATE };
+
+    void propagateBlock(size_t block, float *scratch);
+    void weightBlock(size_t block, float maxLogLikelihood);
+    void resampleBlock(size_t block, const std::vector<double> &cumulative,
+                       double offset, float invTotal, size_t numResampled);
+    void resample(float total);
+    void respawn();
+    void setNumParticles(size_t n);
+    void updateTargetParticles();
+
+    size_t          numParticles, maxParticles;     // maxParticles is also the row stride
+    size_t          numBlocks, maxBlocks;
+    size_t          numTemplates, numDimensions;
+
+    float           sigmas[3];
+    float           invTwoVariance;         // 0.5 / tolerance^2
+    float           resamplingRatio;        // of numParticles
+
+    Mat             particles[2];           // 4 x maxParticles, current and resampling target
+    int             current;
+    Mat             weights;                // 1 x maxParticles, the first numParticles sum to 1
+    Mat             logLikelihoods;         // 1 x maxParticles
+
+    Mat             templates;              // frames x dimensions, the caller's memory
+    Mat             frameStart, frameLength;    // 1 x numTemplates
+    Mat             frameNorms;             // |t|^2 of every template frame
+    Mat             frameDots;              // <t, o> for the current observation
+    float           observationNorm;
+
+    // per block reductions: max log likelihood, sum of weights, sum of
+    // squared weights, and (weight, phase, speed, scale) sums per template
+    Mat             blockMax, blockSum, blockSumSq;
+    Mat             blockEstimates;         // maxBlocks x (numTemplates * 4)
+
+    Mat             estimates;              // numTemplates * 4, weighted means
+    Mat             templateProbabilities;
+    int             templateIndex;
+    float           effectiveSampleSize;
+
+    float           spreadMean[3], spreadRange[3];
+
+    std::vector<Random> random;             // a stream per block, plus one for resampling
+
+    bool            bAdaptive;
+    size_t          minParticles, targetParticles;
+    float           kldEpsilon, kldZ;
+    float           binSizes[3];
+    size_t          numOccupiedBins;
+    std::vector<std::atomic<uint64_t> > binOccupancy;
+};
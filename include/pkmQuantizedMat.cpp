@@ -0,0 +1,370 @@
+/*
+ *  pkmQuantizedMat.cpp
+ *
+
+ reduced precision matrix storage with dequantize-on-read kernels.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmQuantizedMat.h"
+#include "pkmThreadPool.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// rows decoded at a time by the kernels; 64 rows of a few hundred
+// features stay in L2 next to the output
+#define PKM_QUANTIZED_PANEL 64
+
+static inline uint32_t floatBits(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(float));
+    return x;
+}
+
+static inline float bitsFloat(uint32_t x)
+{
+    float f;
+    memcpy(&f, &x, sizeof(float));
+    return f;
+}
+
+uint16_t pkmQuantizedMat::floatToHalf(float f)
+{
+    uint32_t x = floatBits(f);
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t magnitude = x & 0x7FFFFFFF;
+
+    // nan stays (quiet) nan, inf and anything rounding past 65504 is inf
+    if (magnitude >= 0x7F800000) {
+        return sign | (magnitude > 0x7F800000 ? 0x7E00 : 0x7C00);
+    }
+    if (magnitude >= 0x477FF000) {
+        return sign | 0x7C00;
+    }
+
+    // below 2^-14 the half is subnormal: an integer count of 2^-24
+    if (magnitude < 0x38800000) {
+        return sign | (uint16_t)lrintf(bitsFloat(magnitude) * 16777216.0f);
+    }
+
+    // rebias the exponent from 127 to 15 and round to nearest even on the
+    // 13 mantissa bits dropped (a carry correctly bumps the exponent)
+    uint32_t h = magnitude - 0x38000000;
+    h += 0xFFF + ((h >> 13) & 1);
+    return sign | (h >> 13);
+}
+
+float pkmQuantizedMat::halfToFloat(uint16_t h)
+{
+    // the magnitude shifted into place is the value times 2^-112, for
+    // subnormals too; only inf and nan need their exponent forced
+    uint32_t magnitude = (uint32_t)(h & 0x7FFF) << 13;
+    float f = bitsFloat(magnitude) * bitsFloat(0x77800000);
+    uint32_t x = floatBits(f);
+    if (magnitude >= 0x0F800000) {
+        x |= 0x7F800000;
+    }
+    return bitsFloat(x | ((uint32_t)(h & 0x8000) << 16));
+}
+
+uint16_t pkmQuantizedMat::floatToBFloat16(float f)
+{
+    uint32_t x = floatBits(f);
+    if ((x & 0x7FFFFFFF) > 0x7F800000) {
+        return (x >> 16) | 0x0040;
+    }
+    x += 0x7FFF + ((x >> 16) & 1);
+    return x >> 16;
+}
+
+float pkmQuantizedMat::bfloat16ToFloat(uint16_t b)
+{
+    return bitsFloat((uint32_t)b << 16);
+}
+
+// -----------------------------------------------------------------------------
+//  decoders, n values from src to dst
+// -----------------------------------------------------------------------------
+
+static void decodeHalf(const uint16_t *src, float *dst, size_t n)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    // the same shift and rebias as halfToFloat, eight at a time (two vectors of four)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i signMask = _mm_set1_epi32(0x8000);
+    const __m128i magnitudeMask = _mm_set1_epi32(0x7FFF);
+    const __m128i infLimit = _mm_set1_epi32(0x0F7FFFFF);
+    const __m128 rebias = _mm_castsi128_ps(_mm_set1_epi32(0x77800000));
+    const __m128 infExponent = _mm_castsi128_ps(_mm_set1_epi32(0x7F800000));
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i halves[2] = { _mm_unpacklo_epi16(h, zero), _mm_unpackhi_epi16(h, zero) };
+        for (int k = 0; k < 2; k++) {
+            __m128i sign = _mm_slli_epi32(_mm_and_si128(halves[k], signMask), 16);
+            __m128i magnitude = _mm_slli_epi32(_mm_and_si128(halves[k], magnitudeMask), 13);
+            __m128 f = _mm_mul_ps(_mm_castsi128_ps(magnitude), rebias);
+            __m128 special = _mm_castsi128_ps(_mm_cmpgt_epi32(magnitude, infLimit));
+            f = _mm_or_ps(f, _mm_and_ps(special, infExponent));
+            _mm_storeu_ps(dst + i + 4 * k, _mm_or_ps(f, _mm_castsi128_ps(sign)));
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 8 <= n; i += 8) {
+        float16x8_t h = vreinterpretq_f16_u16(vld1q_u16(src + i));
+        vst1q_f32(dst + i, vcvt_f32_f16(vget_low_f16(h)));
+        vst1q_f32(dst + i + 4, vcvt_high_f32_f16(h));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = pkmQuantizedMat::halfToFloat(src[i]);
+    }
+}
+
+static void decodeBFloat16(const uint16_t *src, float *dst, size_t n)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_ps(dst + i, _mm_castsi128_ps(_mm_unpacklo_epi16(zero, b)));
+        _mm_storeu_ps(dst + i + 4, _mm_castsi128_ps(_mm_unpackhi_epi16(zero, b)));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 8 <= n; i += 8) {
+        uint16x8_t b = vld1q_u16(src + i);
+        vst1q_f32(dst + i, vreinterpretq_f32_u32(vshll_n_u16(vget_low_u16(b), 16)));
+        vst1q_f32(dst + i + 4, vreinterpretq_f32_u32(vshll_high_n_u16(b, 16)));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = pkmQuantizedMat::bfloat16ToFloat(src[i]);
+    }
+}
+
+static void decodeInt8(const int8_t *src, float scale, float *dst, size_t n)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    // widen each byte to the top of a 32 bit lane, then shift it back down
+    // with its sign
+    const __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 16 <= n; i += 16) {
+        __m128i q = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_unpacklo_epi8(q, q), hi = _mm_unpackhi_epi8(q, q);
+        __m128i words[4] = {
+            _mm_unpacklo_epi16(lo, lo), _mm_unpackhi_epi16(lo, lo),
+            _mm_unpacklo_epi16(hi, hi), _mm_unpackhi_epi16(hi, hi)
+        };
+        for (int k = 0; k < 4; k++) {
+            __m128 f = _mm_cvtepi32_ps(_mm_srai_epi32(words[k], 24));
+            _mm_storeu_ps(dst + i + 4 * k, _mm_mul_ps(f, vscale));
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t w = vmovl_s8(vld1_s8(src + i));
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(w))), scale));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_high_s16(w)), scale));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = src[i] * scale;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+pkmQuantizedMat::pkmQuantizedMat(Format format)
+: format(format), rows(0), cols(0)
+{
+}
+
+pkmQuantizedMat::pkmQuantizedMat(const Mat &m, Format format)
+: format(format), rows(0), cols(0)
+{
+    quantize(m);
+}
+
+void pkmQuantizedMat::clear()
+{
+    rows = cols = 0;
+    storage.clear();
+    scales.clear();
+}
+
+void pkmQuantizedMat::quantize(const Mat &m)
+{
+    clear();
+    push_back(m);
+}
+
+void pkmQuantizedMat::push_back(const Mat &m)
+{
+    if (m.rows == 0 || m.cols == 0) {
+        return;
+    }
+    if (rows && m.cols != cols) {
+        printf("[ERROR: pkmQuantizedMat::push_back()] Expected %lu columns, got %lu.\n", cols, m.cols);
+        return;
+    }
+
+    size_t first = rows;
+    cols = m.cols;
+    rows += m.rows;
+    storage.resize(rows * cols * elementSize());
+    if (format == INT8) {
+        scales.resize(rows);
+    }
+
+    pkm::parallelFor(m.rows, 256, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            encodeRow(m.data + r * cols, first + r);
+        }
+    });
+}
+
+void pkmQuantizedMat::encodeRow(const float *src, size_t r)
+{
+    if (format == INT8) {
+        float maxMagnitude = 0;
+        for (size_t c = 0; c < cols; c++) {
+            maxMagnitude = std::max(maxMagnitude, fabsf(src[c]));
+        }
+        float scale = maxMagnitude / 127.0f;
+        float invScale = scale > 0 ? 1.0f / scale : 0.0f;
+        int8_t *dst = (int8_t *)&storage[r * cols];
+        for (size_t c = 0; c < cols; c++) {
+            long q = lrintf(src[c] * invScale);
+            dst[c] = (int8_t)(q > 127 ? 127 : (q < -127 ? -127 : q));
+        }
+        scales[r] = scale;
+    }
+    else {
+        uint16_t *dst = (uint16_t *)&storage[r * cols * 2];
+        for (size_t c = 0; c < cols; c++) {
+            dst[c] = format == FLOAT16 ? floatToHalf(src[c]) : floatToBFloat16(src[c]);
+        }
+    }
+}
+
+void pkmQuantizedMat::decodeRows(size_t first, size_t n, float *out) const
+{
+    for (size_t r = first; r < first + n; r++, out += cols) {
+        switch (format) {
+            case FLOAT16:
+                decodeHalf((const uint16_t *)&storage[r * cols * 2], out, cols);
+                break;
+            case BFLOAT16:
+                decodeBFloat16((const uint16_t *)&storage[r * cols * 2], out, cols);
+                break;
+            case INT8:
+                decodeInt8((const int8_t *)&storage[r * cols], scales[r], out, cols);
+                break;
+        }
+    }
+}
+
+void pkmQuantizedMat::getRow(size_t r, float *out) const
+{
+#ifdef DEBUG
+    assert(r < rows);
+#endif
+    decodeRows(r, 1, out);
+}
+
+void pkmQuantizedMat::dequantize(Mat &m) const
+{
+    m.reset(rows, cols);
+    pkm::parallelFor(rows, PKM_QUANTIZED_PANEL, [&](size_t begin, size_t end) {
+        decodeRows(begin, end - begin, m.data + begin * cols);
+    });
+}
+
+// -----------------------------------------------------------------------------
+//  kernels: decode a panel of rows into scratch, then the float routine
+// -----------------------------------------------------------------------------
+
+void pkmQuantizedMat::GEMM(const Mat &rhs, Mat &result) const
+{
+    if (rhs.rows != cols) {
+        printf("[ERROR: pkmQuantizedMat::GEMM()] %lu x %lu times %lu x %lu.\n", rows, cols, rhs.rows, rhs.cols);
+        return;
+    }
+    result.reset(rows, rhs.cols);
+
+    size_t numPanels = (rows + PKM_QUANTIZED_PANEL - 1) / PKM_QUANTIZED_PANEL;
+    pkm::parallelFor(numPanels, 1, [&](size_t begin, size_t end) {
+        std::vector<float> panel(PKM_QUANTIZED_PANEL * cols);
+        for (size_t p = begin; p < end; p++) {
+            size_t first = p * PKM_QUANTIZED_PANEL;
+            size_t n = std::min((size_t)PKM_QUANTIZED_PANEL, rows - first);
+            decodeRows(first, n, &panel[0]);
+            cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, n, rhs.cols, cols,
+                        1.0f, &panel[0], cols, rhs.data, rhs.cols,
+                        0.0f, result.data + first * rhs.cols, rhs.cols);
+        }
+    });
+}
+
+void pkmQuantizedMat::GEMV(const float *v, float *out) const
+{
+    size_t numPanels = (rows + PKM_QUANTIZED_PANEL - 1) / PKM_QUANTIZED_PANEL;
+    pkm::parallelFor(numPanels, 4, [&](size_t begin, size_t end) {
+        std::vector<float> panel(PKM_QUANTIZED_PANEL * cols);
+        for (size_t p = begin; p < end; p++) {
+            size_t first = p * PKM_QUANTIZED_PANEL;
+            size_t n = std::min((size_t)PKM_QUANTIZED_PANEL, rows - first);
+            decodeRows(first, n, &panel[0]);
+            cblas_sgemv(CblasRowMajor, CblasNoTrans, n, cols, 1.0f, &panel[0], cols,
+                        v, 1, 0.0f, out + first, 1);
+        }
+    });
+}
+
+void pkmQuantizedMat::squaredDistances(const float *q, float *out) const
+{
+    pkm::parallelFor(rows, PKM_QUANTIZED_PANEL, [&](size_t begin, size_t end) {
+        std::vector<float> row(cols);
+        for (size_t r = begin; r < end; r++) {
+            decodeRows(r, 1, &row[0]);
+            vDSP_distancesq(&row[0], 1, q, 1, out + r, cols);
+        }
+    });
+}
+
+void pkmQuantizedMat::l1Distances(const float *q, float *out) const
+{
+    pkm::parallelFor(rows, PKM_QUANTIZED_PANEL, [&](size_t begin, size_t end) {
+        std::vector<float> row(cols);
+        for (size_t r = begin; r < end; r++) {
+            decodeRows(r, 1, &row[0]);
+            vDSP_vsub(q, 1, &row[0], 1, &row[0], 1, cols);
+            vDSP_svemg(&row[0], 1, out + r, cols);
+        }
+    });
+}
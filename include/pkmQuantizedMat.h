@@ -0,0 +1,97 @@
+/*
+ *  pkmQuantizedMat.h
+ *
+
+ storage-only reduced precision copy of a pkm::Mat, for large read-mostly
+ tables such as a feature database.  rows are kept as float16 (half the
+ memory), bfloat16 (half, with float's range but 8 bits of mantissa) or
+ int8 with one float scale per row (about a quarter).
+
+ nothing is computed in the reduced type: the kernels below decode a row
+ (or a panel of rows for GEMM) into a small float buffer that stays in
+ cache and run the usual float routines on it, so the full float matrix
+ never exists in memory.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include "pkmMatrix.h"
+#include <vector>
+#include <stdint.h>
+
+using namespace pkm;
+
+class pkmQuantizedMat
+{
+public:
+    enum Format
+    {
+        FLOAT16,        // ieee half, round to nearest even, saturating to inf
+        BFLOAT16,       // top 16 bits of a float, round to nearest even
+        INT8            // symmetric, scale = max |x| / 127 per row
+    };
+
+    pkmQuantizedMat(Format format = FLOAT16);
+    pkmQuantizedMat(const Mat &m, Format format = FLOAT16);
+
+    // replaces the contents with m
+    void quantize(const Mat &m);
+
+    // appends rows of the same width (any width when empty)
+    void push_back(const Mat &m);
+
+    void clear();
+
+    // back to float, whole or one row (cols floats)
+    void dequantize(Mat &m) const;
+    void getRow(size_t r, float *out) const;
+
+    // result = this * rhs, rows x rhs.cols
+    void GEMM(const Mat &rhs, Mat &result) const;
+
+    // out[r] = <row r, v> for every row
+    void GEMV(const float *v, float *out) const;
+
+    // out[r] = |row r - q|^2 and sum |row r - q|, for every row
+    void squaredDistances(const float *q, float *out) const;
+    void l1Distances(const float *q, float *out) const;
+
+    size_t getRows() const              { return rows; }
+    size_t getCols() const              { return cols; }
+    Format getFormat() const            { return format; }
+
+    // bytes held, for comparing against rows * cols * sizeof(float)
+    size_t getBytes() const             { return storage.size() + scales.size() * sizeof(float); }
+
+    // single value conversions, exposed for tests and file formats
+    static uint16_t floatToHalf(float f);
+    static float halfToFloat(uint16_t h);
+    static uint16_t floatToBFloat16(float f);
+    static float bfloat16ToFloat(uint16_t b);
+
+private:
+    size_t elementSize() const          { return format == INT8 ? 1 : 2; }
+    void encodeRow(const float *src, size_t r);
+    void decodeRows(size_t first, size_t n, float *out) const;
+
+    Format                  format;
+    size_t                  rows, cols;
+    std::vector<uint8_t>    storage;        // rows x cols elements, row-major
+    std::vector<float>      scales;         // one per row for INT8
+};
@@ -0,0 +1,354 @@
+/*
+ *  pkmRandom.cpp
+ *
+
+ counter-based random numbers.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmRandom.h"
+#include "pkmMath.h"
+#include "pkmThreadPool.h"
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// values per task, a multiple of the 64 made per block of 16 counters
+#define PKM_RANDOM_CHUNK 1024
+
+// fills at least this long are split across threads
+#define PKM_RANDOM_PARALLEL_MIN (1 << 16)
+
+namespace
+{
+    // philox 4x32 multipliers and key increments
+    const uint32_t PHILOX_M0 = 0xD2511F53;
+    const uint32_t PHILOX_M1 = 0xCD9E8D57;
+    const uint32_t PHILOX_W0 = 0x9E3779B9;
+    const uint32_t PHILOX_W1 = 0xBB67AE85;
+
+    // W lanes of uint32, with the 32 x 32 -> 64 bit multiply philox needs
+#if defined(__AVX512F__)
+    struct Lanes
+    {
+        typedef __m512i U;
+        enum { W = 16 };
+        static U set(uint32_t a)                        { return _mm512_set1_epi32((int)a); }
+        static U add(U a, U b)                          { return _mm512_add_epi32(a, b); }
+        static U bitXor(U a, U b)                       { return _mm512_xor_si512(a, b); }
+        static U load(const uint32_t *p)                { return _mm512_loadu_si512(p); }
+        static void store(uint32_t *p, U a)             { _mm512_storeu_si512(p, a); }
+        static void mulhilo(U a, uint32_t m, U &hi, U &lo)
+        {
+            U b = set(m);
+            U even = _mm512_mul_epu32(a, b);
+            U odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), b);
+            lo = _mm512_mask_blend_epi32(0xAAAA, even, _mm512_slli_epi64(odd, 32));
+            hi = _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(even, 32), odd);
+        }
+    };
+#elif defined(__AVX2__)
+    struct Lanes
+    {
+        typedef __m256i U;
+        enum { W = 8 };
+        static U set(uint32_t a)                        { return _mm256_set1_epi32((int)a); }
+        static U add(U a, U b)                          { return _mm256_add_epi32(a, b); }
+        static U bitXor(U a, U b)                       { return _mm256_xor_si256(a, b); }
+        static U load(const uint32_t *p)                { return _mm256_loadu_si256((const __m256i *)p); }
+        static void store(uint32_t *p, U a)             { _mm256_storeu_si256((__m256i *)p, a); }
+        static void mulhilo(U a, uint32_t m, U &hi, U &lo)
+        {
+            U b = set(m);
+            U even = _mm256_mul_epu32(a, b);
+            U odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+            lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+            hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+        }
+    };
+#elif defined(__SSE2__)
+    struct Lanes
+    {
+        typedef __m128i U;
+        enum { W = 4 };
+        static U set(uint32_t a)                        { return _mm_set1_epi32((int)a); }
+        static U add(U a, U b)                          { return _mm_add_epi32(a, b); }
+        static U bitXor(U a, U b)                       { return _mm_xor_si128(a, b); }
+        static U load(const uint32_t *p)                { return _mm_loadu_si128((const __m128i *)p); }
+        static void store(uint32_t *p, U a)             { _mm_storeu_si128((__m128i *)p, a); }
+        static void mulhilo(U a, uint32_t m, U &hi, U &lo)
+        {
+            U b = set(m);
+            U even = _mm_mul_epu32(a, b);
+            U odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), b);
+            U low32 = _mm_set_epi32(0, -1, 0, -1);
+            lo = _mm_or_si128(_mm_and_si128(even, low32), _mm_slli_epi64(odd, 32));
+            hi = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_andnot_si128(low32, odd));
+        }
+    };
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    struct Lanes
+    {
+        typedef uint32x4_t U;
+        enum { W = 4 };
+        static U set(uint32_t a)                        { return vdupq_n_u32(a); }
+        static U add(U a, U b)                          { return vaddq_u32(a, b); }
+        static U bitXor(U a, U b)                       { return veorq_u32(a, b); }
+        static U load(const uint32_t *p)                { return vld1q_u32(p); }
+        static void store(uint32_t *p, U a)             { vst1q_u32(p, a); }
+        static void mulhilo(U a, uint32_t m, U &hi, U &lo)
+        {
+            uint32x4_t p0 = vreinterpretq_u32_u64(vmull_u32(vget_low_u32(a), vdup_n_u32(m)));
+            uint32x4_t p1 = vreinterpretq_u32_u64(vmull_high_u32(a, vdupq_n_u32(m)));
+            lo = vuzp1q_u32(p0, p1);
+            hi = vuzp2q_u32(p0, p1);
+        }
+    };
+#else
+    struct Lanes
+    {
+        typedef uint32_t U;
+        enum { W = 1 };
+        static U set(uint32_t a)                        { return a; }
+        static U add(U a, U b)                          { return a + b; }
+        static U bitXor(U a, U b)                       { return a ^ b; }
+        static U load(const uint32_t *p)                { return *p; }
+        static void store(uint32_t *p, U a)             { *p = a; }
+        static void mulhilo(U a, uint32_t m, U &hi, U &lo)
+        {
+            uint64_t p = (uint64_t)a * m;
+            hi = (uint32_t)(p >> 32);
+            lo = (uint32_t)p;
+        }
+    };
+#endif
+
+    typedef Lanes L;
+
+    inline uint64_t splitmix64(uint64_t x)
+    {
+        uint64_t z = x + 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // philox 4x32-10 of W counters at once
+    inline void philox(L::U &c0, L::U &c1, L::U &c2, L::U &c3, uint32_t k0, uint32_t k1)
+    {
+        for (int round = 0; round < 10; round++) {
+            L::U hi0, lo0, hi1, lo1;
+            L::mulhilo(c0, PHILOX_M0, hi0, lo0);
+            L::mulhilo(c2, PHILOX_M1, hi1, lo1);
+            c0 = L::bitXor(L::bitXor(hi1, c1), L::set(k0));
+            c1 = lo1;
+            c2 = L::bitXor(L::bitXor(hi0, c3), L::set(k1));
+            c3 = lo0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+    }
+
+    // the top 23 bits as an odd multiple of 2^-24, so in (0, 1): every
+    // value is exact, where (k + 0.5) 2^-24 for 24 bits would round the
+    // top one up to 1
+    inline float toUnit(uint32_t x)
+    {
+        return (float)(x >> 9) * (1.0f / 8388608.0f) + (1.0f / 16777216.0f);
+    }
+}
+
+namespace pkm
+{
+    Random::Random(uint64_t seed, uint64_t stream)
+    {
+        this->seed(seed, stream);
+    }
+
+    Random::Random(const Random &other)
+    {
+        *this = other;
+    }
+
+    Random & Random::operator=(const Random &other)
+    {
+        key[0] = other.key[0];
+        key[1] = other.key[1];
+        stream = other.stream;
+        position.store(other.position.load());
+        return *this;
+    }
+
+    void Random::seed(uint64_t seed, uint64_t stream)
+    {
+        uint64_t k = splitmix64(seed);
+        key[0] = (uint32_t)k;
+        key[1] = (uint32_t)(k >> 32);
+        this->stream = stream;
+        position.store(0);
+    }
+
+    Random & Random::shared()
+    {
+        static Random random;
+        return random;
+    }
+
+    // block b is counters 16 b .. 16 b + 15 of the stream, with word k of
+    // counter j at 16 k + j, so the layout is the same for any W
+    void Random::generate(uint64_t block, size_t blocks, uint32_t *dst) const
+    {
+        uint32_t lanes[16];
+        for (int j = 0; j < 16; j++) {
+            lanes[j] = j;
+        }
+        for (size_t b = 0; b < blocks; b++, dst += 64) {
+            uint64_t counter = (block + b) * 16;
+            for (int j = 0; j < 16; j += L::W) {
+                // the low word of a multiple of 16 has room for + j
+                L::U c0 = L::add(L::set((uint32_t)counter), L::load(lanes + j));
+                L::U c1 = L::set((uint32_t)(counter >> 32));
+                L::U c2 = L::set((uint32_t)stream);
+                L::U c3 = L::set((uint32_t)(stream >> 32));
+                philox(c0, c1, c2, c3, key[0], key[1]);
+                L::store(dst + j, c0);
+                L::store(dst + 16 + j, c1);
+                L::store(dst + 32 + j, c2);
+                L::store(dst + 48 + j, c3);
+            }
+        }
+    }
+
+    template<typename F>
+    void Random::fill(size_t n, F f)
+    {
+        if (n == 0) {
+            return;
+        }
+        uint64_t first = position.fetch_add((n + 63) / 64);
+        size_t numChunks = (n + PKM_RANDOM_CHUNK - 1) / PKM_RANDOM_CHUNK;
+        auto run = [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++) {
+                size_t offset = c * PKM_RANDOM_CHUNK;
+                f(first + offset / 64, offset, std::min((size_t)PKM_RANDOM_CHUNK, n - offset));
+            }
+        };
+        if (n >= PKM_RANDOM_PARALLEL_MIN) {
+            pkm::parallelFor(numChunks, 8, run);
+        }
+        else {
+            run(0, numChunks);
+        }
+    }
+
+    void Random::bits(uint32_t *dst, size_t n)
+    {
+        fill(n, [&](uint64_t block, size_t offset, size_t count) {
+            uint32_t words[PKM_RANDOM_CHUNK];
+            generate(block, (count + 63) / 64, words);
+            std::copy(words, words + count, dst + offset);
+        });
+    }
+
+    void Random::uniform(float *dst, size_t n, float low, float high)
+    {
+        float width = high - low;
+        fill(n, [&](uint64_t block, size_t offset, size_t count) {
+            uint32_t words[PKM_RANDOM_CHUNK];
+            generate(block, (count + 63) / 64, words);
+            float *out = dst + offset;
+            for (size_t i = 0; i < count; i++) {
+                out[i] = low + toUnit(words[i]) * width;
+            }
+        });
+    }
+
+    void Random::normal(float *dst, size_t n, float mean, float stddev)
+    {
+        fill(n, [&](uint64_t block, size_t offset, size_t count) {
+            uint32_t words[PKM_RANDOM_CHUNK];
+            generate(block, (count + 63) / 64, words);
+
+            // r = sqrt(-2 log u1), theta = 2 pi u2, giving r cos theta for
+            // the first half and r sin theta for the second
+            size_t half = (count + 1) / 2;
+            float radius[PKM_RANDOM_CHUNK / 2], angle[PKM_RANDOM_CHUNK / 2];
+            float cosine[PKM_RANDOM_CHUNK / 2], sine[PKM_RANDOM_CHUNK / 2];
+            for (size_t i = 0; i < half; i++) {
+                radius[i] = toUnit(words[i]);
+                angle[i] = toUnit(words[half + i]) * (float)(2.0 * M_PI);
+            }
+            pkm::math::log(radius, radius, half, pkm::math::FAST);
+            for (size_t i = 0; i < half; i++) {
+                radius[i] *= -2.0f;
+            }
+            pkm::math::sqrt(radius, radius, half);
+            pkm::math::sincos(angle, sine, cosine, half, pkm::math::FAST);
+
+            float *out = dst + offset;
+            for (size_t i = 0; i < half; i++) {
+                out[i] = mean + stddev * radius[i] * cosine[i];
+            }
+            for (size_t i = 0; i < count - half; i++) {
+                out[half + i] = mean + stddev * radius[i] * sine[i];
+            }
+        });
+    }
+
+    void Random::categorical(const float *weights, size_t k, float *dst, size_t n)
+    {
+        std::vector<float> cumulative(k);
+        double total = 0;
+        for (size_t i = 0; i < k; i++) {
+            total += std::max(weights[i], 0.0f);
+            cumulative[i] = (float)total;
+        }
+        if (!(total > 0)) {
+            printf("[ERROR: pkm::Random::categorical()] Weights must be non-negative with a positive sum.\n");
+            std::fill(dst, dst + n, 0.0f);
+            return;
+        }
+
+        // rounding can put u at the very top, which belongs to the last
+        // category with any weight
+        size_t last = k - 1;
+        while (!(weights[last] > 0)) {
+            last--;
+        }
+        const float *cdf = &cumulative[0];
+        float scale = (float)total;
+        fill(n, [&](uint64_t block, size_t offset, size_t count) {
+            uint32_t words[PKM_RANDOM_CHUNK];
+            generate(block, (count + 63) / 64, words);
+            float *out = dst + offset;
+            for (size_t i = 0; i < count; i++) {
+                float u = toUnit(words[i]) * scale;
+                out[i] = (float)std::min((size_t)(std::upper_bound(cdf, cdf + k, u) - cdf), last);
+            }
+        });
+    }
+}
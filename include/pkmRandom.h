@@ -0,0 +1,97 @@
+/*
+ *  pkmRandom.h
+ *
+
+ seedable, counter-based random numbers for filling whole buffers, in
+ place of ::random() (serial, unseedable and shared by every thread).
+
+ values come from philox 4x32-10 (salmon et al., "parallel random numbers:
+ as easy as 1, 2, 3"), which turns a 128 bit counter and a 64 bit key into
+ 4 random words with no other state.  the n values of a fill are a
+ function of the seed, the stream and the position alone, so they can be
+ made 64 at a time in any order: fills are vectorized, split across the
+ shared pkm::ThreadPool when large, and give the same values for a given
+ seed whatever the thread count.  bits() and categorical() are also the
+ same on every instruction set.  uniform() and normal() are only the same
+ on one instruction set: their float arithmetic (and normal()'s log and
+ sincos) uses fused multiply-adds on AVX2, AVX-512 and NEON but not on
+ SSE2, so the last bits can differ between those builds.
+
+ each fill reserves its counters atomically, so one generator (like
+ shared(), which Mat::setRand() uses) can be filled from several threads;
+ which thread gets which values then depends on timing.  give each thread
+ (or each block of work) its own stream for results that don't.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace pkm
+{
+    class Random
+    {
+    public:
+        // generators with different seeds, or the same seed and different
+        // streams, give independent values
+        Random(uint64_t seed = 1, uint64_t stream = 0);
+        Random(const Random &other);
+        Random & operator=(const Random &other);
+
+        // restarts from the beginning of the given stream
+        void seed(uint64_t seed, uint64_t stream = 0);
+
+        // uniform in (low, high), excluding the ends when high - low is not
+        // too large (23 bits of randomness, so never 0 or 1 for (0, 1))
+        void uniform(float *dst, size_t n, float low = 0.0f, float high = 1.0f);
+
+        // gaussian by box-muller
+        void normal(float *dst, size_t n, float mean = 0.0f, float stddev = 1.0f);
+
+        // indices in [0, k) (as floats, like the rest of a Mat) drawn with
+        // probability proportional to the k non-negative weights
+        void categorical(const float *weights, size_t k, float *dst, size_t n);
+
+        // uniform 32 bit words
+        void bits(uint32_t *dst, size_t n);
+
+        // fills so far, in blocks of 64 values: each fill of n uses
+        // ceil(n / 64) blocks.  setPosition() rewinds or skips ahead.
+        uint64_t getPosition() const                { return position.load(); }
+        void setPosition(uint64_t position)         { this->position.store(position); }
+
+        // the generator Mat::setRand() and friends use by default
+        static Random & shared();
+
+    private:
+        // 64 * blocks words from the given block on
+        void generate(uint64_t block, size_t blocks, uint32_t *dst) const;
+
+        // reserves ceil(n / 64) blocks and calls fill(block, first, count)
+        // for every chunk of the n values, across threads when n is large
+        template<typename F>
+        void fill(size_t n, F f);
+
+        uint32_t                key[2];
+        uint64_t                stream;
+        std::atomic<uint64_t>   position;
+    };
+}
@@ -0,0 +1,379 @@
+/*
+ *  pkmResample.cpp
+ *
+
+ separable resampling weights, the two passes that apply them, and 1-D
+ linear interpolation.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmResample.h"
+#include "pkmMatrix.h"
+#include "pkmThreadPool.h"
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// multiply-adds (or interpolated samples) per task
+#define PKM_RESAMPLE_CHUNK 65536
+
+using namespace pkm;
+
+namespace
+{
+#if defined(__AVX512F__)
+    struct Simd
+    {
+        typedef __m512 V;
+        enum { W = 16 };
+        static V load(const float *p)                   { return _mm512_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm512_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm512_set1_ps(f); }
+        static V fma(V a, V b, V c)                     { return _mm512_fmadd_ps(a, b, c); }
+    };
+#elif defined(__AVX2__) && defined(__FMA__)
+    struct Simd
+    {
+        typedef __m256 V;
+        enum { W = 8 };
+        static V load(const float *p)                   { return _mm256_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm256_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm256_set1_ps(f); }
+        static V fma(V a, V b, V c)                     { return _mm256_fmadd_ps(a, b, c); }
+    };
+#elif defined(__SSE2__)
+    struct Simd
+    {
+        typedef __m128 V;
+        enum { W = 4 };
+        static V load(const float *p)                   { return _mm_loadu_ps(p); }
+        static void store(float *p, V a)                { _mm_storeu_ps(p, a); }
+        static V set(float f)                           { return _mm_set1_ps(f); }
+        static V fma(V a, V b, V c)                     { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    };
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    struct Simd
+    {
+        typedef float32x4_t V;
+        enum { W = 4 };
+        static V load(const float *p)                   { return vld1q_f32(p); }
+        static void store(float *p, V a)                { vst1q_f32(p, a); }
+        static V set(float f)                           { return vdupq_n_f32(f); }
+        static V fma(V a, V b, V c)                     { return vfmaq_f32(c, a, b); }
+    };
+#else
+    struct Simd
+    {
+        typedef float V;
+        enum { W = 1 };
+        static V load(const float *p)                   { return *p; }
+        static void store(float *p, V a)                { *p = a; }
+        static V set(float f)                           { return f; }
+        static V fma(V a, V b, V c)                     { return a * b + c; }
+    };
+#endif
+
+    typedef Simd::V V;
+    enum { W = Simd::W, VN = 4 };
+
+    // y[c] = sum_t w[t] x[c + t stride] for c < count: taps source rows
+    // combined into one, VN vectors at a time
+    void combineRows(const float *x, size_t stride, const float *w, size_t taps, float *y, size_t count)
+    {
+        size_t c = 0;
+        for (; c + VN*W <= count; c += VN*W) {
+            V acc[VN];
+#pragma GCC unroll 4
+            for (size_t v = 0; v < VN; v++) {
+                acc[v] = Simd::set(0.0f);
+            }
+            const float *xc = x + c;
+            for (size_t t = 0; t < taps; t++, xc += stride) {
+                V wt = Simd::set(w[t]);
+#pragma GCC unroll 4
+                for (size_t v = 0; v < VN; v++) {
+                    acc[v] = Simd::fma(wt, Simd::load(xc + v*W), acc[v]);
+                }
+            }
+#pragma GCC unroll 4
+            for (size_t v = 0; v < VN; v++) {
+                Simd::store(y + c + v*W, acc[v]);
+            }
+        }
+        for (; c + W <= count; c += W) {
+            V acc = Simd::set(0.0f);
+            const float *xc = x + c;
+            for (size_t t = 0; t < taps; t++, xc += stride) {
+                acc = Simd::fma(Simd::set(w[t]), Simd::load(xc), acc);
+            }
+            Simd::store(y + c, acc);
+        }
+        for (; c < count; c++) {
+            float acc = 0.0f;
+            for (size_t t = 0; t < taps; t++) {
+                acc += w[t] * x[c + t*stride];
+            }
+            y[c] = acc;
+        }
+    }
+
+    // y[j] = sum_t w[j T + t] x[first[j] + t], with the usual tap counts unrolled
+    template<size_t T>
+    void combineColumns(const float *x, const size_t *first, const float *w, float *y, size_t count)
+    {
+        for (size_t j = 0; j < count; j++, w += T) {
+            const float *xj = x + first[j];
+            float acc = w[0] * xj[0];
+#pragma GCC unroll 4
+            for (size_t t = 1; t < T; t++) {
+                acc += w[t] * xj[t];
+            }
+            y[j] = acc;
+        }
+    }
+
+    void combineColumns(const float *x, const size_t *first, const float *w, size_t taps, float *y, size_t count)
+    {
+        switch (taps) {
+            case 1:
+                combineColumns<1>(x, first, w, y, count);
+                break;
+            case 2:
+                combineColumns<2>(x, first, w, y, count);
+                break;
+            case 4:
+                combineColumns<4>(x, first, w, y, count);
+                break;
+            default:
+                for (size_t j = 0; j < count; j++, w += taps) {
+                    const float *xj = x + first[j];
+                    float acc = 0.0f;
+                    for (size_t t = 0; t < taps; t++) {
+                        acc += w[t] * xj[t];
+                    }
+                    y[j] = acc;
+                }
+                break;
+        }
+    }
+
+    // keys' cubic convolution kernel with a = -0.5, at distance d
+    double cubic(double d)
+    {
+        d = fabs(d);
+        if (d < 1.0) {
+            return (1.5 * d - 2.5) * d * d + 1.0;
+        }
+        if (d < 2.0) {
+            return ((-0.5 * d + 2.5) * d - 4.0) * d + 2.0;
+        }
+        return 0.0;
+    }
+
+    size_t perTask(size_t work)
+    {
+        return std::max((size_t)1, PKM_RESAMPLE_CHUNK / std::max(work, (size_t)1));
+    }
+}
+
+void Resampler::Axis::build(size_t in, size_t out, Method method)
+{
+    this->in = in;
+    this->out = out;
+    first.assign(out, 0);
+    weights.clear();
+    taps = 0;
+    if (in == 0 || out == 0) {
+        return;
+    }
+
+    double scale = (double)in / (double)out;
+    size_t wanted = 1;
+    switch (method) {
+        case NEAREST:
+            wanted = 1;
+            break;
+        case BILINEAR:
+            wanted = 2;
+            break;
+        case BICUBIC:
+            wanted = 4;
+            break;
+        case AREA:
+            wanted = (size_t)ceil(scale) + 1;
+            break;
+    }
+    taps = std::min(wanted, in);
+    weights.assign(out * taps, 0.0f);
+
+    std::vector<long> index;
+    std::vector<double> weight;
+    for (size_t i = 0; i < out; i++) {
+        // the source samples and weights before clamping to the edges
+        index.clear();
+        weight.clear();
+        double centre = (i + 0.5) * scale - 0.5;
+        long base = (long)floor(centre);
+        double f = centre - base;
+        switch (method) {
+            case NEAREST:
+                index.push_back((long)floor((i + 0.5) * scale));
+                weight.push_back(1.0);
+                break;
+            case BILINEAR:
+                index.push_back(base);
+                weight.push_back(1.0 - f);
+                index.push_back(base + 1);
+                weight.push_back(f);
+                break;
+            case BICUBIC:
+                for (long t = -1; t <= 2; t++) {
+                    index.push_back(base + t);
+                    weight.push_back(cubic(t - f));
+                }
+                break;
+            case AREA: {
+                double begin = i * scale, end = (i + 1) * scale;
+                for (long j = (long)floor(begin); j < (long)ceil(end); j++) {
+                    double covered = std::min(end, (double)(j + 1)) - std::max(begin, (double)j);
+                    if (covered > 0.0) {
+                        index.push_back(j);
+                        weight.push_back(covered);
+                    }
+                }
+                break;
+            }
+        }
+
+        // clamped, the samples still fall within taps of the lowest one
+        long lowest = std::min(std::max(index[0], 0L), (long)in - 1);
+        first[i] = std::min((size_t)lowest, in - taps);
+        double sum = 0.0;
+        for (size_t k = 0; k < index.size(); k++) {
+            sum += weight[k];
+        }
+        float *w = &weights[i * taps];
+        for (size_t k = 0; k < index.size(); k++) {
+            size_t clamped = (size_t)std::min(std::max(index[k], 0L), (long)in - 1);
+            size_t t = std::min(clamped - first[i], taps - 1);
+            w[t] += (float)(weight[k] / sum);
+        }
+    }
+}
+
+Resampler::Resampler(size_t srcRows, size_t srcCols, size_t dstRows, size_t dstCols, Method method)
+: method(method)
+{
+    rows.build(srcRows, dstRows, method);
+    cols.build(srcCols, dstCols, method);
+}
+
+void Resampler::resample(const float *src, size_t srcStride, float *dst, size_t dstStride) const
+{
+    if (rows.out == 0 || cols.out == 0) {
+        return;
+    }
+    if (rows.in == 0 || cols.in == 0) {
+        printf("[ERROR: pkm::Resampler::resample()] Cannot resample an empty image to %lu x %lu.\n", rows.out, cols.out);
+        return;
+    }
+
+    // each output row: its source rows combined across the full width into
+    // line, then line's columns combined
+    size_t work = rows.taps * cols.in + cols.taps * cols.out;
+    pkm::parallelFor(rows.out, perTask(work), [&](size_t begin, size_t end) {
+        std::vector<float> line(cols.in);
+        for (size_t i = begin; i < end; i++) {
+            const float *x = src + rows.first[i] * srcStride;
+            const float *w = &rows.weights[i * rows.taps];
+            if (rows.taps > 1 || w[0] != 1.0f) {
+                combineRows(x, srcStride, w, rows.taps, &line[0], cols.in);
+                x = &line[0];
+            }
+            combineColumns(x, &cols.first[0], &cols.weights[0], cols.taps, dst + i * dstStride, cols.out);
+        }
+    });
+}
+
+void Resampler::resample(const Mat &src, Mat &dst) const
+{
+    if (src.rows != rows.in || src.cols != cols.in) {
+        printf("[ERROR: pkm::Resampler::resample()] Expected %lu x %lu, got %lu x %lu.\n", rows.in, cols.in, src.rows, src.cols);
+        return;
+    }
+    if (dst.rows != rows.out || dst.cols != cols.out) {
+        dst.reset(rows.out, cols.out);
+    }
+    resample(src.data, src.cols, dst.data, dst.cols);
+}
+
+void pkm::interpolate(const float *x, size_t n, float *y, size_t m)
+{
+    if (m == 0) {
+        return;
+    }
+    if (n == 0) {
+        printf("[ERROR: pkm::interpolate()] Cannot interpolate an empty signal.\n");
+        return;
+    }
+    double step = m > 1 ? (double)(n - 1) / (double)(m - 1) : 0.0;
+    pkm::parallelFor(m, PKM_RESAMPLE_CHUNK, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            double p = i * step;
+            size_t j = (size_t)p;
+            if (j + 1 >= n) {
+                y[i] = x[n - 1];
+                continue;
+            }
+            float f = (float)(p - j);
+            y[i] = x[j] + f * (x[j + 1] - x[j]);
+        }
+    });
+}
+
+void pkm::interpolate(const float *x, size_t n, const float *positions, float *y, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    if (n == 0) {
+        printf("[ERROR: pkm::interpolate()] Cannot interpolate an empty signal.\n");
+        return;
+    }
+    float last = (float)(n - 1);
+    pkm::parallelFor(count, PKM_RESAMPLE_CHUNK, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            float p = std::min(std::max(positions[i], 0.0f), last);
+            size_t j = (size_t)p;
+            if (j + 1 >= n) {
+                y[i] = x[n - 1];
+                continue;
+            }
+            float f = p - j;
+            y[i] = x[j] + f * (x[j + 1] - x[j]);
+        }
+    });
+}
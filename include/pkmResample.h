@@ -0,0 +1,104 @@
+/*
+ *  pkmResample.h
+ *
+
+ 2-D resampling of row-major float images (saliency maps, heatmaps,
+ spectrograms) and 1-D linear interpolation, without vImage or vDSP.
+
+ resizing is separable: an output pixel is a weighted sum of taps
+ consecutive rows, each a weighted sum of taps consecutive columns.
+ Resampler works the weights out once per axis, so a resampler kept
+ around for a shape costs nothing to set up on the next frame.  samples
+ sit at pixel centres, as in vImage and OpenCV, and edges are clamped.
+
+     NEAREST     1 tap, the source pixel under the output pixel's centre
+     BILINEAR    2 taps
+     BICUBIC     4 taps of the Keys cubic (a = -0.5)
+     AREA        the mean of the source pixels an output pixel covers,
+                 weighted by how much of each it covers, for shrinking
+                 without aliasing (ceil(in / out) + 1 taps)
+
+ each output row first combines its source rows across the full width
+ with AVX-512F, AVX2 + FMA, SSE2 or aarch64 NEON vectors, whichever the
+ compiler targets, then combines columns within that one row.  output
+ rows are split across the shared pkm::ThreadPool.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+namespace pkm
+{
+    template<typename T> class BasicMat;
+    typedef BasicMat<float> Mat;
+
+    class Resampler
+    {
+    public:
+        enum Method
+        {
+            NEAREST,
+            BILINEAR,
+            BICUBIC,
+            AREA
+        };
+
+        Resampler(size_t srcRows = 0, size_t srcCols = 0, size_t dstRows = 0, size_t dstCols = 0,
+                  Method method = BILINEAR);
+
+        // dstRows x dstCols from srcRows x srcCols, strides in floats.
+        // dst must not overlap src.
+        void resample(const float *src, size_t srcStride, float *dst, size_t dstStride) const;
+
+        // dst is reset only when it is not already dstRows x dstCols
+        void resample(const Mat &src, Mat &dst) const;
+
+        bool matches(size_t srcRows, size_t srcCols, size_t dstRows, size_t dstCols, Method method) const
+        {
+            return srcRows == rows.in && srcCols == cols.in && dstRows == rows.out &&
+                   dstCols == cols.out && method == this->method;
+        }
+
+        Method getMethod() const                { return method; }
+
+    private:
+        // output i of an axis is the sum over t < taps of
+        // weights[i * taps + t] * input[first[i] + t]
+        struct Axis
+        {
+            void build(size_t in, size_t out, Method method);
+
+            size_t              in, out, taps;
+            std::vector<size_t> first;
+            std::vector<float>  weights;
+        };
+
+        Method  method;
+        Axis    rows, cols;
+    };
+
+    // y[i] = x linearly interpolated at i (n - 1) / (m - 1), so that the
+    // first and last samples line up
+    void interpolate(const float *x, size_t n, float *y, size_t m);
+
+    // y[i] = x linearly interpolated at positions[i], clamped to [0, n - 1]
+    void interpolate(const float *x, size_t n, const float *positions, float *y, size_t count);
+}
@@ -0,0 +1,289 @@
+/*
+ *  pkmSparseMat.cpp
+ *
+
+ CSR / CSC sparse matrices.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmSparseMat.h"
+#include "pkmThreadPool.h"
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+// elements (dense) or entries (sparse) per task
+#define PKM_SPARSE_CHUNK 16384
+
+using namespace pkm;
+
+// outer vectors per task when each holds about n elements
+static size_t perTask(size_t n)
+{
+    return std::max((size_t)1, PKM_SPARSE_CHUNK / std::max(n, (size_t)1));
+}
+
+SparseMat::SparseMat(size_t rows, size_t cols, Layout layout)
+: rows(rows), cols(cols), layout(layout)
+{
+    pointers.assign(getNumOuter() + 1, 0);
+    values.reset(1, 0);
+}
+
+SparseMat SparseMat::fromDense(const Mat &A, float threshold, Layout layout)
+{
+    SparseMat S(A.rows, A.cols, CSR);
+    std::vector<size_t> &pointers = S.pointers;
+
+    pkm::parallelFor(A.rows, perTask(A.cols), [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            const float *a = A.data + r * A.cols;
+            size_t count = 0;
+            for (size_t c = 0; c < A.cols; c++) {
+                count += fabsf(a[c]) > threshold;
+            }
+            pointers[r + 1] = count;
+        }
+    });
+    for (size_t r = 0; r < A.rows; r++) {
+        pointers[r + 1] += pointers[r];
+    }
+
+    S.indices.resize(pointers[A.rows]);
+    S.values.reset(1, pointers[A.rows]);
+    pkm::parallelFor(A.rows, perTask(A.cols), [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            const float *a = A.data + r * A.cols;
+            size_t p = pointers[r];
+            for (size_t c = 0; c < A.cols; c++) {
+                if (fabsf(a[c]) > threshold) {
+                    S.indices[p] = (uint32_t)c;
+                    S.values.data[p++] = a[c];
+                }
+            }
+        }
+    });
+    return layout == CSR ? S : S.convert(CSC);
+}
+
+SparseMat SparseMat::bandPattern(size_t rows, size_t cols, size_t radius, Layout layout)
+{
+    SparseMat S(rows, cols, CSR);
+    if (rows == 0 || cols == 0) {
+        return layout == CSR ? S : S.convert(CSC);
+    }
+
+    // row r keeps the columns [first[r], last[r]] around the stretched diagonal.
+    // a single row is the whole diagonal, corner to corner, so it keeps
+    // every column whatever the radius.
+    std::vector<size_t> first(rows), last(rows);
+    double slope = rows > 1 ? (double)(cols - 1) / (rows - 1) : 0.0;
+    for (size_t r = 0; r < rows; r++) {
+        size_t center = (size_t)(r * slope + 0.5);
+        first[r] = center > radius ? center - radius : 0;
+        last[r] = rows > 1 ? std::min(cols - 1, center + radius) : cols - 1;
+        S.pointers[r + 1] = S.pointers[r] + last[r] - first[r] + 1;
+    }
+
+    S.indices.resize(S.pointers[rows]);
+    S.values.reset(1, S.pointers[rows], 0.0f);
+    pkm::parallelFor(rows, perTask(S.pointers[rows] / rows), [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            uint32_t *index = &S.indices[0] + S.pointers[r];
+            for (size_t c = first[r]; c <= last[r]; c++) {
+                *index++ = (uint32_t)c;
+            }
+        }
+    });
+    return layout == CSR ? S : S.convert(CSC);
+}
+
+SparseMat SparseMat::band(const Mat &A, size_t radius, Layout layout)
+{
+    SparseMat S = bandPattern(A.rows, A.cols, radius, CSR);
+    pkm::parallelFor(S.rows, perTask(2 * radius + 1), [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            const float *a = A.data + r * A.cols;
+            for (size_t p = S.pointers[r]; p < S.pointers[r + 1]; p++) {
+                S.values.data[p] = a[S.indices[p]];
+            }
+        }
+    });
+    return layout == CSR ? S : S.convert(CSC);
+}
+
+void SparseMat::toDense(Mat &A) const
+{
+    A.reset(rows, cols, 0.0f);
+    size_t outer = getNumOuter();
+    pkm::parallelFor(outer, perTask(nnz() / std::max(outer, (size_t)1)), [&](size_t begin, size_t end) {
+        for (size_t o = begin; o < end; o++) {
+            for (size_t p = pointers[o]; p < pointers[o + 1]; p++) {
+                size_t r = rowOf(o, indices[p]);
+                size_t c = colOf(o, indices[p]);
+                A.data[r * cols + c] = values.data[p];
+            }
+        }
+    });
+}
+
+Mat SparseMat::toDense() const
+{
+    Mat A;
+    toDense(A);
+    return A;
+}
+
+void SparseMat::multiply(const Mat &X, Mat &Y) const
+{
+    size_t k;
+    if (X.rows == cols) {
+        k = X.cols;
+        Y.reset(rows, k);
+    }
+    else if (X.rows == 1 && X.cols == cols) {
+        // the same memory as a cols x 1 X, and a rows x 1 Y
+        k = 1;
+        Y.reset(1, rows);
+    }
+    else {
+        printf("[ERROR: pkm::SparseMat::multiply()] Expected %lu x k or 1 x %lu, got %lu x %lu.\n", cols, cols, X.rows, X.cols);
+        return;
+    }
+
+    if (layout == CSR) {
+        // each task owns whole rows of Y
+        pkm::parallelFor(rows, perTask(k * nnz() / std::max(rows, (size_t)1)), [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; r++) {
+                float *y = Y.data + r * k;
+                if (k == 1) {
+                    float sum = 0;
+                    for (size_t p = pointers[r]; p < pointers[r + 1]; p++) {
+                        sum += values.data[p] * X.data[indices[p]];
+                    }
+                    *y = sum;
+                    continue;
+                }
+                std::fill(y, y + k, 0.0f);
+                for (size_t p = pointers[r]; p < pointers[r + 1]; p++) {
+                    const float *x = X.data + (size_t)indices[p] * k;
+                    float v = values.data[p];
+                    for (size_t c = 0; c < k; c++) {
+                        y[c] += v * x[c];
+                    }
+                }
+            }
+        });
+    }
+    else {
+        // column j of S scatters into every row of Y, so each task owns a
+        // range of Y's columns instead
+        std::fill(Y.data, Y.data + rows * k, 0.0f);
+        pkm::parallelFor(k, perTask(nnz()), [&](size_t begin, size_t end) {
+            for (size_t j = 0; j < cols; j++) {
+                const float *x = X.data + j * k;
+                for (size_t p = pointers[j]; p < pointers[j + 1]; p++) {
+                    float *y = Y.data + (size_t)indices[p] * k;
+                    float v = values.data[p];
+                    for (size_t c = begin; c < end; c++) {
+                        y[c] += v * x[c];
+                    }
+                }
+            }
+        });
+    }
+}
+
+SparseMat SparseMat::transpose() const
+{
+    SparseMat T(*this);
+    T.layout = layout == CSR ? CSC : CSR;
+    T.rows = cols;
+    T.cols = rows;
+    return T;
+}
+
+SparseMat SparseMat::convert(Layout layout) const
+{
+    if (layout == this->layout) {
+        return *this;
+    }
+
+    // a counting sort on the inner index; walking the outer vectors in
+    // order leaves each new outer vector sorted
+    SparseMat S(rows, cols, layout);
+    size_t inner = S.getNumOuter();
+    for (size_t p = 0; p < nnz(); p++) {
+        S.pointers[indices[p] + 1]++;
+    }
+    for (size_t i = 0; i < inner; i++) {
+        S.pointers[i + 1] += S.pointers[i];
+    }
+
+    S.indices.resize(nnz());
+    S.values.reset(1, nnz());
+    std::vector<size_t> next(S.pointers.begin(), S.pointers.end() - 1);
+    for (size_t o = 0; o < getNumOuter(); o++) {
+        for (size_t p = pointers[o]; p < pointers[o + 1]; p++) {
+            size_t q = next[indices[p]]++;
+            S.indices[q] = (uint32_t)o;
+            S.values.data[q] = values.data[p];
+        }
+    }
+    return S;
+}
+
+void SparseMat::multiplyElements(const Mat &B)
+{
+    if (B.rows != rows || B.cols != cols) {
+        printf("[ERROR: pkm::SparseMat::multiplyElements()] Expected %lu x %lu, got %lu x %lu.\n", rows, cols, B.rows, B.cols);
+        return;
+    }
+    size_t outer = getNumOuter();
+    pkm::parallelFor(outer, perTask(nnz() / std::max(outer, (size_t)1)), [&](size_t begin, size_t end) {
+        for (size_t o = begin; o < end; o++) {
+            for (size_t p = pointers[o]; p < pointers[o + 1]; p++) {
+                size_t r = rowOf(o, indices[p]);
+                size_t c = colOf(o, indices[p]);
+                values.data[p] *= B.data[r * cols + c];
+            }
+        }
+    });
+}
+
+void SparseMat::setDots(const Mat &A, const Mat &B)
+{
+    if (A.rows != rows || B.rows != cols || A.cols != B.cols) {
+        printf("[ERROR: pkm::SparseMat::setDots()] Expected %lu x d and %lu x d, got %lu x %lu and %lu x %lu.\n",
+               rows, cols, A.rows, A.cols, B.rows, B.cols);
+        return;
+    }
+    size_t d = A.cols;
+    size_t outer = getNumOuter();
+    // the outer operand's row stays put while the inner ones stream past
+    const Mat &O = layout == CSR ? A : B;
+    const Mat &I = layout == CSR ? B : A;
+    pkm::parallelFor(outer, perTask(d * nnz() / std::max(outer, (size_t)1)), [&](size_t begin, size_t end) {
+        for (size_t o = begin; o < end; o++) {
+            const float *a = O.data + o * d;
+            for (size_t p = pointers[o]; p < pointers[o + 1]; p++) {
+                values.data[p] = cblas_sdot(d, a, 1, I.data + (size_t)indices[p] * d, 1);
+            }
+        }
+    });
+}
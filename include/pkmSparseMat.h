@@ -0,0 +1,116 @@
+/*
+ *  pkmSparseMat.h
+ *
+
+ compressed sparse row (CSR) and column (CSC) matrices alongside pkm::Mat,
+ for cost and similarity matrices that are mostly empty: a Sakoe-Chiba
+ band between two sequences, or a thresholded similarity matrix.  memory
+ is O(nnz) rather than O(rows * cols).
+
+ entries are kept one outer vector (a row for CSR, a column for CSC) at a
+ time: outer vector o holds the entries pointers[o] .. pointers[o + 1] - 1,
+ with their inner indices (columns for CSR, rows for CSC) ascending in
+ indices and their values in a 1 x nnz Mat, so every Mat element-wise op
+ (sqr, exp, abs, multiply by a scalar, ...) applies to the stored entries
+ through getValues().
+
+ products, construction from a Mat and setDots() are split across the
+ shared pkm::ThreadPool.  CSR is the layout to multiply in; a CSC matrix
+ only spreads products across the columns of the dense operand, so
+ convert() it first when multiplying by a vector repeatedly.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include "pkmMatrix.h"
+#include <stdint.h>
+#include <vector>
+
+namespace pkm
+{
+    class SparseMat
+    {
+    public:
+        enum Layout
+        {
+            CSR,
+            CSC
+        };
+
+        // rows x cols of zeros
+        SparseMat(size_t rows = 0, size_t cols = 0, Layout layout = CSR);
+
+        // the entries of A with |a| > threshold
+        static SparseMat fromDense(const Mat &A, float threshold = 0.0f, Layout layout = CSR);
+
+        // the entries of A within radius of its diagonal, which runs corner
+        // to corner when A is not square (a Sakoe-Chiba band).  every row
+        // keeps a contiguous run of columns, the first row's starting at 0
+        // and the last row's ending at cols - 1 (a single row keeps them
+        // all).  consecutive rows' runs touch (so a warping path can cross
+        // the band) once radius is at least cols / rows / 2.
+        static SparseMat band(const Mat &A, size_t radius, Layout layout = CSR);
+
+        // the same pattern with zero values, without a dense A
+        static SparseMat bandPattern(size_t rows, size_t cols, size_t radius, Layout layout = CSR);
+
+        void toDense(Mat &A) const;
+        Mat toDense() const;
+
+        // Y = S X, with X cols x k and Y rows x k.  a 1 x cols X is taken
+        // as a vector, giving a 1 x rows Y.
+        void multiply(const Mat &X, Mat &Y) const;
+
+        // S^T, which is S's arrays read in the other layout
+        SparseMat transpose() const;
+
+        // the same matrix in the given layout
+        SparseMat convert(Layout layout) const;
+
+        // s_ij *= b_ij for every stored entry, with B rows x cols
+        void multiplyElements(const Mat &B);
+
+        // s_ij = <A.row(i), B.row(j)> for every stored entry: A B^T
+        // computed only on the pattern, with A rows x d and B cols x d
+        void setDots(const Mat &A, const Mat &B);
+
+        // 1 x nnz, in storage order
+        Mat & getValues()                               { return values; }
+        const Mat & getValues() const                   { return values; }
+
+        const std::vector<size_t> & getPointers() const     { return pointers; }
+        const std::vector<uint32_t> & getIndices() const    { return indices; }
+
+        Layout getLayout() const                        { return layout; }
+        size_t getNumOuter() const                      { return layout == CSR ? rows : cols; }
+        size_t nnz() const                              { return indices.size(); }
+
+        size_t rows, cols;
+
+    private:
+        // the row and column of an entry from its outer and inner index
+        size_t rowOf(size_t outer, uint32_t inner) const    { return layout == CSR ? outer : inner; }
+        size_t colOf(size_t outer, uint32_t inner) const    { return layout == CSR ? inner : outer; }
+
+        Layout                  layout;
+        std::vector<size_t>     pointers;       // getNumOuter() + 1
+        std::vector<uint32_t>   indices;        // nnz
+        Mat                     values;         // 1 x nnz
+    };
+}
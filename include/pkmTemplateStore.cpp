@@ -0,0 +1,320 @@
+/*
+ *  pkmTemplateStore.cpp
+ *
+
+ memory mapped binary template bundle.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmTemplateStore.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PKM_TEMPLATE_STORE_VERSION 2
+
+// rows a new or rewritten lut has room for, at the least
+#define PKM_TEMPLATE_STORE_MIN_CAPACITY 256
+
+pkmTemplateStore::pkmTemplateStore()
+{
+    memset(&header, 0, sizeof(Header));
+    mapping = NULL;
+    mappingSize = 0;
+}
+
+pkmTemplateStore::~pkmTemplateStore()
+{
+    close();
+}
+
+size_t pkmTemplateStore::lutOffset(const Header &header)
+{
+    size_t offset = sizeof(Header) + sizeof(float) * 2 * (size_t)header.dimensions;
+    if (header.version == 1) {
+        offset += sizeof(float) * header.numFrames * header.dimensions;
+    }
+    return offset;
+}
+
+size_t pkmTemplateStore::framesOffset(const Header &header)
+{
+    size_t offset = sizeof(Header) + sizeof(float) * 2 * (size_t)header.dimensions;
+    if (header.version != 1) {
+        offset += sizeof(float) * 2 * (size_t)header.lutCapacity;
+    }
+    return offset;
+}
+
+size_t pkmTemplateStore::fileSize(const Header &header)
+{
+    if (header.version == 1) {
+        return lutOffset(header) + sizeof(float) * 2 * (size_t)header.numTemplates;
+    }
+    return framesOffset(header) + sizeof(float) * header.numFrames * header.dimensions;
+}
+
+bool pkmTemplateStore::exists(const std::string &filename)
+{
+    struct stat st;
+    return stat(filename.c_str(), &st) == 0;
+}
+
+bool pkmTemplateStore::save(const std::string &filename,
+                            const Mat &frames, const Mat &lut,
+                            const Mat &mean, const Mat &stddev)
+{
+#ifdef DEBUG
+    assert(lut.cols == 2);
+    assert((size_t)mean.size() == frames.cols && (size_t)stddev.size() == frames.cols);
+#endif
+    Header header;
+    memset(&header, 0, sizeof(Header));
+    memcpy(header.magic, "PKMT", 4);
+    header.version = PKM_TEMPLATE_STORE_VERSION;
+    header.dimensions = frames.cols;
+    header.numTemplates = lut.rows;
+    header.numFrames = frames.rows;
+    header.lutCapacity = std::max<size_t>(2 * lut.rows, PKM_TEMPLATE_STORE_MIN_CAPACITY);
+
+    std::vector<float> spare(2 * (header.lutCapacity - header.numTemplates), 0.0f);
+    const float *blocks[] = { mean.data, stddev.data, lut.data, &spare[0], frames.data };
+    size_t sizes[] = { frames.cols, frames.cols, (size_t)lut.size(), spare.size(), (size_t)frames.size() };
+    return write(filename, header, blocks, sizes, 5);
+}
+
+bool pkmTemplateStore::write(const std::string &filename, const Header &header,
+                             const float * const *blocks, const size_t *sizes, size_t numBlocks)
+{
+    // everything goes to a temporary file that replaces the bundle only
+    // once it is complete, so a failed or interrupted write leaves the old
+    // bundle as it was (and any mapping of it still valid)
+    std::string temporary = filename + ".tmp";
+    FILE *fp = fopen(temporary.c_str(), "wb");
+    if (!fp) {
+        printf("[ERROR: pkmTemplateStore::write()] Could not open %s for writing.\n", temporary.c_str());
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(Header), 1, fp) == 1;
+    for (size_t b = 0; b < numBlocks && ok; b++) {
+        ok = sizes[b] == 0 || fwrite(blocks[b], sizeof(float), sizes[b], fp) == sizes[b];
+    }
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = (fclose(fp) == 0) && ok;
+    ok = ok && rename(temporary.c_str(), filename.c_str()) == 0;
+
+    if (!ok) {
+        printf("[ERROR: pkmTemplateStore::write()] Could not write %s.\n", filename.c_str());
+        unlink(temporary.c_str());
+    }
+    return ok;
+}
+
+bool pkmTemplateStore::open(const std::string &filename)
+{
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        (size_t)st.st_size < sizeof(Header) ||
+        pread(fd, &header, sizeof(Header), 0) != (ssize_t)sizeof(Header) ||
+        memcmp(header.magic, "PKMT", 4) != 0 ||
+        (header.version != 1 && header.version != PKM_TEMPLATE_STORE_VERSION))
+    {
+        printf("[ERROR: pkmTemplateStore::open()] %s is not a template bundle.\n", filename.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    // an append that never got to its header can leave more, never less
+    if ((size_t)st.st_size < fileSize(header)) {
+        printf("[ERROR: pkmTemplateStore::open()] %s is truncated.\n", filename.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    this->filename = filename;
+    bool ok = map(fd, st.st_size);
+    ::close(fd);
+    if (!ok) {
+        return false;
+    }
+
+    setViews();
+    return true;
+}
+
+bool pkmTemplateStore::map(int fd, size_t size)
+{
+    // twice what is there, so appends can grow into it for a while.  the
+    // part past the end of the file is never read.
+    void *m = mmap(NULL, 2 * size, PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        printf("[ERROR: pkmTemplateStore::map()] Could not map %s.\n", filename.c_str());
+        return false;
+    }
+
+    if (mapping) {
+        retired.push_back(std::make_pair(mapping, mappingSize));
+    }
+    mapping = m;
+    mappingSize = 2 * size;
+    return true;
+}
+
+void pkmTemplateStore::setViews()
+{
+    size_t d = header.dimensions;
+    char *base = (char *)mapping;
+    mean.setUserData(1, d, (float *)(base + sizeof(Header)));
+    stddev.setUserData(1, d, (float *)(base + sizeof(Header)) + d);
+    lut.setUserData(header.numTemplates, 2, (float *)(base + lutOffset(header)));
+    frames.setUserData(header.numFrames, d, (float *)(base + framesOffset(header)));
+}
+
+void pkmTemplateStore::close()
+{
+    if (mapping) {
+        retired.push_back(std::make_pair(mapping, mappingSize));
+        mapping = NULL;
+        mappingSize = 0;
+    }
+    for (size_t i = 0; i < retired.size(); i++) {
+        munmap(retired[i].first, retired[i].second);
+    }
+    retired.clear();
+
+    mean.setUserData(0, 0, NULL);
+    stddev.setUserData(0, 0, NULL);
+    frames.setUserData(0, 0, NULL);
+    lut.setUserData(0, 0, NULL);
+}
+
+bool pkmTemplateStore::append(const Mat &features)
+{
+    if (!isOpen()) {
+        printf("[ERROR: pkmTemplateStore::append()] Open a bundle first.\n");
+        return false;
+    }
+    if (features.cols != getDimensions() || features.rows == 0) {
+        printf("[ERROR: pkmTemplateStore::append()] Template must be frames x %lu.\n", getDimensions());
+        return false;
+    }
+
+    // normalize with the stored statistics
+    size_t d = header.dimensions;
+    Mat normalized(features.rows, d);
+    for (size_t r = 0; r < features.rows; r++) {
+        vDSP_vsub(mean.data, 1, features.data + r * d, 1, normalized.data + r * d, 1, d);
+        vDSP_vdiv(stddev.data, 1, normalized.data + r * d, 1, normalized.data + r * d, 1, d);
+    }
+
+    // a version 1 bundle has no room in its lut, and a full lut none left
+    if (header.version != PKM_TEMPLATE_STORE_VERSION || header.numTemplates == header.lutCapacity) {
+        return rewrite(normalized);
+    }
+
+    int fd = ::open(filename.c_str(), O_RDWR);
+    if (fd < 0) {
+        printf("[ERROR: pkmTemplateStore::append()] Could not open %s for writing.\n", filename.c_str());
+        return false;
+    }
+
+    Header next = header;
+    next.numTemplates += 1;
+    next.numFrames += normalized.rows;
+    float entry[2] = { (float)header.numFrames, (float)normalized.rows };
+
+    // the frames past the end and the lut row past the last, neither of
+    // which the current header counts, then the header that does
+    size_t bytes = sizeof(float) * normalized.size();
+    size_t row = lutOffset(header) + sizeof(entry) * header.numTemplates;
+    bool ok = pwrite(fd, normalized.data, bytes, fileSize(header)) == (ssize_t)bytes &&
+              pwrite(fd, entry, sizeof(entry), row) == (ssize_t)sizeof(entry) &&
+              fsync(fd) == 0 &&
+              pwrite(fd, &next, sizeof(Header), 0) == (ssize_t)sizeof(Header) &&
+              fsync(fd) == 0;
+    if (!ok) {
+        printf("[ERROR: pkmTemplateStore::append()] Could not write %s.\n", filename.c_str());
+        ::close(fd);
+        return false;
+    }
+    header = next;
+
+    // the template is in the file either way; if it can't be mapped yet, it
+    // shows up in the views with the next append that can
+    ok = fileSize(header) <= mappingSize || map(fd, fileSize(header));
+    ::close(fd);
+    if (ok) {
+        setViews();
+    }
+    return ok;
+}
+
+bool pkmTemplateStore::rewrite(const Mat &normalized)
+{
+    Header next = header;
+    next.version = PKM_TEMPLATE_STORE_VERSION;
+    next.numTemplates += 1;
+    next.numFrames += normalized.rows;
+    next.lutCapacity = std::max<size_t>(2 * next.numTemplates, PKM_TEMPLATE_STORE_MIN_CAPACITY);
+
+    // the stored frames are copied straight out of the mapping
+    size_t d = header.dimensions;
+    float entry[2] = { (float)header.numFrames, (float)normalized.rows };
+    std::vector<float> spare(2 * (next.lutCapacity - next.numTemplates), 0.0f);
+    const float *blocks[] = { mean.data, stddev.data, lut.data, entry, &spare[0], frames.data, normalized.data };
+    size_t sizes[] = { d, d, (size_t)lut.size(), 2, spare.size(), (size_t)frames.size(), (size_t)normalized.size() };
+    if (!write(filename, next, blocks, sizes, 7)) {
+        return false;
+    }
+
+    // the renamed file is a new one, so it gets a mapping of its own
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    bool ok = fd >= 0 && map(fd, fileSize(next));
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    if (!ok) {
+        // appending to the new file through the old header would corrupt
+        // it, so stop here, leaving the old mapping to the views into it
+        printf("[ERROR: pkmTemplateStore::rewrite()] Could not reopen %s.\n", filename.c_str());
+        retired.push_back(std::make_pair(mapping, mappingSize));
+        mapping = NULL;
+        mappingSize = 0;
+        mean.setUserData(0, 0, NULL);
+        stddev.setUserData(0, 0, NULL);
+        frames.setUserData(0, 0, NULL);
+        lut.setUserData(0, 0, NULL);
+        return false;
+    }
+
+    header = next;
+    setViews();
+    return true;
+}
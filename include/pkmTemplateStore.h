@@ -0,0 +1,132 @@
+/*
+ *  pkmTemplateStore.h
+ *
+
+ binary bundle of gesture templates for pkmGVF: the normalization statistics,
+ the lut saying where each template starts, and every template's frames in
+ one contiguous block.  the file is memory mapped and handed out as pkm::Mat
+ views, so opening a database costs a page table rather than a text parse.
+
+ templates are added one at a time without rewriting the rest: the new
+ frames go past the end of the file and the new lut row into room the lut
+ keeps for it, both are synced, and only then is the header rewritten to
+ count them.  a crash or a full disk before that leaves the header
+ describing the bundle as it was, and whatever was written past it is
+ ignored (and written over by the next append).  once the lut is full, or
+ for a version 1 bundle, the bundle is written whole to filename.tmp with
+ twice the room and renamed over the old one.
+
+ layout (native endian floats):
+
+    header          64 bytes, see pkmTemplateStore::Header
+    mean            1 x dimensions
+    stddev          1 x dimensions
+    lut             lutCapacity x 2, (first frame, number of frames) of
+                    the first numTemplates rows
+    frames          numFrames x dimensions, normalized
+
+ version 1 bundles, which kept the lut after the frames with no room to
+ spare, are still read.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include "pkmMatrix.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace pkm;
+
+class pkmTemplateStore
+{
+public:
+    struct Header
+    {
+        char        magic[4];           // "PKMT"
+        uint32_t    version;
+        uint32_t    dimensions;
+        uint32_t    numTemplates;
+        uint64_t    numFrames;
+        uint32_t    lutCapacity;        // rows the lut has room for
+        uint32_t    unused;
+        uint64_t    reserved[4];
+    };
+
+    pkmTemplateStore();
+    ~pkmTemplateStore();
+
+    // writes a new bundle.  frames are expected to be normalized already;
+    // mean and stddev are kept so queries (and appended templates) can be
+    // normalized the same way.
+    static bool save(const std::string &filename,
+                     const Mat &frames, const Mat &lut,
+                     const Mat &mean, const Mat &stddev);
+
+    // maps an existing bundle read-only
+    bool open(const std::string &filename);
+    static bool exists(const std::string &filename);
+    void close();
+    bool isOpen() const                 { return mapping != NULL; }
+
+    // appends one template (frames x dimensions, raw features), normalized
+    // with the stored statistics.  a failed append leaves the file as it
+    // was.
+    bool append(const Mat &features);
+
+    // views into the mapping, updated by append().  an append never moves
+    // or unmaps the memory a view points at, so a Mat pointed at a view's
+    // data before an append stays valid (and keeps the templates it had)
+    // until close().
+    const Mat & getFrames() const       { return frames; }
+    const Mat & getLut() const          { return lut; }
+    const Mat & getMean() const         { return mean; }
+    const Mat & getStdDev() const       { return stddev; }
+
+    size_t getNumTemplates() const      { return lut.rows; }
+    size_t getNumFrames() const         { return frames.rows; }
+    size_t getDimensions() const        { return frames.cols; }
+
+private:
+    // byte offsets of the lut and the frames, and where the frames end
+    static size_t lutOffset(const Header &header);
+    static size_t framesOffset(const Header &header);
+    static size_t fileSize(const Header &header);
+
+    // header then the blocks, atomically replacing filename
+    static bool write(const std::string &filename, const Header &header,
+                      const float * const *blocks, const size_t *sizes, size_t numBlocks);
+
+    // writes the bundle whole with room for more templates, then maps it
+    bool rewrite(const Mat &normalized);
+
+    // maps at least size bytes of the open file, keeping the old mapping
+    bool map(int fd, size_t size);
+    void setViews();
+
+    std::string     filename;
+    Header          header;
+    void            *mapping;
+    size_t          mappingSize;        // can run past the end of the file
+
+    // replaced mappings, which views may still point into, unmapped on close()
+    std::vector<std::pair<void *, size_t> > retired;
+
+    Mat             frames, lut, mean, stddev;
+};
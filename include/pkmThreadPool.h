@@ -0,0 +1,184 @@
+/*
+ *  pkmThreadPool.h
+ *
+
+ small persistent thread pool used to split row/tile/batch loops of the
+ pkm::Mat kernels across cores.  workers are started once and sleep between
+ jobs, so a parallelFor costs a wake-up rather than a thread spawn.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+namespace pkm
+{
+    class ThreadPool
+    {
+    public:
+        // numThreads includes the calling thread, so 1 means run everything inline
+        ThreadPool(size_t numThreads = 0)
+        {
+            if (numThreads == 0) {
+                numThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+            }
+            this->numThreads = numThreads;
+            bQuit = false;
+            generation = 0;
+            activeWorkers = 0;
+            job = NULL;
+            for (size_t i = 1; i < numThreads; i++) {
+                workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+            }
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                bQuit = true;
+            }
+            wake.notify_all();
+            for (size_t i = 0; i < workers.size(); i++) {
+                workers[i].join();
+            }
+        }
+
+        // shared by every kernel in the library
+        static ThreadPool & shared()
+        {
+            static ThreadPool pool;
+            return pool;
+        }
+
+        size_t getNumThreads() const
+        {
+            return numThreads;
+        }
+
+        // calls fn(begin, end) over consecutive chunks of [0, n), each at
+        // least minChunk long, and returns once every chunk is done.  runs
+        // inline when n is small, the pool has one thread, or the pool is
+        // already busy (e.g. a parallelFor from inside another one).
+        void parallelFor(size_t n, size_t minChunk, const std::function<void(size_t, size_t)> &fn)
+        {
+            minChunk = std::max<size_t>(1, minChunk);
+            size_t maxChunks = (n + minChunk - 1) / minChunk;
+            size_t numChunks = std::min(maxChunks, numThreads * 4);
+
+            if (numChunks <= 1 || workers.empty() || !jobMutex.try_lock()) {
+                if (n > 0) {
+                    fn(0, n);
+                }
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                job = &fn;
+                jobSize = n;
+                jobChunks = numChunks;
+                nextChunk = 0;
+                chunksDone = 0;
+                generation++;
+            }
+            wake.notify_all();
+
+            runChunks();
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                // workers still inside runChunks must leave before the job's
+                // counters can be reused
+                done.wait(lock, [this]{ return chunksDone == jobChunks && activeWorkers == 0; });
+                job = NULL;
+            }
+            jobMutex.unlock();
+        }
+
+    private:
+        void runChunks()
+        {
+            size_t chunk;
+            while ((chunk = nextChunk.fetch_add(1)) < jobChunks)
+            {
+                size_t begin = chunk * jobSize / jobChunks;
+                size_t end = (chunk + 1) * jobSize / jobChunks;
+                (*job)(begin, end);
+
+                if (chunksDone.fetch_add(1) + 1 == jobChunks) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    done.notify_all();
+                }
+            }
+        }
+
+        void workerLoop()
+        {
+            size_t seen = 0;
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&]{ return bQuit || generation != seen; });
+                    if (bQuit) {
+                        return;
+                    }
+                    seen = generation;
+                    if (job == NULL) {
+                        continue;
+                    }
+                    activeWorkers++;
+                }
+                runChunks();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    activeWorkers--;
+                    done.notify_all();
+                }
+            }
+        }
+
+        size_t                      numThreads;
+        std::vector<std::thread>    workers;
+
+        std::mutex                  jobMutex;       // one job at a time
+        std::mutex                  mutex;
+        std::condition_variable     wake, done;
+        bool                        bQuit;
+        size_t                      generation;
+        size_t                      activeWorkers;
+
+        const std::function<void(size_t, size_t)> *job;
+        size_t                      jobSize, jobChunks;
+        std::atomic<size_t>         nextChunk, chunksDone;
+    };
+
+    // convenience wrapper around the shared pool
+    inline void parallelFor(size_t n, size_t minChunk, const std::function<void(size_t, size_t)> &fn)
+    {
+        ThreadPool::shared().parallelFor(n, minChunk, fn);
+    }
+}
@@ -0,0 +1,220 @@
+/*
+ *  pkmWindowStatistics.cpp
+ *
+
+ streaming statistics over the last windowLength rows pushed through a
+ circular buffer.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#include "pkmWindowStatistics.h"
+#include <algorithm>
+#include <math.h>
+
+pkmWindowStatistics::pkmWindowStatistics(size_t windowLength, size_t dimensions)
+: windowLength(windowLength), dimensions(dimensions)
+{
+#ifdef DEBUG
+    assert(windowLength > 0);
+    assert(dimensions > 0);
+#endif
+    window = Mat(windowLength, dimensions, true);
+    sum.reset(1, dimensions);
+    mean.reset(1, dimensions);
+    M2.reset(1, dimensions);
+    minimum.reset(1, dimensions);
+    maximum.reset(1, dimensions);
+    diff.reset(1, dimensions);
+    scratch.reset(1, dimensions);
+    column.resize(windowLength);
+
+    minDeque.resize(windowLength * dimensions);
+    maxDeque.resize(windowLength * dimensions);
+    minHead.resize(dimensions);
+    minSize.resize(dimensions);
+    maxHead.resize(dimensions);
+    maxSize.resize(dimensions);
+
+    reset();
+}
+
+void pkmWindowStatistics::reset()
+{
+    count = 0;
+    numInserted = 0;
+    window.resetCircularRowCounter();
+
+    sum.clear();
+    mean.clear();
+    M2.clear();
+    minimum.clear();
+    maximum.clear();
+
+    std::fill(minHead.begin(), minHead.end(), 0);
+    std::fill(minSize.begin(), minSize.end(), 0);
+    std::fill(maxHead.begin(), maxHead.end(), 0);
+    std::fill(maxSize.begin(), maxSize.end(), 0);
+}
+
+void pkmWindowStatistics::insert(const float *frame)
+{
+    size_t d = dimensions;
+
+    if (count < windowLength)
+    {
+        // growing window, plain welford update
+        count++;
+        float invN = 1.0f / (float)count;
+
+        vDSP_vadd(sum.data, 1, frame, 1, sum.data, 1, d);
+
+        // diff = x - mean_old, mean += diff / n, M2 += diff * (x - mean_new)
+        vDSP_vsub(mean.data, 1, frame, 1, diff.data, 1, d);
+        vDSP_vsma(diff.data, 1, &invN, mean.data, 1, mean.data, 1, d);
+        vDSP_vsub(mean.data, 1, frame, 1, scratch.data, 1, d);
+        vDSP_vma(diff.data, 1, scratch.data, 1, M2.data, 1, M2.data, 1, d);
+    }
+    else
+    {
+        // full window, the row about to be overwritten leaves as x arrives
+        const float *old = window.row(window.current_row);
+        float invN = 1.0f / (float)count;
+
+        // diff = x - old, sum += diff
+        vDSP_vsub(old, 1, frame, 1, diff.data, 1, d);
+        vDSP_vadd(sum.data, 1, diff.data, 1, sum.data, 1, d);
+
+        // M2 += (x - old) * ((x - mean_new) + (old - mean_old))
+        vDSP_vsub(mean.data, 1, old, 1, scratch.data, 1, d);
+        vDSP_vsma(diff.data, 1, &invN, mean.data, 1, mean.data, 1, d);
+        vDSP_vadd(scratch.data, 1, frame, 1, scratch.data, 1, d);
+        vDSP_vsub(mean.data, 1, scratch.data, 1, scratch.data, 1, d);
+        vDSP_vma(diff.data, 1, scratch.data, 1, M2.data, 1, M2.data, 1, d);
+    }
+
+    window.insertRowCircularly(frame);
+    pushDeques(numInserted, frame);
+    numInserted++;
+
+    // every time the buffer wraps, recompute the sums exactly so rounding
+    // from the add/remove updates can't accumulate (still O(cols) amortized)
+    if (count == windowLength && numInserted % windowLength == 0) {
+        resync();
+    }
+}
+
+void pkmWindowStatistics::pushDeques(size_t seq, const float *frame)
+{
+    size_t w = windowLength;
+    size_t d = dimensions;
+    const float *values = window.data;
+
+    for (size_t c = 0; c < d; c++)
+    {
+        float x = frame[c];
+
+        // max: drop expired from the front, dominated from the back
+        size_t *q = &maxDeque[c * w];
+        size_t &head = maxHead[c], &size = maxSize[c];
+        while (size && q[head] + w <= seq) {
+            head = (head + 1) % w;
+            size--;
+        }
+        while (size && values[(q[(head + size - 1) % w] % w) * d + c] <= x) {
+            size--;
+        }
+        q[(head + size) % w] = seq;
+        size++;
+        maximum.data[c] = values[(q[head] % w) * d + c];
+
+        // min
+        q = &minDeque[c * w];
+        size_t &mhead = minHead[c], &msize = minSize[c];
+        while (msize && q[mhead] + w <= seq) {
+            mhead = (mhead + 1) % w;
+            msize--;
+        }
+        while (msize && values[(q[(mhead + msize - 1) % w] % w) * d + c] >= x) {
+            msize--;
+        }
+        q[(mhead + msize) % w] = seq;
+        msize++;
+        minimum.data[c] = values[(q[mhead] % w) * d + c];
+    }
+}
+
+void pkmWindowStatistics::resync()
+{
+    size_t d = dimensions;
+    float invN = 1.0f / (float)count;
+
+    sum.clear();
+    for (size_t r = 0; r < count; r++) {
+        vDSP_vadd(sum.data, 1, window.row(r), 1, sum.data, 1, d);
+    }
+    vDSP_vsmul(sum.data, 1, &invN, mean.data, 1, d);
+
+    M2.clear();
+    for (size_t r = 0; r < count; r++) {
+        vDSP_vsub(mean.data, 1, window.row(r), 1, scratch.data, 1, d);
+        vDSP_vma(scratch.data, 1, scratch.data, 1, M2.data, 1, M2.data, 1, d);
+    }
+}
+
+void pkmWindowStatistics::getVariance(Mat &variance) const
+{
+    if (variance.rows != 1 || variance.cols != dimensions) {
+        variance.reset(1, dimensions);
+    }
+    if (count == 0) {
+        variance.clear();
+        return;
+    }
+    float invN = 1.0f / (float)count;
+    float zero = 0.0f;
+    vDSP_vsmul(M2.data, 1, &invN, variance.data, 1, dimensions);
+    vDSP_vthr(variance.data, 1, &zero, variance.data, 1, dimensions);
+}
+
+void pkmWindowStatistics::getStdDev(Mat &stddev) const
+{
+    getVariance(stddev);
+    stddev.sqrt();
+}
+
+void pkmWindowStatistics::getPercentile(float p, Mat &percentile)
+{
+    if (percentile.rows != 1 || percentile.cols != dimensions) {
+        percentile.reset(1, dimensions);
+    }
+    if (count == 0) {
+        percentile.clear();
+        return;
+    }
+
+    long rank = (long)ceilf(p * count) - 1;
+    rank = std::min<long>(std::max<long>(rank, 0), count - 1);
+
+    // rows [0, count) hold the window whether or not it has wrapped,
+    // and the order within it doesn't matter for a selection
+    for (size_t c = 0; c < dimensions; c++) {
+        cblas_scopy(count, window.data + c, dimensions, &column[0], 1);
+        std::nth_element(column.begin(), column.begin() + rank, column.begin() + count);
+        percentile.data[c] = column[rank];
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ *  pkmWindowStatistics.h
+ *
+
+ streaming statistics over the last windowLength rows pushed through a
+ circular buffer (see pkm::Mat::insertRowCircularly).  every column keeps a
+ running sum, a welford mean/variance, and monotonic deques for the min and
+ max, so each inserted row costs O(cols) amortized and nothing is realigned
+ or recomputed from scratch.
+
+ Copyright (C) 2015 Parag K. Mital
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, version 3.
+
+ This program is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+ *
+ */
+
+#pragma once
+
+#include "pkmMatrix.h"
+#include <vector>
+
+using namespace pkm;
+
+class pkmWindowStatistics
+{
+public:
+    pkmWindowStatistics(size_t windowLength, size_t dimensions);
+
+    // push one row of 'dimensions' values, evicting the oldest once the window is full
+    void insert(const float *frame);
+    void insert(const Mat &frame)       { insert(frame.data); }
+
+    void reset();
+
+    // number of rows currently in the window (<= windowLength)
+    size_t getCount() const             { return count; }
+    bool isFull() const                 { return count == windowLength; }
+
+    // 1 x dimensions, valid after the first insert
+    const Mat & getSum() const          { return sum; }
+    const Mat & getMean() const         { return mean; }
+    const Mat & getMin() const          { return minimum; }
+    const Mat & getMax() const          { return maximum; }
+
+    // population variance / standard deviation of each column
+    void getVariance(Mat &variance) const;
+    void getStdDev(Mat &stddev) const;
+
+    // p in [0, 1], nearest-rank over the rows currently in the window.
+    // O(windowLength) per column, read straight out of the circular buffer.
+    void getPercentile(float p, Mat &percentile);
+
+    // the underlying circular buffer, oldest row at window.current_row once full
+    const Mat & getWindow() const       { return window; }
+
+private:
+    void pushDeques(size_t seq, const float *frame);
+    void resync();
+
+    size_t          windowLength, dimensions;
+    size_t          count;
+    size_t          numInserted;        // sequence number of the next row
+
+    Mat             window;
+    Mat             sum, mean, M2;
+    Mat             minimum, maximum;
+    Mat             diff, scratch;      // 1 x dimensions work rows
+    std::vector<float> column;          // windowLength work buffer for percentiles
+
+    // per column ring of sequence numbers, each windowLength long
+    std::vector<size_t> minDeque, maxDeque;
+    std::vector<size_t> minHead, minSize, maxHead, maxSize;
+};
@@ -26,11 +26,472 @@
 
 #include <iostream>
 #include "pkmMatrix.h"
+#include "pkmPCA.h"
+#include "pkmConvolution.h"
+#include "pkmFFT.h"
+#include "pkmSparseMat.h"
+#include "pkmThreadPool.h"
 #include <vector>
+#include <chrono>
 
 using namespace pkm;
 using namespace std;
 
+// seconds per call of f, over enough calls to move ~2e8 floats
+template<typename F>
+double timePerCall(size_t elements, F f)
+{
+    size_t repeats = 200000000 / elements + 1;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < repeats; i++) {
+        f(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count() / repeats;
+}
+
+// Mat::setTranspose() against what it used to do (malloc, vDSP_mtrans,
+// copy back, free), plus the scratch-free cycle following transpose and
+// the out-of-place tiled transpose on their own
+void benchmarkTranspose()
+{
+    size_t shapes[][2] = {
+        {8, 8}, {64, 64}, {100, 37}, {513, 129}, {1000, 1000},
+        {1024, 1024}, {4096, 512}, {2000, 3}, {1500, 1499}
+    };
+    
+    printf("%12s %12s %12s %12s %12s\n", "shape", "malloc+copy", "setTranspose", "cycles", "tiled");
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+    {
+        size_t r = shapes[s][0], c = shapes[s][1];
+        pkm::Mat a = pkm::Mat::rand(r, c);
+        pkm::Mat b(c, r);
+        
+        // every call flips the shape, so alternate the dimensions we pass
+        double previous = timePerCall(r*c, [&](size_t i) {
+            size_t rows = (i & 1) ? c : r, cols = (i & 1) ? r : c;
+            float *temp_data = (float *)malloc(sizeof(float)*rows*cols);
+            vDSP_mtrans(a.data, 1, temp_data, 1, cols, rows);
+            cblas_scopy(rows*cols, temp_data, 1, a.data, 1);
+            free(temp_data);
+        });
+        double current = timePerCall(r*c, [&](size_t i) {
+            a.setTranspose();
+        });
+        double cycles = timePerCall(r*c, [&](size_t i) {
+            pkm::Mat::transposeInPlace(a.data, (i & 1) ? c : r, (i & 1) ? r : c, true);
+        });
+        double tiled = timePerCall(r*c, [&](size_t i) {
+            pkm::Mat::transpose(a.data, r, c, c, b.data, r);
+        });
+        
+        char shape[32];
+        snprintf(shape, sizeof(shape), "%lux%lu", r, c);
+        printf("%12s %10.1fus %10.1fus %10.1fus %10.1fus\n", shape,
+               previous * 1e6, current * 1e6, cycles * 1e6, tiled * 1e6);
+    }
+}
+
+// pkmPCA fit and transform on 1M x 128 observations of rank 16 plus noise,
+// through the blocked covariance and through the randomized svd
+void benchmarkPCA()
+{
+    size_t m = 1000000, d = 128, r = 16, k = 16;
+    pkm::Mat basis = pkm::Mat::rand(r, d, -1.0, 1.0);
+    pkm::Mat weights = pkm::Mat::rand(m, r, -1.0, 1.0);
+    pkm::Mat X = pkm::Mat::rand(m, d, -0.01, 0.01);
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, d, r,
+                1.0f, weights.data, r, basis.data, d, 1.0f, X.data, d);
+    
+    const char *names[] = { "covariance", "randomized" };
+    pkmPCA::Method methods[] = { pkmPCA::COVARIANCE, pkmPCA::RANDOMIZED };
+    for (int i = 0; i < 2; i++)
+    {
+        pkmPCA pca;
+        auto start = std::chrono::steady_clock::now();
+        pca.fit(X, k, false, methods[i]);
+        auto fitted = std::chrono::steady_clock::now();
+        pkm::Mat Y = pca.transform(X);
+        auto end = std::chrono::steady_clock::now();
+        
+        float explained = 0;
+        vDSP_sve(pca.getExplainedVarianceRatio().data, 1, &explained, k);
+        printf("pca %s: fit %.3fs, transform %.3fs, %.4f of the variance in %lu components\n", names[i],
+               std::chrono::duration<double>(fitted - start).count(),
+               std::chrono::duration<double>(end - fitted).count(), explained, k);
+    }
+}
+
+// pkm::math kernels against a scalar libm loop, in elements per second, on
+// a buffer small enough for one thread and one large enough to be split
+void benchmarkMath()
+{
+    printf("pkm::math (%s)\n", pkm::math::getInstructionSet());
+    printf("%8s %9s %14s %14s %14s\n", "", "n", "libm", "precise", "fast");
+    
+    size_t sizes[] = { 4096, 1 << 22 };
+    for (size_t s = 0; s < 2; s++)
+    {
+        size_t n = sizes[s];
+        pkm::Mat x = pkm::Mat::rand(1, n, 0.01, 10.0);
+        pkm::Mat y(1, n);
+        
+        struct Kernel {
+            const char *name;
+            float (*scalar)(float);
+            void (*vector)(const float *, float *, size_t, pkm::math::Precision);
+        };
+        Kernel kernels[] = {
+            { "exp", expf, pkm::math::exp },
+            { "log", logf, pkm::math::log },
+            { "log10", log10f, pkm::math::log10 },
+            { "sin", sinf, pkm::math::sin },
+            { "cos", cosf, pkm::math::cos }
+        };
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+        {
+            Kernel &kernel = kernels[k];
+            double scalar = timePerCall(n, [&](size_t) {
+                for (size_t i = 0; i < n; i++) {
+                    y.data[i] = kernel.scalar(x.data[i]);
+                }
+            });
+            double precise = timePerCall(n, [&](size_t) {
+                kernel.vector(x.data, y.data, n, pkm::math::PRECISE);
+            });
+            double fast = timePerCall(n, [&](size_t) {
+                kernel.vector(x.data, y.data, n, pkm::math::FAST);
+            });
+            printf("%8s %9lu %10.1fM/s %10.1fM/s %10.1fM/s\n", kernel.name, n,
+                   n / scalar * 1e-6, n / precise * 1e-6, n / fast * 1e-6);
+        }
+        
+        double scalar = timePerCall(n, [&](size_t) {
+            for (size_t i = 0; i < n; i++) {
+                y.data[i] = powf(x.data[i], 2.4f);
+            }
+        });
+        double precise = timePerCall(n, [&](size_t) {
+            pkm::math::pow(x.data, 2.4f, y.data, n, pkm::math::PRECISE);
+        });
+        double fast = timePerCall(n, [&](size_t) {
+            pkm::math::pow(x.data, 2.4f, y.data, n, pkm::math::FAST);
+        });
+        printf("%8s %9lu %10.1fM/s %10.1fM/s %10.1fM/s\n", "pow 2.4", n,
+               n / scalar * 1e-6, n / precise * 1e-6, n / fast * 1e-6);
+    }
+}
+
+
+// Mat::setSoftmax() against building it from separate passes (max, subtract,
+// exp, sum, divide), along rows and along the strided columns
+void benchmarkSoftmax()
+{
+    size_t shapes[][2] = { {4096, 16}, {4096, 256}, {256, 4096}, {1 << 16, 64} };
+    
+    printf("%12s %14s %14s %14s %14s\n", "softmax", "rows separate", "rows fused", "cols separate", "cols fused");
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+    {
+        size_t rows = shapes[s][0], cols = shapes[s][1], n = rows * cols;
+        pkm::Mat x = pkm::Mat::rand(rows, cols, -10.0, 10.0);
+        pkm::Mat y(rows, cols);
+        
+        double separate[2], fused[2];
+        for (int row_major = 1; row_major >= 0; row_major--)
+        {
+            size_t vecs = row_major ? rows : cols, length = row_major ? cols : rows;
+            size_t stride = row_major ? 1 : cols, step = row_major ? cols : 1;
+            separate[row_major] = timePerCall(n, [&](size_t) {
+                cblas_scopy(n, x.data, 1, y.data, 1);
+                for (size_t v = 0; v < vecs; v++) {
+                    float *p = y.data + v * step, max;
+                    vDSP_maxv(p, stride, &max, length);
+                    max = -max;
+                    vDSP_vsadd(p, stride, &max, p, stride, length);
+                }
+                y.exp();
+                for (size_t v = 0; v < vecs; v++) {
+                    float *p = y.data + v * step, sum;
+                    vDSP_sve(p, stride, &sum, length);
+                    vDSP_vsdiv(p, stride, &sum, p, stride, length);
+                }
+            });
+            fused[row_major] = timePerCall(n, [&](size_t) {
+                cblas_scopy(n, x.data, 1, y.data, 1);
+                y.setSoftmax(row_major);
+            });
+        }
+        char shape[32];
+        snprintf(shape, sizeof(shape), "%lux%lu", rows, cols);
+        printf("%12s %10.1fM/s %10.1fM/s %10.1fM/s %10.1fM/s\n", shape,
+               n / separate[1] * 1e-6, n / fused[1] * 1e-6, n / separate[0] * 1e-6, n / fused[0] * 1e-6);
+    }
+}
+
+
+// Mat::setRand() as it was (::random() per element) against pkm::Random
+void benchmarkRandom()
+{
+    size_t n = 1 << 22;
+    pkm::Mat x(1, n);
+    pkm::Random random(1);
+    
+    double serial = timePerCall(n, [&](size_t) {
+        for (size_t i = 0; i < n; i++) {
+            x.data[i] = float(::random()) / float(RAND_MAX);
+        }
+    });
+    double uniform = timePerCall(n, [&](size_t) {
+        random.uniform(x.data, n);
+    });
+    double normal = timePerCall(n, [&](size_t) {
+        random.normal(x.data, n);
+    });
+    printf("random %9lu: ::random() %.1fM/s, uniform %.1fM/s, normal %.1fM/s\n", n,
+           n / serial * 1e-6, n / uniform * 1e-6, n / normal * 1e-6);
+}
+
+// a banded matrix-vector product and A B^T (as in banded dtw), sparse
+// against dense
+void benchmarkSparse()
+{
+    size_t n = 4000, radius = 40, d = 32;
+    pkm::Random random(1);
+    pkm::Mat A(n, n, true), x(n, 1), y(n, 1);
+    pkm::SparseMat S = pkm::SparseMat::band(A, radius);
+    S.getValues().setRandn(0.0f, 1.0f, random);
+    S.toDense(A);
+    x.setRandn(0.0f, 1.0f, random);
+    
+    double dense = timePerCall(n * n, [&](size_t) {
+        A.GEMM(x, y);
+    });
+    double sparse = timePerCall(S.nnz(), [&](size_t) {
+        S.multiply(x, y);
+    });
+    printf("band %lu x %lu, radius %lu: dense mv %.3f ms, sparse mv %.3f ms\n", n, n, radius, dense * 1e3, sparse * 1e3);
+    
+    pkm::Mat P(n, d), Q(n, d), Qt, full(n, n);
+    P.setRandn(0.0f, 1.0f, random);
+    Q.setRandn(0.0f, 1.0f, random);
+    Qt = Q;
+    Qt.setTranspose();
+    dense = timePerCall(n * n * d, [&](size_t) {
+        P.GEMM(Qt, full);
+    });
+    sparse = timePerCall(S.nnz() * d, [&](size_t) {
+        S.setDots(P, Q);
+    });
+    printf("band %lu x %lu, d %lu: dense A B^T %.3f ms, sparse setDots %.3f ms\n", n, n, d, dense * 1e3, sparse * 1e3);
+}
+
+// every band pattern a banded dtw can ask for must run corner to corner
+// with consecutive rows' runs touching, including 1 frame templates
+void checkBandPattern()
+{
+    size_t failures = 0;
+    for (size_t rows = 1; rows <= 40; rows++) {
+        for (size_t cols = 1; cols <= 40; cols++) {
+            size_t connected = rows > 1 ? (cols - 1 + rows - 2) / (rows - 1) : 1;
+            for (size_t radius = (connected + 1) / 2; radius <= cols; radius += 3) {
+                pkm::SparseMat S = pkm::SparseMat::bandPattern(rows, cols, radius);
+                const vector<size_t> &pointers = S.getPointers();
+                const vector<uint32_t> &indices = S.getIndices();
+                bool ok = indices[0] == 0 && indices[S.nnz() - 1] == cols - 1;
+                for (size_t r = 1; r < rows && ok; r++) {
+                    ok = indices[pointers[r]] <= indices[pointers[r] - 1] + 1;
+                }
+                failures += !ok;
+            }
+        }
+    }
+    printf("band patterns: %lu broken\n", failures);
+}
+
+// thousands of 3 x 3 products, one Mat::GEMM() each against one batch
+void benchmarkBatchedGEMM()
+{
+    size_t batch = 10000;
+    pkm::Random random(1);
+    std::vector<pkm::Mat> lhs(batch), rhs(batch), result(batch);
+    for (size_t i = 0; i < batch; i++) {
+        lhs[i] = pkm::Mat::randn(3, 3, 0.0f, 1.0f, random);
+        rhs[i] = pkm::Mat::randn(3, 3, 0.0f, 1.0f, random);
+        result[i].reset(3, 3);
+    }
+    
+    double single = timePerCall(batch * 27, [&](size_t) {
+        for (size_t i = 0; i < batch; i++) {
+            lhs[i].GEMM(rhs[i], result[i]);
+        }
+    });
+    double batched = timePerCall(batch * 27, [&](size_t) {
+        pkm::Mat::GEMMBatched(lhs, rhs, result);
+    });
+    printf("%lu 3 x 3 products: GEMM %.3f ms, GEMMBatched %.3f ms\n", batch, single * 1e3, batched * 1e3);
+}
+
+// gemm::sgemm() against cblas_sgemm on square products, in GFLOP/s
+void benchmarkSGEMM()
+{
+    const pkm::gemm::BlockSizes &sizes = pkm::gemm::getBlockSizes();
+    size_t threads = pkm::ThreadPool::shared().getNumThreads();
+    double peak = pkm::gemm::measurePeakFlops() * threads;
+    printf("sgemm %s, mc %lu kc %lu nc %lu, %lu threads, peak %.1f GFLOP/s\n",
+           pkm::gemm::getInstructionSet(), sizes.mc, sizes.kc, sizes.nc, threads, peak * 1e-9);
+    
+    size_t sizesN[] = { 1024, 2048, 4096 };
+    pkm::Random random(1);
+    for (size_t s = 0; s < sizeof(sizesN) / sizeof(sizesN[0]); s++)
+    {
+        size_t n = sizesN[s];
+        pkm::Mat A = pkm::Mat::randn(n, n, 0.0f, 1.0f, random);
+        pkm::Mat B = pkm::Mat::randn(n, n, 0.0f, 1.0f, random);
+        pkm::Mat C(n, n);
+        double flops = 2.0 * n * n * n;
+        auto native = [&](size_t) {
+            pkm::gemm::sgemm(pkm::gemm::NO_TRANS, pkm::gemm::NO_TRANS, n, n, n, 1.0f, A.data, n, B.data, n, 0.0f, C.data, n);
+        };
+        auto blas = [&](size_t) {
+            cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, (int)n, (int)n, (int)n, 1.0f, A.data, (int)n, B.data, (int)n, 0.0f, C.data, (int)n);
+        };
+
+        // peak is the best of several runs, so take the best of a few
+        // products too, after one untimed call that faults in the packing
+        // buffers (a cold first call read up to 10 points low)
+        native(0);
+        blas(0);
+        double nativeTime = HUGE_VAL, blasTime = HUGE_VAL;
+        for (int run = 0; run < 3; run++) {
+            nativeTime = std::min(nativeTime, timePerCall(2 * n * n * n, native));
+            blasTime = std::min(blasTime, timePerCall(2 * n * n * n, blas));
+        }
+        printf("sgemm %5lu: native %.1f GFLOP/s (%.0f%% of peak), cblas %.1f GFLOP/s (%.0f%%)\n", n,
+               flops / nativeTime * 1e-9, 100.0 * flops / nativeTime / peak,
+               flops / blasTime * 1e-9, 100.0 * flops / blasTime / peak);
+    }
+}
+
+// strassen against the classic product, to pick PKM_GEMM_STRASSEN_CROSSOVER:
+// a crossover pays once strassen wins at twice that size
+void benchmarkStrassen()
+{
+    size_t sizesN[] = { 1024, 2048, 4096 };
+    pkm::Random random(1);
+    for (size_t s = 0; s < sizeof(sizesN) / sizeof(sizesN[0]); s++)
+    {
+        size_t n = sizesN[s];
+        pkm::Mat A = pkm::Mat::randn(n, n, 0.0f, 1.0f, random);
+        pkm::Mat B = pkm::Mat::randn(n, n, 0.0f, 1.0f, random);
+        pkm::Mat C(n, n), D(n, n);
+        double flops = 2.0 * n * n * n;
+        
+        pkm::gemm::setStrassenCrossover(0);
+        double classic = timePerCall(2 * n * n * n, [&](size_t) {
+            A.GEMM(B, D);
+        });
+        printf("strassen %5lu: classic %.1f GFLOP/s", n, flops / classic * 1e-9);
+        for (size_t crossover = n / 4; crossover <= n; crossover *= 2)
+        {
+            double fast = timePerCall(2 * n * n * n, [&](size_t) {
+                pkm::gemm::strassen(pkm::gemm::NO_TRANS, pkm::gemm::NO_TRANS, n, n, n, 1.0f, A.data, n, B.data, n, 0.0f, C.data, n, crossover);
+            });
+            float error = 0;
+            for (size_t i = 0; i < n * n; i++) {
+                error = std::max(error, fabsf(C.data[i] - D.data[i]));
+            }
+            printf(", crossover %lu %.1f GFLOP/s (max error %g)", crossover, flops / fast * 1e-9, error);
+        }
+        printf("\n");
+    }
+}
+
+// direct against overlap-add filtering either side of PKM_FILTER_FFT_TAPS,
+// and a stream of frames through pkm::filter::Stream
+void benchmarkConvolution()
+{
+    pkm::Random random(1);
+    pkm::Mat X = pkm::Mat::randn(64, 16384, 0.0f, 1.0f, random);
+    pkm::Mat Y;
+    size_t taps[] = { 8, 32, PKM_FILTER_FFT_TAPS, PKM_FILTER_FFT_TAPS + 1, 256, 1024 };
+    for (size_t t = 0; t < sizeof(taps) / sizeof(taps[0]); t++)
+    {
+        pkm::Mat kernel = pkm::Mat::randn(1, taps[t], 0.0f, 1.0f, random);
+        double rows = timePerCall(X.size(), [&](size_t) {
+            pkm::filter::convolve(X, kernel, Y, pkm::filter::ALONG_ROWS);
+        });
+        double columns = timePerCall(X.size(), [&](size_t) {
+            pkm::filter::convolve(X, kernel, Y, pkm::filter::ALONG_COLUMNS);
+        });
+        printf("convolve %4lu taps (%s): rows %.1f, columns %.1f Msamples/s\n", taps[t],
+               taps[t] > PKM_FILTER_FFT_TAPS ? "fft" : "direct",
+               X.size() / rows * 1e-6, X.size() / columns * 1e-6);
+    }
+    
+    pkm::Mat kernel = pkm::Mat::randn(1, 32, 0.0f, 1.0f, random);
+    pkm::filter::Stream stream(kernel, X.cols);
+    double frame = timePerCall(X.cols, [&](size_t i) {
+        stream.insert(X.row(i % X.rows));
+    });
+    printf("stream 32 taps x %lu: %.2f us/frame\n", X.cols, frame * 1e6);
+}
+
+// complex FFTs at a few sizes, then a spectrogram of a minute of 44.1 kHz
+// audio and its inverse
+void benchmarkFFT()
+{
+    size_t sizesN[] = { 256, 1024, 4096, 16384 };
+    for (size_t s = 0; s < sizeof(sizesN) / sizeof(sizesN[0]); s++)
+    {
+        size_t n = sizesN[s];
+        const pkm::FFT &fft = pkm::FFT::get(n);
+        std::vector<float> re(n, 1.0f), im(n, 0.0f);
+        double t = timePerCall(n * 8, [&](size_t) {
+            fft.forward(&re[0], &im[0]);
+        });
+        printf("fft %5lu: %.2f us, %.1f GFLOP/s (5 n log2 n)\n", n, t * 1e6, 5.0 * n * log2((double)n) / t * 1e-9);
+    }
+    
+    pkm::Random random(1);
+    pkm::Mat signal = pkm::Mat::randn(1, 44100 * 60, 0.0f, 1.0f, random);
+    pkm::STFT stft(2048, 512);
+    pkm::Mat real, imag;
+    std::vector<float> y(signal.size());
+    double analysis = timePerCall(signal.size(), [&](size_t) {
+        stft.forward(signal.data, signal.size(), real, imag);
+    });
+    double synthesis = timePerCall(signal.size(), [&](size_t) {
+        stft.inverse(real, imag, &y[0]);
+    });
+    printf("stft 2048 / 512 of 60 s: forward %.1f ms (%lu frames), inverse %.1f ms\n",
+           analysis * 1e3, real.rows, synthesis * 1e3);
+}
+
+// a 480 x 640 map resized every frame, with the weights worked out once,
+// plus Mat::rescale()'s 1-D interpolation
+void benchmarkResample()
+{
+    pkm::Random random(1);
+    pkm::Mat map = pkm::Mat::randn(480, 640, 0.0f, 1.0f, random);
+    pkm::Mat resized;
+    const char *names[] = { "nearest", "bilinear", "bicubic", "area" };
+    for (int m = pkm::Resampler::NEAREST; m <= pkm::Resampler::AREA; m++)
+    {
+        size_t rows = m == pkm::Resampler::AREA ? 120 : 960;
+        size_t cols = m == pkm::Resampler::AREA ? 160 : 1280;
+        pkm::Resampler resampler(map.rows, map.cols, rows, cols, (pkm::Resampler::Method)m);
+        double t = timePerCall(rows * cols * 4, [&](size_t) {
+            resampler.resample(map, resized);
+        });
+        printf("resample %-8s 480 x 640 -> %lu x %lu: %.3f ms\n", names[m], rows, cols, t * 1e3);
+    }
+    
+    pkm::Mat line;
+    double t = timePerCall(1 << 22, [&](size_t) {
+        map.rescale(1, 1 << 22, line);
+    });
+    printf("rescale %lu -> %d samples: %.3f ms\n", map.size(), 1 << 22, t * 1e3);
+}
 
 int main (int argc, char * const argv[]) {
     
@@ -47,6 +508,20 @@ int main (int argc, char * const argv[]) {
         auto end = std::chrono::steady_clock::now();
         std::cout << "Mean calculated in " << double((end-start).count())/double(std::chrono::steady_clock::period::den) << "s" << std::endl;
     }
+    
+    benchmarkTranspose();
+    benchmarkPCA();
+    benchmarkMath();
+    benchmarkSoftmax();
+    benchmarkRandom();
+    benchmarkSparse();
+    checkBandPattern();
+    benchmarkBatchedGEMM();
+    benchmarkSGEMM();
+    benchmarkStrassen();
+    benchmarkConvolution();
+    benchmarkFFT();
+    benchmarkResample();
 
     
 	return 0;